@@ -1,4 +1,7 @@
 //includes
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700 //ftruncate, shm_open, mmap e realpath declarados também com -std=c99/c11
+#endif
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -7,6 +10,24 @@
 #include <SDL3_ttf/SDL_ttf.h>
 #include <string.h>   
 #include <math.h> 
+#ifdef _WIN32
+#include <io.h>      //_setmode para stdin/stdout binários
+#include <fcntl.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h> //CreateFileMapping/MapViewOfFile
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h> //--serve/--client: socket Unix
+#include <sys/un.h>
+#include <sys/time.h>   //struct timeval de SO_RCVTIMEO
+#include <poll.h>
+#include <signal.h>
+#include <setjmp.h>     //sigsetjmp: leitura protegida da memória compartilhada do cliente
+#include <errno.h>
+#include <unistd.h>
+#endif
 #define FONT_PATH "Roboto-Regular.ttf"
 
 //variáveis e structs
@@ -15,15 +36,286 @@ typedef struct {
   SDL_Renderer* renderer;
 } AppContext;
 
+//plano de 8 bits por pixel (um canal)
 typedef struct {
-  SDL_Surface* surface_rgba;   //surface de trabalho em RGBA32 
-  SDL_Texture* texture;        //textura para renderizar 
+  Uint8* pixels;
+  int    w, h;
+  int    pitch;                //bytes por linha
+  bool   borrowed;             //memória de outro dono (arquivo mapeado): plane_free só esquece
+} GrayPlane;
+
+//plano de 16 bits por pixel (Y16) das entradas com mais de 8 bits por amostra
+typedef struct {
+  Uint16* pixels;
+  int     w, h;
+  int     pitch;               //amostras por linha
+} GrayPlane16;
+
+//cabeçalho de PGM/PPM binário (8 ou 16 bits) ou de Y16 cru
+typedef struct {
+  int    w, h;
+  int    channels;             //1 (P5) ou 3 (P6)
+  Sint64 data_offset;
+  int    maxval;               //> 255: duas amostras por byte, big-endian (PNM)
+  bool   little_endian;        //Y16 cru
+} PnmHeader;
+
+//arquivo mapeado em memória: [0] é a visão de trabalho (cópia na escrita: só as páginas
+//escritas viram memória privada, o arquivo nunca muda) e [1] a original, só leitura
+typedef struct {
+  Uint8* views[2];
+  size_t size;
+} MappedFile;
+
+//visualização em blocos para imagens maiores que a textura máxima do renderer:
+//pirâmide de mip (cada nível 2x menor, gerada em segundo plano) e um cache LRU de
+//texturas TILE_SIZE x TILE_SIZE limitado por um orçamento de VRAM
+#define TILE_SIZE 512
+#define MIP_MAX_LEVELS 16
+
+typedef struct {
+  GrayPlane     levels[MIP_MAX_LEVELS]; //[0] é o próprio plano de trabalho (não é dono)
+  GrayPlane     alpha[MIP_MAX_LEVELS];  //idem para o alfa, se houver
+  int           count;
+  SDL_AtomicInt built;                  //níveis prontos para exibir (o 0 sempre está)
+  SDL_AtomicInt cancel;
+  SDL_Thread*   thread;
+} MipPyramid;
+
+//índice de histogramas integrais da original para consultas de retângulos (ROI):
+//cum[by * (nbx + 1) + bx] é o histograma de [0, bx*B) x [0, by*B), só blocos inteiros
+typedef struct {
+  Uint32*          cum;                 //(nbx + 1) x (nby + 1) histogramas de 256 bins
+  int              block, nbx, nby;
+  const GrayPlane* src;
+  SDL_AtomicInt    ready;               //cantos prontos; antes disso as consultas leem os pixels
+  SDL_AtomicInt    cancel;
+  SDL_Thread*      thread;
+} HistIndex;
+
+typedef struct {
+  SDL_Texture* tex;
+  int          level, tx, ty;           //chave; level < 0 = livre
+  Uint32       gen;                     //geração do conteúdo quando foi enviado
+  Uint64       last_used;               //quadro do último uso (LRU)
+} TileSlot;
+
+typedef struct {
+  TileSlot* slots;
+  int       nslots;                     //orçamento de VRAM / bytes por bloco
+  Uint64    frame;
+  Uint32    gen;                        //incrementa quando o plano de trabalho muda
+} TileCache;
+
+typedef struct {
+  GrayPlane    gray;           //imagem de trabalho em cinza (Y8)
+  SDL_Texture* texture;        //textura para renderizar (RGBA só no upload)
   int w, h;
-  SDL_Surface* original_gray;
+  GrayPlane    original_gray;  //backup para reverter
+  GrayPlane    alpha;          //só alocado quando a imagem tem transparência
+  GrayPlane    filtered;       //saída do filtro espacial sobre a original, sob demanda
+  GrayPlane    clahe;          //saída do CLAHE (sobre a filtrada, se houver), sob demanda
+  SDL_Surface* color;          //modo cor: RGBA32 original; a cor exibida é refeita de Y' - Y
+  MappedFile   map;            //PGM/Y8 mapeado: gray e original_gray apontam para cá
+  GrayPlane16  deep;           //entrada de 16 bits: Y16 original (gray e original_gray são a exibição)
+  GrayPlane16  deep_out;       //saída de 16 bits da pilha (sem operações vale o próprio deep)
+  Uint32*      hist16;         //histograma de 65536 bins do deep (da ingestão)
+  int          maxval;         //0: imagem de 8 bits
+  bool         deep_valid;     //gray é a exibição de deep_out (sem filtro, CLAHE ou só ROI)
+  int          tex_y0, tex_y1; //linhas [y0,y1) alteradas desde o último envio à textura
+  bool         tiled;          //exibe pela pirâmide em blocos em vez de uma textura única
+  MipPyramid   pyr;
+  TileCache    tiles;
+  HistIndex    hindex;
+  GrayPlane    proxy;          //original reduzida 1/PROXY_SCALE (só imagens grandes): base das prévias
+  GrayPlane    proxy_alpha;    //idem para o alfa, se houver
+  SDL_Texture* proxy_tex;      //prévia da última edição, esticada sobre a imagem
+  bool         preview;        //exibe proxy_tex: a resolução cheia ainda não chegou à tela
 } ImageData;
 
+//operações pontuais (pixel a pixel): a pilha inteira é composta em uma única LUT
+typedef enum { OP_EQUALIZE, OP_GAMMA, OP_STRETCH, OP_THRESHOLD, OP_INVERT } PointOpKind;
+
+typedef struct {
+  PointOpKind kind;
+  float       param;           //gama, % de saturação do stretch, limiar (<0 = Otsu)
+} PointOp;
+
+#define POINT_OPS_MAX 8
+typedef struct {
+  PointOp ops[POINT_OPS_MAX];  //aplicadas em ordem sobre a imagem original
+  int     count;
+} PointOpStack;
+
+//CLAHE: equalização adaptativa por blocos com limite de contraste
+typedef struct {
+  int   tiles_x, tiles_y;      //grade de blocos
+  float clip;                  //limite por bin, em múltiplos da média (<= 0: sem limite)
+} ClaheParams;
+
+//filtros espaciais (vizinhança) sobre a original, antes do CLAHE e da pilha
+typedef enum {
+  FILTER_NONE, FILTER_GAUSSIAN, FILTER_BOX, FILTER_UNSHARP, FILTER_SOBEL, FILTER_SCHARR, FILTER_MEDIAN,
+  FILTER_COUNT
+} FilterKind;
+
+typedef struct {
+  FilterKind kind;
+  float      size;             //sigma da gaussiana/unsharp, raio da caixa
+  float      amount;           //unsharp: ganho sobre (original - borrada)
+} FilterParams;
+
+//enquadramento da janela principal: `fit` mostra a imagem inteira; senão `zoom`
+//(px de tela por px da imagem) em torno do centro (cx, cy), em coordenadas da imagem
+typedef struct {
+  bool  fit;
+  float zoom;
+  float cx, cy;
+  bool  panning;
+} ViewState;
+
+//gravação em segundo plano a partir de um snapshot do plano de trabalho
+typedef enum { SAVE_PNG, SAVE_PNG_STORE, SAVE_PGM, SAVE_QOI, SAVE_FORMAT_COUNT } SaveFormat;
+
+typedef struct {
+  SDL_Thread*   thread;        //não nulo enquanto há gravação em andamento
+  GrayPlane     gray, alpha;   //cópia: a UI continua editando o plano de trabalho
+  SDL_Surface*  color;         //modo cor: a cópia é a imagem RGBA32 já refeita (sem gray/alpha)
+  GrayPlane16   deep;          //16 bits: cópia da saída de 16 bits (PGM e PNG gravam ela)
+  int           maxval;
+  bool          has_alpha;
+  int           w, h;
+  SaveFormat    format;
+  char          path[64];
+  SDL_AtomicInt progress;      //linhas gravadas
+  SDL_AtomicInt done;
+  bool          ok;
+  Uint64        t0;
+} SaveTask;
+
+//sessão com várias imagens: cache LRU das decodificadas (planos, histograma, índice e
+//textura) limitado por um orçamento de memória; uma thread carrega as vizinhas da atual
+typedef enum { ENTRY_EMPTY, ENTRY_LOADING, ENTRY_READY, ENTRY_FAILED } EntryState;
+
+typedef struct {
+  char*      path;
+  ImageData  img;
+  Uint32     hist[256];        //histograma da original (da ingestão)
+  EntryState state;            //protegido por Session.lock; READY só a UI mexe na imagem
+  bool       edited;           //plano de trabalho ficou diferente da original
+  Uint64     last_used;
+  size_t     bytes;
+} SessionEntry;
+
+typedef struct {
+  SessionEntry*  entries;
+  int            count, current;
+  int            raw_w, raw_h;  //--raw: todas as entradas são Y8 cru
+  bool           raw16;         //--raw16: Y16 cru (little-endian)
+  bool           color;         //--color: guarda a cor e equaliza só a luminância
+  size_t         budget, used;  //bytes
+  Uint64         clock;
+  SDL_Mutex*     lock;
+  SDL_Condition* changed;       //atual mudou, memória liberada ou carga terminada
+  SDL_Thread*    thread;
+  bool           quit;
+} Session;
+
+//região de interesse: arrastar com o botão direito na janela principal (px da imagem)
+typedef struct {
+  bool   active, dragging;
+  bool   only;                 //pilha só dentro do ROI, com a LUT composta do histograma dele
+  int    x0, y0, x1, y1;       //[x0,x1) x [y0,y1)
+  float  ax, ay;               //âncora do arrasto
+  Uint32 hist[256];            //histograma exibido da região
+} RoiState;
+
+//histórico (desfazer/refazer): cada passo guarda o estado da pipeline e o que basta para
+//refazer os pixels sem recalcular. Passos só da pilha guardam a LUT (256 bytes); os
+//espaciais (filtro, CLAHE, só ROI) guardam os blocos do plano de trabalho que mudaram,
+//como XOR antes/depois comprimido - o mesmo delta serve para desfazer e refazer
+typedef struct {
+  int    tile;                 //índice na grade de HISTORY_TILE x HISTORY_TILE
+  Uint32 size;
+  Uint8* data;
+} HistoryTile;
+
+typedef struct {
+  PointOpStack ops;
+  FilterParams filter;
+  ClaheParams  clahe;
+  bool         clahe_on;
+  RoiState     roi;
+  Uint8        lut[256];
+  Uint32       hist[256];
+  bool         spatial;        //chegou-se a este passo por blocos (senão, pela LUT)
+  HistoryTile* tiles;
+  int          ntiles;
+  size_t       bytes;
+} HistoryEntry;
+
+typedef struct {
+  HistoryEntry* entries;       //[0] é o estado mais antigo que ainda dá para voltar
+  int        count, cap, cur;
+  size_t     used, budget;
+  GrayPlane  snap;             //plano de trabalho do passo atual: referência dos deltas
+  bool       stale;            //planos do filtro/CLAHE são de outro passo (refeitos sob demanda)
+} History;
+
+//processamento progressivo das imagens grandes: cada edição é refeita na hora sobre o proxy
+//e em resolução cheia numa thread cancelável; ao terminar, os planos novos entram no lugar
+//quanto da pipeline refazer: nada, só a pilha, desde o CLAHE ou desde o filtro
+typedef enum { STAGE_NONE, STAGE_POINT_OPS, STAGE_CLAHE, STAGE_FILTER } PipelineStage;
+
+typedef struct {
+  SDL_Thread*   thread;        //não nulo enquanto há uma passada em andamento
+  ImageData*    img;
+  PipelineStage from;          //estágios refeitos; os anteriores vêm dos planos da imagem
+  PipelineStage pending;       //o mais antigo editado desde a última passada instalada
+  bool          restart;       //cancelada por uma edição mais nova: relança ao terminar
+  bool          fresh;         //primeira passada da imagem aberta: o histórico recomeça dela
+  bool          dropped;       //desfazer descartou a edição pendente: refazer pede ela de novo
+  HistoryEntry  redo;          //estado da pipeline dessa edição
+  FilterParams  filter;        //estado da pipeline no lançamento
+  ClaheParams   clahe;
+  bool          clahe_on;
+  PointOpStack  ops;
+  Uint32        src_hist[256], filter_hist[256], clahe_hist[256], hist[256];
+  Uint8         lut[256];
+  GrayPlane     filtered, clahe_out, gray; //saídas (filtered/clahe_out só dos estágios refeitos)
+  SDL_AtomicInt cancel;
+  SDL_AtomicInt done;
+  bool          ok;
+  Uint64        t0;
+} FullPass;
+
 typedef enum { BTN_IDLE, BTN_HOVER, BTN_ACTIVE } ButtonState;
 
+//cache de texturas de rótulos: cada texto é rasterizado uma vez e reaproveitado enquanto
+//não muda (estatísticas, pilha, botões, overlay de tempos)
+#define LABEL_CACHE_SIZE 48    //mais que os rótulos de um quadro (4 textos, 3 botões, overlay)
+#define LABEL_MAX_LEN 160
+typedef struct {
+  SDL_Renderer* rr;            //NULL: entrada livre
+  SDL_Texture*  tex;
+  SDL_Color     color;
+  char          text[LABEL_MAX_LEN];
+  int           w, h;
+  Uint64        used;          //último uso (LRU)
+} LabelEntry;
+
+typedef struct {
+  LabelEntry entries[LABEL_CACHE_SIZE];
+  Uint64     tick;
+} LabelCache;
+
+//lote de quadriláteros coloridos para um único SDL_RenderGeometry
+#define QUAD_BATCH_MAX 1024    //barras linear e log (512), CDF (255), grade, molduras e botões
+typedef struct {
+  SDL_Vertex verts[QUAD_BATCH_MAX * 4];
+  int        quads;
+} QuadBatch;
+
 typedef struct {
   SDL_FRect rect;
   ButtonState state;  // pode manter pra hover visual (opcional)
@@ -33,79 +325,246 @@ typedef struct {
   AppContext mainApp;
   AppContext sideApp;
   UIButton   eqButton;
-  Uint32     hist[256];
+  UIButton   claheButton;
+  Uint32     hist[256];      //histograma da imagem exibida
+  Uint32     src_hist[256];  //histograma da original (da ingestão), base da LUT
+  PointOpStack ops;
+  Uint8      lut[256];       //LUT composta da pilha para a imagem inteira
+  RoiState   roi;
+  char       opsLabel[128];
+  ClaheParams clahe;
+  bool       clahe_on;       //base da pilha é o resultado do CLAHE, não a original
+  Uint32     clahe_hist[256];
+  UIButton   filterButton;
+  FilterParams filter;       //FILTER_NONE: desligado
+  Uint32     filter_hist[256];
   TTF_Font*  font;
   float      yzoom; 
+  ViewState  view;
+  Session    session;
+  History    history;
+  Sint64     max_tex;        //textura máxima do renderer; acima disso, pirâmide em blocos
+  SaveTask   save;
+  FullPass   full;           //passada em resolução cheia da última edição (imagens grandes)
+  bool       stats_approx;   //histograma e estatísticas ainda são os da prévia
+  SaveFormat save_format;
+  int        save_index;     //último número usado em output_NNNN
+  char       saveLabel[96];
   float      mean, stddev;
+  float      deep_mean, deep_stddev; //16 bits: estatísticas da saída de 16 bits, em 0..deep_maxval
+  int        deep_maxval;    //0: estatísticas só da exibição em 8 bits
   char       meanLabel[64];
   char       stdLabel[64];
+  LabelCache labels;         //texturas dos rótulos das duas janelas
+  bool       hist_log;       //L: barras em escala log atrás das lineares
+  bool       hist_cdf;       //D: curva da distribuição acumulada
   bool is_equalized;
+  Uint32     dirty;          //DIRTY_*: o que mudou desde o último redesenho
 } UIContext;
 
+//motivos de redesenho, por janela
+#define DIRTY_MAIN_IMAGE   (1u << 0)  //conteúdo da imagem mudou
+#define DIRTY_MAIN_LAYOUT  (1u << 1)  //resize/exposição da janela principal
+#define DIRTY_SIDE_HIST    (1u << 2)  //histograma, estatísticas ou zoom mudaram
+#define DIRTY_SIDE_BUTTON  (1u << 3)  //estado/rótulo do botão mudou
+#define DIRTY_SIDE_LAYOUT  (1u << 4)  //resize/exposição da janela secundária
+#define DIRTY_MAIN_ANY     (DIRTY_MAIN_IMAGE | DIRTY_MAIN_LAYOUT)
+#define DIRTY_SIDE_ANY     (DIRTY_SIDE_HIST | DIRTY_SIDE_BUTTON | DIRTY_SIDE_LAYOUT)
+
 //constantes
 #define SIDE_W  320
 #define SIDE_H  440
 #define SIDE_MARGIN 16
 #define BUTTON_H 36
-#define BUTTON_W 160
+#define BUTTON_W 90
+#define BATCH_MAX_JOBS 256
+#define INGEST_STRIP_ROWS 16
+#define POOL_MAX_THREADS 64
+#define HIST_MIN_BAND_PIXELS (64 * 1024)
+#define TEXTURE_STRIP_ROWS 64
+#define CLAHE_MAX_TILES 64
+#define CLAHE_MIN_TILE 8
+#define FILTER_TILE_W 512      //bloco dos filtros: cabe na L2 com o halo e o buffer de 16 bits
+#define FILTER_TILE_H 64
+#define FILTER_MAX_RADIUS 32
+#define HINDEX_MIN_BLOCK 32
+#define HINDEX_MAX_MB 64
+#define SESSION_PREFETCH 2     //vizinhas carregadas de cada lado da atual
+#define HISTORY_TILE 64         //blocos dos deltas do histórico (4 KiB)
+#define PROXY_SCALE 8           //lado do proxy: 1/8 da imagem (1/64 dos pixels)
+#define PROXY_MIN_MPIX 16       //imagens a partir daqui ganham proxy (CV_PROXY_MPIX muda; 0 desliga)
+#define FULL_PASS_STRIP_ROWS 256 //a LUT da resolução cheia roda em faixas, testando o cancelamento
+#define TEXTURE_STEP_MB 16      //depois da passada, a textura sobe no máximo isto por volta do laço
 
 //declaração de função
 static void  log_sdl_error(const char* msg);
-static bool  img_load_rgba32(const char* path, ImageData* out);
-static bool  is_surface_grayscale_rgba32(const SDL_Surface* surf);
-static bool  convert_to_grayscale_inplace(SDL_Surface* surf);
-static void  compute_histogram_gray_rgba32(const SDL_Surface* surf, Uint32 hist[256], float* out_mean, float* out_stddev);
-static void  draw_histogram(SDL_Renderer* rr, const Uint32 hist[256], SDL_FRect area, float yzoom);
-static void  draw_button(SDL_Renderer* rr, const UIButton* btn, TTF_Font* font, bool is_equalized);
+static bool  img_load_gray(const char* path, ImageData* out, Uint32 hist[256], bool with_backup, bool keep_color);
+static void  compute_histogram_gray(const GrayPlane* plane, Uint32 hist[256], float* out_mean, float* out_stddev);
+static void  draw_histogram(QuadBatch* q, const Uint32 hist[256], SDL_FRect area, float yzoom, bool log_scale, bool cdf);
 static bool  create_main_window(UIContext* ui, int imgw, int imgh);
 static bool  create_side_window(UIContext* ui);
-static void  cleanup_all(UIContext* ui, ImageData* img);
+static void  cleanup_all(UIContext* ui);
 static void  render_main_window(UIContext* ui, ImageData* img);
 static void  render_side_window(UIContext* ui);
-static void  handle_events(UIContext* ui, ImageData* img);
-static void  render_loop(UIContext* ui, ImageData* img);
-static bool  equalize_histogram_inplace(SDL_Surface* surf);
-void shutdown(void);
+static void  view_transform(const ViewState* v, const ImageData* img, int ww, int wh, float* scale, float* ox, float* oy);
+static void  render_tiles(UIContext* ui, ImageData* img, int ww, int wh, float scale, float ox, float oy);
+static void  draw_text(SDL_Renderer* rr, LabelCache* labels, TTF_Font* font, const char* msg, int x, int y);
+static void  pyramid_free(MipPyramid* p);
+static void  hist_index_free(HistIndex* ix);
+static void  tile_cache_free(TileCache* c);
+static void  handle_event(UIContext* ui, ImageData* img, const SDL_Event* e);
+static void  render_loop(UIContext* ui);
+static void  point_stack_build_lut(const PointOpStack* stack, const Uint32 src_hist[256], Uint8 lut[256], Uint32 out_hist[256]);
+static bool  point_stack_build_lut16(const PointOpStack* stack, const Uint32* src_hist16, int maxval,
+                                     Uint32* lut, Uint32* out_hist16, Uint32 out_hist[256]);
+static bool  point_stack_parse(PointOpStack* stack, const char* spec);
+static void  point_stack_describe(const PointOpStack* stack, char* out, size_t outsz);
+static bool  plane_clahe(const GrayPlane* src, GrayPlane* dst, const ClaheParams* p, Uint32 out_hist[256]);
+static bool  clahe_parse(ClaheParams* p, const char* spec);
+static bool  plane_filter(const GrayPlane* src, GrayPlane* dst, const FilterParams* p, Uint32 out_hist[256]);
+static bool  filter_parse(FilterParams* p, const char* spec);
+static void  filter_describe(const FilterParams* p, char* out, size_t outsz);
+static void  filter_set_kind(FilterParams* p, FilterKind kind);
+static int   run_batch(int argc, char** argv);
+static int   run_serve(int argc, char** argv);
+static int   run_client(int argc, char** argv);
+static void  pool_shutdown(void);
+static void  trace_flush(void);
+static void  save_finish(UIContext* ui);
+static void  session_free(Session* s);
+static void  history_clear(History* h);
+static void  stages_sync(UIContext* ui, ImageData* img);
+static bool  full_pass_eligible(const UIContext* ui, const ImageData* img);
+static bool  full_pass_request(UIContext* ui, ImageData* img, PipelineStage from);
+static bool  full_pass_cancel(UIContext* ui);
+static void  full_pass_finish(UIContext* ui);
+static bool  pnm_read_header(SDL_IOStream* io, PnmHeader* h);
+static int   pnm_maxval(const char* path);
+static void  free_image(ImageData* img);
+static bool  is_pnm_name(const char* name);
+static bool  has_image_extension(const char* name);
+static int   compare_names(const void* a, const void* b);
+void app_shutdown(void);
 
 //funções
 static void log_sdl_error(const char* msg) {
   SDL_Log("%s: %s", msg, SDL_GetError());
 }
 
-void shutdown(void) {
+void app_shutdown(void) {
   SDL_Log("shutdown()");
+  pool_shutdown();
+  trace_flush();
   TTF_Quit();
   SDL_Quit();
 }
 
-//carrega a imagem do disco e converte para RGBA32
-static bool img_load_rgba32(const char* path, ImageData* out) {
-  SDL_Log("Carregando: %s", path);
+//instrumentação por fase: com CV_TRACE=arquivo.json (ou --trace) cada trecho marcado vira
+//um evento "X" do formato trace_event do Chrome (abrir em chrome://tracing ou no Perfetto).
+//a tecla P liga um overlay com a última duração de cada fase na janela secundária.
+//desligada, cada marcação custa só o teste de um bool
+typedef enum {
+  PH_LOAD, PH_INGEST, PH_HISTOGRAM, PH_POINT_OPS, PH_CLAHE, PH_FILTER, PH_UPLOAD, PH_PYRAMID, PH_SAVE,
+  PH_RENDER_MAIN, PH_RENDER_SIDE, PH_TEXT, PH_PRESENT, PH_FRAME, PH_COUNT
+} TracePhase;
 
-  SDL_Surface* loaded = IMG_Load(path);
-  if (!loaded) {
-    log_sdl_error("IMG_Load falhou");
-    return false;
-  }
+static const char* const trace_phase_names[PH_COUNT] = {
+  "load", "ingest", "histogram", "point_ops", "clahe", "filter", "texture_upload", "pyramid_level", "save",
+  "render_main", "render_side", "text", "present", "frame"
+};
 
-  SDL_Surface* rgba = SDL_ConvertSurface(loaded, SDL_PIXELFORMAT_RGBA32);
-  SDL_DestroySurface(loaded);
-  if (!rgba) {
-    log_sdl_error("SDL_ConvertSurface para RGBA32 falhou");
-    return false;
+#define TRACE_MAX_EVENTS (1 << 18)
+
+typedef struct {
+  Uint64       t0, t1;         //contador de performance; t1 == 0: evento ainda sendo escrito
+  SDL_ThreadID tid;
+  int          phase;
+} TraceEvent;
+
+typedef struct {
+  bool          enabled;       //timers ativos (arquivo de trace ou overlay)
+  bool          overlay;
+  char          path[256];
+  TraceEvent*   events;        //só alocado com arquivo de trace
+  SDL_AtomicInt count;
+  Uint64        origin;
+  SDL_AtomicInt last_us[PH_COUNT]; //última duração de cada fase, para o overlay
+} TraceState;
+
+static TraceState g_trace;
+
+//chamada de novo (--trace com CV_TRACE já ligado), só troca o arquivo: a linha de comando
+//vale mais que o ambiente
+static void trace_init(const char* path) {
+  if (!path || !*path) return;
+  if (g_trace.events) {
+    snprintf(g_trace.path, sizeof(g_trace.path), "%s", path);
+    SDL_Log("Trace redirecionado: %s", g_trace.path);
+    return;
   }
+  g_trace.events = (TraceEvent*)calloc(TRACE_MAX_EVENTS, sizeof(TraceEvent));
+  if (!g_trace.events) { SDL_Log("Sem memória para o buffer de trace"); return; }
+  snprintf(g_trace.path, sizeof(g_trace.path), "%s", path);
+  g_trace.origin = SDL_GetPerformanceCounter();
+  g_trace.enabled = true;
+  SDL_Log("Trace ligado: %s", g_trace.path);
+}
 
-  out->surface_rgba = rgba;
-  out->texture = NULL;
-  out->w = rgba->w;
-  out->h = rgba->h;
+static void trace_set_overlay(bool on) {
+  g_trace.overlay = on;
+  g_trace.enabled = on || g_trace.events;
+}
 
-  const char* fmt_name = SDL_GetPixelFormatName(rgba->format);
-  SDL_Log("Imagem OK: %dx%d | pitch=%d bytes | formato=%s",
-          rgba->w, rgba->h, rgba->pitch, fmt_name ? fmt_name : "(desconhecido)");
-  return true;
+static inline Uint64 trace_begin(void) {
+  return g_trace.enabled ? SDL_GetPerformanceCounter() : 0;
+}
+
+static inline void trace_end(TracePhase ph, Uint64 t0) {
+  if (!t0) return;
+  Uint64 t1 = SDL_GetPerformanceCounter();
+  Uint64 us = (t1 - t0) * 1000000u / SDL_GetPerformanceFrequency();
+  SDL_SetAtomicInt(&g_trace.last_us[ph], us > SDL_MAX_SINT32 ? SDL_MAX_SINT32 : (int)us);
+  if (!g_trace.events) return;
+  int i = SDL_AddAtomicInt(&g_trace.count, 1);
+  if (i >= TRACE_MAX_EVENTS) return; //buffer cheio: descarta
+  TraceEvent* ev = &g_trace.events[i];
+  ev->t0 = t0;
+  ev->tid = SDL_GetCurrentThreadID();
+  ev->phase = (int)ph;
+  ev->t1 = t1;
 }
 
+//grava os eventos no formato JSON do trace_event (tempos em microssegundos)
+static void trace_flush(void) {
+  if (!g_trace.events) return;
+  int n = SDL_GetAtomicInt(&g_trace.count);
+  if (n > TRACE_MAX_EVENTS) {
+    SDL_Log("Trace: %d eventos descartados (buffer cheio)", n - TRACE_MAX_EVENTS);
+    n = TRACE_MAX_EVENTS;
+  }
+  FILE* f = fopen(g_trace.path, "w");
+  if (!f) {
+    SDL_Log("Falha ao criar trace '%s'", g_trace.path);
+  } else {
+    const double to_us = 1e6 / (double)SDL_GetPerformanceFrequency();
+    fprintf(f, "{\"traceEvents\": [\n");
+    bool first = true;
+    for (int i = 0; i < n; i++) {
+      const TraceEvent* ev = &g_trace.events[i];
+      if (!ev->t1) continue;
+      fprintf(f, "%s  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %llu, \"ts\": %.3f, \"dur\": %.3f}",
+              first ? "" : ",\n", trace_phase_names[ev->phase], (unsigned long long)ev->tid,
+              (double)(ev->t0 - g_trace.origin) * to_us, (double)(ev->t1 - ev->t0) * to_us);
+      first = false;
+    }
+    fprintf(f, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    fclose(f);
+    SDL_Log("Trace gravado: %s (%d eventos)", g_trace.path, n);
+  }
+  free(g_trace.events);
+  g_trace.events = NULL;
+  g_trace.enabled = g_trace.overlay;
+}
 
 static const char* classify_mean(float mean) {
   if (mean < 85.f)   return "escura";
@@ -121,522 +580,7156 @@ static const char* classify_stddev(float sd) {
 
 
 static void render_main_window(UIContext* ui, ImageData* img) {
+  Uint64 tr = trace_begin();
   SDL_SetRenderDrawColor(ui->mainApp.renderer, 20,20,20,255);
   SDL_RenderClear(ui->mainApp.renderer);
 
   int ww, wh;
   SDL_GetWindowSize(ui->mainApp.window, &ww, &wh);
 
-  float iW = (float)img->w, iH = (float)img->h;
-  float wW = (float)ww,     wH = (float)wh;
-  float scale = (wW / iW < wH / iH) ? (wW / iW) : (wH / iH);
-  float dw = iW * scale;
-  float dh = iH * scale;
+  float scale, ox, oy;
+  view_transform(&ui->view, img, ww, wh, &scale, &ox, &oy);
 
-  SDL_FRect dst = { (wW - dw) * 0.5f, (wH - dh) * 0.5f, dw, dh };
-  SDL_RenderTexture(ui->mainApp.renderer, img->texture, NULL, &dst);
+  if (img->preview && img->proxy_tex) {
+    //prévia sobre o proxy enquanto a resolução cheia não chega à tela
+    SDL_FRect dst = { -ox * scale, -oy * scale, (float)img->w * scale, (float)img->h * scale };
+    SDL_RenderTexture(ui->mainApp.renderer, img->proxy_tex, NULL, &dst);
+  } else if (img->tiled) {
+    render_tiles(ui, img, ww, wh, scale, ox, oy);
+  } else {
+    SDL_FRect dst = { -ox * scale, -oy * scale, (float)img->w * scale, (float)img->h * scale };
+    SDL_RenderTexture(ui->mainApp.renderer, img->texture, NULL, &dst);
+  }
+  if (ui->roi.active) {
+    const RoiState* r = &ui->roi;
+    SDL_FRect box = { ((float)r->x0 - ox) * scale, ((float)r->y0 - oy) * scale,
+                      (float)(r->x1 - r->x0) * scale, (float)(r->y1 - r->y0) * scale };
+    SDL_SetRenderDrawColor(ui->mainApp.renderer, 255, 200, 40, 255);
+    SDL_RenderRect(ui->mainApp.renderer, &box);
+  }
+  trace_end(PH_RENDER_MAIN, tr);
 
+  tr = trace_begin();
   SDL_RenderPresent(ui->mainApp.renderer);
+  trace_end(PH_PRESENT, tr);
 }
 
-//verifica se todos os pixels têm R==G==B. Pressupõe surf->format == RGBA32
-static bool is_surface_grayscale_rgba32(const SDL_Surface* surf) {
-  if (!surf) return false;
+//kernels de pixel: a entrada decodificada chega em RGBA32 (bytes R,G,B,A em memória),
+//mas todo o processamento interno é feito em planos de 8 bits (Y8)
+//pesos BT.709 em ponto fixo Q15: 0.2125, 0.7154, 0.0721 -> somam exatamente 32768,
+//então um pixel já cinza (R==G==B) é preservado sem erro de arredondamento
+#define GRAY_WR    6963
+#define GRAY_WG    23442
+#define GRAY_WB    2363
+#define GRAY_SHIFT 15
+#define GRAY_ROUND (1 << (GRAY_SHIFT - 1))
 
-  if (!SDL_LockSurface((SDL_Surface*)surf)) { 
-    SDL_Log("Falha ao SDL_LockSurface (is_surface_grayscale): %s", SDL_GetError());
-    return false;
+typedef struct {
+  const char* name;
+  void (*row_to_gray)(const Uint8* rgba, Uint8* gray, int w);
+  void (*row_hist)(const Uint8* gray, int w, Uint32 hist[256]);
+  void (*row_apply_lut)(const Uint8* src, Uint8* dst, int w, const Uint8 lut[256]);
+  void (*row_expand)(const Uint8* gray, const Uint8* alpha, Uint8* rgba, int w); //alpha NULL = opaco
+  //interpolação bilinear entre 4 LUTs (sup.esq, sup.dir, inf.esq, inf.dir); pesos 0..256
+  void (*row_bilerp_lut)(const Uint8* src, Uint8* dst, int w, const Uint32* const luts[4],
+                         const Uint16* fx, Uint32 fy);
+  //modo cor: RGB' = RGB + (Y' - Y) com saturação, alfa da origem (y = Y original, y2 = Y')
+  void (*row_recolor)(const Uint8* rgba, const Uint8* y, const Uint8* y2, Uint8* dst, int w);
+  //convolução separável. horizontal: u8 -> Q8 com pesos Q8 (somam 256); src já traz o halo,
+  //dst[x] usa src[x..x+ntaps-1]
+  void (*row_hconv)(const Uint8* src, Uint16* dst, int w, const Uint16* taps, int ntaps);
+  //vertical: Q8 -> u8 com pesos Q16 (somam 65536); rows[k] é a k-ésima linha da janela
+  void (*row_vconv)(const Uint16* const* rows, Uint8* dst, int w, const Uint16* taps, int ntaps);
+  //mediana 3x3: dst[x] = mediana das colunas x..x+2 de r0, r1, r2 (linhas com halo)
+  void (*row_median3)(const Uint8* r0, const Uint8* r1, const Uint8* r2, Uint8* dst, int w);
+  //LUT de 16 bits com a exibição embutida: lut[v] = saída de 16 bits | Y8 exibido << 16
+  //(dst16 NULL: só a exibição)
+  void (*row_apply_lut16)(const Uint16* src, Uint16* dst16, Uint8* dst8, int w, const Uint32* lut);
+} PixelKernels;
+
+static void row_to_gray_scalar(const Uint8* rgba, Uint8* gray, int w) {
+  for (int x = 0; x < w; x++) {
+    const Uint8* p = rgba + 4 * x;
+    gray[x] = (Uint8)((GRAY_WR * p[0] + GRAY_WG * p[1] + GRAY_WB * p[2] + GRAY_ROUND) >> GRAY_SHIFT);
   }
+}
+
+//o scatter do histograma não vetoriza; 4 sub-histogramas quebram a dependência
+//entre incrementos seguidos no mesmo bin (comum em regiões lisas)
+static void row_hist_scalar(const Uint8* gray, int w, Uint32 hist[256]) {
+  Uint32 h4[4][256];
+  memset(h4, 0, sizeof(h4));
+  int x = 0;
+  for (; x + 4 <= w; x += 4) {
+    h4[0][gray[x]]++;
+    h4[1][gray[x + 1]]++;
+    h4[2][gray[x + 2]]++;
+    h4[3][gray[x + 3]]++;
+  }
+  for (; x < w; x++) h4[0][gray[x]]++;
+  for (int i = 0; i < 256; i++) hist[i] += h4[0][i] + h4[1][i] + h4[2][i] + h4[3][i];
+}
 
-  const Uint32* pixels = (const Uint32*)surf->pixels;
-  const int w = surf->w, h = surf->h;
-  const int count = w * h;
-  const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(surf->format);
-  const SDL_Palette* pal = SDL_GetSurfacePalette((SDL_Surface*)surf);
+static void row_apply_lut_scalar(const Uint8* src, Uint8* dst, int w, const Uint8 lut[256]) {
+  for (int x = 0; x < w; x++) dst[x] = lut[src[x]];
+}
 
-  bool is_gray = true;
-  for (int i = 0; i < count; i++) {
-    Uint8 r, g, b, a;
-    SDL_GetRGBA(pixels[i], fmt, pal, &r, &g, &b, &a);
-    if (!(r == g && g == b)) { is_gray = false; break; }
+static void row_expand_scalar(const Uint8* gray, const Uint8* alpha, Uint8* rgba, int w) {
+  for (int x = 0; x < w; x++) {
+    Uint8* p = rgba + 4 * x;
+    p[0] = p[1] = p[2] = gray[x];
+    p[3] = alpha ? alpha[x] : 255;
   }
+}
 
-  SDL_UnlockSurface((SDL_Surface*)surf);
-  return is_gray;
+//top/bottom <= 255*256; a mistura vertical cabe em 24 bits, sem estouro em 32
+static void row_bilerp_lut_scalar(const Uint8* src, Uint8* dst, int w, const Uint32* const luts[4],
+                                  const Uint16* fx, Uint32 fy) {
+  for (int x = 0; x < w; x++) {
+    Uint32 v = src[x], f = fx[x];
+    Uint32 top = luts[0][v] * (256 - f) + luts[1][v] * f;
+    Uint32 bot = luts[2][v] * (256 - f) + luts[3][v] * f;
+    dst[x] = (Uint8)((top * (256 - fy) + bot * fy + 32768) >> 16);
+  }
 }
 
-static bool convert_to_grayscale_inplace(SDL_Surface* surf) {
-  if (!surf) return false;
-  if (!SDL_LockSurface(surf)) {
-    SDL_Log("Falha ao SDL_LockSurface (convert_to_grayscale): %s", SDL_GetError());
-    return false;
+//somar a mesma diferença aos 3 canais preserva o croma (Cb, Cr) e leva o Y ao valor novo,
+//a menos da saturação em 0/255
+static void row_recolor_scalar(const Uint8* rgba, const Uint8* y, const Uint8* y2, Uint8* dst, int w) {
+  for (int x = 0; x < w; x++) {
+    int d = (int)y2[x] - (int)y[x];
+    const Uint8* p = rgba + 4 * x;
+    Uint8* q = dst + 4 * x;
+    for (int c = 0; c < 3; c++) {
+      int v = p[c] + d;
+      q[c] = (Uint8)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+    q[3] = p[3];
+  }
+}
+
+//soma <= 255*256: cabe nos 16 bits que o SIMD usa
+static void row_hconv_scalar(const Uint8* src, Uint16* dst, int w, const Uint16* taps, int ntaps) {
+  for (int x = 0; x < w; x++) {
+    Uint32 acc = 0;
+    for (int k = 0; k < ntaps; k++) acc += (Uint32)src[x + k] * taps[k];
+    dst[x] = (Uint16)acc;
   }
+}
 
-  Uint32* pixels = (Uint32*)surf->pixels;
-  const int count = surf->w * surf->h;
-  const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(surf->format);
-   const SDL_Palette* pal = SDL_GetSurfacePalette(surf);
-  for (int i = 0; i < count; i++) {
-    Uint8 r, g, b, a;
-    SDL_GetRGBA(pixels[i], fmt, pal, &r, &g, &b, &a);
+//cada produto é truncado como no mulhi do SIMD; ntaps/2 compensa a perda média
+//e o total fica abaixo de 65536 (255*256 + ntaps/2 + 128)
+static void row_vconv_scalar(const Uint16* const* rows, Uint8* dst, int w, const Uint16* taps, int ntaps) {
+  for (int x = 0; x < w; x++) {
+    Uint32 acc = (Uint32)(ntaps / 2);
+    for (int k = 0; k < ntaps; k++) acc += ((Uint32)rows[k][x] * taps[k]) >> 16;
+    dst[x] = (Uint8)((acc + 128) >> 8);
+  }
+}
 
-    // Y = 0.2125R + 0.7154G + 0.0721B 
-    float Yf = 0.2125f * (float)r + 0.7154f * (float)g + 0.0721f * (float)b;
-    Uint8 Y = (Uint8)(Yf + 0.5f);
+static inline Uint8 min_u8(Uint8 a, Uint8 b) { return a < b ? a : b; }
+static inline Uint8 max_u8(Uint8 a, Uint8 b) { return a > b ? a : b; }
+static inline Uint8 med3_u8(Uint8 a, Uint8 b, Uint8 c) { return max_u8(min_u8(a, b), min_u8(max_u8(a, b), c)); }
 
-    pixels[i] = SDL_MapRGBA(fmt, pal, Y, Y, Y, a);
+//colunas ordenadas (lo <= mid <= hi): a mediana dos 9 é a mediana de
+//(maior dos lo, mediana dos mid, menor dos hi) - 3x3 exato sem ordenar a janela
+static void row_median3_scalar(const Uint8* r0, const Uint8* r1, const Uint8* r2, Uint8* dst, int w) {
+  for (int x = 0; x < w; x++) {
+    Uint8 lo[3], mid[3], hi[3];
+    for (int c = 0; c < 3; c++) {
+      Uint8 a = r0[x + c], b = r1[x + c], d = r2[x + c];
+      lo[c]  = min_u8(min_u8(a, b), d);
+      hi[c]  = max_u8(max_u8(a, b), d);
+      mid[c] = med3_u8(a, b, d);
+    }
+    dst[x] = med3_u8(max_u8(max_u8(lo[0], lo[1]), lo[2]), med3_u8(mid[0], mid[1], mid[2]),
+                     min_u8(min_u8(hi[0], hi[1]), hi[2]));
   }
+}
 
-  SDL_UnlockSurface(surf);
-  return true;
+static void row_apply_lut16_scalar(const Uint16* src, Uint16* dst16, Uint8* dst8, int w, const Uint32* lut) {
+  if (dst16) {
+    for (int x = 0; x < w; x++) {
+      Uint32 v = lut[src[x]];
+      dst16[x] = (Uint16)v;
+      dst8[x] = (Uint8)(v >> 16);
+    }
+  } else {
+    for (int x = 0; x < w; x++) dst8[x] = (Uint8)(lut[src[x]] >> 16);
+  }
 }
 
+static const PixelKernels kernels_scalar = {
+  "scalar", row_to_gray_scalar, row_hist_scalar, row_apply_lut_scalar, row_expand_scalar, row_bilerp_lut_scalar,
+  row_recolor_scalar, row_hconv_scalar, row_vconv_scalar, row_median3_scalar, row_apply_lut16_scalar
+};
 
-static void compute_histogram_gray_rgba32(const SDL_Surface* surf, Uint32 hist[256],
-                                          float* out_mean, float* out_stddev) {
-  memset(hist, 0, sizeof(Uint32) * 256);
-  const int count = surf->w * surf->h;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CV_X86_SIMD 1
+#include <immintrin.h>
 
-  if (!SDL_LockSurface((SDL_Surface*)surf)) {
-    SDL_Log("Lock falhou (hist): %s", SDL_GetError());
-    return;
+//4 pixels RGBA -> Y em dwords, mesmo arredondamento do escalar
+__attribute__((target("sse2")))
+static __m128i gray4_sse2(__m128i v) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i wts  = _mm_setr_epi16(GRAY_WR, GRAY_WG, GRAY_WB, 0, GRAY_WR, GRAY_WG, GRAY_WB, 0);
+  const __m128i rnd  = _mm_set1_epi32(GRAY_ROUND);
+  __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), wts); //[R0*wr+G0*wg, B0*wb, R1.., B1..]
+  __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), wts);
+  lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+  hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+  __m128i y = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+                                              _MM_SHUFFLE(2, 0, 2, 0)));
+  return _mm_srli_epi32(_mm_add_epi32(y, rnd), GRAY_SHIFT);
+}
+
+__attribute__((target("sse2")))
+static void row_to_gray_sse2(const Uint8* rgba, Uint8* gray, int w) {
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    const Uint8* p = rgba + 4 * x;
+    __m128i y0 = gray4_sse2(_mm_loadu_si128((const __m128i*)(p)));
+    __m128i y1 = gray4_sse2(_mm_loadu_si128((const __m128i*)(p + 16)));
+    __m128i y2 = gray4_sse2(_mm_loadu_si128((const __m128i*)(p + 32)));
+    __m128i y3 = gray4_sse2(_mm_loadu_si128((const __m128i*)(p + 48)));
+    __m128i y  = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+    _mm_storeu_si128((__m128i*)(gray + x), y);
   }
-  const Uint32* p = (const Uint32*)surf->pixels;
-  const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(surf->format);
-  const SDL_Palette* pal = SDL_GetSurfacePalette((SDL_Surface*)surf);
+  row_to_gray_scalar(rgba + 4 * x, gray + x, w - x);
+}
 
-  double sum = 0.0, sum2 = 0.0;
-  for (int i = 0; i < count; i++) {
-    Uint8 r,g,b,a;
-    SDL_GetRGBA(p[i], fmt, pal, &r,&g,&b,&a);
-    // imagem está em cinza -> r==g==b (r como intensidade)
-    Uint8 Y = r;
-    hist[Y]++;
-    sum  += Y;
-    sum2 += (double)Y * (double)Y;
+__attribute__((target("sse2")))
+static void row_expand_sse2(const Uint8* gray, const Uint8* alpha, Uint8* rgba, int w) {
+  const __m128i opaque = _mm_set1_epi8((char)0xFF);
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(gray + x));
+    __m128i a = alpha ? _mm_loadu_si128((const __m128i*)(alpha + x)) : opaque;
+    __m128i vv_lo = _mm_unpacklo_epi8(v, v), vv_hi = _mm_unpackhi_epi8(v, v); //Y,Y
+    __m128i va_lo = _mm_unpacklo_epi8(v, a), va_hi = _mm_unpackhi_epi8(v, a); //Y,A
+    Uint8* p = rgba + 4 * x;
+    _mm_storeu_si128((__m128i*)(p),      _mm_unpacklo_epi16(vv_lo, va_lo));
+    _mm_storeu_si128((__m128i*)(p + 16), _mm_unpackhi_epi16(vv_lo, va_lo));
+    _mm_storeu_si128((__m128i*)(p + 32), _mm_unpacklo_epi16(vv_hi, va_hi));
+    _mm_storeu_si128((__m128i*)(p + 48), _mm_unpackhi_epi16(vv_hi, va_hi));
   }
-  SDL_UnlockSurface((SDL_Surface*)surf);
+  row_expand_scalar(gray + x, alpha ? alpha + x : NULL, rgba + 4 * x, w - x);
+}
 
-  double mean = sum / (double)count;
-  double var  = (sum2 / (double)count) - (mean*mean);
-  if (var < 0.0) var = 0.0;
-  double stddev = sqrt(var);
-  if (out_mean)   *out_mean = (float)mean;
-  if (out_stddev) *out_stddev = (float)stddev;
+//a diferença vira dois bytes sem sinal (subida e descida) replicados em R,G,B:
+//adds/subs saturados fazem o clamp de graça
+__attribute__((target("sse2")))
+static void row_recolor_sse2(const Uint8* rgba, const Uint8* y, const Uint8* y2, Uint8* dst, int w) {
+  const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(y + x));
+    __m128i b = _mm_loadu_si128((const __m128i*)(y2 + x));
+    __m128i up = _mm_subs_epu8(b, a), down = _mm_subs_epu8(a, b);
+    __m128i up2[2]   = { _mm_unpacklo_epi8(up, up), _mm_unpackhi_epi8(up, up) };
+    __m128i down2[2] = { _mm_unpacklo_epi8(down, down), _mm_unpackhi_epi8(down, down) };
+    for (int k = 0; k < 4; k++) {
+      __m128i u = (k & 1) ? _mm_unpackhi_epi16(up2[k >> 1], up2[k >> 1]) : _mm_unpacklo_epi16(up2[k >> 1], up2[k >> 1]);
+      __m128i d = (k & 1) ? _mm_unpackhi_epi16(down2[k >> 1], down2[k >> 1]) : _mm_unpacklo_epi16(down2[k >> 1], down2[k >> 1]);
+      __m128i c = _mm_loadu_si128((const __m128i*)(rgba + 4 * (x + 4 * k)));
+      c = _mm_subs_epu8(_mm_adds_epu8(c, _mm_and_si128(u, rgb)), _mm_and_si128(d, rgb));
+      _mm_storeu_si128((__m128i*)(dst + 4 * (x + 4 * k)), c);
+    }
+  }
+  row_recolor_scalar(rgba + 4 * x, y + x, y2 + x, dst + 4 * x, w - x);
 }
 
-static void draw_histogram(SDL_Renderer* rr, const Uint32 hist[256],
-                           SDL_FRect area, float yzoom)
-{
-  // fundo
-  SDL_SetRenderDrawColor(rr, 30,30,30,255);
-  SDL_RenderFillRect(rr, &area);
-  SDL_SetRenderDrawColor(rr, 60,60,60,255);
-  for (int i = 1; i <= 4; i++) {
-    float y = area.y + (area.h * i) / 5.0f;
-    SDL_RenderLine(rr, area.x, y, area.x + area.w, y);
+//8 colunas por vez: produtos em 16 bits (mullo), a soma exata cabe
+__attribute__((target("sse2")))
+static void row_hconv_sse2(const Uint8* src, Uint16* dst, int w, const Uint16* taps, int ntaps) {
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+  for (; x + 8 <= w; x += 8) {
+    __m128i acc = zero;
+    for (int k = 0; k < ntaps; k++) {
+      __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + x + k)), zero);
+      acc = _mm_add_epi16(acc, _mm_mullo_epi16(v, _mm_set1_epi16((short)taps[k])));
+    }
+    _mm_storeu_si128((__m128i*)(dst + x), acc);
   }
+  row_hconv_scalar(src + x, dst + x, w - x, taps, ntaps);
+}
 
-  // max
-  Uint32 maxv = 1;
-  for (int i = 0; i < 256; i++) if (hist[i] > maxv) maxv = hist[i];
+__attribute__((target("sse2")))
+static void row_vconv_sse2(const Uint16* const* rows, Uint8* dst, int w, const Uint16* taps, int ntaps) {
+  const __m128i bias = _mm_set1_epi16((short)(ntaps / 2));
+  const __m128i rnd  = _mm_set1_epi16(128);
+  int x = 0;
+  for (; x + 8 <= w; x += 8) {
+    __m128i acc = bias;
+    for (int k = 0; k < ntaps; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+      acc = _mm_add_epi16(acc, _mm_mulhi_epu16(v, _mm_set1_epi16((short)taps[k])));
+    }
+    acc = _mm_srli_epi16(_mm_add_epi16(acc, rnd), 8);
+    _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(acc, acc));
+  }
+  const Uint16* tail[2 * FILTER_MAX_RADIUS + 1];
+  for (int k = 0; k < ntaps; k++) tail[k] = rows[k] + x;
+  row_vconv_scalar(tail, dst + x, w - x, taps, ntaps);
+}
 
-  // barras
-  float barw = area.w / 256.0f;
-  if (barw < 2.0f) barw = 2.0f; // deixa as barras mais grossas
-  SDL_SetRenderDrawColor(rr, 220,220,220,255);
+__attribute__((target("sse2")))
+static __m128i med3_sse2(__m128i a, __m128i b, __m128i c) {
+  return _mm_max_epu8(_mm_min_epu8(a, b), _mm_min_epu8(_mm_max_epu8(a, b), c));
+}
 
-  float usableH = area.h - 2.0f;
-  for (int i = 0; i < 256; i++) {
-    float h = ((float)hist[i] / (float)maxv) * usableH * yzoom;
-    if (h > usableH) h = usableH; // clampa
-    SDL_FRect bar = { area.x + i * (area.w/256.0f), area.y + (area.h - h), barw, h };
-    SDL_RenderFillRect(rr, &bar);
+//16 pixels: a mesma rede min/max do escalar, com as colunas deslocadas por loads desalinhados
+__attribute__((target("sse2")))
+static void row_median3_sse2(const Uint8* r0, const Uint8* r1, const Uint8* r2, Uint8* dst, int w) {
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_set1_epi8((char)0xFF), mid[3];
+    for (int c = 0; c < 3; c++) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(r0 + x + c));
+      __m128i b = _mm_loadu_si128((const __m128i*)(r1 + x + c));
+      __m128i d = _mm_loadu_si128((const __m128i*)(r2 + x + c));
+      lo = _mm_max_epu8(lo, _mm_min_epu8(_mm_min_epu8(a, b), d));
+      hi = _mm_min_epu8(hi, _mm_max_epu8(_mm_max_epu8(a, b), d));
+      mid[c] = med3_sse2(a, b, d);
+    }
+    _mm_storeu_si128((__m128i*)(dst + x), med3_sse2(lo, med3_sse2(mid[0], mid[1], mid[2]), hi));
   }
+  row_median3_scalar(r0 + x, r1 + x, r2 + x, dst + x, w - x);
+}
 
-  // moldura
-  SDL_SetRenderDrawColor(rr, 100,100,100,255);
-  SDL_RenderRect(rr, &area);
+//8 pixels RGBA -> Y em dwords (lanes de 128 bits: px 0-3 | px 4-7)
+__attribute__((target("avx2")))
+static __m256i gray8_avx2(__m256i v) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i wts  = _mm256_setr_epi16(GRAY_WR, GRAY_WG, GRAY_WB, 0, GRAY_WR, GRAY_WG, GRAY_WB, 0,
+                                         GRAY_WR, GRAY_WG, GRAY_WB, 0, GRAY_WR, GRAY_WG, GRAY_WB, 0);
+  const __m256i rnd  = _mm256_set1_epi32(GRAY_ROUND);
+  //unpack trabalha por lane: lo = px 0,1,4,5 | hi = px 2,3,6,7
+  __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(v, zero), wts);
+  __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(v, zero), wts);
+  lo = _mm256_add_epi32(lo, _mm256_srli_epi64(lo, 32));
+  hi = _mm256_add_epi32(hi, _mm256_srli_epi64(hi, 32));
+  __m256i y = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi),
+                                                    _MM_SHUFFLE(2, 0, 2, 0)));
+  return _mm256_srli_epi32(_mm256_add_epi32(y, rnd), GRAY_SHIFT);
 }
 
-static void draw_text(SDL_Renderer* rr, TTF_Font* font,
-                      const char* msg, int x, int y)
-{
-  if (!font || !msg || !*msg) return;
+//empacota 4x8 dwords (px 0-31, valores 0..255) em 32 bytes na ordem certa:
+//os packs operam por lane, o permute final desfaz o entrelaçamento
+__attribute__((target("avx2")))
+static __m256i pack32_avx2(__m256i a, __m256i b, __m256i c, __m256i d) {
+  __m256i p = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+  return _mm256_permutevar8x32_epi32(p, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
 
-  SDL_Color white = (SDL_Color){ 230, 230, 230, 255 };
+__attribute__((target("avx2")))
+static void row_to_gray_avx2(const Uint8* rgba, Uint8* gray, int w) {
+  int x = 0;
+  for (; x + 32 <= w; x += 32) {
+    const Uint8* p = rgba + 4 * x;
+    __m256i y0 = gray8_avx2(_mm256_loadu_si256((const __m256i*)(p)));
+    __m256i y1 = gray8_avx2(_mm256_loadu_si256((const __m256i*)(p + 32)));
+    __m256i y2 = gray8_avx2(_mm256_loadu_si256((const __m256i*)(p + 64)));
+    __m256i y3 = gray8_avx2(_mm256_loadu_si256((const __m256i*)(p + 96)));
+    _mm256_storeu_si256((__m256i*)(gray + x), pack32_avx2(y0, y1, y2, y3));
+  }
+  row_to_gray_scalar(rgba + 4 * x, gray + x, w - x);
+}
 
-  // length = 0  => string null-terminated (UTF-8)
-  SDL_Surface* surf = TTF_RenderText_Blended(font, msg, 0, white);
-  if (!surf) {
-    SDL_Log("TTF_RenderText_Blended falhou: %s", SDL_GetError());
-    return;
+//LUT vetorizada: gather de 8 entradas de 32 bits por vez
+__attribute__((target("avx2")))
+static void row_apply_lut_avx2(const Uint8* src, Uint8* dst, int w, const Uint8 lut[256]) {
+  Uint32 lut32[256];
+  for (int i = 0; i < 256; i++) lut32[i] = lut[i];
+
+  int x = 0;
+  for (; x + 32 <= w; x += 32) {
+    __m256i g[4];
+    for (int k = 0; k < 4; k++) {
+      __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x + 8 * k)));
+      g[k] = _mm256_i32gather_epi32((const int*)lut32, idx, 4);
+    }
+    _mm256_storeu_si256((__m256i*)(dst + x), pack32_avx2(g[0], g[1], g[2], g[3]));
   }
+  row_apply_lut_scalar(src + x, dst + x, w - x, lut);
+}
 
-  SDL_Texture* tex = SDL_CreateTextureFromSurface(rr, surf);
-  if (!tex) {
-    SDL_Log("CreateTextureFromSurface (texto) falhou: %s", SDL_GetError());
-    SDL_DestroySurface(surf);
-    return;
+__attribute__((target("avx2")))
+static void row_expand_avx2(const Uint8* gray, const Uint8* alpha, Uint8* rgba, int w) {
+  const __m256i opaque = _mm256_set1_epi8((char)0xFF);
+  int x = 0;
+  for (; x + 32 <= w; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(gray + x));
+    __m256i a = alpha ? _mm256_loadu_si256((const __m256i*)(alpha + x)) : opaque;
+    __m256i vv_lo = _mm256_unpacklo_epi8(v, v), vv_hi = _mm256_unpackhi_epi8(v, v);
+    __m256i va_lo = _mm256_unpacklo_epi8(v, a), va_hi = _mm256_unpackhi_epi8(v, a);
+    //lane 0 cobre px 0-15 e lane 1 px 16-31
+    __m256i q0 = _mm256_unpacklo_epi16(vv_lo, va_lo); //px 0-3   | 16-19
+    __m256i q1 = _mm256_unpackhi_epi16(vv_lo, va_lo); //px 4-7   | 20-23
+    __m256i q2 = _mm256_unpacklo_epi16(vv_hi, va_hi); //px 8-11  | 24-27
+    __m256i q3 = _mm256_unpackhi_epi16(vv_hi, va_hi); //px 12-15 | 28-31
+    Uint8* p = rgba + 4 * x;
+    _mm256_storeu_si256((__m256i*)(p),      _mm256_permute2x128_si256(q0, q1, 0x20));
+    _mm256_storeu_si256((__m256i*)(p + 32), _mm256_permute2x128_si256(q2, q3, 0x20));
+    _mm256_storeu_si256((__m256i*)(p + 64), _mm256_permute2x128_si256(q0, q1, 0x31));
+    _mm256_storeu_si256((__m256i*)(p + 96), _mm256_permute2x128_si256(q2, q3, 0x31));
   }
+  row_expand_scalar(gray + x, alpha ? alpha + x : NULL, rgba + 4 * x, w - x);
+}
 
-  SDL_FRect dst = { (float)x, (float)y, (float)surf->w, (float)surf->h };
-  SDL_RenderTexture(rr, tex, NULL, &dst);
+//8 pixels: 4 gathers (um por bloco vizinho) e a mesma aritmética inteira do escalar
+__attribute__((target("avx2")))
+static __m256i bilerp8_avx2(const Uint8* src, const Uint32* const luts[4], const Uint16* fx,
+                            __m256i vfy, __m256i vify) {
+  const __m256i k256 = _mm256_set1_epi32(256);
+  __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src));
+  __m256i f   = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)fx));
+  __m256i nf  = _mm256_sub_epi32(k256, f);
+  __m256i tl = _mm256_i32gather_epi32((const int*)luts[0], idx, 4);
+  __m256i tr = _mm256_i32gather_epi32((const int*)luts[1], idx, 4);
+  __m256i bl = _mm256_i32gather_epi32((const int*)luts[2], idx, 4);
+  __m256i br = _mm256_i32gather_epi32((const int*)luts[3], idx, 4);
+  __m256i top = _mm256_add_epi32(_mm256_mullo_epi32(tl, nf), _mm256_mullo_epi32(tr, f));
+  __m256i bot = _mm256_add_epi32(_mm256_mullo_epi32(bl, nf), _mm256_mullo_epi32(br, f));
+  __m256i acc = _mm256_add_epi32(_mm256_mullo_epi32(top, vify), _mm256_mullo_epi32(bot, vfy));
+  return _mm256_srli_epi32(_mm256_add_epi32(acc, _mm256_set1_epi32(32768)), 16);
+}
 
-  SDL_DestroyTexture(tex);
-  SDL_DestroySurface(surf);
+__attribute__((target("avx2")))
+static void row_bilerp_lut_avx2(const Uint8* src, Uint8* dst, int w, const Uint32* const luts[4],
+                                const Uint16* fx, Uint32 fy) {
+  const __m256i vfy  = _mm256_set1_epi32((int)fy);
+  const __m256i vify = _mm256_set1_epi32((int)(256 - fy));
+  int x = 0;
+  for (; x + 32 <= w; x += 32) {
+    __m256i r0 = bilerp8_avx2(src + x,      luts, fx + x,      vfy, vify);
+    __m256i r1 = bilerp8_avx2(src + x + 8,  luts, fx + x + 8,  vfy, vify);
+    __m256i r2 = bilerp8_avx2(src + x + 16, luts, fx + x + 16, vfy, vify);
+    __m256i r3 = bilerp8_avx2(src + x + 24, luts, fx + x + 24, vfy, vify);
+    _mm256_storeu_si256((__m256i*)(dst + x), pack32_avx2(r0, r1, r2, r3));
+  }
+  row_bilerp_lut_scalar(src + x, dst + x, w - x, luts, fx + x, fy);
 }
 
+//32 pixels: a replicação por lane segue o mesmo entrelaçamento do row_expand_avx2
+__attribute__((target("avx2")))
+static void row_recolor_avx2(const Uint8* rgba, const Uint8* y, const Uint8* y2, Uint8* dst, int w) {
+  const __m256i rgb = _mm256_set1_epi32(0x00FFFFFF);
+  int x = 0;
+  for (; x + 32 <= w; x += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(y + x));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(y2 + x));
+    __m256i diff[2] = { _mm256_subs_epu8(b, a), _mm256_subs_epu8(a, b) };
+    __m256i rep4[2][4];
+    for (int s = 0; s < 2; s++) {
+      __m256i lo = _mm256_unpacklo_epi8(diff[s], diff[s]), hi = _mm256_unpackhi_epi8(diff[s], diff[s]);
+      __m256i q0 = _mm256_unpacklo_epi16(lo, lo); //px 0-3   | 16-19
+      __m256i q1 = _mm256_unpackhi_epi16(lo, lo); //px 4-7   | 20-23
+      __m256i q2 = _mm256_unpacklo_epi16(hi, hi); //px 8-11  | 24-27
+      __m256i q3 = _mm256_unpackhi_epi16(hi, hi); //px 12-15 | 28-31
+      rep4[s][0] = _mm256_and_si256(_mm256_permute2x128_si256(q0, q1, 0x20), rgb);
+      rep4[s][1] = _mm256_and_si256(_mm256_permute2x128_si256(q2, q3, 0x20), rgb);
+      rep4[s][2] = _mm256_and_si256(_mm256_permute2x128_si256(q0, q1, 0x31), rgb);
+      rep4[s][3] = _mm256_and_si256(_mm256_permute2x128_si256(q2, q3, 0x31), rgb);
+    }
+    for (int k = 0; k < 4; k++) {
+      __m256i c = _mm256_loadu_si256((const __m256i*)(rgba + 4 * (x + 8 * k)));
+      c = _mm256_subs_epu8(_mm256_adds_epu8(c, rep4[0][k]), rep4[1][k]);
+      _mm256_storeu_si256((__m256i*)(dst + 4 * (x + 8 * k)), c);
+    }
+  }
+  row_recolor_scalar(rgba + 4 * x, y + x, y2 + x, dst + 4 * x, w - x);
+}
 
-static void draw_button(SDL_Renderer* rr, const UIButton* btn, TTF_Font* font, bool is_equalized) {
-  // cores por estado
-  SDL_Color fill;
-  switch (btn->state) {
-    case BTN_IDLE:   fill = (SDL_Color){  0,102,204,255}; break; // azul
-    case BTN_HOVER:  fill = (SDL_Color){ 30,144,255,255}; break; // azul claro
-    case BTN_ACTIVE: fill = (SDL_Color){  0, 70,160,255}; break; // azul escuro
-    default:         fill = (SDL_Color){  0,102,204,255}; break;
+__attribute__((target("avx2")))
+static void row_hconv_avx2(const Uint8* src, Uint16* dst, int w, const Uint16* taps, int ntaps) {
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m256i acc = _mm256_setzero_si256();
+    for (int k = 0; k < ntaps; k++) {
+      __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + x + k)));
+      acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(v, _mm256_set1_epi16((short)taps[k])));
+    }
+    _mm256_storeu_si256((__m256i*)(dst + x), acc);
   }
-  SDL_SetRenderDrawColor(rr, fill.r, fill.g, fill.b, fill.a);
-  SDL_RenderFillRect(rr, &btn->rect);
+  row_hconv_scalar(src + x, dst + x, w - x, taps, ntaps);
+}
 
-  // borda
-  SDL_SetRenderDrawColor(rr, 20,20,20,255);
-  SDL_RenderRect(rr, &btn->rect);
+__attribute__((target("avx2")))
+static void row_vconv_avx2(const Uint16* const* rows, Uint8* dst, int w, const Uint16* taps, int ntaps) {
+  const __m256i bias = _mm256_set1_epi16((short)(ntaps / 2));
+  const __m256i rnd  = _mm256_set1_epi16(128);
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m256i acc = bias;
+    for (int k = 0; k < ntaps; k++) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(rows[k] + x));
+      acc = _mm256_add_epi16(acc, _mm256_mulhi_epu16(v, _mm256_set1_epi16((short)taps[k])));
+    }
+    acc = _mm256_srli_epi16(_mm256_add_epi16(acc, rnd), 8);
+    __m128i lo = _mm256_castsi256_si128(acc), hi = _mm256_extracti128_si256(acc, 1);
+    _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+  }
+  const Uint16* tail[2 * FILTER_MAX_RADIUS + 1];
+  for (int k = 0; k < ntaps; k++) tail[k] = rows[k] + x;
+  row_vconv_scalar(tail, dst + x, w - x, taps, ntaps);
+}
 
-  // rótulo
-  const char* label = is_equalized ? "Original" : "Equalizar";
-  SDL_Surface* s = TTF_RenderText_Blended(font, label, 0, (SDL_Color){240,240,240,255});
-  if (!s) return;
-  SDL_Texture* t = SDL_CreateTextureFromSurface(rr, s);
-  if (!t) { SDL_DestroySurface(s); return; }
+__attribute__((target("avx2")))
+static __m256i med3_avx2(__m256i a, __m256i b, __m256i c) {
+  return _mm256_max_epu8(_mm256_min_epu8(a, b), _mm256_min_epu8(_mm256_max_epu8(a, b), c));
+}
 
-  SDL_FRect dst = {
-    btn->rect.x + (btn->rect.w - s->w) * 0.5f,
-    btn->rect.y + (btn->rect.h - s->h) * 0.5f,
-    (float)s->w, (float)s->h
-  };
-  SDL_RenderTexture(rr, t, NULL, &dst);
-  SDL_DestroyTexture(t);
-  SDL_DestroySurface(s);
+__attribute__((target("avx2")))
+static void row_median3_avx2(const Uint8* r0, const Uint8* r1, const Uint8* r2, Uint8* dst, int w) {
+  int x = 0;
+  for (; x + 32 <= w; x += 32) {
+    __m256i lo = _mm256_setzero_si256(), hi = _mm256_set1_epi8((char)0xFF), mid[3];
+    for (int c = 0; c < 3; c++) {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(r0 + x + c));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(r1 + x + c));
+      __m256i d = _mm256_loadu_si256((const __m256i*)(r2 + x + c));
+      lo = _mm256_max_epu8(lo, _mm256_min_epu8(_mm256_min_epu8(a, b), d));
+      hi = _mm256_min_epu8(hi, _mm256_max_epu8(_mm256_max_epu8(a, b), d));
+      mid[c] = med3_avx2(a, b, d);
+    }
+    _mm256_storeu_si256((__m256i*)(dst + x), med3_avx2(lo, med3_avx2(mid[0], mid[1], mid[2]), hi));
+  }
+  row_median3_scalar(r0 + x, r1 + x, r2 + x, dst + x, w - x);
 }
 
+//um gather por pixel traz as duas saídas; a de 16 bits sai da metade baixa, a exibição da alta
+__attribute__((target("avx2")))
+static void row_apply_lut16_avx2(const Uint16* src, Uint16* dst16, Uint8* dst8, int w, const Uint32* lut) {
+  const __m256i low = _mm256_set1_epi32(0xFFFF);
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m256i idx = _mm256_loadu_si256((const __m256i*)(src + x));
+    __m256i a = _mm256_i32gather_epi32((const int*)lut, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(idx)), 4);
+    __m256i b = _mm256_i32gather_epi32((const int*)lut, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(idx, 1)), 4);
+    if (dst16) {
+      __m256i v = _mm256_packus_epi32(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+      _mm256_storeu_si256((__m256i*)(dst16 + x), _mm256_permute4x64_epi64(v, 0xD8));
+    }
+    __m256i d = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_srli_epi32(a, 16), _mm256_srli_epi32(b, 16)), 0xD8);
+    _mm_storeu_si128((__m128i*)(dst8 + x), _mm_packus_epi16(_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1)));
+  }
+  row_apply_lut16_scalar(src + x, dst16 ? dst16 + x : NULL, dst8 + x, w - x, lut);
+}
 
+//SSE2 não tem gather: LUT e interpolação do CLAHE ficam no caminho escalar
+static const PixelKernels kernels_sse2 = {
+  "sse2", row_to_gray_sse2, row_hist_scalar, row_apply_lut_scalar, row_expand_sse2, row_bilerp_lut_scalar,
+  row_recolor_sse2, row_hconv_sse2, row_vconv_sse2, row_median3_sse2, row_apply_lut16_scalar
+};
+static const PixelKernels kernels_avx2 = {
+  "avx2", row_to_gray_avx2, row_hist_scalar, row_apply_lut_avx2, row_expand_avx2, row_bilerp_lut_avx2,
+  row_recolor_avx2, row_hconv_avx2, row_vconv_avx2, row_median3_avx2, row_apply_lut16_avx2
+};
+#endif
 
+static const PixelKernels* g_kernels = &kernels_scalar;
 
-//window principal: adapta ao tamanho da imagem e centraliza
-static bool create_main_window(UIContext* ui, int imgw, int imgh) {
-  //limite um pouco o tamanho inicial pra não extrapolar telas muito pequenas
-  int w = imgw, h = imgh;
-  if (w > 1400) { float s = 1400.0f / (float)w; w = 1400; h = (int)(imgh * s); }
-  if (h > 900)  { float s =  900.0f / (float)h; h = 900;  w = (int)(w * s); }
+//escolhe os kernels pela CPU; CV_SIMD=scalar|sse2|avx2 força um caminho
+static void init_pixel_kernels(void) {
+  const char* force = SDL_getenv("CV_SIMD");
+  g_kernels = &kernels_scalar;
+#ifdef CV_X86_SIMD
+  bool allow_avx2 = !force || strcmp(force, "avx2") == 0;
+  bool allow_sse2 = !force || strcmp(force, "sse2") == 0 || strcmp(force, "avx2") == 0;
+  if (allow_avx2 && SDL_HasAVX2())      g_kernels = &kernels_avx2;
+  else if (allow_sse2 && SDL_HasSSE2()) g_kernels = &kernels_sse2;
+#endif
+  if (force && strcmp(force, g_kernels->name) != 0)
+    SDL_Log("CV_SIMD=%s indisponível nesta CPU/compilação", force);
+  SDL_Log("Kernels de pixel: %s", g_kernels->name);
+}
 
-  ui->mainApp.window = SDL_CreateWindow("Imagem (principal)", w, h, SDL_WINDOW_RESIZABLE);
-  if (!ui->mainApp.window) { log_sdl_error("Create main window"); return false; }
-  SDL_SetWindowPosition(ui->mainApp.window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
+//média e desvio padrão exatos a partir dos bins (O(níveis), sem somar pixel a pixel)
+static void hist_mean_stddev_n(const Uint32* hist, int levels, float* out_mean, float* out_stddev) {
+  Uint64 n = 0;
+  double sum = 0.0, sum2 = 0.0; //em 16 bits a soma dos quadrados passa de 64 bits
+  for (int i = 0; i < levels; i++) {
+    if (!hist[i]) continue;
+    n    += hist[i];
+    sum  += (double)hist[i] * (double)i;
+    sum2 += (double)hist[i] * (double)i * (double)i;
+  }
+  double mean = n ? sum / (double)n : 0.0;
+  double var  = n ? (sum2 / (double)n) - (mean*mean) : 0.0;
+  if (var < 0.0) var = 0.0;
+  if (out_mean)   *out_mean = (float)mean;
+  if (out_stddev) *out_stddev = (float)sqrt(var);
+}
 
-  ui->mainApp.renderer = SDL_CreateRenderer(ui->mainApp.window, NULL);
-  if (!ui->mainApp.renderer) { log_sdl_error("Create main renderer"); return false; }
-  return true;
+static void hist_mean_stddev(const Uint32 hist[256], float* out_mean, float* out_stddev) {
+  hist_mean_stddev_n(hist, 256, out_mean, out_stddev);
 }
 
-static bool create_side_window(UIContext* ui) {
-  ui->sideApp.window = SDL_CreateWindow("Histograma (secundária)", SIDE_W, SIDE_H, 0);
-  if (!ui->sideApp.window) { log_sdl_error("Create side window"); return false; }
+//pool de threads persistente: divide um trabalho em tarefas (faixas de linhas).
+//a thread que chama parallel_for também executa tarefas
+typedef void (*ParallelTaskFn)(void* ctx, int task, int ntasks);
 
-  ui->sideApp.renderer = SDL_CreateRenderer(ui->sideApp.window, NULL);
-  if (!ui->sideApp.renderer) { log_sdl_error("Create side renderer"); return false; }
+typedef struct {
+  SDL_Thread*    threads[POOL_MAX_THREADS];
+  int            nthreads;        //workers além da thread chamadora
+  int            max_threads;     //limite de participantes (inclui a chamadora)
+  SDL_Mutex*     lock;
+  SDL_Condition* wake;
+  SDL_Condition* finished;
+  SDL_Mutex*     submit;          //um parallel_for por vez; concorrentes rodam em série
+  ParallelTaskFn fn;
+  void*          ctx;
+  int            ntasks;
+  SDL_AtomicInt  next_task;
+  int            busy_workers;
+  Uint32         generation;
+  bool           quit;
+} WorkerPool;
 
-  //posiciona ao lado direito da principal
-  int x,y,w,h;
-  SDL_GetWindowPosition(ui->mainApp.window, &x,&y);
-  SDL_GetWindowSize(ui->mainApp.window, &w,&h);
-  SDL_SetWindowPosition(ui->sideApp.window, x + w + SIDE_MARGIN, y);
+static WorkerPool g_pool;
 
-  //botão embaixo do histograma
-  ui->eqButton.rect.x = SIDE_MARGIN;
-  ui->eqButton.rect.w = BUTTON_W;
-  ui->eqButton.rect.h = BUTTON_H;
-  ui->eqButton.rect.y = 0;
-  ui->eqButton.state  = BTN_IDLE;
-  return true;
+static void pool_run_tasks(ParallelTaskFn fn, void* ctx, int ntasks) {
+  for (;;) {
+    int t = SDL_AddAtomicInt(&g_pool.next_task, 1);
+    if (t >= ntasks) break;
+    fn(ctx, t, ntasks);
+  }
 }
 
+typedef struct { int index; } PoolWorkerArg;
+static PoolWorkerArg g_pool_args[POOL_MAX_THREADS];
+
+static int SDLCALL pool_worker(void* data) {
+  const int index = ((PoolWorkerArg*)data)->index;
+  Uint32 seen = 0;
+  for (;;) {
+    SDL_LockMutex(g_pool.lock);
+    while (!g_pool.quit && g_pool.generation == seen)
+      SDL_WaitCondition(g_pool.wake, g_pool.lock);
+    if (g_pool.quit) { SDL_UnlockMutex(g_pool.lock); break; }
+    seen = g_pool.generation;
+    ParallelTaskFn fn = g_pool.fn;
+    void* ctx = g_pool.ctx;
+    int ntasks = g_pool.ntasks;
+    bool participate = index + 1 < g_pool.max_threads;
+    SDL_UnlockMutex(g_pool.lock);
 
+    if (participate) pool_run_tasks(fn, ctx, ntasks);
 
-static void cleanup_all(UIContext* ui, ImageData* img) {
-  if (ui) {
-    if (ui->font) { TTF_CloseFont(ui->font); ui->font = NULL; }
+    SDL_LockMutex(g_pool.lock);
+    if (--g_pool.busy_workers == 0) SDL_SignalCondition(g_pool.finished);
+    SDL_UnlockMutex(g_pool.lock);
   }
-  if (img) {
-    if (img->texture)      SDL_DestroyTexture(img->texture);
-    if (img->surface_rgba) SDL_DestroySurface(img->surface_rgba);
-    if (img->original_gray) SDL_DestroySurface(img->original_gray);
+  return 0;
+}
+
+//nthreads <= 0: um worker por núcleo lógico além da thread principal
+//(CV_THREADS=N define o total de threads, incluindo a principal)
+static void pool_init(int nthreads) {
+  if (g_pool.lock) return;
+  const char* env = SDL_getenv("CV_THREADS");
+  if (nthreads <= 0 && env && atoi(env) > 0) nthreads = atoi(env) - 1;
+  else if (nthreads <= 0) nthreads = SDL_GetNumLogicalCPUCores() - 1;
+  if (nthreads < 0) nthreads = 0;
+  if (nthreads > POOL_MAX_THREADS) nthreads = POOL_MAX_THREADS;
+
+  g_pool.lock     = SDL_CreateMutex();
+  g_pool.submit   = SDL_CreateMutex();
+  g_pool.wake     = SDL_CreateCondition();
+  g_pool.finished = SDL_CreateCondition();
+  if (!g_pool.lock || !g_pool.submit || !g_pool.wake || !g_pool.finished) {
+    log_sdl_error("Falha ao criar primitivas do pool");
+    return;
   }
-  if (ui) {
-    if (ui->mainApp.renderer) SDL_DestroyRenderer(ui->mainApp.renderer);
-    if (ui->mainApp.window)   SDL_DestroyWindow(ui->mainApp.window);
-    if (ui->sideApp.renderer) SDL_DestroyRenderer(ui->sideApp.renderer);
-    if (ui->sideApp.window)   SDL_DestroyWindow(ui->sideApp.window);
+  for (int i = 0; i < nthreads; i++) {
+    g_pool_args[i].index = i;
+    g_pool.threads[i] = SDL_CreateThread(pool_worker, "pool_worker", &g_pool_args[i]);
+    if (!g_pool.threads[i]) { log_sdl_error("SDL_CreateThread (pool) falhou"); break; }
+    g_pool.nthreads++;
   }
+  g_pool.max_threads = g_pool.nthreads + 1;
+  SDL_Log("Pool de threads: %d workers", g_pool.nthreads);
 }
 
-static bool point_in_rect(float x, float y, SDL_FRect r) {
-  return (x >= r.x && x <= r.x + r.w && y >= r.y && y <= r.y + r.h);
+static void pool_shutdown(void) {
+  if (!g_pool.lock) return;
+  SDL_LockMutex(g_pool.lock);
+  g_pool.quit = true;
+  SDL_BroadcastCondition(g_pool.wake);
+  SDL_UnlockMutex(g_pool.lock);
+  for (int i = 0; i < g_pool.nthreads; i++) SDL_WaitThread(g_pool.threads[i], NULL);
+  SDL_DestroyCondition(g_pool.finished);
+  SDL_DestroyCondition(g_pool.wake);
+  SDL_DestroyMutex(g_pool.submit);
+  SDL_DestroyMutex(g_pool.lock);
+  memset(&g_pool, 0, sizeof(g_pool));
 }
 
-static void rebuild_texture(ImageData* img, SDL_Renderer* rr) {
-  if (img->texture) { SDL_DestroyTexture(img->texture); img->texture = NULL; }
-  img->texture = SDL_CreateTextureFromSurface(rr, img->surface_rgba);
-  if (!img->texture) SDL_Log("CreateTextureFromSurface falhou: %s", SDL_GetError());
+//limita quantas threads (incluindo a chamadora) participam; usado para medir escalabilidade
+static void pool_set_max_threads(int n) {
+  if (n < 1) n = 1;
+  if (n > g_pool.nthreads + 1) n = g_pool.nthreads + 1;
+  g_pool.max_threads = n;
 }
 
-static void recompute_stats(UIContext* ui, ImageData* img) {
-  compute_histogram_gray_rgba32(img->surface_rgba, ui->hist, &ui->mean, &ui->stddev);
-  snprintf(ui->meanLabel, sizeof(ui->meanLabel),
-           "Média de intensidade: %.1f (%s)", ui->mean, classify_mean(ui->mean));
-  snprintf(ui->stdLabel, sizeof(ui->stdLabel),
-           "Desvio padrão: %.1f (contraste %s)", ui->stddev, classify_stddev(ui->stddev));
+static int pool_thread_count(void) {
+  return g_pool.lock ? g_pool.max_threads : 1;
 }
 
-static void render_side_window(UIContext* ui) {
-  SDL_SetRenderDrawColor(ui->sideApp.renderer, 15,15,15,255);
-  SDL_RenderClear(ui->sideApp.renderer);
+static void parallel_for(int ntasks, ParallelTaskFn fn, void* ctx) {
+  if (ntasks <= 0) return;
+  //sem pool, tarefa única ou pool ocupado por outra thread: executa em série
+  if (!g_pool.lock || g_pool.nthreads == 0 || g_pool.max_threads <= 1 || ntasks == 1 ||
+      !SDL_TryLockMutex(g_pool.submit)) {
+    for (int t = 0; t < ntasks; t++) fn(ctx, t, ntasks);
+    return;
+  }
 
-  // medidas de texto
-  int line_h = TTF_GetFontLineSkip(ui->font);
-  if (line_h <= 0) line_h = 18; // fallback
-  const float gap = 6.0f;
-  const float labels_h = (float)(line_h * 2) + gap; // duas linhas + respiro
+  SDL_LockMutex(g_pool.lock);
+  g_pool.fn = fn;
+  g_pool.ctx = ctx;
+  g_pool.ntasks = ntasks;
+  SDL_SetAtomicInt(&g_pool.next_task, 0);
+  g_pool.busy_workers = g_pool.nthreads;
+  g_pool.generation++;
+  SDL_BroadcastCondition(g_pool.wake);
+  SDL_UnlockMutex(g_pool.lock);
 
-  // área do histograma agora reserva espaço p/ textos E botão
-  SDL_FRect histArea = {
-    SIDE_MARGIN,
-    SIDE_MARGIN,
-    SIDE_W - SIDE_MARGIN * 2.0f,
-    SIDE_H - SIDE_MARGIN * 3.0f - BUTTON_H - labels_h
-  };
-  if (histArea.h < 80.0f) histArea.h = 80.0f; // evita ficar negativo/pequeno demais
+  pool_run_tasks(fn, ctx, ntasks);
 
-  // histograma
-  draw_histogram(ui->sideApp.renderer, ui->hist, histArea, ui->yzoom);
+  SDL_LockMutex(g_pool.lock);
+  while (g_pool.busy_workers > 0) SDL_WaitCondition(g_pool.finished, g_pool.lock);
+  SDL_UnlockMutex(g_pool.lock);
+  SDL_UnlockMutex(g_pool.submit);
+}
 
-  // textos logo abaixo do histograma
-  int textX = (int)histArea.x + 6;
-  int textY = (int)(histArea.y + histArea.h) + (int)gap;
-  draw_text(ui->sideApp.renderer, ui->font, ui->meanLabel, textX, textY);
-  textY += line_h; // próxima linha
-  draw_text(ui->sideApp.renderer, ui->font, ui->stdLabel,  textX, textY);
+//quantas faixas de linhas usar: algumas por thread para balancear, mas nunca
+//faixas menores que `min_rows` (o custo de despacho passaria a dominar)
+static int band_count(int h, int min_rows) {
+  int bands = pool_thread_count() * 4;
+  if (min_rows < 1) min_rows = 1;
+  if (bands > h / min_rows) bands = h / min_rows;
+  if (bands < 1) bands = 1;
+  return bands;
+}
 
-  // botão abaixo dos textos
-  ui->eqButton.rect.y = (float)( (int)(histArea.y + histArea.h) + (int)labels_h );
-  draw_button(ui->sideApp.renderer, &ui->eqButton, ui->font, ui->is_equalized);
+static void band_rows(int h, int band, int nbands, int* y0, int* y1) {
+  *y0 = (int)((Sint64)h * band / nbands);
+  *y1 = (int)((Sint64)h * (band + 1) / nbands);
+}
 
-  SDL_RenderPresent(ui->sideApp.renderer);
+//planos Y8: linhas alinhadas em 64 bytes
+static bool plane_alloc(GrayPlane* p, int w, int h) {
+  p->w = w;
+  p->h = h;
+  p->pitch = (w + 63) & ~63;
+  p->borrowed = false;
+  p->pixels = (Uint8*)SDL_aligned_alloc(64, (size_t)p->pitch * (size_t)(h > 0 ? h : 1));
+  if (!p->pixels) {
+    SDL_Log("Sem memória para plano %dx%d", w, h);
+    return false;
+  }
+  return true;
 }
 
+static void plane_free(GrayPlane* p) {
+  if (p->pixels && !p->borrowed) SDL_aligned_free(p->pixels);
+  memset(p, 0, sizeof(*p));
+}
 
-static void handle_events(UIContext* ui, ImageData* img) {
-  SDL_Event e;
-  while (SDL_PollEvent(&e)) {
-    if (e.type == SDL_EVENT_QUIT) exit(0);
+static Uint8* plane_row(const GrayPlane* p, int y) {
+  return p->pixels + (size_t)y * (size_t)p->pitch;
+}
 
-    if (e.type == SDL_EVENT_WINDOW_RESIZED || e.type == SDL_EVENT_WINDOW_MOVED) {
-      int x,y,w,h;
-      SDL_GetWindowPosition(ui->mainApp.window, &x,&y);
-      SDL_GetWindowSize(ui->mainApp.window, &w,&h);
-      SDL_SetWindowPosition(ui->sideApp.window, x + w + SIDE_MARGIN, y);
-    }
+//mesmas dimensões; com o mesmo pitch a cópia é em bloco (planos mapeados têm pitch = w)
+static void plane_copy(GrayPlane* dst, const GrayPlane* src) {
+  if (dst->pitch == src->pitch) {
+    memcpy(dst->pixels, src->pixels, (size_t)src->pitch * (size_t)src->h);
+    return;
+  }
+  for (int y = 0; y < src->h; y++) memcpy(plane_row(dst, y), plane_row(src, y), (size_t)src->w);
+}
 
-    if (e.type == SDL_EVENT_KEY_DOWN) {
-      if (e.key.key == SDLK_ESCAPE) exit(0);
-      if (e.key.key == SDLK_EQUALS || e.key.key == SDLK_PLUS)
-        ui->yzoom = ui->yzoom < 4.0f ? ui->yzoom + 0.25f : 4.0f;
-      if (e.key.key == SDLK_MINUS)
-        ui->yzoom = ui->yzoom > 0.25f ? ui->yzoom - 0.25f : 0.25f;
-      if (e.key.scancode == SDL_SCANCODE_S) {
-        SDL_ClearError();
-        if (IMG_SavePNG(img->surface_rgba, "output_image.png") != true) {
-          SDL_Log("Erro em salvar: %s", SDL_GetError());
+//visão sem cópia do retângulo [x0,x1) x [y0,y1) de um plano
+static GrayPlane plane_view(const GrayPlane* p, int x0, int y0, int x1, int y1) {
+  GrayPlane v = { plane_row(p, y0) + x0, x1 - x0, y1 - y0, p->pitch, true };
+  return v;
+}
+
+//planos Y16: linhas alinhadas em 64 bytes (32 amostras)
+static bool plane16_alloc(GrayPlane16* p, int w, int h) {
+  p->w = w;
+  p->h = h;
+  p->pitch = (w + 31) & ~31;
+  p->pixels = (Uint16*)SDL_aligned_alloc(64, (size_t)p->pitch * 2 * (size_t)(h > 0 ? h : 1));
+  if (!p->pixels) {
+    SDL_Log("Sem memória para plano de 16 bits %dx%d", w, h);
+    return false;
+  }
+  return true;
+}
+
+static void plane16_free(GrayPlane16* p) {
+  if (p->pixels) SDL_aligned_free(p->pixels);
+  memset(p, 0, sizeof(*p));
+}
+
+static Uint16* plane16_row(const GrayPlane16* p, int y) {
+  return p->pixels + (size_t)y * (size_t)p->pitch;
+}
+
+//histograma paralelo: cada faixa tem seus próprios bins (1 KiB, múltiplo da linha
+//de cache e alinhados em 64 bytes -> nenhuma faixa compartilha linha com outra);
+//a redução soma as faixas no final
+typedef struct {
+  Uint32 bins[256];
+} HistBins;
+
+typedef struct {
+  const GrayPlane* plane;
+  HistBins*        partial;
+} HistJob;
+
+static void hist_band_task(void* ctx, int band, int nbands) {
+  HistJob* job = (HistJob*)ctx;
+  int y0, y1;
+  band_rows(job->plane->h, band, nbands, &y0, &y1);
+  Uint32* bins = job->partial[band].bins;
+  memset(bins, 0, sizeof(HistBins));
+  for (int y = y0; y < y1; y++)
+    g_kernels->row_hist(plane_row(job->plane, y), job->plane->w, bins);
+}
+
+static void plane_histogram(const GrayPlane* plane, Uint32 hist[256]) {
+  Uint64 tr = trace_begin();
+  int nbands = band_count(plane->h, HIST_MIN_BAND_PIXELS / (plane->w > 0 ? plane->w : 1));
+  HistBins* partial = nbands > 1 ? (HistBins*)SDL_aligned_alloc(64, sizeof(HistBins) * (size_t)nbands) : NULL;
+  if (!partial) {
+    for (int y = 0; y < plane->h; y++)
+      g_kernels->row_hist(plane_row(plane, y), plane->w, hist);
+  } else {
+    HistJob job = { plane, partial };
+    parallel_for(nbands, hist_band_task, &job);
+
+    for (int b = 0; b < nbands; b++)
+      for (int i = 0; i < 256; i++) hist[i] += partial[b].bins[i];
+    SDL_aligned_free(partial);
+  }
+  trace_end(PH_HISTOGRAM, tr);
+}
+
+//soma ao histograma os pixels do retângulo [x0,x1) x [y0,y1) (vazio: nada)
+static void rect_histogram(const GrayPlane* src, int x0, int y0, int x1, int y1, Uint32 hist[256]) {
+  if (x1 <= x0 || y1 <= y0) return;
+  GrayPlane v = plane_view(src, x0, y0, x1, y1);
+  plane_histogram(&v, hist);
+}
+
+static void compute_histogram_gray(const GrayPlane* plane, Uint32 hist[256],
+                                   float* out_mean, float* out_stddev) {
+  memset(hist, 0, sizeof(Uint32) * 256);
+  if (!plane || !plane->pixels) return;
+  plane_histogram(plane, hist);
+  hist_mean_stddev(hist, out_mean, out_stddev);
+}
+
+//histograma de 65536 bins: bins parciais por thread (256 KiB, cabem na L2) em vez de por
+//faixa, cada thread com um bloco contínuo de linhas. a redução também é em blocos: cada
+//tarefa soma um intervalo de HIST16_BLOCK bins (16 KiB, cabe na L1) de todas as parciais
+#define HIST16_BINS  65536
+#define HIST16_BLOCK 4096
+
+typedef struct {
+  const GrayPlane16* plane;
+  Uint32*            partial;  //nparts x HIST16_BINS
+  int                nparts;
+  Uint32*            hist;
+} Hist16Job;
+
+static void hist16_part_task(void* ctx, int part, int nparts) {
+  Hist16Job* job = (Hist16Job*)ctx;
+  int y0, y1;
+  band_rows(job->plane->h, part, nparts, &y0, &y1);
+  Uint32* bins = job->partial + (size_t)part * HIST16_BINS;
+  memset(bins, 0, sizeof(Uint32) * HIST16_BINS);
+  for (int y = y0; y < y1; y++) {
+    //sequências iguais somam de uma vez: em áreas lisas o mesmo bin vira uma cadeia de dependência
+    const Uint16* row = plane16_row(job->plane, y);
+    Uint16 v = row[0];
+    Uint32 run = 1;
+    for (int x = 1; x < job->plane->w; x++) {
+      if (row[x] == v) { run++; continue; }
+      bins[v] += run;
+      v = row[x];
+      run = 1;
+    }
+    bins[v] += run;
+  }
+}
+
+static void hist16_reduce_task(void* ctx, int block, int nblocks) {
+  (void)nblocks;
+  Hist16Job* job = (Hist16Job*)ctx;
+  Uint32* dst = job->hist + (size_t)block * HIST16_BLOCK;
+  for (int p = 0; p < job->nparts; p++) {
+    const Uint32* src = job->partial + (size_t)p * HIST16_BINS + (size_t)block * HIST16_BLOCK;
+    for (int i = 0; i < HIST16_BLOCK; i++) dst[i] += src[i];
+  }
+}
+
+//soma ao histograma (65536 bins) os pixels do plano
+static bool plane_histogram16(const GrayPlane16* plane, Uint32* hist) {
+  Uint64 tr = trace_begin();
+  int nparts = pool_thread_count();
+  int max_parts = (int)((Sint64)plane->w * plane->h / (HIST_MIN_BAND_PIXELS * 4)); //parciais custam 256 KiB cada
+  if (nparts > max_parts) nparts = max_parts;
+  if (nparts > plane->h) nparts = plane->h;
+  if (nparts < 1) nparts = 1;
+  Hist16Job job = { plane, NULL, nparts, hist };
+  job.partial = (Uint32*)SDL_aligned_alloc(64, sizeof(Uint32) * HIST16_BINS * (size_t)nparts);
+  if (!job.partial) { SDL_Log("Sem memória para o histograma de 16 bits"); return false; }
+  parallel_for(nparts, hist16_part_task, &job);
+  parallel_for(HIST16_BINS / HIST16_BLOCK, hist16_reduce_task, &job);
+  SDL_aligned_free(job.partial);
+  trace_end(PH_HISTOGRAM, tr);
+  return true;
+}
+
+//aplica uma LUT de 256 entradas em faixas paralelas (src e dst podem ser o mesmo plano)
+typedef struct {
+  const GrayPlane* src;
+  GrayPlane*       dst;
+  const Uint8*     lut;
+} LutJob;
+
+static void lut_band_task(void* ctx, int band, int nbands) {
+  LutJob* job = (LutJob*)ctx;
+  int y0, y1;
+  band_rows(job->src->h, band, nbands, &y0, &y1);
+  for (int y = y0; y < y1; y++)
+    g_kernels->row_apply_lut(plane_row(job->src, y), plane_row(job->dst, y), job->src->w, job->lut);
+}
+
+static void plane_apply_lut(const GrayPlane* src, GrayPlane* dst, const Uint8 lut[256]) {
+  LutJob job = { src, dst, lut };
+  parallel_for(band_count(src->h, HIST_MIN_BAND_PIXELS / (src->w > 0 ? src->w : 1)), lut_band_task, &job);
+}
+
+//LUT de 16 bits (com a exibição embutida, ver row_apply_lut16) em faixas paralelas:
+//src -> dst16 (NULL: só exibição) e dst8
+typedef struct {
+  const GrayPlane16* src;
+  GrayPlane16*       dst16;
+  GrayPlane*         dst8;
+  const Uint32*      lut;
+} Lut16Job;
+
+static void lut16_band_task(void* ctx, int band, int nbands) {
+  Lut16Job* job = (Lut16Job*)ctx;
+  int y0, y1;
+  band_rows(job->src->h, band, nbands, &y0, &y1);
+  for (int y = y0; y < y1; y++)
+    g_kernels->row_apply_lut16(plane16_row(job->src, y), job->dst16 ? plane16_row(job->dst16, y) : NULL,
+                               plane_row(job->dst8, y), job->src->w, job->lut);
+}
+
+static void plane_apply_lut16(const GrayPlane16* src, GrayPlane16* dst16, GrayPlane* dst8, const Uint32* lut) {
+  Lut16Job job = { src, dst16, dst8, lut };
+  parallel_for(band_count(src->h, HIST_MIN_BAND_PIXELS / (src->w > 0 ? src->w : 1)), lut16_band_task, &job);
+}
+
+static bool row_is_opaque(const Uint8* rgba, int w) {
+  Uint8 acc = 0xFF;
+  for (int x = 0; x < w; x++) acc &= rgba[4 * x + 3];
+  return acc == 0xFF;
+}
+
+static void row_extract_alpha(const Uint8* rgba, Uint8* alpha, int w) {
+  for (int x = 0; x < w; x++) alpha[x] = rgba[4 * x + 3];
+}
+
+//ingestão em passada única: converte uma faixa de linhas para RGBA32, reduz para Y8,
+//separa o alfa (só se houver transparência), preenche o histograma e copia o backup
+//enquanto a faixa está no cache. consome `loaded`
+//keep_color guarda a surface RGBA32 decodificada como fonte de cor (implica backup:
+//a cor é refeita da diferença entre o Y processado e o original)
+//reuse: `out` traz a imagem anterior (quadros de uma série); os planos próprios do mesmo
+//tamanho são reaproveitados e o resto é liberado
+static bool ingest_surface_gray(SDL_Surface* loaded, ImageData* out, Uint32 hist[256], bool with_backup,
+                                bool keep_color, bool reuse) {
+  memset(hist, 0, sizeof(Uint32) * 256);
+  const int w = loaded->w, h = loaded->h;
+  const bool may_have_alpha = SDL_ISPIXELFORMAT_ALPHA(loaded->format) || SDL_ISPIXELFORMAT_INDEXED(loaded->format);
+
+  if (keep_color) with_backup = true;
+  if (SDL_ISPIXELFORMAT_INDEXED(loaded->format) || (keep_color && loaded->format != SDL_PIXELFORMAT_RGBA32)) {
+    //SDL_ConvertPixels não recebe paleta: imagens indexadas pagam uma conversão inteira antes;
+    //no modo cor a conversão inteira vira a própria fonte de cor
+    SDL_Surface* conv = SDL_ConvertSurface(loaded, SDL_PIXELFORMAT_RGBA32);
+    SDL_DestroySurface(loaded);
+    if (!conv) { log_sdl_error("SDL_ConvertSurface para RGBA32 falhou"); return false; }
+    loaded = conv;
+  }
+  const bool direct = loaded->format == SDL_PIXELFORMAT_RGBA32;
+
+  ImageData img = {0};
+  GrayPlane spare_alpha = {0}; //só vira o alfa do quadro se aparecer transparência
+  if (reuse) {
+    if (out->w == w && out->h == h && !out->gray.borrowed && !out->original_gray.borrowed) {
+      img.gray = out->gray;
+      out->gray = (GrayPlane){0};
+      spare_alpha = out->alpha;
+      out->alpha = (GrayPlane){0};
+      if (with_backup) {
+        img.original_gray = out->original_gray;
+        out->original_gray = (GrayPlane){0};
+      }
+    }
+    free_image(out);
+  }
+  img.w = w;
+  img.h = h;
+  Uint8* strip = direct ? NULL : (Uint8*)SDL_aligned_alloc(64, (size_t)w * 4 * INGEST_STRIP_ROWS);
+  bool ok = (direct || strip) && (img.gray.pixels || plane_alloc(&img.gray, w, h)) &&
+            (!with_backup || img.original_gray.pixels || plane_alloc(&img.original_gray, w, h)) &&
+            SDL_LockSurface(loaded);
+
+  for (int y0 = 0; ok && y0 < h; y0 += INGEST_STRIP_ROWS) {
+    int rows = (h - y0 < INGEST_STRIP_ROWS) ? h - y0 : INGEST_STRIP_ROWS;
+    const Uint8* src = (const Uint8*)loaded->pixels + (size_t)y0 * loaded->pitch;
+    int src_pitch = loaded->pitch;
+
+    if (!direct) {
+      ok = SDL_ConvertPixels(w, rows, loaded->format, src, loaded->pitch,
+                             SDL_PIXELFORMAT_RGBA32, strip, w * 4);
+      if (!ok) { log_sdl_error("SDL_ConvertPixels para RGBA32 falhou"); break; }
+      src = strip;
+      src_pitch = w * 4;
+    }
+
+    for (int r = 0; r < rows && ok; r++) {
+      const Uint8* rgba = src + (size_t)r * src_pitch;
+      Uint8* gray = plane_row(&img.gray, y0 + r);
+      g_kernels->row_to_gray(rgba, gray, w);
+
+      //o plano alfa só nasce na primeira linha não opaca; as anteriores eram 255
+      if (may_have_alpha && !img.alpha.pixels && !row_is_opaque(rgba, w)) {
+        if (spare_alpha.pixels) {
+          img.alpha = spare_alpha;
+          spare_alpha = (GrayPlane){0};
         } else {
-          SDL_Log("Imagem salva");
+          ok = plane_alloc(&img.alpha, w, h);
         }
+        if (ok) memset(img.alpha.pixels, 0xFF, (size_t)img.alpha.pitch * (size_t)(y0 + r));
       }
+      if (img.alpha.pixels) row_extract_alpha(rgba, plane_row(&img.alpha, y0 + r), w);
+
+      g_kernels->row_hist(gray, w, hist);
+      if (with_backup) memcpy(plane_row(&img.original_gray, y0 + r), gray, (size_t)w);
     }
+  }
+  SDL_UnlockSurface(loaded);
+  if (ok && keep_color) img.color = loaded;
+  else                  SDL_DestroySurface(loaded);
+  if (strip) SDL_aligned_free(strip);
+  plane_free(&spare_alpha);
 
-    // eventos do botão (apenas quando mouse está na janela secundária)
-    if (e.type == SDL_EVENT_MOUSE_MOTION || e.type == SDL_EVENT_MOUSE_BUTTON_DOWN || e.type == SDL_EVENT_MOUSE_BUTTON_UP) {
-      SDL_Window* focus = SDL_GetMouseFocus();
-      if (focus == ui->sideApp.window) {
-        float mx = (float)e.motion.x;
-        float my = (float)e.motion.y;
-        bool inside = point_in_rect(mx, my, ui->eqButton.rect);
+  if (!ok) {
+    plane_free(&img.gray);
+    plane_free(&img.original_gray);
+    plane_free(&img.alpha);
+    return false;
+  }
+  *out = img;
+  return true;
+}
 
-        if (e.type == SDL_EVENT_MOUSE_MOTION) {
-          ui->eqButton.state = inside ? BTN_HOVER : BTN_IDLE;
-        }
+static void unmap_file(MappedFile* m) {
+  for (int i = 0; i < 2; i++) {
+    if (!m->views[i]) continue;
+#ifdef _WIN32
+    UnmapViewOfFile(m->views[i]);
+#else
+    munmap(m->views[i], m->size);
+#endif
+  }
+  memset(m, 0, sizeof(*m));
+}
 
-        if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN && inside && e.button.button == SDL_BUTTON_LEFT) {
-          ui->eqButton.state = BTN_ACTIVE;
-        }
+static bool map_file(const char* path, MappedFile* m, bool with_original) {
+  memset(m, 0, sizeof(*m));
+#ifdef _WIN32
+  HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER sz;
+  HANDLE map = NULL;
+  if (GetFileSizeEx(f, &sz) && sz.QuadPart > 0 && (Uint64)sz.QuadPart <= (Uint64)SIZE_MAX)
+    map = CreateFileMappingA(f, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  CloseHandle(f);
+  if (!map) return false;
+  m->size = (size_t)sz.QuadPart;
+  m->views[0] = (Uint8*)MapViewOfFile(map, FILE_MAP_COPY, 0, 0, 0);
+  if (with_original) m->views[1] = (Uint8*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(map); //as visões mantêm o mapeamento vivo
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) { close(fd); return false; }
+  m->size = (size_t)st.st_size;
+  void* v = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  m->views[0] = (v == MAP_FAILED) ? NULL : (Uint8*)v;
+  if (with_original) {
+    v = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    m->views[1] = (v == MAP_FAILED) ? NULL : (Uint8*)v;
+  }
+  close(fd);
+#endif
+  if (!m->views[0] || (with_original && !m->views[1])) { unmap_file(m); return false; }
+  return true;
+}
+
+//PGM (P5, 8 bits) ou Y8 cru (raw_w x raw_h, sem cabeçalho) mapeados direto nos planos:
+//sem decodificar e sem copiar, então a carga custa as faltas de página do histograma.
+//devolve false sem log para formatos que não dá para mapear (P6, 16 bits)
+static bool img_map_gray(const char* path, int raw_w, int raw_h, ImageData* out, Uint32 hist[256], bool with_backup) {
+  PnmHeader h = { raw_w, raw_h, 1, 0, 255, false };
+  if (raw_w <= 0) {
+    SDL_IOStream* io = SDL_IOFromFile(path, "rb");
+    bool ok = io && pnm_read_header(io, &h) && h.channels == 1 && h.maxval == 255;
+    if (io) SDL_CloseIO(io);
+    if (!ok) return false;
+  }
+
+  ImageData img = {0};
+  if (!map_file(path, &img.map, with_backup)) {
+    SDL_Log("Falha ao mapear %s", path);
+    return false;
+  }
+  if ((Uint64)h.data_offset + (Uint64)h.w * (Uint64)h.h > (Uint64)img.map.size) {
+    SDL_Log("%s: arquivo menor que %dx%d", path, h.w, h.h);
+    unmap_file(&img.map);
+    return false;
+  }
+  img.w = h.w;
+  img.h = h.h;
+  img.gray = (GrayPlane){ img.map.views[0] + h.data_offset, h.w, h.h, h.w, true };
+  if (with_backup) img.original_gray = (GrayPlane){ img.map.views[1] + h.data_offset, h.w, h.h, h.w, true };
+
+  memset(hist, 0, sizeof(Uint32) * 256);
+  plane_histogram(&img.gray, hist);
+  SDL_Log("Mapeado: %s %dx%d (%s, sem cópia)", path, h.w, h.h, raw_w > 0 ? "Y8" : "P5");
+  *out = img;
+  return true;
+}
+
+//exibição em 8 bits de uma amostra 0..maxval
+static Uint8 deep_to8(int v, int maxval) {
+  return v >= maxval ? 255 : (Uint8)(((Uint32)v * 255u + (Uint32)maxval / 2u) / (Uint32)maxval);
+}
+
+typedef struct {
+  ImageData*   img;
+  int          order;          //0: já nativa (P6 convertido), 1: big-endian (PNM), 2: little-endian (Y16 cru)
+  const Uint8* disp;           //deep_to8 tabelado
+} DeepIngestJob;
+
+static void deep_ingest_task(void* ctx, int band, int nbands) {
+  DeepIngestJob* job = (DeepIngestJob*)ctx;
+  ImageData* img = job->img;
+  const Uint16 maxval = (Uint16)img->maxval;
+  int y0, y1;
+  band_rows(img->h, band, nbands, &y0, &y1);
+  for (int y = y0; y < y1; y++) {
+    Uint16* row = plane16_row(&img->deep, y);
+    Uint8* gray = plane_row(&img->gray, y);
+    //ordem dos bytes e corte no maxval (amostra fora do cabeçalho) numa passada vetorizável;
+    //a exibição é uma consulta de tabela à parte
+    for (int x = 0; x < img->w; x++) {
+      Uint16 v = job->order == 1 ? SDL_Swap16BE(row[x]) : job->order == 2 ? SDL_Swap16LE(row[x]) : row[x];
+      row[x] = v > maxval ? maxval : v;
+    }
+    for (int x = 0; x < img->w; x++) gray[x] = job->disp[row[x]];
+    if (img->original_gray.pixels) memcpy(plane_row(&img->original_gray, y), gray, (size_t)img->w);
+  }
+}
+
+//ingestão de 16 bits: as amostras são lidas direto nas linhas do plano Y16 (P6 é reduzido
+//para Y com os mesmos pesos Q15 do caminho de 8 bits), uma passada paralela acerta a ordem
+//dos bytes e gera a exibição em 8 bits, e o histograma de 65536 bins sai por thread.
+//`hist` recebe o histograma da exibição
+static bool ingest_deep(SDL_IOStream* io, const PnmHeader* h, ImageData* out, Uint32 hist[256], bool with_backup) {
+  ImageData img = {0};
+  img.w = h->w;
+  img.h = h->h;
+  img.maxval = h->maxval;
+  img.deep_valid = true;
+  const size_t row_bytes = (size_t)h->w * 2 * (size_t)h->channels;
+  Uint8* rgb = h->channels == 3 ? (Uint8*)malloc(row_bytes) : NULL;
+  Uint8* disp = (Uint8*)malloc(HIST16_BINS);
+  img.hist16 = (Uint32*)calloc(HIST16_BINS, sizeof(Uint32));
+  bool ok = disp && img.hist16 && (h->channels == 1 || rgb) && plane16_alloc(&img.deep, h->w, h->h) &&
+            plane_alloc(&img.gray, h->w, h->h) && (!with_backup || plane_alloc(&img.original_gray, h->w, h->h));
+  if (!ok) SDL_Log("Sem memória para a imagem de 16 bits %dx%d", h->w, h->h);
+
+  for (int y = 0; ok && y < h->h; y++) {
+    Uint16* row = plane16_row(&img.deep, y);
+    ok = SDL_ReadIO(io, h->channels == 1 ? (void*)row : (void*)rgb, row_bytes) == row_bytes;
+    if (!ok) { SDL_Log("Arquivo de 16 bits truncado na linha %d", y); break; }
+    for (int x = 0; h->channels == 3 && x < h->w; x++) {
+      const Uint8* p = rgb + 6 * x;
+      Uint32 r = (Uint32)(p[0] << 8 | p[1]), g = (Uint32)(p[2] << 8 | p[3]), b = (Uint32)(p[4] << 8 | p[5]);
+      row[x] = (Uint16)((GRAY_WR * r + GRAY_WG * g + GRAY_WB * b + GRAY_ROUND) >> GRAY_SHIFT);
+    }
+  }
+  if (ok) {
+    for (int v = 0; v < HIST16_BINS; v++) disp[v] = deep_to8(v, img.maxval);
+    DeepIngestJob job = { &img, h->channels == 3 ? 0 : h->little_endian ? 2 : 1, disp };
+    parallel_for(band_count(img.h, HIST_MIN_BAND_PIXELS / (img.w > 0 ? img.w : 1)), deep_ingest_task, &job);
+    ok = plane_histogram16(&img.deep, img.hist16);
+  }
+  if (ok) {
+    memset(hist, 0, sizeof(Uint32) * 256);
+    for (int v = 0; v <= img.maxval; v++) hist[disp[v]] += img.hist16[v];
+  }
+  free(rgb);
+  free(disp);
+  if (!ok) {
+    free_image(&img);
+    return false;
+  }
+  *out = img;
+  return true;
+}
+
+//PGM/PPM de 16 bits (maxval > 255) ou Y16 cru (raw_w x raw_h, little-endian, sem cabeçalho).
+//o SDL_image reduz tudo para 8 bits, então estes formatos são lidos aqui
+static bool img_load_deep(const char* path, int raw_w, int raw_h, ImageData* out, Uint32 hist[256], bool with_backup) {
+  SDL_IOStream* io = SDL_IOFromFile(path, "rb");
+  if (!io) { SDL_Log("Falha ao abrir %s: %s", path, SDL_GetError()); return false; }
+  PnmHeader h = { raw_w, raw_h, 1, 0, 65535, true };
+  Uint64 tr = trace_begin();
+  bool ok = (raw_w > 0 || pnm_read_header(io, &h)) && ingest_deep(io, &h, out, hist, with_backup);
+  trace_end(PH_INGEST, tr);
+  SDL_CloseIO(io);
+  if (ok) SDL_Log("16 bits: %s %dx%d (%s, maxval %d)", path, h.w, h.h,
+                  raw_w > 0 ? "Y16" : h.channels == 1 ? "P5" : "P6", h.maxval);
+  return ok;
+}
+
+//carrega a imagem do disco já em cinza (Y8) com o histograma calculado. entradas de
+//16 bits guardam também o plano Y16, e o Y8 é só a exibição dele
+static bool img_load_gray(const char* path, ImageData* out, Uint32 hist[256], bool with_backup, bool keep_color) {
+  SDL_Log("Carregando: %s", path);
+  if (is_pnm_name(path)) {
+    if (pnm_maxval(path) > 255) {
+      if (keep_color) SDL_Log("--color: entradas de 16 bits ficam em cinza");
+      return img_load_deep(path, 0, 0, out, hist, with_backup);
+    }
+    if (img_map_gray(path, 0, 0, out, hist, with_backup)) return true;
+  }
+
+  Uint64 tr = trace_begin();
+  SDL_Surface* loaded = IMG_Load(path);
+  trace_end(PH_LOAD, tr);
+  if (!loaded) {
+    log_sdl_error("IMG_Load falhou");
+    return false;
+  }
+
+  const char* fmt_name = SDL_GetPixelFormatName(loaded->format);
+  SDL_Log("Imagem OK: %dx%d | pitch=%d bytes | formato=%s",
+          loaded->w, loaded->h, loaded->pitch, fmt_name ? fmt_name : "(desconhecido)");
+
+  tr = trace_begin();
+  bool ok = ingest_surface_gray(loaded, out, hist, with_backup, keep_color, false);
+  trace_end(PH_INGEST, tr);
+  return ok;
+}
 
-        if (e.type == SDL_EVENT_MOUSE_BUTTON_UP && e.button.button == SDL_BUTTON_LEFT) {
-          if (inside && ui->eqButton.state == BTN_ACTIVE) {
-            // equalização
-            ui->is_equalized = !ui->is_equalized;
-
-            if (ui->is_equalized) {
-              // aplica equalização na imagem atual (que está em cinza)
-              if (!equalize_histogram_inplace(img->surface_rgba)) {
-                SDL_Log("equalize_histogram_inplace falhou");
-                ui->is_equalized = false;
-              }
-            } else {
-              // reverte a partir do backup
-              if (!SDL_LockSurface(img->surface_rgba) || !SDL_LockSurface(img->original_gray)) {
-                SDL_Log("Lock para reverter falhou: %s", SDL_GetError());
-                if (SDL_MUSTLOCK(img->original_gray)) SDL_UnlockSurface(img->original_gray);
-                if (SDL_MUSTLOCK(img->surface_rgba))  SDL_UnlockSurface(img->surface_rgba);
-              } else {
-                memcpy(img->surface_rgba->pixels, img->original_gray->pixels, (size_t)img->h * img->original_gray->pitch);
-                SDL_UnlockSurface(img->original_gray);
-                SDL_UnlockSurface(img->surface_rgba);
-              }
-            }
-
-            // atualizar textura e estatísticas
-            rebuild_texture(img, ui->mainApp.renderer);
-            recompute_stats(ui, img);
+static void free_image(ImageData* img) {
+  pyramid_free(&img->pyr); //para a thread da pirâmide antes de liberar o plano que ela lê
+  hist_index_free(&img->hindex); //idem para o índice, que lê a original
+  tile_cache_free(&img->tiles);
+  if (img->texture) SDL_DestroyTexture(img->texture);
+  if (img->proxy_tex) SDL_DestroyTexture(img->proxy_tex);
+  img->proxy_tex = NULL;
+  plane_free(&img->proxy);
+  plane_free(&img->proxy_alpha);
+  plane_free(&img->gray);
+  plane_free(&img->original_gray);
+  plane_free(&img->alpha);
+  plane_free(&img->filtered);
+  plane_free(&img->clahe);
+  plane16_free(&img->deep);
+  plane16_free(&img->deep_out);
+  free(img->hist16);
+  img->hist16 = NULL;
+  if (img->color) SDL_DestroySurface(img->color);
+  img->color = NULL;
+  unmap_file(&img->map); //depois dos planos, que só emprestavam as visões
+  img->texture = NULL;
+}
+
+static const Uint8* color_row(const ImageData* img, int y) {
+  return (const Uint8*)img->color->pixels + (size_t)y * (size_t)img->color->pitch;
+}
+
+//modo cor: imagem RGBA32 com a luminância processada (Y' do plano de trabalho)
+static SDL_Surface* recolor_surface(const ImageData* img) {
+  SDL_Surface* s = SDL_CreateSurface(img->w, img->h, SDL_PIXELFORMAT_RGBA32);
+  if (s)
+    for (int y = 0; y < img->h; y++)
+      g_kernels->row_recolor(color_row(img, y), plane_row(&img->original_gray, y), plane_row(&img->gray, y),
+                             (Uint8*)s->pixels + (size_t)y * s->pitch, img->w);
+  return s;
+}
+
+//salva em PNG. Imagem opaca: o plano Y8 vira uma surface INDEX8 com paleta de cinza
+//sem cópia; com alfa, expande para RGBA32 só aqui; no modo cor, refaz a cor da luminância
+static bool save_image_png(const ImageData* img, const char* path) {
+  SDL_Surface* s = NULL;
+  if (img->color) {
+    s = recolor_surface(img);
+  } else if (!img->alpha.pixels) {
+    s = SDL_CreateSurfaceFrom(img->w, img->h, SDL_PIXELFORMAT_INDEX8, img->gray.pixels, img->gray.pitch);
+    SDL_Palette* pal = s ? SDL_CreateSurfacePalette(s) : NULL;
+    if (pal) {
+      SDL_Color ramp[256];
+      for (int i = 0; i < 256; i++) ramp[i] = (SDL_Color){ (Uint8)i, (Uint8)i, (Uint8)i, 255 };
+      SDL_SetPaletteColors(pal, ramp, 0, 256);
+    } else if (s) {
+      SDL_DestroySurface(s);
+      s = NULL;
+    }
+  } else {
+    s = SDL_CreateSurface(img->w, img->h, SDL_PIXELFORMAT_RGBA32);
+    if (s)
+      for (int y = 0; y < img->h; y++)
+        g_kernels->row_expand(plane_row(&img->gray, y), plane_row(&img->alpha, y),
+                              (Uint8*)s->pixels + (size_t)y * s->pitch, img->w);
+  }
+  if (!s) {
+    log_sdl_error("Falha ao preparar surface para salvar");
+    return false;
+  }
+
+  Uint64 tr = trace_begin();
+  bool ok = IMG_SavePNG(s, path);
+  trace_end(PH_SAVE, tr);
+  if (!ok) SDL_Log("Erro em salvar %s: %s", path, SDL_GetError());
+  SDL_DestroySurface(s);
+  return ok;
+}
+
+//gravação assíncrona: PNG (SDL_image), PNG sem compressão, PGM e QOI, codificados por
+//um worker a partir de um snapshot do plano de trabalho. os codificadores próprios
+//gravam linha a linha e publicam o progresso em `progress`
+static const char* const save_format_names[SAVE_FORMAT_COUNT] = { "PNG", "PNG sem compressão", "PGM", "QOI" };
+static const char* const save_format_ext[SAVE_FORMAT_COUNT]   = { "png", "png", "pgm", "qoi" };
+
+static Uint32 g_save_event; //avisa a thread da UI sobre progresso e fim da gravação
+static Uint32 g_crc_table[256];
+
+static void crc_init(void) {
+  for (Uint32 n = 0; n < 256; n++) {
+    Uint32 c = n;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    g_crc_table[n] = c;
+  }
+}
+
+static Uint32 crc_update(Uint32 crc, const Uint8* p, size_t n) {
+  for (size_t i = 0; i < n; i++) crc = g_crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+static void put_be32(Uint8* p, Uint32 v) {
+  p[0] = (Uint8)(v >> 24); p[1] = (Uint8)(v >> 16); p[2] = (Uint8)(v >> 8); p[3] = (Uint8)v;
+}
+
+static void save_progress(SaveTask* t, int rows) {
+  int step = t->h / 50 > 0 ? t->h / 50 : 1;
+  int prev = SDL_GetAtomicInt(&t->progress);
+  SDL_SetAtomicInt(&t->progress, rows);
+  if (!g_save_event || (rows / step == prev / step && rows < t->h)) return; //sem UI (batch): só conta
+  SDL_Event ev;
+  SDL_zero(ev);
+  ev.type = g_save_event;
+  SDL_PushEvent(&ev);
+}
+
+static const Uint8* save_color_row(const SaveTask* t, int y) {
+  return (const Uint8*)t->color->pixels + (size_t)y * (size_t)t->color->pitch;
+}
+
+//amostras de 16 bits em big-endian, como PGM e PNG pedem
+static void row_store_be16(const Uint16* src, Uint8* dst, int w) {
+  for (int x = 0; x < w; x++) { dst[2 * x] = (Uint8)(src[x] >> 8); dst[2 * x + 1] = (Uint8)src[x]; }
+}
+
+//PGM (P5); no modo cor, PPM (P6). os dois descartam o alfa. 16 bits: P5 com o maxval da entrada
+static bool save_pgm(SaveTask* t, SDL_IOStream* io) {
+  const int channels = t->color ? 3 : t->maxval ? 2 : 1;
+  if (SDL_IOprintf(io, "P%d\n%d %d\n%d\n", t->color ? 6 : 5, t->w, t->h, t->maxval ? t->maxval : 255) == 0)
+    return false;
+  Uint8* rgb = t->color || t->maxval ? (Uint8*)malloc((size_t)t->w * 3) : NULL;
+  if ((t->color || t->maxval) && !rgb) return false;
+  bool ok = true;
+  for (int y = 0; ok && y < t->h; y++) {
+    const Uint8* row = rgb;
+    if (t->color) {
+      const Uint8* c = save_color_row(t, y);
+      for (int x = 0; x < t->w; x++) memcpy(rgb + 3 * x, c + 4 * x, 3);
+    } else if (t->maxval) {
+      row_store_be16(plane16_row(&t->deep, y), rgb, t->w);
+    } else {
+      row = plane_row(&t->gray, y);
+    }
+    ok = SDL_WriteIO(io, row, (size_t)t->w * channels) == (size_t)t->w * channels;
+    save_progress(t, y + 1);
+  }
+  free(rgb);
+  return ok;
+}
+
+//PNG sem compressão: IDATs com blocos deflate "stored" (até 65535 bytes cada), filtro 0.
+//troca tamanho de arquivo por velocidade de gravação próxima à do PGM
+#define PNG_STORE_BLOCK 65535
+
+typedef struct {
+  SDL_IOStream* io;
+  Uint8*        out;           //"IDAT" + zlib + cabeçalho do bloco + dados + adler
+  Uint8*        data;          //início dos dados do bloco dentro de `out`
+  size_t        fill;
+  Uint64        remaining;     //bytes do fluxo zlib ainda não consumidos
+  Uint32        adler_a, adler_b;
+  bool          first;
+} PngStore;
+
+static bool png_chunk(SDL_IOStream* io, const Uint8* type_and_data, size_t len) {
+  Uint8 b[4];
+  put_be32(b, (Uint32)len);
+  if (SDL_WriteIO(io, b, 4) != 4 || SDL_WriteIO(io, type_and_data, len + 4) != len + 4) return false;
+  put_be32(b, crc_update(0xFFFFFFFFu, type_and_data, len + 4) ^ 0xFFFFFFFFu);
+  return SDL_WriteIO(io, b, 4) == 4;
+}
+
+static bool png_store_emit(PngStore* s) {
+  const bool last = s->remaining == 0;
+  Uint8* p = s->out + 4;
+  if (s->first) { *p++ = 0x78; *p++ = 0x01; }
+  *p++ = last ? 1 : 0;
+  *p++ = (Uint8)s->fill; *p++ = (Uint8)(s->fill >> 8);
+  *p++ = (Uint8)~s->fill; *p++ = (Uint8)(~s->fill >> 8);
+  memmove(p, s->data, s->fill);
+  p += s->fill;
+  if (last) { put_be32(p, (s->adler_b << 16) | s->adler_a); p += 4; }
+  bool ok = png_chunk(s->io, s->out, (size_t)(p - s->out) - 4);
+  s->first = false;
+  s->fill = 0;
+  return ok;
+}
+
+static bool png_store_write(PngStore* s, const Uint8* src, size_t n) {
+  while (n > 0) {
+    size_t k = PNG_STORE_BLOCK - s->fill;
+    if (k > n) k = n;
+    memcpy(s->data + s->fill, src, k);
+    //adler-32 com o módulo adiado (no máximo 5552 bytes entre reduções)
+    for (size_t i = 0; i < k; ) {
+      size_t end = (k - i > 5552) ? i + 5552 : k;
+      for (; i < end; i++) { s->adler_a += src[i]; s->adler_b += s->adler_a; }
+      s->adler_a %= 65521u;
+      s->adler_b %= 65521u;
+    }
+    s->fill += k;
+    s->remaining -= k;
+    src += k;
+    n -= k;
+    if ((s->fill == PNG_STORE_BLOCK || s->remaining == 0) && !png_store_emit(s)) return false;
+  }
+  return true;
+}
+
+//16 bits: cinza de 16 bits; o PNG não tem maxval, então amostras 0..maxval são esticadas
+//para 0..65535 (com o bit mais alto replicado, como recomenda a especificação)
+static bool save_png_store(SaveTask* t, SDL_IOStream* io) {
+  static const Uint8 sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  const int bpp = t->maxval ? 2 : (t->color ? 3 : 1) + (t->has_alpha ? 1 : 0);
+  const size_t row_bytes = 1 + (size_t)t->w * bpp;
+  Uint8 ihdr[4 + 13] = { 'I', 'H', 'D', 'R' };
+  put_be32(ihdr + 4, (Uint32)t->w);
+  put_be32(ihdr + 8, (Uint32)t->h);
+  ihdr[12] = t->maxval ? 16 : 8;     //bits por amostra
+  ihdr[13] = (Uint8)((t->color ? 2 : 0) | (t->has_alpha ? 4 : 0)); //RGB/cinza, com ou sem alfa
+
+  PngStore s = { io, NULL, NULL, 0, (Uint64)row_bytes * (Uint64)t->h, 1, 0, true };
+  s.out = (Uint8*)malloc(4 + 2 + 5 + PNG_STORE_BLOCK + 4);
+  s.data = s.out ? s.out + 4 + 2 + 5 : NULL;
+  Uint8* row = (Uint8*)malloc(row_bytes);
+  bool ok = s.out && row && SDL_WriteIO(io, sig, 8) == 8 && png_chunk(io, ihdr, 13);
+  if (ok) memcpy(s.out, "IDAT", 4);
+  Uint16* wide = t->maxval ? (Uint16*)malloc(sizeof(Uint16) * (size_t)t->w) : NULL;
+  ok = ok && (!t->maxval || wide);
+  int bits = 0;
+  while (t->maxval >> bits) bits++;
+  for (int y = 0; ok && y < t->h; y++) {
+    row[0] = 0;
+    if (t->maxval) {
+      const Uint16* d = plane16_row(&t->deep, y);
+      if (t->maxval == 65535) {
+        row_store_be16(d, row + 1, t->w);
+      } else {
+        //maxval = 2^bits - 1 (bits > 8): replica os bits altos; outros maxval arredondam
+        for (int x = 0; x < t->w; x++)
+          wide[x] = t->maxval == (1 << bits) - 1
+                  ? (Uint16)(d[x] << (16 - bits) | d[x] >> (2 * bits - 16))
+                  : (Uint16)(((Uint32)d[x] * 65535u + (Uint32)t->maxval / 2u) / (Uint32)t->maxval);
+        row_store_be16(wide, row + 1, t->w);
+      }
+    } else if (t->color) {
+      const Uint8* c = save_color_row(t, y);
+      if (bpp == 4) memcpy(row + 1, c, (size_t)t->w * 4);
+      else          for (int x = 0; x < t->w; x++) memcpy(row + 1 + 3 * x, c + 4 * x, 3);
+    } else if (bpp == 1) {
+      memcpy(row + 1, plane_row(&t->gray, y), (size_t)t->w);
+    } else {
+      const Uint8* g = plane_row(&t->gray, y);
+      const Uint8* a = plane_row(&t->alpha, y);
+      for (int x = 0; x < t->w; x++) { row[1 + 2 * x] = g[x]; row[2 + 2 * x] = a[x]; }
+    }
+    ok = png_store_write(&s, row, row_bytes);
+    save_progress(t, y + 1);
+  }
+  static const Uint8 iend[4] = { 'I', 'E', 'N', 'D' };
+  ok = ok && png_chunk(io, iend, 0);
+  free(wide);
+  free(row);
+  free(s.out);
+  return ok;
+}
+
+//QOI (qoiformat.org): RGB para imagens opacas, RGBA com alfa
+static bool save_qoi(SaveTask* t, SDL_IOStream* io) {
+  const int channels = t->has_alpha ? 4 : 3;
+  Uint8 header[14] = { 'q', 'o', 'i', 'f' };
+  put_be32(header + 4, (Uint32)t->w);
+  put_be32(header + 8, (Uint32)t->h);
+  header[12] = (Uint8)channels;
+  header[13] = 0;
+  Uint8* out = (Uint8*)malloc((size_t)t->w * 5 + 8);
+  if (!out || SDL_WriteIO(io, header, 14) != 14) { free(out); return false; }
+
+  Uint8 index[64][4];
+  memset(index, 0, sizeof(index));
+  Uint8 prev[4] = { 0, 0, 0, 255 };
+  int run = 0;
+  bool ok = true;
+  for (int y = 0; ok && y < t->h; y++) {
+    const Uint8* c = t->color ? save_color_row(t, y) : NULL;
+    const Uint8* g = t->color ? NULL : plane_row(&t->gray, y);
+    const Uint8* al = t->alpha.pixels ? plane_row(&t->alpha, y) : NULL;
+    size_t n = 0;
+    for (int x = 0; x < t->w; x++) {
+      Uint8 px[4];
+      if (c) memcpy(px, c + 4 * x, 4);
+      else   { px[0] = px[1] = px[2] = g[x]; px[3] = al ? al[x] : 255; }
+      if (memcmp(px, prev, 4) == 0) {
+        if (++run == 62) { out[n++] = (Uint8)(0xC0 | (run - 1)); run = 0; }
+        continue;
+      }
+      if (run > 0) { out[n++] = (Uint8)(0xC0 | (run - 1)); run = 0; }
+      int hi = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+      if (memcmp(index[hi], px, 4) == 0) {
+        out[n++] = (Uint8)hi;
+      } else {
+        memcpy(index[hi], px, 4);
+        if (px[3] == prev[3]) {
+          int dr = (Sint8)(px[0] - prev[0]), dg = (Sint8)(px[1] - prev[1]), db = (Sint8)(px[2] - prev[2]);
+          int dr_dg = dr - dg, db_dg = db - dg;
+          if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+            out[n++] = (Uint8)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+          } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+            out[n++] = (Uint8)(0x80 | (dg + 32));
+            out[n++] = (Uint8)((dr_dg + 8) << 4 | (db_dg + 8));
+          } else {
+            out[n++] = 0xFE; out[n++] = px[0]; out[n++] = px[1]; out[n++] = px[2];
           }
-          // estado visual pós-click
-          ui->eqButton.state = inside ? BTN_HOVER : BTN_IDLE;
+        } else {
+          out[n++] = 0xFF; out[n++] = px[0]; out[n++] = px[1]; out[n++] = px[2]; out[n++] = px[3];
         }
       }
+      memcpy(prev, px, 4);
+    }
+    if (y == t->h - 1) {
+      static const Uint8 end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+      if (run > 0) out[n++] = (Uint8)(0xC0 | (run - 1));
+      memcpy(out + n, end, 8);
+      n += 8;
     }
+    ok = SDL_WriteIO(io, out, n) == n;
+    save_progress(t, y + 1);
   }
+  free(out);
+  return ok;
 }
 
-static void render_loop(UIContext* ui, ImageData* img) {
-  recompute_stats(ui, img);
+static int SDLCALL save_worker(void* data) {
+  SaveTask* t = (SaveTask*)data;
+  if (t->format == SAVE_PNG && t->color) {
+    Uint64 tr = trace_begin();
+    t->ok = IMG_SavePNG(t->color, t->path);
+    trace_end(PH_SAVE, tr);
+    if (!t->ok) SDL_Log("Erro em salvar %s: %s", t->path, SDL_GetError());
+  } else if (t->format == SAVE_PNG && !t->maxval) {
+    //IMG_SavePNG não informa progresso: a barra só avança no fim
+    ImageData snap = {0};
+    snap.gray = t->gray;
+    snap.alpha = t->alpha;
+    snap.w = t->w;
+    snap.h = t->h;
+    t->ok = save_image_png(&snap, t->path);
+  } else {
+    Uint64 tr = trace_begin();
+    SDL_IOStream* io = SDL_IOFromFile(t->path, "wb");
+    if (!io) SDL_Log("Falha ao criar %s: %s", t->path, SDL_GetError());
+    t->ok = io && (t->format == SAVE_PGM ? save_pgm(t, io) :
+                   t->format == SAVE_QOI ? save_qoi(t, io) : save_png_store(t, io));
+    if (io && !SDL_CloseIO(io)) t->ok = false;
+    trace_end(PH_SAVE, tr);
+  }
+  SDL_SetAtomicInt(&t->progress, t->h);
+  SDL_SetAtomicInt(&t->done, 1);
+  SDL_Event ev;
+  SDL_zero(ev);
+  ev.type = g_save_event;
+  SDL_PushEvent(&ev);
+  return 0;
+}
 
-  for (;;) {
-    handle_events(ui, img);
-    render_main_window(ui, img);
-    render_side_window(ui);
-    SDL_Delay(16);
+//marca linhas do plano Y8 como pendentes de envio à textura (acumula a união)
+static void mark_texture_rows(ImageData* img, int y0, int y1) {
+  if (y0 < 0) y0 = 0;
+  if (y1 > img->h) y1 = img->h;
+  if (y0 >= y1) return;
+  if (img->tex_y0 >= img->tex_y1) { img->tex_y0 = y0; img->tex_y1 = y1; return; }
+  if (y0 < img->tex_y0) img->tex_y0 = y0;
+  if (y1 > img->tex_y1) img->tex_y1 = y1;
+}
+
+typedef struct {
+  const ImageData* img;
+  Uint8* dst;                  //memória travada da textura, já na linha y0
+  int    dst_pitch;
+  int    y0, rows;
+} ExpandJob;
+
+static void expand_band_task(void* ctx, int band, int nbands) {
+  ExpandJob* job = (ExpandJob*)ctx;
+  const ImageData* img = job->img;
+  int r0, r1;
+  band_rows(job->rows, band, nbands, &r0, &r1);
+  for (int r = r0; r < r1; r++) {
+    int y = job->y0 + r;
+    Uint8* dst = job->dst + (size_t)r * job->dst_pitch;
+    if (img->color)
+      g_kernels->row_recolor(color_row(img, y), plane_row(&img->original_gray, y), plane_row(&img->gray, y), dst, img->w);
+    else
+      g_kernels->row_expand(plane_row(&img->gray, y), img->alpha.pixels ? plane_row(&img->alpha, y) : NULL, dst, img->w);
   }
 }
 
+//caminho alternativo quando o driver não deixa travar a textura: expande em faixas e usa SDL_UpdateTexture
+static bool update_texture_strips(ImageData* img, int y0, int y1) {
+  Uint8* strip = (Uint8*)SDL_aligned_alloc(64, (size_t)img->w * 4 * TEXTURE_STRIP_ROWS);
+  if (!strip) { SDL_Log("Sem memória para faixa de upload"); return false; }
 
-// equaliza in-place assumindo imagem em GRAYSCALE já (R==G==B) em RGBA32
-static bool equalize_histogram_inplace(SDL_Surface* surf) {
-  if (!surf) return false;
-  if (!SDL_LockSurface(surf)) return false;
+  bool ok = true;
+  for (int y = y0; y < y1 && ok; y += TEXTURE_STRIP_ROWS) {
+    int rows = (y1 - y < TEXTURE_STRIP_ROWS) ? y1 - y : TEXTURE_STRIP_ROWS;
+    ExpandJob job = { img, strip, img->w * 4, y, rows };
+    expand_band_task(&job, 0, 1);
+    SDL_Rect rect = { 0, y, img->w, rows };
+    ok = SDL_UpdateTexture(img->texture, &rect, strip, img->w * 4);
+    if (!ok) log_sdl_error("SDL_UpdateTexture falhou");
+  }
+  SDL_aligned_free(strip);
+  return ok;
+}
 
-  const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(surf->format);
-  const SDL_Palette* pal = SDL_GetSurfacePalette(surf);
-  Uint32* px = (Uint32*)surf->pixels;
-  const int n = surf->w * surf->h;
+//reenvia só as linhas marcadas: trava o retângulo na textura de streaming e expande
+//Y8 -> RGBA (no modo cor, RGB + Y' - Y) direto na memória do driver, em paralelo,
+//sem buffer intermediário
+static bool sync_texture_rows(ImageData* img) {
+  int y0 = img->tex_y0, y1 = img->tex_y1;
+  if (y0 >= y1) return true;
+  img->tex_y0 = img->tex_y1 = 0;
 
-  // 1) histograma
-  Uint32 hist[256] = {0};
-  for (int i = 0; i < n; i++) {
-    Uint8 r,g,b,a; SDL_GetRGBA(px[i], fmt, pal, &r,&g,&b,&a);
-    hist[r]++; // r==g==b
+  Uint64 tr = trace_begin();
+  SDL_Rect rect = { 0, y0, img->w, y1 - y0 };
+  void* pixels = NULL;
+  int pitch = 0;
+  bool ok = true;
+  if (SDL_LockTexture(img->texture, &rect, &pixels, &pitch)) {
+    ExpandJob job = { img, (Uint8*)pixels, pitch, y0, y1 - y0 };
+    parallel_for(band_count(y1 - y0, HIST_MIN_BAND_PIXELS / (img->w > 0 ? img->w : 1)), expand_band_task, &job);
+    SDL_UnlockTexture(img->texture);
+  } else {
+    log_sdl_error("SDL_LockTexture falhou, usando SDL_UpdateTexture");
+    ok = update_texture_strips(img, y0, y1);
   }
+  trace_end(PH_UPLOAD, tr);
+  return ok;
+}
 
-  // 2) CDF normalizada
-  Uint32 cum = 0; double cdf[256];
-  for (int i = 0; i < 256; i++) {    
-    cum += hist[i];
-    cdf[i] = (double)cum / (double)n;
+//cria a textura de streaming uma única vez e envia a imagem inteira
+static bool upload_texture_gray(ImageData* img, SDL_Renderer* rr) {
+  if (!img->texture) {
+    img->texture = SDL_CreateTexture(rr, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, img->w, img->h);
+    if (!img->texture) { log_sdl_error("SDL_CreateTexture falhou"); return false; }
   }
+  mark_texture_rows(img, 0, img->h);
+  return sync_texture_rows(img);
+}
 
-  // 3) mapeia intensidade antiga -> nova (0..255)
-  Uint8 lut[256];
-  for (int i = 0; i < 256; i++) {
-    int v = (int)round(cdf[i] * 255.0);
-    if (v < 0) v = 0;
-    if (v > 255) v = 255;
-    lut[i] = (Uint8)v;
+//pirâmide: média 2x2 com arredondamento; coluna/linha ímpar final replica a borda
+static void downsample_row(const Uint8* r0, const Uint8* r1, Uint8* dst, int src_w) {
+  int half = src_w / 2;
+  for (int x = 0; x < half; x++)
+    dst[x] = (Uint8)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+  if (src_w & 1) dst[half] = (Uint8)((r0[src_w - 1] + r1[src_w - 1] + 1) >> 1);
+}
+
+static bool downsample_plane(const GrayPlane* src, GrayPlane* dst, SDL_AtomicInt* cancel) {
+  for (int y = 0; y < dst->h; y++) {
+    if ((y & 63) == 0 && SDL_GetAtomicInt(cancel)) return false;
+    int y1 = (2 * y + 1 < src->h) ? 2 * y + 1 : 2 * y;
+    downsample_row(plane_row(src, 2 * y), plane_row(src, y1), plane_row(dst, y), src->w);
   }
+  return true;
+}
+
+static Uint32 g_pyramid_event; //avisa a thread da UI que mais um nível ficou pronto
 
-  // 4) aplica
-  for (int i = 0; i < n; i++) {
-    Uint8 r,g,b,a; SDL_GetRGBA(px[i], fmt, pal, &r,&g,&b,&a);
-    Uint8 y = lut[r];
-    px[i] = SDL_MapRGBA(fmt, pal, y, y, y, a);
+//roda fora do pool de propósito: o pool fica livre para a interação na thread da UI
+static int SDLCALL pyramid_worker(void* data) {
+  ImageData* img = (ImageData*)data;
+  MipPyramid* p = &img->pyr;
+  for (int l = 1; l < p->count; l++) {
+    Uint64 tr = trace_begin();
+    if (!downsample_plane(&p->levels[l - 1], &p->levels[l], &p->cancel)) return 0;
+    if (p->alpha[0].pixels && !downsample_plane(&p->alpha[l - 1], &p->alpha[l], &p->cancel)) return 0;
+    trace_end(PH_PYRAMID, tr);
+    SDL_SetAtomicInt(&p->built, l + 1);
+
+    SDL_Event ev;
+    SDL_zero(ev);
+    ev.type = g_pyramid_event;
+    SDL_PushEvent(&ev);
   }
+  return 0;
+}
 
-  SDL_UnlockSurface(surf);
+//aloca os níveis uma única vez: até a imagem inteira caber em um bloco
+static bool pyramid_alloc(ImageData* img) {
+  MipPyramid* p = &img->pyr;
+  if (p->count > 0) return true;
+  p->levels[0] = img->gray;
+  p->alpha[0] = img->alpha;
+  int w = img->w, h = img->h, n = 1;
+  while ((w > TILE_SIZE || h > TILE_SIZE) && n < MIP_MAX_LEVELS) {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    if (!plane_alloc(&p->levels[n], w, h)) break;
+    if (img->alpha.pixels && !plane_alloc(&p->alpha[n], w, h)) { plane_free(&p->levels[n]); break; }
+    n++;
+  }
+  p->count = n;
+  if (w > TILE_SIZE || h > TILE_SIZE) SDL_Log("Pirâmide incompleta: %d níveis (sem memória)", n);
   return true;
 }
 
-int main(int argc, char** argv) {
-  atexit(shutdown);
+static void pyramid_stop(MipPyramid* p) {
+  if (!p->thread) return;
+  SDL_SetAtomicInt(&p->cancel, 1);
+  SDL_WaitThread(p->thread, NULL);
+  p->thread = NULL;
+}
 
-  if (argc != 2) {
-    SDL_Log("Uso: %s <caminho_imagem>", argv[0]);
-    return 1;
+//(re)gera os níveis a partir do plano de trabalho atual, em segundo plano
+static void pyramid_start(ImageData* img) {
+  MipPyramid* p = &img->pyr;
+  pyramid_stop(p);
+  if (!pyramid_alloc(img)) return;
+  if (!g_pyramid_event) g_pyramid_event = SDL_RegisterEvents(1);
+  SDL_SetAtomicInt(&p->built, 1);
+  SDL_SetAtomicInt(&p->cancel, 0);
+  p->thread = SDL_CreateThread(pyramid_worker, "mip_pyramid", img);
+  if (!p->thread) {
+    log_sdl_error("SDL_CreateThread (pirâmide) falhou, gerando na thread da UI");
+    pyramid_worker(img);
   }
+}
 
-  if (!SDL_Init(SDL_INIT_VIDEO)) {
-    log_sdl_error("SDL_Init: Erro ao inicializar"); return 1;
-  }
-  if (!TTF_Init()) {
-    SDL_Log("TTF_Init falhou: %s", SDL_GetError());
-    return 1;
+static void pyramid_free(MipPyramid* p) {
+  pyramid_stop(p);
+  for (int l = 1; l < p->count; l++) {
+    plane_free(&p->levels[l]);
+    plane_free(&p->alpha[l]);
   }
+  memset(p, 0, sizeof(*p));
+}
 
+//proxy: média de blocos k x k (os da borda direita/inferior com o que houver), uma linha
+//do proxy por vez com as somas das colunas acumuladas em `acc`
+typedef struct {
+  const GrayPlane* src;
+  GrayPlane*       dst;
+  int              k;
+} BoxDownJob;
 
-  ImageData img = {0};
-  if (!img_load_rgba32(argv[1], &img)) {
-    cleanup_all(NULL, &img); return 1;
+static void box_down_task(void* ctx, int band, int nbands) {
+  BoxDownJob* job = (BoxDownJob*)ctx;
+  const GrayPlane* src = job->src;
+  GrayPlane* dst = job->dst;
+  const int k = job->k;
+  Uint32* acc = (Uint32*)malloc(sizeof(Uint32) * (size_t)dst->w);
+  if (!acc) return; //o proxy fica com lixo nessas linhas: só a prévia erra
+  int y0, y1;
+  band_rows(dst->h, band, nbands, &y0, &y1);
+  for (int y = y0; y < y1; y++) {
+    int sy0 = y * k, sy1 = SDL_min(sy0 + k, src->h);
+    memset(acc, 0, sizeof(Uint32) * (size_t)dst->w);
+    for (int sy = sy0; sy < sy1; sy++) {
+      const Uint8* row = plane_row(src, sy);
+      for (int x = 0; x < dst->w; x++) {
+        int sx1 = SDL_min(x * k + k, src->w);
+        Uint32 sum = 0;
+        for (int sx = x * k; sx < sx1; sx++) sum += row[sx];
+        acc[x] += sum;
+      }
+    }
+    Uint8* out = plane_row(dst, y);
+    for (int x = 0; x < dst->w; x++) {
+      Uint32 n = (Uint32)(SDL_min(x * k + k, src->w) - x * k) * (Uint32)(sy1 - sy0);
+      out[x] = (Uint8)((acc[x] + n / 2) / n);
+    }
   }
+  free(acc);
+}
+
+static void plane_box_down(const GrayPlane* src, GrayPlane* dst, int k) {
+  BoxDownJob job = { src, dst, k };
+  parallel_for(band_count(dst->h, 1), box_down_task, &job);
+}
+
+//imagens grandes (CV_PROXY_MPIX megapixels ou mais, padrão PROXY_MIN_MPIX) ganham na carga
+//uma cópia 1/PROXY_SCALE da original, sobre a qual cada edição é mostrada na hora. cor e
+//16 bits ficam de fora: a prévia cinza de 8 bits não representaria a exibição delas
+static void image_build_proxy(ImageData* img) {
+  if (img->color || img->deep.pixels || img->proxy.pixels) return;
+  const char* env = SDL_getenv("CV_PROXY_MPIX");
+  double mpix = env ? atof(env) : PROXY_MIN_MPIX;
+  if (mpix <= 0.0 || (double)img->w * (double)img->h < mpix * 1e6) return;
+  int pw = (img->w + PROXY_SCALE - 1) / PROXY_SCALE, ph = (img->h + PROXY_SCALE - 1) / PROXY_SCALE;
+  Uint64 t0 = SDL_GetTicksNS();
+  if (!plane_alloc(&img->proxy, pw, ph)) return;
+  if (img->alpha.pixels && !plane_alloc(&img->proxy_alpha, pw, ph)) { plane_free(&img->proxy); return; }
+  plane_box_down(&img->original_gray, &img->proxy, PROXY_SCALE);
+  if (img->alpha.pixels) plane_box_down(&img->alpha, &img->proxy_alpha, PROXY_SCALE);
+  SDL_Log("Proxy %dx%d para as prévias: %.1f ms", pw, ph, (double)(SDL_GetTicksNS() - t0) / 1e6);
+}
+
+//índice de histogramas integrais: uma passada serial sobre a original, faixa de blocos
+//por faixa de blocos (a UI continua usando o pool); cada canto acumula o de cima mais a
+//soma dos blocos à esquerda na faixa
+static int SDLCALL hist_index_worker(void* data) {
+  HistIndex* ix = (HistIndex*)data;
+  const int B = ix->block, stride = ix->nbx + 1;
+  Uint64 t0 = SDL_GetTicksNS();
+  Uint32* blocks = (Uint32*)malloc(sizeof(Uint32) * 256 * (size_t)(ix->nbx > 0 ? ix->nbx : 1));
+  if (!blocks) { SDL_Log("Sem memória para o índice de histogramas"); return 0; }
 
-  if (!is_surface_grayscale_rgba32(img.surface_rgba)) {
-    if (!convert_to_grayscale_inplace(img.surface_rgba)) {
-      cleanup_all(NULL, &img); return 1;
+  for (int by = 0; by < ix->nby; by++) {
+    if (SDL_GetAtomicInt(&ix->cancel)) { free(blocks); return 0; }
+    memset(blocks, 0, sizeof(Uint32) * 256 * (size_t)ix->nbx);
+    for (int y = by * B; y < (by + 1) * B; y++) {
+      const Uint8* row = plane_row(ix->src, y);
+      for (int bx = 0; bx < ix->nbx; bx++) {
+        Uint32* h = blocks + 256 * (size_t)bx;
+        const Uint8* p = row + (size_t)bx * B;
+        for (int x = 0; x < B; x++) h[p[x]]++;
+      }
+    }
+    const Uint32* above = ix->cum + 256 * (size_t)by * stride;
+    Uint32* cur = ix->cum + 256 * (size_t)(by + 1) * stride;
+    Uint32 acc[256] = {0};
+    for (int bx = 0; bx < ix->nbx; bx++) {
+      const Uint32* h = blocks + 256 * (size_t)bx;
+      const size_t k = 256 * (size_t)(bx + 1);
+      for (int i = 0; i < 256; i++) {
+        acc[i] += h[i];
+        cur[k + i] = above[k + i] + acc[i];
+      }
     }
   }
+  free(blocks);
+  SDL_SetAtomicInt(&ix->ready, 1);
+  SDL_Log("Índice de histogramas: blocos %dx%d, %.1f MB, %.1f ms", B, B,
+          (double)sizeof(Uint32) * 256 * stride * (ix->nby + 1) / (1024.0 * 1024.0),
+          (double)(SDL_GetTicksNS() - t0) / 1e6);
+  return 0;
+}
+
+static void hist_index_free(HistIndex* ix) {
+  if (ix->thread) {
+    SDL_SetAtomicInt(&ix->cancel, 1);
+    SDL_WaitThread(ix->thread, NULL);
+  }
+  free(ix->cum);
+  memset(ix, 0, sizeof(*ix));
+}
 
+//gera o índice da original em segundo plano; o bloco dobra até os cantos caberem
+//em HINDEX_MAX_MB
+static void hist_index_start(ImageData* img) {
+  HistIndex* ix = &img->hindex;
+  hist_index_free(ix);
+  const GrayPlane* src = &img->original_gray;
+  if (!src->pixels) return;
+  int B = HINDEX_MIN_BLOCK;
+  while ((Uint64)(src->w / B + 1) * (Uint64)(src->h / B + 1) * 1024u > (Uint64)HINDEX_MAX_MB << 20) B *= 2;
+  ix->block = B;
+  ix->nbx = src->w / B;
+  ix->nby = src->h / B;
+  ix->src = src;
+  ix->cum = (Uint32*)calloc((size_t)(ix->nbx + 1) * (size_t)(ix->nby + 1), sizeof(Uint32) * 256);
+  if (!ix->cum) { SDL_Log("Sem memória para o índice de histogramas"); return; }
+  ix->thread = SDL_CreateThread(hist_index_worker, "hist_index", ix);
+  if (!ix->thread) log_sdl_error("SDL_CreateThread (índice) falhou, ROIs leem os pixels");
+}
 
-  // cria backup da imagem em cinza para poder reverter
-  img.original_gray = SDL_CreateSurface(img.w, img.h, SDL_PIXELFORMAT_RGBA32);
-  if (!img.original_gray) {
-    SDL_Log("Falha ao criar surface original_gray: %s", SDL_GetError());
-    cleanup_all(NULL, &img); return 1;
+//histograma exato de [x0,x1) x [y0,y1) da original: o miolo alinhado aos blocos sai de
+//4 cantos do índice; as bordas parciais (< B px de largura) são lidas da imagem
+static void hist_index_query(const HistIndex* ix, const GrayPlane* src, int x0, int y0, int x1, int y1,
+                             Uint32 hist[256]) {
+  memset(hist, 0, sizeof(Uint32) * 256);
+  const int B = ix->block;
+  int bx0 = 0, by0 = 0, bx1 = 0, by1 = 0;
+  if (ix->cum && SDL_GetAtomicInt((SDL_AtomicInt*)&ix->ready)) {
+    bx0 = (x0 + B - 1) / B; bx1 = x1 / B;
+    by0 = (y0 + B - 1) / B; by1 = y1 / B;
   }
-  if (!SDL_LockSurface(img.surface_rgba) || !SDL_LockSurface(img.original_gray)) {
-    SDL_Log("Falha ao lockar para copiar original_gray: %s", SDL_GetError());
-    if (SDL_MUSTLOCK(img.original_gray)) SDL_UnlockSurface(img.original_gray);
-    if (SDL_MUSTLOCK(img.surface_rgba))  SDL_UnlockSurface(img.surface_rgba);
-    cleanup_all(NULL, &img); return 1;
+  if (bx0 >= bx1 || by0 >= by1) {
+    rect_histogram(src, x0, y0, x1, y1, hist);
+    return;
   }
-  memcpy(img.original_gray->pixels, img.surface_rgba->pixels,
-        (size_t)img.h * img.surface_rgba->pitch);
-  SDL_UnlockSurface(img.original_gray);
-  SDL_UnlockSurface(img.surface_rgba);
+  const size_t stride = (size_t)ix->nbx + 1;
+  const Uint32* a = ix->cum + 256 * ((size_t)by0 * stride + (size_t)bx0);
+  const Uint32* b = ix->cum + 256 * ((size_t)by0 * stride + (size_t)bx1);
+  const Uint32* c = ix->cum + 256 * ((size_t)by1 * stride + (size_t)bx0);
+  const Uint32* d = ix->cum + 256 * ((size_t)by1 * stride + (size_t)bx1);
+  for (int i = 0; i < 256; i++) hist[i] = d[i] - b[i] - c[i] + a[i];
+
+  const int ix0 = bx0 * B, ix1 = bx1 * B, iy0 = by0 * B, iy1 = by1 * B;
+  rect_histogram(src, x0, y0, x1, iy0, hist);   //faixa de cima
+  rect_histogram(src, x0, iy1, x1, y1, hist);   //de baixo
+  rect_histogram(src, x0, iy0, ix0, iy1, hist); //esquerda
+  rect_histogram(src, ix1, iy0, x1, iy1, hist); //direita
+}
 
+//CV_VRAM_MB define o orçamento de texturas dos blocos (padrão 256 MB)
+static bool tile_cache_init(TileCache* c) {
+  const char* env = SDL_getenv("CV_VRAM_MB");
+  Sint64 budget_mb = (env && atoi(env) > 0) ? atoi(env) : 256;
+  c->nslots = (int)(budget_mb * 1024 * 1024 / ((Sint64)TILE_SIZE * TILE_SIZE * 4));
+  if (c->nslots < 32) c->nslots = 32;
+  c->slots = (TileSlot*)calloc((size_t)c->nslots, sizeof(TileSlot));
+  if (!c->slots) { SDL_Log("Sem memória para o cache de blocos"); return false; }
+  for (int i = 0; i < c->nslots; i++) c->slots[i].level = -1;
+  SDL_Log("Cache de blocos: %d x %dx%d (%lld MB)", c->nslots, TILE_SIZE, TILE_SIZE, (long long)budget_mb);
+  return true;
+}
+
+static void tile_cache_free(TileCache* c) {
+  for (int i = 0; i < c->nslots; i++)
+    if (c->slots[i].tex) SDL_DestroyTexture(c->slots[i].tex);
+  free(c->slots);
+  memset(c, 0, sizeof(*c));
+}
+
+//expande um bloco do nível para a textura (RGBA) travada
+static bool tile_upload(const MipPyramid* p, TileSlot* slot) {
+  const GrayPlane* lv = &p->levels[slot->level];
+  const GrayPlane* al = &p->alpha[slot->level];
+  int x0 = slot->tx * TILE_SIZE, y0 = slot->ty * TILE_SIZE;
+  int tw = (lv->w - x0 < TILE_SIZE) ? lv->w - x0 : TILE_SIZE;
+  int th = (lv->h - y0 < TILE_SIZE) ? lv->h - y0 : TILE_SIZE;
+
+  void* pixels = NULL;
+  int pitch = 0;
+  SDL_Rect rect = { 0, 0, tw, th };
+  if (!SDL_LockTexture(slot->tex, &rect, &pixels, &pitch)) { log_sdl_error("SDL_LockTexture (bloco) falhou"); return false; }
+  Uint64 tr = trace_begin();
+  for (int r = 0; r < th; r++)
+    g_kernels->row_expand(plane_row(lv, y0 + r) + x0, al->pixels ? plane_row(al, y0 + r) + x0 : NULL,
+                          (Uint8*)pixels + (size_t)r * pitch, tw);
+  SDL_UnlockTexture(slot->tex);
+  trace_end(PH_UPLOAD, tr);
+  return true;
+}
+
+//devolve o bloco pronto para desenhar: acerto no cache, reenvio se a geração mudou,
+//ou despejo do menos usado recentemente (nunca um já usado neste quadro)
+static TileSlot* tile_acquire(TileCache* c, const MipPyramid* p, SDL_Renderer* rr, int level, int tx, int ty) {
+  TileSlot* victim = NULL;
+  for (int i = 0; i < c->nslots; i++) {
+    TileSlot* s = &c->slots[i];
+    if (s->level == level && s->tx == tx && s->ty == ty) { victim = s; break; }
+    if (s->last_used == c->frame && s->level >= 0) continue;
+    if (!victim || s->level < 0 || (victim->level >= 0 && s->last_used < victim->last_used)) victim = s;
+  }
+  if (!victim) return NULL;
+
+  bool hit = victim->level == level && victim->tx == tx && victim->ty == ty;
+  victim->last_used = c->frame;
+  if (hit && victim->gen == c->gen) return victim;
+
+  if (!victim->tex) {
+    victim->tex = SDL_CreateTexture(rr, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, TILE_SIZE, TILE_SIZE);
+    if (!victim->tex) { log_sdl_error("SDL_CreateTexture (bloco) falhou"); return NULL; }
+  }
+  victim->level = level;
+  victim->tx = tx;
+  victim->ty = ty;
+  victim->gen = c->gen;
+  if (!tile_upload(p, victim)) { victim->level = -1; return NULL; }
+  return victim;
+}
+
+//janela -> imagem: escala e coordenada da imagem no canto superior esquerdo da janela
+static void view_transform(const ViewState* v, const ImageData* img, int ww, int wh,
+                           float* scale, float* ox, float* oy) {
+  float fit = ((float)ww / img->w < (float)wh / img->h) ? (float)ww / img->w : (float)wh / img->h;
+  float s  = v->fit ? fit : v->zoom;
+  float cx = v->fit ? img->w * 0.5f : v->cx;
+  float cy = v->fit ? img->h * 0.5f : v->cy;
+  *scale = s;
+  *ox = cx - (float)ww / (2.0f * s);
+  *oy = cy - (float)wh / (2.0f * s);
+}
+
+//desenha só os blocos visíveis no nível cuja resolução ainda cobre a da tela; se os
+//blocos não cabem no orçamento (pirâmide ainda sendo gerada), mostra o progresso
+static void render_tiles(UIContext* ui, ImageData* img, int ww, int wh, float scale, float ox, float oy) {
+  TileCache* c = &img->tiles;
+  const MipPyramid* p = &img->pyr;
+  SDL_Renderer* rr = ui->mainApp.renderer;
+  int built = SDL_GetAtomicInt((SDL_AtomicInt*)&p->built);
+  c->frame++;
+
+  int level = 0;
+  while (level + 1 < built && scale * (float)(1 << (level + 1)) <= 1.0f) level++;
+
+  int tx0, tx1, ty0, ty1;
+  for (;;) {
+    const GrayPlane* lv = &p->levels[level];
+    float span = (float)(TILE_SIZE << level);
+    int ntx = (lv->w + TILE_SIZE - 1) / TILE_SIZE, nty = (lv->h + TILE_SIZE - 1) / TILE_SIZE;
+    tx0 = ox > 0.0f ? (int)(ox / span) : 0;
+    ty0 = oy > 0.0f ? (int)(oy / span) : 0;
+    tx1 = (int)ceilf((ox + (float)ww / scale) / span);
+    ty1 = (int)ceilf((oy + (float)wh / scale) / span);
+    if (tx1 > ntx) tx1 = ntx;
+    if (ty1 > nty) ty1 = nty;
+    if ((tx1 - tx0) * (ty1 - ty0) <= c->nslots || level + 1 >= built) break;
+    level++;
+  }
+  if ((tx1 - tx0) * (ty1 - ty0) > c->nslots) {
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Gerando pirâmide: nível %d de %d...", built, p->count);
+    draw_text(rr, &ui->labels, ui->font, msg, 12, 12);
+    return;
+  }
+
+  for (int ty = ty0; ty < ty1; ty++) {
+    for (int tx = tx0; tx < tx1; tx++) {
+      TileSlot* slot = tile_acquire(c, p, rr, level, tx, ty);
+      if (!slot) continue;
+      const GrayPlane* lv = &p->levels[level];
+      int tw = (lv->w - tx * TILE_SIZE < TILE_SIZE) ? lv->w - tx * TILE_SIZE : TILE_SIZE;
+      int th = (lv->h - ty * TILE_SIZE < TILE_SIZE) ? lv->h - ty * TILE_SIZE : TILE_SIZE;
+      float k = (float)(1 << level) * scale;
+      SDL_FRect src = { 0.0f, 0.0f, (float)tw, (float)th };
+      SDL_FRect dst = { ((float)(tx * (TILE_SIZE << level)) - ox) * scale,
+                        ((float)(ty * (TILE_SIZE << level)) - oy) * scale, tw * k, th * k };
+      SDL_RenderTexture(rr, slot->tex, &src, &dst);
+    }
+  }
+}
+
+//lote de quadriláteros da janela secundária: fundo, grade, barras, sobreposições, moldura,
+//botões e barra de progresso viram um único SDL_RenderGeometry por quadro
+static QuadBatch g_quads;
+static int       g_quad_indices[QUAD_BATCH_MAX * 6]; //0,1,2, 0,2,3 de cada quad (fixos)
+
+static SDL_FColor fcolor(Uint8 r, Uint8 g, Uint8 b) {
+  return (SDL_FColor){ r / 255.0f, g / 255.0f, b / 255.0f, 1.0f };
+}
+
+static void batch_quad(QuadBatch* q, const SDL_FPoint p[4], SDL_FColor c) {
+  if (q->quads == QUAD_BATCH_MAX) return;
+  SDL_Vertex* v = q->verts + (size_t)q->quads * 4;
+  for (int k = 0; k < 4; k++) v[k] = (SDL_Vertex){ p[k], c, { 0.0f, 0.0f } };
+  q->quads++;
+}
+
+static void batch_rect(QuadBatch* q, SDL_FRect r, SDL_FColor c) {
+  const SDL_FPoint p[4] = { { r.x, r.y }, { r.x + r.w, r.y }, { r.x + r.w, r.y + r.h }, { r.x, r.y + r.h } };
+  batch_quad(q, p, c);
+}
+
+//contorno de 1 px por dentro do retângulo, como o SDL_RenderRect
+static void batch_frame(QuadBatch* q, SDL_FRect r, SDL_FColor c) {
+  batch_rect(q, (SDL_FRect){ r.x, r.y, r.w, 1.0f }, c);
+  batch_rect(q, (SDL_FRect){ r.x, r.y + r.h - 1.0f, r.w, 1.0f }, c);
+  batch_rect(q, (SDL_FRect){ r.x, r.y, 1.0f, r.h }, c);
+  batch_rect(q, (SDL_FRect){ r.x + r.w - 1.0f, r.y, 1.0f, r.h }, c);
+}
+
+//segmento com espessura: quad alinhado à direção do segmento
+static void batch_segment(QuadBatch* q, float x0, float y0, float x1, float y1, float thick, SDL_FColor c) {
+  float dx = x1 - x0, dy = y1 - y0;
+  float len = sqrtf(dx * dx + dy * dy);
+  if (len <= 0.0f) return;
+  float nx = -dy / len * thick * 0.5f, ny = dx / len * thick * 0.5f;
+  const SDL_FPoint p[4] = { { x0 + nx, y0 + ny }, { x1 + nx, y1 + ny }, { x1 - nx, y1 - ny }, { x0 - nx, y0 - ny } };
+  batch_quad(q, p, c);
+}
+
+static void batch_flush(SDL_Renderer* rr, QuadBatch* q) {
+  static bool indices_ready = false;
+  if (!indices_ready) {
+    static const int pattern[6] = { 0, 1, 2, 0, 2, 3 };
+    for (int i = 0; i < QUAD_BATCH_MAX * 6; i++) g_quad_indices[i] = (i / 6) * 4 + pattern[i % 6];
+    indices_ready = true;
+  }
+  if (q->quads > 0 && !SDL_RenderGeometry(rr, NULL, q->verts, q->quads * 4, g_quad_indices, q->quads * 6))
+    log_sdl_error("SDL_RenderGeometry falhou");
+  q->quads = 0;
+}
+
+//histograma no lote: barras lineares e, opcionalmente, a escala log atrás delas (log1p
+//normalizado, sempre >= a linear) e a CDF como uma linha por cima
+static void draw_histogram(QuadBatch* q, const Uint32 hist[256], SDL_FRect area, float yzoom,
+                           bool log_scale, bool cdf)
+{
+  // fundo
+  batch_rect(q, area, fcolor(30,30,30));
+  for (int i = 1; i <= 4; i++) {
+    float y = area.y + (area.h * i) / 5.0f;
+    batch_rect(q, (SDL_FRect){ area.x, y, area.w, 1.0f }, fcolor(60,60,60));
+  }
+
+  // max
+  Uint32 maxv = 1;
+  Uint64 total = 0;
+  for (int i = 0; i < 256; i++) {
+    if (hist[i] > maxv) maxv = hist[i];
+    total += hist[i];
+  }
+
+  // barras
+  float barw = area.w / 256.0f;
+  if (barw < 2.0f) barw = 2.0f; // deixa as barras mais grossas
+
+  float usableH = area.h - 2.0f;
+  if (log_scale) {
+    const float lmax = log1pf((float)maxv);
+    for (int i = 0; i < 256; i++) {
+      float h = log1pf((float)hist[i]) / lmax * usableH * yzoom;
+      if (h > usableH) h = usableH;
+      batch_rect(q, (SDL_FRect){ area.x + i * (area.w/256.0f), area.y + (area.h - h), barw, h }, fcolor(70,110,170));
+    }
+  }
+  for (int i = 0; i < 256; i++) {
+    float h = ((float)hist[i] / (float)maxv) * usableH * yzoom;
+    if (h > usableH) h = usableH; // clampa
+    batch_rect(q, (SDL_FRect){ area.x + i * (area.w/256.0f), area.y + (area.h - h), barw, h }, fcolor(220,220,220));
+  }
+
+  // CDF de 0 (base) a 1 (topo), sem o zoom vertical
+  if (cdf && total > 0) {
+    Uint64 cum = 0;
+    float px = 0.0f, py = 0.0f;
+    for (int i = 0; i < 256; i++) {
+      cum += hist[i];
+      float x = area.x + (i + 0.5f) * (area.w/256.0f);
+      float y = area.y + area.h - 1.0f - (float)((double)cum / (double)total) * usableH;
+      if (i > 0) batch_segment(q, px, py, x, y, 1.5f, fcolor(240,160,40));
+      px = x;
+      py = y;
+    }
+  }
+
+  // moldura
+  batch_frame(q, area, fcolor(100,100,100));
+}
+
+static void label_cache_free(LabelCache* c) {
+  for (int i = 0; i < LABEL_CACHE_SIZE; i++)
+    if (c->entries[i].tex) SDL_DestroyTexture(c->entries[i].tex);
+  memset(c, 0, sizeof(*c));
+}
+
+//textura de um rótulo, pela chave (renderer, cor, texto). o texto só é rasterizado quando
+//muda; a entrada usada há mais tempo é a que sai. texto maior que a entrada é cortado
+//(a chave e o que se desenha são o mesmo texto cortado)
+static const LabelEntry* label_get(LabelCache* c, SDL_Renderer* rr, TTF_Font* font, const char* msg, SDL_Color color) {
+  if (!font || !msg || !*msg) return NULL;
+  LabelEntry* victim = &c->entries[0];
+  for (int i = 0; i < LABEL_CACHE_SIZE; i++) {
+    LabelEntry* e = &c->entries[i];
+    if (e->rr == rr && e->color.r == color.r && e->color.g == color.g && e->color.b == color.b &&
+        e->color.a == color.a && strncmp(e->text, msg, LABEL_MAX_LEN - 1) == 0) {
+      e->used = ++c->tick;
+      return e;
+    }
+    if (e->used < victim->used) victim = e;
+  }
+
+  if (victim->tex) SDL_DestroyTexture(victim->tex);
+  memset(victim, 0, sizeof(*victim));
+  snprintf(victim->text, sizeof(victim->text), "%s", msg);
+  // length = 0  => string null-terminated (UTF-8)
+  SDL_Surface* surf = TTF_RenderText_Blended(font, victim->text, 0, color);
+  if (!surf) {
+    SDL_Log("TTF_RenderText_Blended falhou: %s", SDL_GetError());
+    return NULL;
+  }
+  victim->tex = SDL_CreateTextureFromSurface(rr, surf);
+  if (!victim->tex) {
+    SDL_Log("CreateTextureFromSurface (texto) falhou: %s", SDL_GetError());
+    SDL_DestroySurface(surf);
+    return NULL;
+  }
+  victim->rr = rr;
+  victim->color = color;
+  victim->w = surf->w;
+  victim->h = surf->h;
+  victim->used = ++c->tick;
+  SDL_DestroySurface(surf);
+  return victim;
+}
+
+static void draw_text(SDL_Renderer* rr, LabelCache* labels, TTF_Font* font,
+                      const char* msg, int x, int y)
+{
+  const LabelEntry* e = label_get(labels, rr, font, msg, (SDL_Color){ 230, 230, 230, 255 });
+  if (!e) return;
+  SDL_FRect dst = { (float)x, (float)y, (float)e->w, (float)e->h };
+  SDL_RenderTexture(rr, e->tex, NULL, &dst);
+}
+
+//fundo e borda do botão vão para o lote; o rótulo é desenhado depois do lote
+static void batch_button(QuadBatch* q, const UIButton* btn) {
+  // cores por estado
+  SDL_FColor fill;
+  switch (btn->state) {
+    case BTN_IDLE:   fill = fcolor(  0,102,204); break; // azul
+    case BTN_HOVER:  fill = fcolor( 30,144,255); break; // azul claro
+    case BTN_ACTIVE: fill = fcolor(  0, 70,160); break; // azul escuro
+    default:         fill = fcolor(  0,102,204); break;
+  }
+  batch_rect(q, btn->rect, fill);
+
+  // borda
+  batch_frame(q, btn->rect, fcolor(20,20,20));
+}
+
+static void draw_button_label(SDL_Renderer* rr, LabelCache* labels, const UIButton* btn, TTF_Font* font,
+                              const char* label) {
+  const LabelEntry* e = label_get(labels, rr, font, label, (SDL_Color){240,240,240,255});
+  if (!e) return;
+  SDL_FRect dst = {
+    btn->rect.x + (btn->rect.w - e->w) * 0.5f,
+    btn->rect.y + (btn->rect.h - e->h) * 0.5f,
+    (float)e->w, (float)e->h
+  };
+  SDL_RenderTexture(rr, e->tex, NULL, &dst);
+}
+
+
+
+
+//window principal: adapta ao tamanho da imagem e centraliza
+static bool create_main_window(UIContext* ui, int imgw, int imgh) {
+  //limite um pouco o tamanho inicial pra não extrapolar telas muito pequenas
+  int w = imgw, h = imgh;
+  if (w > 1400) { float s = 1400.0f / (float)w; w = 1400; h = (int)(imgh * s); }
+  if (h > 900)  { float s =  900.0f / (float)h; h = 900;  w = (int)(w * s); }
+
+  ui->mainApp.window = SDL_CreateWindow("Imagem (principal)", w, h, SDL_WINDOW_RESIZABLE);
+  if (!ui->mainApp.window) { log_sdl_error("Create main window"); return false; }
+  SDL_SetWindowPosition(ui->mainApp.window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
+
+  ui->mainApp.renderer = SDL_CreateRenderer(ui->mainApp.window, NULL);
+  if (!ui->mainApp.renderer) { log_sdl_error("Create main renderer"); return false; }
+  return true;
+}
+
+static bool create_side_window(UIContext* ui) {
+  ui->sideApp.window = SDL_CreateWindow("Histograma (secundária)", SIDE_W, SIDE_H, 0);
+  if (!ui->sideApp.window) { log_sdl_error("Create side window"); return false; }
+
+  ui->sideApp.renderer = SDL_CreateRenderer(ui->sideApp.window, NULL);
+  if (!ui->sideApp.renderer) { log_sdl_error("Create side renderer"); return false; }
+
+  //posiciona ao lado direito da principal
+  int x,y,w,h;
+  SDL_GetWindowPosition(ui->mainApp.window, &x,&y);
+  SDL_GetWindowSize(ui->mainApp.window, &w,&h);
+  SDL_SetWindowPosition(ui->sideApp.window, x + w + SIDE_MARGIN, y);
+
+  //botão embaixo do histograma
+  ui->eqButton.rect.x = SIDE_MARGIN;
+  ui->eqButton.rect.w = BUTTON_W;
+  ui->eqButton.rect.h = BUTTON_H;
+  ui->eqButton.rect.y = 0;
+  ui->eqButton.state  = BTN_IDLE;
+
+  //CLAHE ao lado
+  ui->claheButton.rect.x = SIDE_MARGIN + BUTTON_W + SIDE_MARGIN / 2;
+  ui->claheButton.rect.w = BUTTON_W;
+  ui->claheButton.rect.h = BUTTON_H;
+  ui->claheButton.rect.y = 0;
+  ui->claheButton.state  = BTN_IDLE;
+
+  //filtro espacial no fim da linha, ocupando o resto da largura
+  ui->filterButton.rect.x = ui->claheButton.rect.x + BUTTON_W + SIDE_MARGIN / 2;
+  ui->filterButton.rect.w = SIDE_W - SIDE_MARGIN - ui->filterButton.rect.x;
+  ui->filterButton.rect.h = BUTTON_H;
+  ui->filterButton.rect.y = 0;
+  ui->filterButton.state  = BTN_IDLE;
+  return true;
+}
+
+
+
+static void cleanup_all(UIContext* ui) {
+  full_pass_cancel(ui); //lê planos das imagens da sessão
+  save_finish(ui);
+  if (ui->font) { TTF_CloseFont(ui->font); ui->font = NULL; }
+  label_cache_free(&ui->labels);
+  session_free(&ui->session); //texturas antes dos renderers
+  history_clear(&ui->history);
+  if (ui->mainApp.renderer) SDL_DestroyRenderer(ui->mainApp.renderer);
+  if (ui->mainApp.window)   SDL_DestroyWindow(ui->mainApp.window);
+  if (ui->sideApp.renderer) SDL_DestroyRenderer(ui->sideApp.renderer);
+  if (ui->sideApp.window)   SDL_DestroyWindow(ui->sideApp.window);
+}
+
+static bool point_in_rect(float x, float y, SDL_FRect r) {
+  return (x >= r.x && x <= r.x + r.w && y >= r.y && y <= r.y + r.h);
+}
+
+//a textura é reaproveitada: só as linhas marcadas em mark_texture_rows são reenviadas
+static void rebuild_texture(ImageData* img, SDL_Renderer* rr) {
+  if (img->tiled) {
+    //em blocos: a nova geração invalida os blocos enviados e a pirâmide é refeita
+    img->tex_y0 = img->tex_y1 = 0;
+    img->tiles.gen++;
+    pyramid_start(img);
+    return;
+  }
+  bool ok = img->texture ? sync_texture_rows(img) : upload_texture_gray(img, rr);
+  if (!ok) SDL_Log("Upload da textura falhou");
+}
+
+//com um ROI marcado as estatísticas (e o histograma) são as da região
+static void update_stat_labels(UIContext* ui) {
+  const RoiState* r = &ui->roi;
+  hist_mean_stddev(r->active ? r->hist : ui->hist, &ui->mean, &ui->stddev);
+  if (!r->active && ui->deep_maxval > 0) {
+    //16 bits: valores na escala da imagem, classificados como se fossem 0..255
+    float k = 255.0f / (float)ui->deep_maxval;
+    snprintf(ui->meanLabel, sizeof(ui->meanLabel), "Média de intensidade: %.1f/%d (%s)",
+             ui->deep_mean, ui->deep_maxval, classify_mean(ui->deep_mean * k));
+    snprintf(ui->stdLabel, sizeof(ui->stdLabel), "Desvio padrão: %.1f (contraste %s)",
+             ui->deep_stddev, classify_stddev(ui->deep_stddev * k));
+    return;
+  }
+  if (r->active)
+    snprintf(ui->meanLabel, sizeof(ui->meanLabel), "Média (ROI %dx%d): %.1f (%s)",
+             r->x1 - r->x0, r->y1 - r->y0, ui->mean, classify_mean(ui->mean));
+  else
+    snprintf(ui->meanLabel, sizeof(ui->meanLabel),
+             "Média de intensidade: %.1f (%s)", ui->mean, classify_mean(ui->mean));
+  snprintf(ui->stdLabel, sizeof(ui->stdLabel),
+           "Desvio padrão: %.1f (contraste %s)", ui->stddev, classify_stddev(ui->stddev));
+  if (ui->stats_approx) {
+    size_t len = strlen(ui->meanLabel);
+    snprintf(ui->meanLabel + len, sizeof(ui->meanLabel) - len, " (prévia)");
+  }
+}
+
+//imagem de 16 bits sem estágios espaciais nem modo só ROI: a pilha roda sobre o Y16 e o
+//Y8 é só a exibição. filtro, CLAHE e só ROI trabalham na exibição de 8 bits
+static bool deep_path(const UIContext* ui, const ImageData* img) {
+  return img->deep.pixels && ui->filter.kind == FILTER_NONE && !ui->clahe_on && !ui->roi.only;
+}
+
+//base da pilha: original -> filtro -> CLAHE, cada estágio só quando ligado
+static const GrayPlane* stack_base(const UIContext* ui, const ImageData* img, const Uint32** hist) {
+  if (ui->clahe_on) { *hist = ui->clahe_hist; return &img->clahe; }
+  if (ui->filter.kind != FILTER_NONE) { *hist = ui->filter_hist; return &img->filtered; }
+  *hist = ui->src_hist;
+  return &img->original_gray;
+}
+
+//histograma do ROI na base da pilha (original pelo índice, ou a saída do filtro/CLAHE) e a
+//LUT que vale dentro dele; o histograma exibido sai do remapeamento, sem reler os pixels
+static void roi_compute(UIContext* ui, ImageData* img, Uint32 base_hist[256], Uint8 lut[256]) {
+  RoiState* r = &ui->roi;
+  if (deep_path(ui, img)) {
+    //16 bits: a LUT não é função do Y8 da base, o histograma sai da própria exibição
+    memset(r->hist, 0, sizeof(r->hist));
+    rect_histogram(&img->gray, r->x0, r->y0, r->x1, r->y1, r->hist);
+    return;
+  }
+  stages_sync(ui, img);
+  const Uint32* unused;
+  const GrayPlane* base = stack_base(ui, img, &unused);
+  if (base != &img->original_gray) {
+    memset(base_hist, 0, sizeof(Uint32) * 256);
+    rect_histogram(base, r->x0, r->y0, r->x1, r->y1, base_hist);
+  } else {
+    hist_index_query(&img->hindex, &img->original_gray, r->x0, r->y0, r->x1, r->y1, base_hist);
+  }
+  if (r->only) {
+    //só no ROI: a pilha (vazia = equalizar) é composta com o histograma da região
+    static const PointOpStack equalize_only = { { { OP_EQUALIZE, 0.0f } }, 1 };
+    point_stack_build_lut(ui->ops.count > 0 ? &ui->ops : &equalize_only, base_hist, lut, r->hist);
+    return;
+  }
+  memcpy(lut, ui->lut, 256);
+  memset(r->hist, 0, sizeof(r->hist));
+  for (int i = 0; i < 256; i++) r->hist[lut[i]] += base_hist[i];
+}
+
+//rótulo da pipeline (filtro | CLAHE | pilha) e o estado do botão de equalizar
+static void describe_pipeline(UIContext* ui, const ImageData* img) {
+  ui->is_equalized = false;
+  for (int i = 0; i < ui->ops.count; i++)
+    if (ui->ops.ops[i].kind == OP_EQUALIZE) ui->is_equalized = true;
+
+  int len = 0;
+  if (ui->filter.kind != FILTER_NONE) {
+    filter_describe(&ui->filter, ui->opsLabel, sizeof(ui->opsLabel) - 3);
+    len = (int)strlen(ui->opsLabel);
+    len += snprintf(ui->opsLabel + len, sizeof(ui->opsLabel) - (size_t)len, " | ");
+  }
+  if (ui->clahe_on)
+    len += snprintf(ui->opsLabel + len, sizeof(ui->opsLabel) - (size_t)len, "CLAHE %dx%d/%.1f | ",
+                    ui->clahe.tiles_x, ui->clahe.tiles_y, ui->clahe.clip);
+  point_stack_describe(&ui->ops, ui->opsLabel + len, sizeof(ui->opsLabel) - (size_t)len);
+  if (ui->roi.only) {
+    len = (int)strlen(ui->opsLabel);
+    snprintf(ui->opsLabel + len, sizeof(ui->opsLabel) - (size_t)len, ui->roi.active ? " (só ROI)" : " (só ROI: marque)");
+  }
+  if (img->deep.pixels) {
+    len = (int)strlen(ui->opsLabel);
+    snprintf(ui->opsLabel + len, sizeof(ui->opsLabel) - (size_t)len, deep_path(ui, img) ? " [16 bits]" : " [8 bits]");
+  }
+  if (ui->full.thread) {
+    len = (int)strlen(ui->opsLabel);
+    snprintf(ui->opsLabel + len, sizeof(ui->opsLabel) - (size_t)len, " (calculando...)");
+  }
+}
+
+//pilha em 16 bits: Y16 original -> deep_out e a exibição em gray na mesma passada; sem
+//operações só a exibição é refeita e a saída de 16 bits é o próprio original
+static void apply_deep_ops(UIContext* ui, ImageData* img) {
+  Uint32* lut = (Uint32*)malloc(sizeof(Uint32) * HIST16_BINS * 2);
+  Uint32* out_hist16 = lut ? lut + HIST16_BINS : NULL;
+  bool ok = lut && point_stack_build_lut16(&ui->ops, img->hist16, img->maxval, lut, out_hist16, ui->hist);
+  if (ok && ui->ops.count > 0 && !img->deep_out.pixels) ok = plane16_alloc(&img->deep_out, img->w, img->h);
+  if (!ok) {
+    SDL_Log("Sem memória para a pilha em 16 bits");
+    free(lut);
+    return;
+  }
+  if (ui->ops.count == 0) plane16_free(&img->deep_out);
+  plane_apply_lut16(&img->deep, img->deep_out.pixels ? &img->deep_out : NULL, &img->gray, lut);
+  hist_mean_stddev_n(out_hist16, img->maxval + 1, &ui->deep_mean, &ui->deep_stddev);
+  ui->deep_maxval = img->maxval;
+  for (int i = 0; i < 256; i++) ui->lut[i] = (Uint8)i; //a LUT de 8 bits não se aplica
+  img->deep_valid = true;
+  free(lut);
+}
+
+//recompõe a LUT da pilha a partir do histograma da original e aplica em uma passada
+//original -> trabalho; o novo histograma sai do remapeamento, sem reler os pixels
+static void apply_point_ops(UIContext* ui, ImageData* img) {
+  pyramid_stop(&img->pyr); //a pirâmide lê o plano de trabalho em segundo plano
+  stages_sync(ui, img);
+  //com filtro/CLAHE ligados a pilha parte da saída (já calculada) do último estágio
+  const Uint32* base_hist;
+  const GrayPlane* base = stack_base(ui, img, &base_hist);
+  RoiState* r = &ui->roi;
+
+  Uint64 tr = trace_begin();
+  Uint32 roi_base[256];
+  Uint8 roi_lut[256];
+  const bool deep = deep_path(ui, img);
+  img->deep_valid = false;
+  ui->deep_maxval = 0;
+  if (deep) apply_deep_ops(ui, img);
+  else      point_stack_build_lut(&ui->ops, base_hist, ui->lut, ui->hist);
+  if (r->active) roi_compute(ui, img, roi_base, roi_lut);
+  if (deep) {
+    //a pilha já rodou em 16 bits
+  } else if (r->active && r->only) {
+    //fora do ROI fica a base; o histograma da imagem troca só a parte da região
+    plane_copy(&img->gray, base);
+    GrayPlane src = plane_view(base, r->x0, r->y0, r->x1, r->y1);
+    GrayPlane dst = plane_view(&img->gray, r->x0, r->y0, r->x1, r->y1);
+    plane_apply_lut(&src, &dst, roi_lut);
+    for (int i = 0; i < 256; i++) ui->hist[i] = base_hist[i] - roi_base[i] + r->hist[i];
+  } else if (ui->ops.count == 0) {
+    plane_copy(&img->gray, base);
+  } else {
+    plane_apply_lut(base, &img->gray, ui->lut);
+  }
+  trace_end(PH_POINT_OPS, tr);
+  mark_texture_rows(img, 0, img->h);
+  describe_pipeline(ui, img);
+
+  rebuild_texture(img, ui->mainApp.renderer);
+  update_stat_labels(ui);
+  ui->dirty |= DIRTY_MAIN_IMAGE | DIRTY_SIDE_HIST | DIRTY_SIDE_BUTTON;
+}
+
+//a pilha mudou: imagem com proxy mostra a prévia e refaz em segundo plano, as outras na hora
+static void point_ops_changed(UIContext* ui, ImageData* img) {
+  if (!full_pass_request(ui, img, STAGE_POINT_OPS)) apply_point_ops(ui, img);
+}
+
+//janela principal -> px da imagem, limitado à imagem
+static void roi_image_point(UIContext* ui, const ImageData* img, float mx, float my, float* ix, float* iy) {
+  int ww, wh;
+  SDL_GetWindowSize(ui->mainApp.window, &ww, &wh);
+  float scale, ox, oy;
+  view_transform(&ui->view, img, ww, wh, &scale, &ox, &oy);
+  *ix = SDL_clamp(ox + mx / scale, 0.0f, (float)img->w);
+  *iy = SDL_clamp(oy + my / scale, 0.0f, (float)img->h);
+}
+
+static void roi_begin(UIContext* ui, const ImageData* img, float mx, float my) {
+  roi_image_point(ui, img, mx, my, &ui->roi.ax, &ui->roi.ay);
+  ui->roi.dragging = true;
+}
+
+//cada movimento só consulta o índice: histograma e estatísticas acompanham o arrasto
+static void roi_drag(UIContext* ui, ImageData* img, float mx, float my) {
+  RoiState* r = &ui->roi;
+  float ix, iy;
+  roi_image_point(ui, img, mx, my, &ix, &iy);
+  r->x0 = (int)floorf(SDL_min(r->ax, ix));
+  r->x1 = (int)ceilf(SDL_max(r->ax, ix));
+  r->y0 = (int)floorf(SDL_min(r->ay, iy));
+  r->y1 = (int)ceilf(SDL_max(r->ay, iy));
+  r->active = r->x1 - r->x0 >= 2 && r->y1 - r->y0 >= 2;
+  if (r->active) {
+    Uint32 base_hist[256];
+    Uint8 lut[256];
+    roi_compute(ui, img, base_hist, lut);
+  }
+  update_stat_labels(ui);
+  ui->dirty |= DIRTY_MAIN_IMAGE | DIRTY_SIDE_HIST;
+}
+
+//soltou: um clique sem arrasto descarta o ROI; no modo "só ROI" a imagem é refeita
+static void roi_end(UIContext* ui, ImageData* img, float mx, float my) {
+  roi_drag(ui, img, mx, my);
+  ui->roi.dragging = false;
+  if (ui->roi.only) apply_point_ops(ui, img);
+}
+
+static void toggle_roi_only(UIContext* ui, ImageData* img) {
+  full_pass_finish(ui); //o modo só ROI segue pelo caminho síncrono
+  ui->roi.only = !ui->roi.only;
+  apply_point_ops(ui, img);
+}
+
+//(re)calcula o CLAHE da original (ou da saída do filtro) com os parâmetros atuais
+static bool refresh_clahe(UIContext* ui, ImageData* img) {
+  if (!img->clahe.pixels && !plane_alloc(&img->clahe, img->w, img->h)) {
+    SDL_Log("Sem memória para o plano do CLAHE");
+    return false;
+  }
+  const GrayPlane* src = ui->filter.kind != FILTER_NONE ? &img->filtered : &img->original_gray;
+  Uint64 t0 = SDL_GetTicksNS(), tr = trace_begin();
+  bool ok = plane_clahe(src, &img->clahe, &ui->clahe, ui->clahe_hist);
+  trace_end(PH_CLAHE, tr);
+  if (!ok) return false;
+  SDL_Log("CLAHE %dx%d clip %.1f: %.1f ms", ui->clahe.tiles_x, ui->clahe.tiles_y, ui->clahe.clip,
+          (double)(SDL_GetTicksNS() - t0) / 1e6);
+  return true;
+}
+
+static void toggle_clahe(UIContext* ui, ImageData* img) {
+  if (full_pass_eligible(ui, img)) {
+    ui->clahe_on = !ui->clahe_on; //desligar só troca a base da pilha
+    full_pass_request(ui, img, ui->clahe_on ? STAGE_CLAHE : STAGE_POINT_OPS);
+    return;
+  }
+  if (!ui->clahe_on && !refresh_clahe(ui, img)) return;
+  ui->clahe_on = !ui->clahe_on;
+  apply_point_ops(ui, img);
+}
+
+//(re)calcula o filtro sobre a original; sem filtro, libera o plano
+static bool refresh_filter(UIContext* ui, ImageData* img) {
+  if (ui->filter.kind == FILTER_NONE) {
+    plane_free(&img->filtered);
+    return true;
+  }
+  if (!img->filtered.pixels && !plane_alloc(&img->filtered, img->w, img->h)) {
+    SDL_Log("Sem memória para o plano do filtro");
+    return false;
+  }
+  Uint64 t0 = SDL_GetTicksNS(), tr = trace_begin();
+  bool ok = plane_filter(&img->original_gray, &img->filtered, &ui->filter, ui->filter_hist);
+  trace_end(PH_FILTER, tr);
+  if (!ok) return false;
+  char desc[48];
+  filter_describe(&ui->filter, desc, sizeof(desc));
+  SDL_Log("Filtro %s: %.1f ms", desc, (double)(SDL_GetTicksNS() - t0) / 1e6);
+  return true;
+}
+
+//troca o filtro (ou só o parâmetro) e refaz o que depende dele: CLAHE e a pilha
+static void set_filter(UIContext* ui, ImageData* img, const FilterParams* f) {
+  FilterParams prev = ui->filter;
+  ui->filter = *f;
+  if (full_pass_request(ui, img, STAGE_FILTER)) return;
+  if (!refresh_filter(ui, img)) {
+    ui->filter = prev;
+    return;
+  }
+  if (ui->clahe_on && !refresh_clahe(ui, img)) ui->clahe_on = false;
+  apply_point_ops(ui, img);
+}
+
+//botão/tecla B: nenhum -> gauss -> caixa -> unsharp -> Sobel -> Scharr -> mediana -> nenhum
+static void cycle_filter(UIContext* ui, ImageData* img) {
+  FilterParams f;
+  filter_set_kind(&f, (FilterKind)((ui->filter.kind + 1) % FILTER_COUNT));
+  set_filter(ui, img, &f);
+}
+
+//N/M: sigma (passos de 0.5) ou raio da caixa (passos de 1)
+static void adjust_filter(UIContext* ui, ImageData* img, int dir) {
+  FilterParams f = ui->filter;
+  if (f.kind == FILTER_BOX)
+    f.size = SDL_clamp(f.size + (float)dir, 1.0f, (float)FILTER_MAX_RADIUS);
+  else if (f.kind == FILTER_GAUSSIAN || f.kind == FILTER_UNSHARP)
+    f.size = SDL_clamp(f.size + 0.5f * (float)dir, 0.5f, FILTER_MAX_RADIUS / 3.0f);
+  else
+    return;
+  if (f.size != ui->filter.size) set_filter(ui, img, &f);
+}
+
+//planos do filtro/CLAHE refeitos para o passo atual do histórico, se ficaram para trás
+static void stages_sync(UIContext* ui, ImageData* img) {
+  if (!ui->history.stale) return;
+  ui->history.stale = false;
+  if (!refresh_filter(ui, img)) ui->filter.kind = FILTER_NONE;
+  if (ui->clahe_on && !refresh_clahe(ui, img)) ui->clahe_on = false;
+}
+
+static void history_free_tiles(HistoryEntry* e) {
+  for (int i = 0; i < e->ntiles; i++) free(e->tiles[i].data);
+  free(e->tiles);
+  e->tiles = NULL;
+  e->ntiles = 0;
+  e->bytes = sizeof(HistoryEntry);
+}
+
+static void history_clear(History* h) {
+  for (int i = 0; i < h->count; i++) history_free_tiles(&h->entries[i]);
+  free(h->entries);
+  plane_free(&h->snap);
+  memset(h, 0, sizeof(*h));
+}
+
+//estado da pipeline e o resultado (LUT e histogramas) que ele produziu
+static void history_capture(const UIContext* ui, HistoryEntry* e) {
+  memset(e, 0, sizeof(*e));
+  e->ops = ui->ops;
+  e->filter = ui->filter;
+  e->clahe = ui->clahe;
+  e->clahe_on = ui->clahe_on;
+  e->roi = ui->roi;
+  e->roi.dragging = false;
+  memcpy(e->lut, ui->lut, sizeof(e->lut));
+  memcpy(e->hist, ui->hist, sizeof(e->hist));
+  e->bytes = sizeof(HistoryEntry);
+}
+
+//mesma base da pilha: filtro e CLAHE iguais
+static bool history_same_stages(const HistoryEntry* a, const HistoryEntry* b) {
+  if (memcmp(&a->filter, &b->filter, sizeof(a->filter)) != 0 || a->clahe_on != b->clahe_on) return false;
+  return !a->clahe_on || memcmp(&a->clahe, &b->clahe, sizeof(a->clahe)) == 0;
+}
+
+static bool history_same_roi(const RoiState* a, const RoiState* b) {
+  if (a->only != b->only) return false;
+  return !a->only || (a->active == b->active && a->x0 == b->x0 && a->y0 == b->y0 && a->x1 == b->x1 && a->y1 == b->y1);
+}
+
+//XOR em RLE: c < 128 -> c+1 bytes literais; c >= 128 -> c-126 zeros (2..129).
+//blocos pouco alterados viram quase só corridas de zero
+static size_t delta_pack(const Uint8* x, int n, Uint8* out) {
+  size_t o = 0;
+  int i = 0;
+  while (i < n) {
+    int z = 0;
+    while (i + z < n && z < 129 && x[i + z] == 0) z++;
+    if (z >= 2) {
+      out[o++] = (Uint8)(126 + z);
+      i += z;
+      continue;
+    }
+    int lit = 0;
+    while (i + lit < n && lit < 128 && !(x[i + lit] == 0 && i + lit + 1 < n && x[i + lit + 1] == 0)) lit++;
+    out[o++] = (Uint8)(lit - 1);
+    memcpy(out + o, x + i, (size_t)lit);
+    o += (size_t)lit;
+    i += lit;
+  }
+  return o;
+}
+
+static void delta_unpack(const Uint8* in, Uint32 size, Uint8* x) {
+  for (Uint32 i = 0; i < size;) {
+    Uint8 c = in[i++];
+    if (c >= 128) {
+      memset(x, 0, (size_t)(c - 126));
+      x += c - 126;
+    } else {
+      memcpy(x, in + i, (size_t)c + 1);
+      x += c + 1;
+      i += c + 1u;
+    }
+  }
+}
+
+static void history_tile_rect(const GrayPlane* p, int tile, int* x0, int* y0, int* x1, int* y1) {
+  int tiles_x = (p->w + HISTORY_TILE - 1) / HISTORY_TILE;
+  *x0 = (tile % tiles_x) * HISTORY_TILE;
+  *y0 = (tile / tiles_x) * HISTORY_TILE;
+  *x1 = SDL_min(*x0 + HISTORY_TILE, p->w);
+  *y1 = SDL_min(*y0 + HISTORY_TILE, p->h);
+}
+
+typedef struct {
+  GrayPlane*   snap;
+  GrayPlane*   gray;
+  HistoryTile* slots;          //diff: um por bloco da grade; apply: os blocos do passo
+  int          nslots;
+  SDL_AtomicInt failed;
+} DeltaJob;
+
+//compara snap e trabalho bloco a bloco; os que mudaram viram delta e a snap é atualizada
+static void delta_diff_task(void* ctx, int band, int nbands) {
+  DeltaJob* job = (DeltaJob*)ctx;
+  Uint8 xor_buf[HISTORY_TILE * HISTORY_TILE];
+  Uint8 packed[HISTORY_TILE * HISTORY_TILE + HISTORY_TILE * HISTORY_TILE / 128 + 8];
+  int t0, t1;
+  band_rows(job->nslots, band, nbands, &t0, &t1);
+  for (int t = t0; t < t1; t++) {
+    int x0, y0, x1, y1;
+    history_tile_rect(job->gray, t, &x0, &y0, &x1, &y1);
+    int tw = x1 - x0, n = 0;
+    bool changed = false;
+    for (int y = y0; y < y1; y++) {
+      const Uint8* a = plane_row(job->snap, y) + x0;
+      const Uint8* b = plane_row(job->gray, y) + x0;
+      if (!changed && memcmp(a, b, (size_t)tw) == 0) { memset(xor_buf + n, 0, (size_t)tw); n += tw; continue; }
+      changed = true;
+      for (int x = 0; x < tw; x++) xor_buf[n++] = a[x] ^ b[x];
+    }
+    if (!changed) continue;
+    size_t size = delta_pack(xor_buf, n, packed);
+    Uint8* data = (Uint8*)malloc(size);
+    if (!data) { SDL_SetAtomicInt(&job->failed, 1); continue; }
+    memcpy(data, packed, size);
+    job->slots[t] = (HistoryTile){ t, (Uint32)size, data };
+    for (int y = y0; y < y1; y++) memcpy(plane_row(job->snap, y) + x0, plane_row(job->gray, y) + x0, (size_t)tw);
+  }
+}
+
+//aplica (desfaz ou refaz) os blocos de um passo no trabalho e na snap
+static void delta_apply_task(void* ctx, int band, int nbands) {
+  DeltaJob* job = (DeltaJob*)ctx;
+  Uint8 xor_buf[HISTORY_TILE * HISTORY_TILE];
+  int t0, t1;
+  band_rows(job->nslots, band, nbands, &t0, &t1);
+  for (int t = t0; t < t1; t++) {
+    const HistoryTile* ht = &job->slots[t];
+    int x0, y0, x1, y1;
+    history_tile_rect(job->gray, ht->tile, &x0, &y0, &x1, &y1);
+    delta_unpack(ht->data, ht->size, xor_buf);
+    const Uint8* d = xor_buf;
+    for (int y = y0; y < y1; y++, d += x1 - x0) {
+      Uint8* g = plane_row(job->gray, y) + x0;
+      for (int x = 0; x < x1 - x0; x++) g[x] ^= d[x];
+      memcpy(plane_row(job->snap, y) + x0, g, (size_t)(x1 - x0));
+    }
+  }
+}
+
+static int history_tile_count(const GrayPlane* p) {
+  return ((p->w + HISTORY_TILE - 1) / HISTORY_TILE) * ((p->h + HISTORY_TILE - 1) / HISTORY_TILE);
+}
+
+static bool history_diff(History* h, ImageData* img, HistoryEntry* e) {
+  DeltaJob job = { &h->snap, &img->gray, NULL, history_tile_count(&img->gray), { 0 } };
+  job.slots = (HistoryTile*)calloc((size_t)job.nslots, sizeof(HistoryTile));
+  if (!job.slots) return false;
+  parallel_for(band_count(job.nslots, 16), delta_diff_task, &job);
+  for (int t = 0; t < job.nslots; t++)
+    if (job.slots[t].data) job.slots[e->ntiles++] = job.slots[t];
+  e->tiles = job.slots;
+  e->spatial = true;
+  for (int i = 0; i < e->ntiles; i++) e->bytes += sizeof(HistoryTile) + e->tiles[i].size;
+  if (SDL_GetAtomicInt(&job.failed)) {
+    SDL_Log("Sem memória para o delta do histórico");
+    return false;
+  }
+  return true;
+}
+
+//XOR dos blocos do passo; só as linhas cobertas por eles voltam para a textura
+static void history_apply_tiles(History* h, ImageData* img, const HistoryEntry* e) {
+  if (e->ntiles == 0) return;
+  DeltaJob job = { &h->snap, &img->gray, e->tiles, e->ntiles, { 0 } };
+  parallel_for(band_count(e->ntiles, 16), delta_apply_task, &job);
+  int ymin = img->h, ymax = 0;
+  for (int i = 0; i < e->ntiles; i++) {
+    int x0, y0, x1, y1;
+    history_tile_rect(&img->gray, e->tiles[i].tile, &x0, &y0, &x1, &y1);
+    ymin = SDL_min(ymin, y0);
+    ymax = SDL_max(ymax, y1);
+  }
+  mark_texture_rows(img, ymin, ymax);
+}
+
+//novo passo base ao abrir uma imagem: o histórico anterior é da imagem anterior.
+//orçamento em CV_HISTORY_MB (padrão 64), sem contar a snap
+static void history_reset(UIContext* ui, ImageData* img) {
+  History* h = &ui->history;
+  for (int i = 0; i < h->count; i++) history_free_tiles(&h->entries[i]);
+  h->count = h->cur = 0;
+  ui->full.dropped = false;
+  h->used = 0;
+  h->stale = false;
+  if (h->budget == 0) {
+    const char* env = SDL_getenv("CV_HISTORY_MB");
+    h->budget = (size_t)(env && atoi(env) > 0 ? atoi(env) : 64) * 1024 * 1024;
+  }
+  if (h->snap.pixels && (h->snap.w != img->w || h->snap.h != img->h)) plane_free(&h->snap);
+  if (!h->snap.pixels && !plane_alloc(&h->snap, img->w, img->h)) return;
+  if (!h->entries) {
+    h->entries = (HistoryEntry*)malloc(sizeof(HistoryEntry) * 16);
+    if (!h->entries) { plane_free(&h->snap); return; }
+    h->cap = 16;
+  }
+  plane_copy(&h->snap, &img->gray);
+  history_capture(ui, &h->entries[0]);
+  h->count = 1;
+  h->used = h->entries[0].bytes;
+}
+
+//registra o estado atual como novo passo (descarta o que havia para refazer);
+//acima do orçamento os passos mais antigos saem primeiro
+static void history_commit(UIContext* ui, ImageData* img) {
+  History* h = &ui->history;
+  if (h->count == 0) return; //sem snap (falta de memória): histórico desligado
+  HistoryEntry e;
+  history_capture(ui, &e);
+  const HistoryEntry* prev = &h->entries[h->cur];
+  if (history_same_stages(prev, &e) && history_same_roi(&prev->roi, &e.roi) &&
+      memcmp(&prev->ops, &e.ops, sizeof(e.ops)) == 0)
+    return; //nada mudou (ex.: gama já no limite)
+  //só a pilha mudou (mesma base, fora do modo só ROI): a LUT basta para refazer
+  bool lut_only = history_same_stages(prev, &e) && !prev->roi.only && !e.roi.only;
+
+  for (int i = h->cur + 1; i < h->count; i++) {
+    h->used -= h->entries[i].bytes;
+    history_free_tiles(&h->entries[i]);
+  }
+  h->count = h->cur + 1;
+  if (h->count == h->cap) {
+    HistoryEntry* grown = (HistoryEntry*)realloc(h->entries, sizeof(HistoryEntry) * (size_t)h->cap * 2);
+    if (!grown) { SDL_Log("Sem memória para o histórico"); return; }
+    h->entries = grown;
+    h->cap *= 2;
+  }
+
+  Uint64 t0 = SDL_GetTicksNS();
+  if (lut_only) {
+    plane_copy(&h->snap, &img->gray);
+  } else if (!history_diff(h, img, &e)) {
+    for (int i = 0; i < e.ntiles; i++) free(e.tiles[i].data);
+    free(e.tiles);
+    history_reset(ui, img); //a snap ficou parcial: recomeça do estado atual
+    return;
+  }
+  h->entries[h->count++] = e;
+  h->cur = h->count - 1;
+  h->used += e.bytes;
+  ui->full.dropped = false;
+
+  while (h->used > h->budget && h->cur > 0) {
+    //o passo 1 vira a nova base: a transição que levava até ele não serve mais
+    h->used -= h->entries[0].bytes + h->entries[1].bytes - sizeof(HistoryEntry);
+    history_free_tiles(&h->entries[0]);
+    history_free_tiles(&h->entries[1]);
+    memmove(&h->entries[0], &h->entries[1], sizeof(HistoryEntry) * (size_t)(h->count - 1));
+    h->count--;
+    h->cur--;
+  }
+  SDL_Log("Histórico: passo %d (%s, %d blocos, %.1f KB), total %.1f MB, %.1f ms", h->cur,
+          e.spatial ? "blocos" : "LUT", e.ntiles, (double)e.bytes / 1024.0, (double)h->used / (1024.0 * 1024.0),
+          (double)(SDL_GetTicksNS() - t0) / 1e6);
+}
+
+//desfazer com uma edição ainda em resolução cheia: ela é descartada e a pipeline volta ao
+//passo atual, que é o que os planos ainda têm
+static void history_restore_current(UIContext* ui, ImageData* img) {
+  const HistoryEntry* e = &ui->history.entries[ui->history.cur];
+  ui->ops = e->ops;
+  ui->filter = e->filter;
+  ui->clahe = e->clahe;
+  ui->clahe_on = e->clahe_on;
+  memcpy(ui->lut, e->lut, sizeof(ui->lut));
+  memcpy(ui->hist, e->hist, sizeof(ui->hist));
+  SDL_Log("Desfazer: edição em andamento descartada (passo %d)", ui->history.cur);
+  describe_pipeline(ui, img);
+  update_stat_labels(ui);
+  ui->dirty |= DIRTY_MAIN_IMAGE | DIRTY_SIDE_HIST | DIRTY_SIDE_BUTTON;
+}
+
+//desfaz (dir < 0) ou refaz (dir > 0) um passo: blocos por XOR, passos de LUT pela LUT
+//guardada sobre a base; filtro/CLAHE só são recalculados quando voltarem a ser usados
+static void history_step(UIContext* ui, ImageData* img, int dir) {
+  History* h = &ui->history;
+  if (ui->full.thread) {
+    //edição ainda em resolução cheia: desfazer descarta ela (os planos ainda são do passo
+    //atual); refazer espera ela virar passo
+    if (dir < 0 && !ui->full.fresh && h->count > 0) {
+      history_capture(ui, &ui->full.redo);
+      full_pass_cancel(ui);
+      ui->full.dropped = true;
+      history_restore_current(ui, img);
+      return;
+    }
+    full_pass_finish(ui);
+  }
+  if (dir > 0 && ui->full.dropped && h->cur == h->count - 1) {
+    //refazer a edição descartada: é pedida de novo, com prévia e passada como da primeira vez
+    const HistoryEntry* r = &ui->full.redo;
+    const HistoryEntry* e = &h->entries[h->cur];
+    PipelineStage from = memcmp(&r->filter, &e->filter, sizeof(r->filter)) != 0 ? STAGE_FILTER
+                       : !history_same_stages(r, e) ? STAGE_CLAHE : STAGE_POINT_OPS;
+    ui->ops = r->ops;
+    ui->filter = r->filter;
+    ui->clahe = r->clahe;
+    ui->clahe_on = r->clahe_on;
+    SDL_Log("Refazer: edição descartada pedida de novo");
+    full_pass_request(ui, img, from);
+    return;
+  }
+  int to = h->cur + (dir < 0 ? -1 : 1);
+  if (h->count == 0 || to < 0 || to >= h->count) return;
+  //o passo que liga os dois estados é sempre o mais novo deles
+  const HistoryEntry* link = &h->entries[dir < 0 ? h->cur : to];
+  const HistoryEntry* from = &h->entries[h->cur];
+  const HistoryEntry* e = &h->entries[to];
+  pyramid_stop(&img->pyr);
+  Uint64 t0 = SDL_GetTicksNS();
+
+  if (!history_same_stages(from, e)) h->stale = true;
+  ui->ops = e->ops;
+  ui->filter = e->filter;
+  ui->clahe = e->clahe;
+  ui->clahe_on = e->clahe_on;
+  ui->roi = e->roi;
+  memcpy(ui->lut, e->lut, sizeof(ui->lut));
+  memcpy(ui->hist, e->hist, sizeof(ui->hist));
+  img->deep_valid = false;
+  ui->deep_maxval = 0;
+  if (deep_path(ui, img)) {
+    //16 bits: a saída de 16 bits (e a exibição junto) é refeita pela pilha
+    apply_deep_ops(ui, img);
+    plane_copy(&h->snap, &img->gray);
+    mark_texture_rows(img, 0, img->h);
+  } else if (link->spatial) {
+    history_apply_tiles(h, img, link);
+  } else {
+    stages_sync(ui, img);
+    const Uint32* unused;
+    plane_apply_lut(stack_base(ui, img, &unused), &img->gray, e->lut);
+    plane_copy(&h->snap, &img->gray);
+    mark_texture_rows(img, 0, img->h);
+  }
+  h->cur = to;
+  SDL_Log("%s: passo %d/%d (%.1f ms)", dir < 0 ? "Desfazer" : "Refazer", h->cur, h->count - 1,
+          (double)(SDL_GetTicksNS() - t0) / 1e6);
+
+  describe_pipeline(ui, img);
+  rebuild_texture(img, ui->mainApp.renderer);
+  update_stat_labels(ui);
+  ui->dirty |= DIRTY_MAIN_IMAGE | DIRTY_SIDE_HIST | DIRTY_SIDE_BUTTON;
+}
+
+static Uint32 g_full_pass_event; //avisa a thread da UI que a passada em resolução cheia terminou
+
+static bool full_pass_eligible(const UIContext* ui, const ImageData* img) {
+  return img->proxy.pixels && !ui->roi.only;
+}
+
+//sobe a prévia para a textura dela (do tamanho do proxy, criada uma vez por imagem)
+static bool proxy_upload(ImageData* img, SDL_Renderer* rr, const GrayPlane* p) {
+  if (!img->proxy_tex) {
+    img->proxy_tex = SDL_CreateTexture(rr, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, p->w, p->h);
+    if (!img->proxy_tex) { log_sdl_error("SDL_CreateTexture (prévia) falhou"); return false; }
+  }
+  void* pixels = NULL;
+  int pitch = 0;
+  if (!SDL_LockTexture(img->proxy_tex, NULL, &pixels, &pitch)) {
+    log_sdl_error("SDL_LockTexture (prévia) falhou");
+    return false;
+  }
+  const GrayPlane* a = img->proxy_alpha.pixels ? &img->proxy_alpha : NULL;
+  for (int y = 0; y < p->h; y++)
+    g_kernels->row_expand(plane_row(p, y), a ? plane_row(a, y) : NULL, (Uint8*)pixels + (size_t)y * (size_t)pitch, p->w);
+  SDL_UnlockTexture(img->proxy_tex);
+  return true;
+}
+
+//a edição sobre o proxy, na thread da UI: filtro com o tamanho reduzido na mesma escala,
+//CLAHE com a mesma grade e a pilha. sem estágios espaciais a LUT e o histograma saem do
+//histograma exato da original; com eles, do histograma do proxy escalado (aproximado)
+static void proxy_preview(UIContext* ui, ImageData* img) {
+  const GrayPlane* base = &img->proxy;
+  const int pw = base->w, ph = base->h;
+  const bool spatial = ui->filter.kind != FILTER_NONE || ui->clahe_on;
+  GrayPlane filtered = {0}, clahe = {0}, out = {0};
+  Uint32 base_hist[256], hist[256];
+  Uint64 t0 = SDL_GetTicksNS();
+  bool ok = plane_alloc(&out, pw, ph);
+  if (ok && ui->filter.kind != FILTER_NONE) {
+    FilterParams f = ui->filter;
+    f.size = SDL_max(f.size / PROXY_SCALE, f.kind == FILTER_BOX ? 1.0f : 0.5f);
+    ok = plane_alloc(&filtered, pw, ph) && plane_filter(base, &filtered, &f, base_hist);
+    base = &filtered;
+  }
+  if (ok && ui->clahe_on) {
+    ok = plane_alloc(&clahe, pw, ph) && plane_clahe(base, &clahe, &ui->clahe, base_hist);
+    base = &clahe;
+  }
+  if (ok) {
+    if (spatial) {
+      point_stack_build_lut(&ui->ops, base_hist, ui->lut, hist);
+      const double k = (double)img->w * (double)img->h / ((double)pw * (double)ph);
+      for (int i = 0; i < 256; i++) ui->hist[i] = (Uint32)((double)hist[i] * k + 0.5);
+    } else {
+      point_stack_build_lut(&ui->ops, ui->src_hist, ui->lut, ui->hist);
+    }
+    plane_apply_lut(base, &out, ui->lut);
+    ok = proxy_upload(img, ui->mainApp.renderer, &out);
+  }
+  plane_free(&filtered);
+  plane_free(&clahe);
+  plane_free(&out);
+  img->preview = ok;
+  ui->stats_approx = ok && spatial;
+  SDL_Log("Prévia %dx%d: %.1f ms", pw, ph, (double)(SDL_GetTicksNS() - t0) / 1e6);
+}
+
+static bool full_pass_cancelled(FullPass* f) {
+  return SDL_GetAtomicInt(&f->cancel) != 0;
+}
+
+//filtro -> CLAHE -> pilha em resolução cheia com o estado copiado no lançamento. lê só a
+//original e os planos dos estágios não refeitos (a UI não mexe neles enquanto a passada
+//existe) e escreve só nos próprios planos; o cancelamento é testado entre os estágios e
+//entre as faixas da LUT
+static int SDLCALL full_pass_worker(void* data) {
+  FullPass* f = (FullPass*)data;
+  const ImageData* img = f->img;
+  const GrayPlane* base = &img->original_gray;
+  const Uint32* base_hist = f->src_hist;
+  bool ok = true;
+  if (f->filter.kind != FILTER_NONE) {
+    if (f->from >= STAGE_FILTER) {
+      Uint64 tr = trace_begin();
+      ok = plane_alloc(&f->filtered, img->w, img->h) && plane_filter(base, &f->filtered, &f->filter, f->filter_hist);
+      trace_end(PH_FILTER, tr);
+    }
+    base = f->from >= STAGE_FILTER ? &f->filtered : &img->filtered;
+    base_hist = f->filter_hist;
+  }
+  if (ok && f->clahe_on && !full_pass_cancelled(f)) {
+    if (f->from >= STAGE_CLAHE) {
+      Uint64 tr = trace_begin();
+      ok = plane_alloc(&f->clahe_out, img->w, img->h) && plane_clahe(base, &f->clahe_out, &f->clahe, f->clahe_hist);
+      trace_end(PH_CLAHE, tr);
+    }
+    base = f->from >= STAGE_CLAHE ? &f->clahe_out : &img->clahe;
+    base_hist = f->clahe_hist;
+  }
+  if (ok && !full_pass_cancelled(f)) {
+    ok = plane_alloc(&f->gray, img->w, img->h);
+    Uint64 tr = trace_begin();
+    if (ok) point_stack_build_lut(&f->ops, base_hist, f->lut, f->hist);
+    for (int y = 0; ok && y < img->h && !full_pass_cancelled(f); y += FULL_PASS_STRIP_ROWS) {
+      int y1 = SDL_min(y + FULL_PASS_STRIP_ROWS, img->h);
+      GrayPlane src = plane_view(base, 0, y, img->w, y1), dst = plane_view(&f->gray, 0, y, img->w, y1);
+      plane_apply_lut(&src, &dst, f->lut);
+    }
+    trace_end(PH_POINT_OPS, tr);
+  }
+  f->ok = ok;
+  SDL_SetAtomicInt(&f->done, 1);
+
+  SDL_Event ev;
+  SDL_zero(ev);
+  ev.type = g_full_pass_event;
+  SDL_PushEvent(&ev);
+  return 0;
+}
+
+static void full_pass_discard(FullPass* f) {
+  plane_free(&f->filtered);
+  plane_free(&f->clahe_out);
+  plane_free(&f->gray);
+}
+
+static void full_pass_done(UIContext* ui);
+
+//lança a passada do estado atual, refazendo tudo o que foi editado desde a última instalada
+static void full_pass_launch(UIContext* ui) {
+  FullPass* f = &ui->full;
+  if (!g_full_pass_event) g_full_pass_event = SDL_RegisterEvents(1);
+  f->from = f->pending;
+  f->filter = ui->filter;
+  f->clahe = ui->clahe;
+  f->clahe_on = ui->clahe_on;
+  f->ops = ui->ops;
+  memcpy(f->src_hist, ui->src_hist, sizeof(f->src_hist));
+  memcpy(f->filter_hist, ui->filter_hist, sizeof(f->filter_hist));
+  memcpy(f->clahe_hist, ui->clahe_hist, sizeof(f->clahe_hist));
+  f->restart = false;
+  f->ok = false;
+  SDL_SetAtomicInt(&f->cancel, 0);
+  SDL_SetAtomicInt(&f->done, 0);
+  f->t0 = SDL_GetTicksNS();
+  f->thread = SDL_CreateThread(full_pass_worker, "full_pass", f);
+  if (!f->thread) {
+    log_sdl_error("SDL_CreateThread (resolução cheia) falhou, processando na thread da UI");
+    full_pass_worker(f);
+    full_pass_done(ui);
+  }
+}
+
+//os planos da passada entram no lugar dos da imagem, sem cópia. a textura única sobe por
+//faixas (preview_step) e a pirâmide é refeita em segundo plano, com a prévia na tela até lá
+static void full_pass_install(UIContext* ui) {
+  FullPass* f = &ui->full;
+  ImageData* img = f->img;
+  pyramid_stop(&img->pyr); //a pirâmide lê o plano de trabalho
+  if (f->from >= STAGE_FILTER) {
+    plane_free(&img->filtered);
+    img->filtered = f->filtered;
+    memcpy(ui->filter_hist, f->filter_hist, sizeof(ui->filter_hist));
+    ui->history.stale = false;
+  }
+  if (f->clahe_out.pixels) {
+    plane_free(&img->clahe);
+    img->clahe = f->clahe_out;
+    memcpy(ui->clahe_hist, f->clahe_hist, sizeof(ui->clahe_hist));
+  }
+  plane_free(&img->gray);
+  img->gray = f->gray;
+  if (img->pyr.count > 0) img->pyr.levels[0] = img->gray;
+  memset(&f->filtered, 0, sizeof(f->filtered));
+  memset(&f->clahe_out, 0, sizeof(f->clahe_out));
+  memset(&f->gray, 0, sizeof(f->gray));
+  memcpy(ui->lut, f->lut, sizeof(ui->lut));
+  memcpy(ui->hist, f->hist, sizeof(ui->hist));
+  f->pending = STAGE_NONE;
+  ui->stats_approx = false;
+  SDL_Log("Resolução cheia: %.1f ms", (double)(SDL_GetTicksNS() - f->t0) / 1e6);
+
+  if (ui->roi.active) {
+    Uint32 roi_base[256];
+    Uint8 roi_lut[256];
+    roi_compute(ui, img, roi_base, roi_lut);
+  }
+  mark_texture_rows(img, 0, img->h);
+  if (img->tiled || !img->texture || !img->preview) rebuild_texture(img, ui->mainApp.renderer);
+  describe_pipeline(ui, img);
+  update_stat_labels(ui);
+  ui->dirty |= DIRTY_MAIN_IMAGE | DIRTY_SIDE_HIST | DIRTY_SIDE_BUTTON;
+  if (f->fresh) history_reset(ui, img); //primeira passada da imagem: o histórico começa dela
+  else          history_commit(ui, img);
+  f->fresh = false;
+}
+
+//a thread terminou (evento ou espera explícita): instala, descarta ou relança
+static void full_pass_done(UIContext* ui) {
+  FullPass* f = &ui->full;
+  SDL_WaitThread(f->thread, NULL);
+  f->thread = NULL;
+  if (full_pass_cancelled(f)) {
+    full_pass_discard(f);
+    if (f->restart) full_pass_launch(ui);
+    return;
+  }
+  if (f->ok) { full_pass_install(ui); return; }
+
+  //sem memória para os planos da passada: refaz na thread da UI, como sem proxy
+  SDL_Log("Passada em resolução cheia falhou, refazendo na thread da UI");
+  full_pass_discard(f);
+  if (f->pending >= STAGE_CLAHE) ui->history.stale = true; //stages_sync refaz filtro e CLAHE
+  f->pending = STAGE_NONE;
+  f->img->preview = false;
+  ui->stats_approx = false;
+  apply_point_ops(ui, f->img);
+  if (f->fresh) history_reset(ui, f->img);
+  else          history_commit(ui, f->img);
+  f->fresh = false;
+}
+
+//edição numa imagem com proxy: a prévia sai na hora e a resolução cheia vai para a thread;
+//uma passada em andamento é cancelada e relançada com o estado mais novo. false: a imagem
+//não tem proxy (ou está no modo só ROI) e a edição segue pelo caminho síncrono
+static bool full_pass_request(UIContext* ui, ImageData* img, PipelineStage from) {
+  if (!full_pass_eligible(ui, img)) return false;
+  FullPass* f = &ui->full;
+  f->dropped = false; //edição nova: a descartada não volta mais
+  if (ui->history.stale) from = STAGE_FILTER; //planos do filtro/CLAHE de outro passo
+  if (from > f->pending) f->pending = from;
+  proxy_preview(ui, img);
+  if (f->thread) {
+    //a passada em andamento é desta imagem (trocar de imagem cancela): relança ao terminar
+    SDL_SetAtomicInt(&f->cancel, 1);
+    f->restart = true;
+  } else {
+    f->img = img;
+    full_pass_launch(ui);
+  }
+  describe_pipeline(ui, img);
+  update_stat_labels(ui);
+  ui->dirty |= DIRTY_MAIN_IMAGE | DIRTY_SIDE_HIST | DIRTY_SIDE_BUTTON;
+  return true;
+}
+
+//descarta a passada em andamento junto com a edição que ela levava; true se havia uma.
+//espera a thread: no pior caso, o fim do estágio (filtro ou CLAHE) em que ela estava
+static bool full_pass_cancel(UIContext* ui) {
+  FullPass* f = &ui->full;
+  if (!f->thread) return false;
+  SDL_SetAtomicInt(&f->cancel, 1);
+  SDL_WaitThread(f->thread, NULL);
+  f->thread = NULL;
+  full_pass_discard(f);
+  f->restart = f->fresh = false;
+  f->pending = STAGE_NONE;
+  f->img->preview = false;
+  ui->stats_approx = false;
+  //faixas de uma passada anterior que ainda não tinham subido
+  if (!f->img->tiled && f->img->tex_y0 < f->img->tex_y1) rebuild_texture(f->img, ui->mainApp.renderer);
+  return true;
+}
+
+//espera a passada (e as relançadas por edições mais novas) e instala: para quem precisa do
+//plano de trabalho em dia (gravar, ROI, refazer)
+static void full_pass_finish(UIContext* ui) {
+  while (ui->full.thread) full_pass_done(ui);
+}
+
+//depois de instalada a passada: sobe uma faixa da textura por volta do laço (a prévia fica
+//na tela até a última) e tira a prévia quando a imagem inteira já pode ser exibida.
+//true: ainda há faixas, o laço não deve dormir
+static bool preview_step(UIContext* ui, ImageData* img) {
+  if (!img->preview || ui->full.thread) return false;
+  if (!img->tiled && img->texture && img->tex_y0 < img->tex_y1) {
+    int rows = SDL_max(1, (TEXTURE_STEP_MB << 20) / (4 * img->w));
+    int y1 = img->tex_y1, end = SDL_min(img->tex_y0 + rows, y1);
+    img->tex_y1 = end;
+    if (!sync_texture_rows(img)) SDL_Log("Upload da textura falhou");
+    if (end < y1) {
+      img->tex_y0 = end;
+      img->tex_y1 = y1;
+      return true;
+    }
+  }
+  if (img->tiled && SDL_GetAtomicInt(&img->pyr.built) < img->pyr.count) return false;
+  img->preview = false;
+  ui->dirty |= DIRTY_MAIN_IMAGE;
+  return false;
+}
+
+//bytes que a imagem ocupa no cache: planos, níveis da pirâmide, índice e texturas
+static size_t image_bytes(const ImageData* img) {
+  const GrayPlane* planes[] = { &img->gray, &img->original_gray, &img->alpha, &img->filtered, &img->clahe,
+                                &img->proxy, &img->proxy_alpha };
+  size_t n = 0;
+  for (size_t i = 0; i < sizeof(planes) / sizeof(planes[0]); i++)
+    if (planes[i]->pixels) n += (size_t)planes[i]->pitch * (size_t)planes[i]->h;
+  for (int l = 1; l < img->pyr.count; l++)
+    n += (size_t)img->pyr.levels[l].pitch * (size_t)img->pyr.levels[l].h * (img->pyr.alpha[l].pixels ? 2 : 1);
+  if (img->hindex.cum)
+    n += sizeof(Uint32) * 256 * (size_t)(img->hindex.nbx + 1) * (size_t)(img->hindex.nby + 1);
+  if (img->color) n += (size_t)img->color->pitch * (size_t)img->color->h;
+  n += ((size_t)img->deep.pitch * (size_t)img->deep.h + (size_t)img->deep_out.pitch * (size_t)img->deep_out.h) * 2;
+  if (img->hist16) n += sizeof(Uint32) * HIST16_BINS;
+  if (img->texture) n += (size_t)img->w * (size_t)img->h * 4;
+  if (img->proxy_tex) n += (size_t)img->proxy.w * (size_t)img->proxy.h * 4;
+  for (int i = 0; i < img->tiles.nslots; i++)
+    if (img->tiles.slots[i].tex) n += (size_t)TILE_SIZE * TILE_SIZE * 4;
+  return n;
+}
+
+static bool session_add_path(Session* s, const char* path) {
+  SessionEntry* grown = (SessionEntry*)realloc(s->entries, sizeof(SessionEntry) * (size_t)(s->count + 1));
+  if (!grown) return false;
+  s->entries = grown;
+  memset(&s->entries[s->count], 0, sizeof(SessionEntry));
+  s->entries[s->count].path = SDL_strdup(path);
+  if (!s->entries[s->count].path) return false;
+  s->count++;
+  return true;
+}
+
+typedef struct {
+  const char** names;
+  int          count;
+} DirListing;
+
+static SDL_EnumerationResult SDLCALL collect_session_file(void* userdata, const char* dirname, const char* fname) {
+  (void)dirname;
+  DirListing* d = (DirListing*)userdata;
+  if (!has_image_extension(fname)) return SDL_ENUM_CONTINUE;
+  const char** grown = (const char**)realloc(d->names, sizeof(char*) * (size_t)(d->count + 1));
+  if (!grown) return SDL_ENUM_FAILURE;
+  d->names = grown;
+  d->names[d->count] = SDL_strdup(fname);
+  if (!d->names[d->count]) return SDL_ENUM_FAILURE;
+  d->count++;
+  return SDL_ENUM_CONTINUE;
+}
+
+//um arquivo entra como está; um diretório entra com as imagens dele, em ordem de nome
+static bool session_add_arg(Session* s, const char* arg) {
+  SDL_PathInfo info;
+  if (!SDL_GetPathInfo(arg, &info) || info.type != SDL_PATHTYPE_DIRECTORY)
+    return session_add_path(s, arg);
+
+  DirListing d = { NULL, 0 };
+  bool ok = SDL_EnumerateDirectory(arg, collect_session_file, &d);
+  if (!ok) log_sdl_error("Falha ao listar o diretório");
+  if (d.count > 1) qsort(d.names, (size_t)d.count, sizeof(char*), compare_names);
+  for (int i = 0; i < d.count; i++) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", arg, d.names[i]);
+    ok = ok && session_add_path(s, path);
+    SDL_free((void*)d.names[i]);
+  }
+  free(d.names);
+  if (ok && d.count == 0) SDL_Log("Nenhuma imagem em %s", arg);
+  return ok;
+}
+
+static bool session_load(const Session* s, int i, ImageData* img, Uint32 hist[256]) {
+  const char* path = s->entries[i].path;
+  bool ok;
+  if (s->raw_w > 0)
+    ok = s->raw16 ? img_load_deep(path, s->raw_w, s->raw_h, img, hist, true)
+                  : img_map_gray(path, s->raw_w, s->raw_h, img, hist, true);
+  else
+    ok = img_load_gray(path, img, hist, true, s->color);
+  if (ok) image_build_proxy(img);
+  return ok;
+}
+
+static Uint32 g_session_event; //avisa a thread da UI que uma vizinha terminou de carregar
+
+//com o lock: publica o resultado de uma carga (a entrada estava em LOADING)
+static void session_publish(Session* s, int i, bool ok, const ImageData* img, const Uint32 hist[256]) {
+  SessionEntry* e = &s->entries[i];
+  if (ok) {
+    e->img = *img;
+    memcpy(e->hist, hist, sizeof(e->hist));
+    e->bytes = image_bytes(img);
+    e->edited = false;
+    e->last_used = ++s->clock;
+    s->used += e->bytes;
+  }
+  e->state = ok ? ENTRY_READY : ENTRY_FAILED;
+  SDL_BroadcastCondition(s->changed);
+
+  SDL_Event ev;
+  SDL_zero(ev);
+  ev.type = g_session_event;
+  ev.user.code = i;
+  SDL_PushEvent(&ev);
+}
+
+//com o lock: próxima vizinha a carregar (mais perto primeiro, à frente antes de atrás),
+//enquanto uma imagem do tamanho da atual ainda couber no orçamento
+static int session_next_prefetch(const Session* s) {
+  size_t estimate = s->entries[s->current].bytes;
+  if (s->used + estimate > s->budget) return -1;
+  for (int d = 1; d <= SESSION_PREFETCH; d++) {
+    int cand[2] = { s->current + d, s->current - d };
+    for (int k = 0; k < 2; k++)
+      if (cand[k] >= 0 && cand[k] < s->count && s->entries[cand[k]].state == ENTRY_EMPTY) return cand[k];
+  }
+  return -1;
+}
+
+static int SDLCALL session_worker(void* data) {
+  Session* s = (Session*)data;
+  SDL_LockMutex(s->lock);
+  while (!s->quit) {
+    int i = session_next_prefetch(s);
+    if (i < 0) { SDL_WaitCondition(s->changed, s->lock); continue; }
+    s->entries[i].state = ENTRY_LOADING;
+    SDL_UnlockMutex(s->lock);
+
+    ImageData img = {0};
+    Uint32 hist[256];
+    bool ok = session_load(s, i, &img, hist);
+
+    SDL_LockMutex(s->lock);
+    session_publish(s, i, ok, &img, hist);
+  }
+  SDL_UnlockMutex(s->lock);
+  return 0;
+}
+
+//CV_CACHE_MB define o orçamento do cache (padrão 1024 MB)
+static bool session_init(Session* s, int raw_w, int raw_h, bool raw16, bool color) {
+  const char* env = SDL_getenv("CV_CACHE_MB");
+  Sint64 budget_mb = (env && atoi(env) > 0) ? atoi(env) : 1024;
+  s->budget = (size_t)budget_mb * 1024 * 1024;
+  s->raw_w = raw_w;
+  s->raw_h = raw_h;
+  s->raw16 = raw16;
+  s->color = color;
+  s->lock = SDL_CreateMutex();
+  s->changed = SDL_CreateCondition();
+  if (!s->lock || !s->changed) { log_sdl_error("SDL_CreateMutex/Condition (sessão) falhou"); return false; }
+  if (!g_session_event) g_session_event = SDL_RegisterEvents(1);
+  return true;
+}
+
+static void session_start_prefetch(Session* s) {
+  if (s->count < 2 || s->thread) return;
+  s->thread = SDL_CreateThread(session_worker, "prefetch", s);
+  if (!s->thread) log_sdl_error("SDL_CreateThread (pré-carga) falhou, imagens carregam ao navegar");
+}
+
+//para a thread de pré-carga (no fim do programa, antes de liberar as imagens)
+static void session_stop(Session* s) {
+  if (!s->thread) return;
+  SDL_LockMutex(s->lock);
+  s->quit = true;
+  SDL_BroadcastCondition(s->changed);
+  SDL_UnlockMutex(s->lock);
+  SDL_WaitThread(s->thread, NULL);
+  s->thread = NULL;
+}
+
+static void session_free(Session* s) {
+  session_stop(s);
+  for (int i = 0; i < s->count; i++) {
+    free_image(&s->entries[i].img);
+    SDL_free(s->entries[i].path);
+  }
+  free(s->entries);
+  if (s->changed) SDL_DestroyCondition(s->changed);
+  if (s->lock) SDL_DestroyMutex(s->lock);
+  memset(s, 0, sizeof(*s));
+}
+
+//garante a entrada carregada: espera a pré-carga em andamento ou carrega aqui mesmo
+static bool session_acquire(Session* s, int i) {
+  SessionEntry* e = &s->entries[i];
+  SDL_LockMutex(s->lock);
+  while (e->state == ENTRY_LOADING) SDL_WaitCondition(s->changed, s->lock);
+  if (e->state == ENTRY_EMPTY) {
+    e->state = ENTRY_LOADING;
+    SDL_UnlockMutex(s->lock);
+    ImageData img = {0};
+    Uint32 hist[256];
+    bool ok = session_load(s, i, &img, hist);
+    SDL_LockMutex(s->lock);
+    session_publish(s, i, ok, &img, hist);
+  }
+  bool ok = e->state == ENTRY_READY;
+  if (ok) e->last_used = ++s->clock;
+  SDL_UnlockMutex(s->lock);
+  return ok;
+}
+
+//recontabiliza as entradas prontas e libera as menos usadas até caber no orçamento;
+//a atual e as vizinhas da janela de pré-carga ficam (senão seriam recarregadas em loop)
+static void session_evict(Session* s) {
+  SDL_LockMutex(s->lock);
+  s->used = 0;
+  for (int i = 0; i < s->count; i++) {
+    SessionEntry* e = &s->entries[i];
+    if (e->state != ENTRY_READY) continue;
+    e->bytes = image_bytes(&e->img);
+    s->used += e->bytes;
+  }
+  while (s->used > s->budget) {
+    int victim = -1;
+    for (int i = 0; i < s->count; i++) {
+      const SessionEntry* e = &s->entries[i];
+      if (e->state != ENTRY_READY || abs(i - s->current) <= SESSION_PREFETCH) continue;
+      if (victim < 0 || e->last_used < s->entries[victim].last_used) victim = i;
+    }
+    if (victim < 0) break;
+    SessionEntry* e = &s->entries[victim];
+    free_image(&e->img);
+    memset(&e->img, 0, sizeof(e->img));
+    s->used -= e->bytes;
+    e->bytes = 0;
+    e->state = ENTRY_EMPTY;
+  }
+  SDL_BroadcastCondition(s->changed);
+  SDL_UnlockMutex(s->lock);
+}
+
+static bool image_needs_tiles(const UIContext* ui, const ImageData* img) {
+  const char* force_tiled = SDL_getenv("CV_TILED");
+  return (force_tiled && atoi(force_tiled) != 0) ||
+         (ui->max_tex > 0 && (img->w > ui->max_tex || img->h > ui->max_tex));
+}
+
+//textura única ou, maior que a textura máxima do renderer, pirâmide em blocos
+static bool image_prepare_display(UIContext* ui, ImageData* img) {
+  if (img->texture || img->tiles.slots) return true;
+  img->tiled = image_needs_tiles(ui, img);
+  if (!img->tiled) return upload_texture_gray(img, ui->mainApp.renderer);
+  SDL_Log("Visualização em blocos (textura máxima: %lld)", (long long)ui->max_tex);
+  if (!tile_cache_init(&img->tiles)) return false;
+  pyramid_start(img);
+  return true;
+}
+
+//uma vizinha terminou de carregar: já sobe a textura (só na thread da UI), se couber
+static void session_loaded(UIContext* ui, int i) {
+  Session* s = &ui->session;
+  if (i < 0 || i >= s->count) return;
+  SDL_LockMutex(s->lock);
+  bool ready = s->entries[i].state == ENTRY_READY;
+  SDL_UnlockMutex(s->lock);
+  ImageData* img = &s->entries[i].img;
+  if (ready && i != s->current && !img->texture && !image_needs_tiles(ui, img))
+    upload_texture_gray(img, ui->mainApp.renderer);
+  session_evict(s);
+}
+
+static ImageData* session_image(UIContext* ui) {
+  return &ui->session.entries[ui->session.current].img;
+}
+
+//troca a imagem exibida; a pilha de operações, o filtro, o CLAHE e o modo "só ROI" continuam
+//valendo e são refeitos sobre a nova imagem
+static bool session_show(UIContext* ui, int index) {
+  Session* s = &ui->session;
+  if (index < 0 || index >= s->count) return false;
+  bool identity = ui->ops.count == 0 && !ui->clahe_on && ui->filter.kind == FILTER_NONE && !ui->roi.only;
+  //o plano de trabalho sempre reflete o estado atual da pilha
+  SessionEntry* prev = &s->entries[s->current];
+  bool dropped = full_pass_cancel(ui); //edição em resolução cheia da anterior: refeita ao voltar
+  if (prev->state == ENTRY_READY) prev->edited = !identity || dropped;
+  if (!session_acquire(s, index)) { SDL_Log("Não foi possível abrir %s", s->entries[index].path); return false; }
+
+  SessionEntry* e = &s->entries[index];
+  ImageData* img = &e->img;
+  if (!image_prepare_display(ui, img)) { SDL_Log("Falha ao exibir %s", e->path); return false; }
+  SDL_LockMutex(s->lock);
+  s->current = index;
+  SDL_UnlockMutex(s->lock);
+
+  memcpy(ui->src_hist, e->hist, sizeof(ui->src_hist));
+  ui->roi.active = ui->roi.dragging = false;
+  if (!img->hindex.cum) hist_index_start(img);
+  ui->history.stale = false; //filtro e CLAHE são refeitos agora para a nova imagem
+  if ((!identity || e->edited) && full_pass_eligible(ui, img)) {
+    //com proxy: a prévia já sai com a pipeline inteira e a resolução cheia vem em seguida
+    ui->full.fresh = true;
+    full_pass_request(ui, img, STAGE_FILTER);
+  } else if (!identity || e->edited) {
+    if (!refresh_filter(ui, img)) ui->filter.kind = FILTER_NONE; //sem filtro: só libera um plano antigo
+    if (ui->clahe_on && !refresh_clahe(ui, img)) ui->clahe_on = false;
+    apply_point_ops(ui, img);
+  } else {
+    if (!refresh_filter(ui, img)) ui->filter.kind = FILTER_NONE;
+    if (ui->clahe_on && !refresh_clahe(ui, img)) ui->clahe_on = false;
+    //intacta e sem operações: nada a refazer, a textura do cache já vale
+    memcpy(ui->hist, ui->src_hist, sizeof(ui->hist));
+    for (int i = 0; i < 256; i++) ui->lut[i] = (Uint8)i;
+    ui->deep_maxval = img->hist16 ? img->maxval : 0;
+    if (img->hist16) hist_mean_stddev_n(img->hist16, img->maxval + 1, &ui->deep_mean, &ui->deep_stddev);
+    img->deep_valid = true;
+    describe_pipeline(ui, img);
+    update_stat_labels(ui);
+  }
+  history_reset(ui, img); //o histórico é por imagem
+
+  char title[256];
+  const char* name = strrchr(e->path, '/');
+  snprintf(title, sizeof(title), "%s (%d/%d)", name ? name + 1 : e->path, index + 1, s->count);
+  SDL_SetWindowTitle(ui->mainApp.window, title);
+  ui->view.fit = true;
+  ui->dirty |= DIRTY_MAIN_ANY | DIRTY_SIDE_ANY;
+  session_evict(s);
+  return true;
+}
+
+//próxima/anterior, pulando as que não abrem
+static void session_step(UIContext* ui, int dir) {
+  Session* s = &ui->session;
+  for (int i = s->current + dir; i >= 0 && i < s->count; i += dir)
+    if (session_show(ui, i)) return;
+}
+
+//S: grava em segundo plano a partir de uma cópia do plano de trabalho, em
+//output_NNNN.<ext> (o primeiro número livre); uma gravação por vez
+static void save_start(UIContext* ui, const ImageData* img) {
+  SaveTask* t = &ui->save;
+  if (t->thread) { SDL_Log("Gravação em andamento, aguarde"); return; }
+  if (!g_save_event) { g_save_event = SDL_RegisterEvents(1); crc_init(); }
+
+  memset(t, 0, sizeof(*t));
+  t->w = img->w;
+  t->h = img->h;
+  t->format = ui->save_format;
+  t->has_alpha = img->alpha.pixels != NULL;
+  if (img->color) {
+    //modo cor: o snapshot já é a imagem refeita em RGBA
+    t->color = recolor_surface(img);
+    if (!t->color) { log_sdl_error("Sem memória para o snapshot da gravação"); return; }
+  } else if (!plane_alloc(&t->gray, img->w, img->h) ||
+             (img->alpha.pixels && !plane_alloc(&t->alpha, img->w, img->h))) {
+    SDL_Log("Sem memória para o snapshot da gravação");
+    plane_free(&t->gray);
+    return;
+  } else {
+    plane_copy(&t->gray, &img->gray);
+    if (img->alpha.pixels) plane_copy(&t->alpha, &img->alpha);
+  }
+  //16 bits: PGM e PNG gravam a saída de 16 bits (o IMG_SavePNG só grava 8 bits, então o PNG
+  //vai pelo gravador sem compressão); QOI e os estágios espaciais ficam com a exibição
+  if (img->deep_valid && img->deep.pixels && t->format != SAVE_QOI) {
+    const GrayPlane16* src = img->deep_out.pixels ? &img->deep_out : &img->deep;
+    if (!plane16_alloc(&t->deep, img->w, img->h)) {
+      plane_free(&t->gray);
+      plane_free(&t->alpha);
+      return;
+    }
+    memcpy(t->deep.pixels, src->pixels, (size_t)src->pitch * 2 * (size_t)src->h);
+    t->maxval = img->maxval;
+  }
+
+  const char* ext = (img->color && t->format == SAVE_PGM) ? "ppm" : save_format_ext[t->format];
+  do {
+    snprintf(t->path, sizeof(t->path), "output_%04d.%s", ++ui->save_index, ext);
+  } while (SDL_GetPathInfo(t->path, NULL) && ui->save_index < 9999);
+
+  t->t0 = SDL_GetTicksNS();
+  t->thread = SDL_CreateThread(save_worker, "save", t);
+  if (!t->thread) {
+    log_sdl_error("SDL_CreateThread (gravação) falhou");
+    plane_free(&t->gray);
+    plane_free(&t->alpha);
+    plane16_free(&t->deep);
+    if (t->color) SDL_DestroySurface(t->color);
+    t->color = NULL;
+    return;
+  }
+  snprintf(ui->saveLabel, sizeof(ui->saveLabel), "Salvando %s...", t->path);
+  ui->dirty |= DIRTY_SIDE_HIST;
+}
+
+//espera o worker (já terminado, ou na saída do programa) e publica o resultado
+static void save_finish(UIContext* ui) {
+  SaveTask* t = &ui->save;
+  if (!t->thread) return;
+  SDL_WaitThread(t->thread, NULL);
+  t->thread = NULL;
+  plane_free(&t->gray);
+  plane_free(&t->alpha);
+  plane16_free(&t->deep);
+  if (t->color) SDL_DestroySurface(t->color);
+  t->color = NULL;
+  double ms = (double)(SDL_GetTicksNS() - t->t0) / 1e6;
+  if (t->ok) snprintf(ui->saveLabel, sizeof(ui->saveLabel), "Salvo: %s (%.0f ms)", t->path, ms);
+  else       snprintf(ui->saveLabel, sizeof(ui->saveLabel), "Falha ao salvar %s", t->path);
+  SDL_Log("%s", ui->saveLabel);
+  ui->dirty |= DIRTY_SIDE_HIST;
+}
+
+//png (SDL_image, comprimido), png0 (sem compressão), pgm ou qoi
+static bool save_format_parse(SaveFormat* f, const char* spec) {
+  static const char* const names[SAVE_FORMAT_COUNT] = { "png", "png0", "pgm", "qoi" };
+  for (int i = 0; i < SAVE_FORMAT_COUNT; i++)
+    if (strcmp(spec, names[i]) == 0) { *f = (SaveFormat)i; return true; }
+  SDL_Log("Formato de gravação desconhecido: %s", spec);
+  return false;
+}
+
+static void describe_save_format(UIContext* ui) {
+  snprintf(ui->saveLabel, sizeof(ui->saveLabel), "S salva em %s (O troca)", save_format_names[ui->save_format]);
+}
+
+//liga/desliga uma operação: se já está na pilha sai, senão entra no topo
+static void toggle_point_op(UIContext* ui, ImageData* img, PointOpKind kind, float param) {
+  PointOpStack* st = &ui->ops;
+  for (int i = 0; i < st->count; i++) {
+    if (st->ops[i].kind != kind) continue;
+    memmove(&st->ops[i], &st->ops[i + 1], sizeof(PointOp) * (size_t)(st->count - i - 1));
+    st->count--;
+    point_ops_changed(ui, img);
+    return;
+  }
+  if (st->count == POINT_OPS_MAX) { SDL_Log("Pilha de operações cheia"); return; }
+  st->ops[st->count++] = (PointOp){ kind, param };
+  point_ops_changed(ui, img);
+}
+
+//overlay de tempos sobre o histograma: última duração de cada fase já medida
+static void draw_trace_overlay(UIContext* ui, SDL_FRect area, int line_h) {
+  SDL_Renderer* rr = ui->sideApp.renderer;
+  int lines = 0;
+  for (int ph = 0; ph < PH_COUNT; ph++)
+    if (SDL_GetAtomicInt(&g_trace.last_us[ph]) > 0) lines++;
+  if (lines == 0) return;
+
+  SDL_FRect bg = { area.x + 2.0f, area.y + 2.0f, area.w * 0.62f, (float)(line_h * lines) + 8.0f };
+  if (bg.h > area.h - 4.0f) bg.h = area.h - 4.0f;
+  SDL_SetRenderDrawBlendMode(rr, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(rr, 0, 0, 0, 190);
+  SDL_RenderFillRect(rr, &bg);
+  SDL_SetRenderDrawBlendMode(rr, SDL_BLENDMODE_NONE);
+
+  int y = (int)bg.y + 4;
+  for (int ph = 0; ph < PH_COUNT && y + line_h <= (int)(bg.y + bg.h); ph++) {
+    int us = SDL_GetAtomicInt(&g_trace.last_us[ph]);
+    if (us <= 0) continue;
+    char line[64];
+    snprintf(line, sizeof(line), "%s: %.2f ms", trace_phase_names[ph], us / 1000.0);
+    draw_text(rr, &ui->labels, ui->font, line, (int)bg.x + 6, y);
+    y += line_h;
+  }
+}
+
+static void render_side_window(UIContext* ui) {
+  Uint64 tr = trace_begin();
+  SDL_Renderer* rr = ui->sideApp.renderer;
+  SDL_SetRenderDrawColor(rr, 15,15,15,255);
+  SDL_RenderClear(rr);
+
+  // medidas de texto
+  int line_h = TTF_GetFontLineSkip(ui->font);
+  if (line_h <= 0) line_h = 18; // fallback
+  const float gap = 6.0f;
+  const float labels_h = (float)(line_h * 4) + gap; // quatro linhas + respiro
+
+  // área do histograma agora reserva espaço p/ textos E botão
+  SDL_FRect histArea = {
+    SIDE_MARGIN,
+    SIDE_MARGIN,
+    SIDE_W - SIDE_MARGIN * 2.0f,
+    SIDE_H - SIDE_MARGIN * 3.0f - BUTTON_H - labels_h
+  };
+  if (histArea.h < 80.0f) histArea.h = 80.0f; // evita ficar negativo/pequeno demais
+
+  //tudo que é forma vai num lote só: histograma, barra de progresso e fundo dos botões
+  draw_histogram(&g_quads, ui->roi.active ? ui->roi.hist : ui->hist, histArea, ui->yzoom, ui->hist_log, ui->hist_cdf);
+
+  int textX = (int)histArea.x + 6;
+  int textY = (int)(histArea.y + histArea.h) + (int)gap;
+
+  // barra de progresso da gravação em segundo plano
+  if (ui->save.thread && ui->save.h > 0) {
+    float frac = (float)SDL_GetAtomicInt(&ui->save.progress) / (float)ui->save.h;
+    SDL_FRect bar = { histArea.x, (float)(textY + line_h * 4 - 3), histArea.w * frac, 3.0f };
+    batch_rect(&g_quads, bar, fcolor(90, 160, 230));
+  }
+
+  // botões abaixo dos textos
+  ui->eqButton.rect.y = (float)( (int)(histArea.y + histArea.h) + (int)labels_h );
+  ui->claheButton.rect.y = ui->eqButton.rect.y;
+  ui->filterButton.rect.y = ui->eqButton.rect.y;
+  batch_button(&g_quads, &ui->eqButton);
+  batch_button(&g_quads, &ui->claheButton);
+  batch_button(&g_quads, &ui->filterButton);
+  batch_flush(rr, &g_quads);
+
+  // textos logo abaixo do histograma e rótulos dos botões, do cache
+  Uint64 tr_text = trace_begin();
+  draw_text(rr, &ui->labels, ui->font, ui->meanLabel, textX, textY);
+  textY += line_h; // próxima linha
+  draw_text(rr, &ui->labels, ui->font, ui->stdLabel,  textX, textY);
+  textY += line_h;
+  draw_text(rr, &ui->labels, ui->font, ui->opsLabel,  textX, textY);
+  textY += line_h;
+  draw_text(rr, &ui->labels, ui->font, ui->saveLabel, textX, textY);
+  static const char* const filter_buttons[FILTER_COUNT] = {
+    "Filtro", "Gauss", "Caixa", "Unsharp", "Sobel", "Scharr", "Mediana"
+  };
+  draw_button_label(rr, &ui->labels, &ui->eqButton, ui->font, ui->is_equalized ? "Original" : "Equalizar");
+  draw_button_label(rr, &ui->labels, &ui->claheButton, ui->font, ui->clahe_on ? "Sem CLAHE" : "CLAHE");
+  draw_button_label(rr, &ui->labels, &ui->filterButton, ui->font, filter_buttons[ui->filter.kind]);
+  trace_end(PH_TEXT, tr_text);
+
+  if (g_trace.overlay) draw_trace_overlay(ui, histArea, line_h);
+  trace_end(PH_RENDER_SIDE, tr);
+
+  tr = trace_begin();
+  SDL_RenderPresent(rr);
+  trace_end(PH_PRESENT, tr);
+}
+
+
+static void set_button_state(UIContext* ui, UIButton* btn, ButtonState st) {
+  if (btn->state != st) ui->dirty |= DIRTY_SIDE_BUTTON;
+  btn->state = st;
+}
+
+//hover/clique de um botão; devolve true quando o clique termina (soltou dentro)
+static bool button_handle_mouse(UIContext* ui, UIButton* btn, const SDL_Event* e) {
+  bool inside = point_in_rect((float)e->motion.x, (float)e->motion.y, btn->rect);
+  bool clicked = false;
+
+  if (e->type == SDL_EVENT_MOUSE_MOTION) {
+    set_button_state(ui, btn, inside ? BTN_HOVER : BTN_IDLE);
+  }
+  if (e->type == SDL_EVENT_MOUSE_BUTTON_DOWN && inside && e->button.button == SDL_BUTTON_LEFT) {
+    set_button_state(ui, btn, BTN_ACTIVE);
+  }
+  if (e->type == SDL_EVENT_MOUSE_BUTTON_UP && e->button.button == SDL_BUTTON_LEFT) {
+    clicked = inside && btn->state == BTN_ACTIVE;
+    // estado visual pós-click
+    set_button_state(ui, btn, inside ? BTN_HOVER : BTN_IDLE);
+  }
+  return clicked;
+}
+
+//sai do modo "ajustar" mantendo o enquadramento atual como ponto de partida
+static void view_unfit(UIContext* ui, const ImageData* img, int ww, int wh) {
+  if (!ui->view.fit) return;
+  float scale, ox, oy;
+  view_transform(&ui->view, img, ww, wh, &scale, &ox, &oy);
+  ui->view.fit = false;
+  ui->view.zoom = scale;
+  ui->view.cx = img->w * 0.5f;
+  ui->view.cy = img->h * 0.5f;
+}
+
+//multiplica o zoom mantendo fixo o ponto da imagem sob (mx, my); factor 0 = 100%
+static void view_zoom_at(UIContext* ui, const ImageData* img, float factor, float mx, float my) {
+  int ww, wh;
+  SDL_GetWindowSize(ui->mainApp.window, &ww, &wh);
+  view_unfit(ui, img, ww, wh);
+  float scale, ox, oy;
+  view_transform(&ui->view, img, ww, wh, &scale, &ox, &oy);
+  float ix = ox + mx / scale, iy = oy + my / scale;
+
+  float z = factor > 0.0f ? scale * factor : 1.0f;
+  if (z < 1.0f / 512.0f) z = 1.0f / 512.0f;
+  if (z > 32.0f) z = 32.0f;
+  ui->view.zoom = z;
+  ui->view.cx = ix - mx / z + (float)ww / (2.0f * z);
+  ui->view.cy = iy - my / z + (float)wh / (2.0f * z);
+  ui->dirty |= DIRTY_MAIN_IMAGE;
+}
+
+static void view_pan(UIContext* ui, const ImageData* img, float dx, float dy) {
+  int ww, wh;
+  SDL_GetWindowSize(ui->mainApp.window, &ww, &wh);
+  view_unfit(ui, img, ww, wh);
+  ui->view.cx -= dx / ui->view.zoom;
+  ui->view.cy -= dy / ui->view.zoom;
+  ui->dirty |= DIRTY_MAIN_IMAGE;
+}
+
+//marca a janela dona do evento para redesenho (resize, exposição, restauração)
+static void mark_window_dirty(UIContext* ui, SDL_WindowID id) {
+  if (id == SDL_GetWindowID(ui->mainApp.window)) ui->dirty |= DIRTY_MAIN_LAYOUT;
+  if (id == SDL_GetWindowID(ui->sideApp.window)) ui->dirty |= DIRTY_SIDE_LAYOUT;
+}
+
+//espera a gravação e a pré-carga antes de sair
+static void quit_app(UIContext* ui) {
+  full_pass_cancel(ui);
+  save_finish(ui);
+  session_stop(&ui->session);
+  exit(0);
+}
+
+static void handle_event(UIContext* ui, ImageData* img, const SDL_Event* ev) {
+  const SDL_Event e = *ev;
+  if (e.type == SDL_EVENT_QUIT) quit_app(ui);
+
+  if (e.type == SDL_EVENT_WINDOW_RESIZED || e.type == SDL_EVENT_WINDOW_MOVED) {
+    int x,y,w,h;
+    SDL_GetWindowPosition(ui->mainApp.window, &x,&y);
+    SDL_GetWindowSize(ui->mainApp.window, &w,&h);
+    SDL_SetWindowPosition(ui->sideApp.window, x + w + SIDE_MARGIN, y);
+  }
+  if (e.type == SDL_EVENT_WINDOW_RESIZED || e.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED ||
+      e.type == SDL_EVENT_WINDOW_EXPOSED || e.type == SDL_EVENT_WINDOW_SHOWN ||
+      e.type == SDL_EVENT_WINDOW_RESTORED) {
+    mark_window_dirty(ui, e.window.windowID);
+  }
+
+  if (g_pyramid_event && e.type == g_pyramid_event) ui->dirty |= DIRTY_MAIN_IMAGE;
+  if (g_full_pass_event && e.type == g_full_pass_event && ui->full.thread && SDL_GetAtomicInt(&ui->full.done))
+    full_pass_done(ui);
+  if (g_session_event && e.type == g_session_event) session_loaded(ui, e.user.code);
+  if (g_save_event && e.type == g_save_event) {
+    if (SDL_GetAtomicInt(&ui->save.done)) save_finish(ui);
+    ui->dirty |= DIRTY_SIDE_HIST;
+  }
+
+  //zoom (roda, em torno do cursor) e pan (arrastar) na janela principal
+  if (e.type == SDL_EVENT_MOUSE_WHEEL && e.wheel.windowID == SDL_GetWindowID(ui->mainApp.window))
+    view_zoom_at(ui, img, e.wheel.y > 0 ? 1.25f : 0.8f, e.wheel.mouse_x, e.wheel.mouse_y);
+  if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN && e.button.button == SDL_BUTTON_LEFT &&
+      e.button.windowID == SDL_GetWindowID(ui->mainApp.window))
+    ui->view.panning = true;
+  if (e.type == SDL_EVENT_MOUSE_BUTTON_UP && e.button.button == SDL_BUTTON_LEFT)
+    ui->view.panning = false;
+  if (e.type == SDL_EVENT_MOUSE_MOTION && ui->view.panning)
+    view_pan(ui, img, e.motion.xrel, e.motion.yrel);
+  //ROI: arrastar com o botão direito (o esquerdo é o pan)
+  if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN && e.button.button == SDL_BUTTON_RIGHT &&
+      e.button.windowID == SDL_GetWindowID(ui->mainApp.window)) {
+    full_pass_finish(ui); //o ROI consulta os planos da pipeline atual
+    roi_begin(ui, img, e.button.x, e.button.y);
+  }
+  if (e.type == SDL_EVENT_MOUSE_MOTION && ui->roi.dragging)
+    roi_drag(ui, img, e.motion.x, e.motion.y);
+  if (e.type == SDL_EVENT_MOUSE_BUTTON_UP && e.button.button == SDL_BUTTON_RIGHT && ui->roi.dragging)
+    roi_end(ui, img, e.button.x, e.button.y);
+
+  if (e.type == SDL_EVENT_KEY_DOWN) {
+    if (e.key.key == SDLK_ESCAPE) quit_app(ui);
+    //Ctrl+Z desfaz; Ctrl+Y ou Ctrl+Shift+Z refaz
+    if ((e.key.mod & SDL_KMOD_CTRL) && (e.key.key == SDLK_Z || e.key.key == SDLK_Y)) {
+      history_step(ui, img, (e.key.key == SDLK_Y || (e.key.mod & SDL_KMOD_SHIFT)) ? 1 : -1);
+      return;
+    }
+    //sessão: próxima/anterior (as vizinhas já vêm da pré-carga)
+    if (e.key.key == SDLK_RIGHT || e.key.key == SDLK_PAGEDOWN) { session_step(ui, 1); return; }
+    if (e.key.key == SDLK_LEFT || e.key.key == SDLK_PAGEUP)    { session_step(ui, -1); return; }
+    if (e.key.key == SDLK_F) { ui->view.fit = true; ui->dirty |= DIRTY_MAIN_IMAGE; }
+    if (e.key.key == SDLK_P) { trace_set_overlay(!g_trace.overlay); ui->dirty |= DIRTY_SIDE_HIST; }
+    if (e.key.key == SDLK_L) { ui->hist_log = !ui->hist_log; ui->dirty |= DIRTY_SIDE_HIST; }
+    if (e.key.key == SDLK_D) { ui->hist_cdf = !ui->hist_cdf; ui->dirty |= DIRTY_SIDE_HIST; }
+    if (e.key.key == SDLK_1) {
+      int ww, wh;
+      SDL_GetWindowSize(ui->mainApp.window, &ww, &wh);
+      view_zoom_at(ui, img, 0.0f, ww * 0.5f, wh * 0.5f);
+    }
+    if (e.key.key == SDLK_EQUALS || e.key.key == SDLK_PLUS) {
+      ui->yzoom = ui->yzoom < 4.0f ? ui->yzoom + 0.25f : 4.0f;
+      ui->dirty |= DIRTY_SIDE_HIST;
+    }
+    if (e.key.key == SDLK_MINUS) {
+      ui->yzoom = ui->yzoom > 0.25f ? ui->yzoom - 0.25f : 0.25f;
+      ui->dirty |= DIRTY_SIDE_HIST;
+    }
+    if (e.key.scancode == SDL_SCANCODE_S) {
+      full_pass_finish(ui); //grava a edição em resolução cheia, não a prévia
+      save_start(ui, img);
+    }
+    if (e.key.key == SDLK_O) {
+      ui->save_format = (SaveFormat)((ui->save_format + 1) % SAVE_FORMAT_COUNT);
+      describe_save_format(ui);
+      ui->dirty |= DIRTY_SIDE_HIST;
+    }
+    //pilha de operações pontuais: cada tecla liga/desliga uma operação
+    if (e.key.key == SDLK_E) toggle_point_op(ui, img, OP_EQUALIZE, 0.0f);
+    if (e.key.key == SDLK_G) toggle_point_op(ui, img, OP_GAMMA, 0.5f);
+    if (e.key.key == SDLK_C) toggle_point_op(ui, img, OP_STRETCH, 1.0f);
+    if (e.key.key == SDLK_T) toggle_point_op(ui, img, OP_THRESHOLD, -1.0f);
+    if (e.key.key == SDLK_I) toggle_point_op(ui, img, OP_INVERT, 0.0f);
+    if (e.key.key == SDLK_R) toggle_roi_only(ui, img);
+    if (e.key.key == SDLK_BACKSPACE && ui->ops.count > 0) {
+      ui->ops.count = 0;
+      point_ops_changed(ui, img);
+    }
+    //, e . ajustam o limite de contraste do CLAHE, se estiver ligado
+    if (ui->clahe_on && (e.key.key == SDLK_COMMA || e.key.key == SDLK_PERIOD)) {
+      float clip = ui->clahe.clip + (e.key.key == SDLK_PERIOD ? 0.5f : -0.5f);
+      ui->clahe.clip = clip < 1.0f ? 1.0f : clip > 16.0f ? 16.0f : clip;
+      if (!full_pass_request(ui, img, STAGE_CLAHE) && refresh_clahe(ui, img)) apply_point_ops(ui, img);
+    }
+    //B troca o filtro espacial; N e M diminuem/aumentam sigma ou raio
+    if (e.key.key == SDLK_B) cycle_filter(ui, img);
+    if (e.key.key == SDLK_N || e.key.key == SDLK_M) adjust_filter(ui, img, e.key.key == SDLK_M ? 1 : -1);
+    //[ e ] ajustam o gama, se estiver na pilha
+    if (e.key.key == SDLK_LEFTBRACKET || e.key.key == SDLK_RIGHTBRACKET) {
+      for (int i = 0; i < ui->ops.count; i++) {
+        PointOp* op = &ui->ops.ops[i];
+        if (op->kind != OP_GAMMA) continue;
+        op->param += (e.key.key == SDLK_RIGHTBRACKET) ? 0.1f : -0.1f;
+        if (op->param < 0.1f) op->param = 0.1f;
+        if (op->param > 5.0f) op->param = 5.0f;
+        point_ops_changed(ui, img);
+      }
+    }
+  }
+
+  // eventos dos botões (apenas quando o evento é da janela secundária)
+  if (e.type == SDL_EVENT_MOUSE_MOTION || e.type == SDL_EVENT_MOUSE_BUTTON_DOWN || e.type == SDL_EVENT_MOUSE_BUTTON_UP) {
+    if (e.motion.windowID == SDL_GetWindowID(ui->sideApp.window)) {
+      // equalização: entra/sai da pilha; a imagem é sempre refeita a partir da original
+      if (button_handle_mouse(ui, &ui->eqButton, &e)) toggle_point_op(ui, img, OP_EQUALIZE, 0.0f);
+      if (button_handle_mouse(ui, &ui->claheButton, &e)) toggle_clahe(ui, img);
+      if (button_handle_mouse(ui, &ui->filterButton, &e)) cycle_filter(ui, img);
+    }
+  }
+
+  //cada edição concluída (tecla ou clique) vira um passo do histórico; sem mudança, nada é gravado.
+  //com uma passada em resolução cheia em andamento, o passo é gravado quando ela for instalada
+  if ((e.type == SDL_EVENT_KEY_DOWN || e.type == SDL_EVENT_MOUSE_BUTTON_UP) && !ui->roi.dragging && !ui->full.thread)
+    history_commit(ui, img);
+}
+
+//dorme até chegar um evento; só redesenha (e apresenta) as janelas marcadas como sujas
+//rótulos e histograma já vêm de session_show
+static void render_loop(UIContext* ui) {
+  describe_save_format(ui);
+  ui->dirty = DIRTY_MAIN_ANY | DIRTY_SIDE_ANY;
+
+  for (;;) {
+    bool uploading = preview_step(ui, session_image(ui));
+    Uint64 tr = trace_begin();
+    if (ui->dirty & DIRTY_MAIN_ANY) render_main_window(ui, session_image(ui));
+    if (ui->dirty & DIRTY_SIDE_ANY) render_side_window(ui);
+    if (ui->dirty) trace_end(PH_FRAME, tr);
+    ui->dirty = 0;
+
+    SDL_Event e;
+    if (uploading) {
+      if (!SDL_PollEvent(&e)) continue; //faixas da textura por subir: não dorme
+    } else if (!SDL_WaitEvent(&e)) {
+      log_sdl_error("SDL_WaitEvent falhou");
+      SDL_Delay(16);
+      continue;
+    }
+    do {
+      handle_event(ui, session_image(ui), &e); //a imagem atual pode trocar no meio da fila
+    } while (SDL_PollEvent(&e)); // esvazia a fila antes de redesenhar
+  }
+}
+
+
+//as LUTs valem para `levels` níveis (256 em 8 bits, maxval + 1 em 16 bits); a saída fica
+//na mesma faixa 0..levels-1
+
+//LUT de equalização: CDF normalizada levada para 0..levels-1
+static void equalize_lut(const Uint32* hist, int levels, Uint64 n, Uint16* lut) {
+  const int top = levels - 1;
+  Uint64 cum = 0;
+  for (int i = 0; i < levels; i++) {
+    cum += hist[i];
+    int v = (int)round((double)cum / (double)n * top);
+    if (v < 0) v = 0;
+    if (v > top) v = top;
+    lut[i] = (Uint16)v;
+  }
+}
+
+//stretch linear: satura `pct`% de cada ponta e estica [lo,hi] para [0,levels-1]
+static void stretch_lut(const Uint32* hist, int levels, Uint64 n, float pct, Uint16* lut) {
+  const int top = levels - 1;
+  Uint64 cut = (Uint64)((double)n * (double)pct / 100.0);
+  int lo = 0, hi = top;
+  Uint64 cum = 0;
+  while (lo < top && cum + hist[lo] <= cut) cum += hist[lo++];
+  cum = 0;
+  while (hi > 0 && cum + hist[hi] <= cut) cum += hist[hi--];
+  for (int i = 0; i < levels; i++) {
+    if (hi <= lo) { lut[i] = (Uint16)i; continue; }
+    int v = (int)round((double)(i - lo) * top / (double)(hi - lo));
+    lut[i] = (Uint16)(v < 0 ? 0 : v > top ? top : v);
+  }
+}
+
+//limiar de Otsu: maximiza a variância entre classes usando só o histograma
+static int otsu_threshold(const Uint32* hist, int levels, Uint64 n) {
+  double sum = 0.0;
+  for (int i = 0; i < levels; i++) sum += (double)i * hist[i];
+  double sum0 = 0.0, best = -1.0;
+  Uint64 n0 = 0;
+  int t = levels / 2 - 1;
+  for (int i = 0; i < levels; i++) {
+    n0 += hist[i];
+    if (n0 == 0) continue;
+    if (n0 == n) break;
+    sum0 += (double)i * hist[i];
+    double m0 = sum0 / (double)n0, m1 = (sum - sum0) / (double)(n - n0);
+    double between = (double)n0 * (double)(n - n0) * (m0 - m1) * (m0 - m1);
+    if (between > best) { best = between; t = i; }
+  }
+  return t;
+}
+
+//LUT de uma operação, a partir do histograma da imagem que ela recebe. o limiar fixo é
+//dado em 0..255 e escalado para a faixa
+static void point_op_lut(const PointOp* op, const Uint32* hist, int levels, Uint64 n, Uint16* lut) {
+  const int top = levels - 1;
+  switch (op->kind) {
+    case OP_EQUALIZE:
+      equalize_lut(hist, levels, n, lut);
+      break;
+    case OP_GAMMA:
+      for (int i = 0; i < levels; i++)
+        lut[i] = (Uint16)round(top * pow((double)i / top, (double)op->param));
+      break;
+    case OP_STRETCH:
+      stretch_lut(hist, levels, n, op->param, lut);
+      break;
+    case OP_THRESHOLD: {
+      int t = op->param < 0.0f ? otsu_threshold(hist, levels, n) : (int)op->param * top / 255;
+      for (int i = 0; i < levels; i++) lut[i] = (Uint16)(i > t ? top : 0);
+      break;
+    }
+    case OP_INVERT:
+      for (int i = 0; i < levels; i++) lut[i] = (Uint16)(top - i);
+      break;
+  }
+}
+
+//compõe a pilha em uma LUT. Operações que dependem do histograma (equalizar, stretch,
+//Otsu) usam o histograma da etapa anterior, obtido remapeando o da original: O(256)
+//por operação, sem tocar nos pixels. `out_hist` (opcional) é o histograma final
+static void point_stack_build_lut(const PointOpStack* stack, const Uint32 src_hist[256],
+                                  Uint8 lut[256], Uint32 out_hist[256]) {
+  Uint32 hist[256];
+  memcpy(hist, src_hist, sizeof(hist));
+  Uint64 n = 0;
+  for (int i = 0; i < 256; i++) { lut[i] = (Uint8)i; n += hist[i]; }
+
+  for (int k = 0; k < stack->count && n > 0; k++) {
+    Uint16 op_lut[256];
+    point_op_lut(&stack->ops[k], hist, 256, n, op_lut);
+    Uint32 remapped[256] = {0};
+    for (int i = 0; i < 256; i++) {
+      lut[i] = (Uint8)op_lut[lut[i]];
+      remapped[op_lut[i]] += hist[i];
+    }
+    memcpy(hist, remapped, sizeof(hist));
+  }
+  if (out_hist) memcpy(out_hist, hist, sizeof(hist));
+}
+
+//a mesma composição em 16 bits, sobre maxval + 1 níveis (O(65536) por operação). a LUT
+//sai já com a exibição embutida (ver row_apply_lut16); `out_hist16` (opcional, 65536
+//bins) é o histograma final em 16 bits e `out_hist` o da exibição
+static bool point_stack_build_lut16(const PointOpStack* stack, const Uint32* src_hist16, int maxval,
+                                    Uint32* lut, Uint32* out_hist16, Uint32 out_hist[256]) {
+  const int levels = maxval + 1;
+  Uint32* hist = (Uint32*)malloc(sizeof(Uint32) * HIST16_BINS * 2);
+  Uint16* lut16 = (Uint16*)malloc(sizeof(Uint16) * HIST16_BINS * 2);
+  if (!hist || !lut16) {
+    SDL_Log("Sem memória para a LUT de 16 bits");
+    free(hist);
+    free(lut16);
+    return false;
+  }
+  Uint32* remapped = hist + HIST16_BINS;
+  Uint16* op_lut = lut16 + HIST16_BINS;
+  memcpy(hist, src_hist16, sizeof(Uint32) * (size_t)levels);
+  Uint64 n = 0;
+  for (int i = 0; i < HIST16_BINS; i++) lut16[i] = (Uint16)i;
+  for (int i = 0; i < levels; i++) n += hist[i];
+
+  for (int k = 0; k < stack->count && n > 0; k++) {
+    point_op_lut(&stack->ops[k], hist, levels, n, op_lut);
+    memset(remapped, 0, sizeof(Uint32) * (size_t)levels);
+    for (int i = 0; i < levels; i++) {
+      lut16[i] = op_lut[lut16[i]];
+      remapped[op_lut[i]] += hist[i];
+    }
+    memcpy(hist, remapped, sizeof(Uint32) * (size_t)levels);
+  }
+
+  //amostras acima do maxval não existem (a ingestão satura): as entradas só completam a tabela
+  for (int i = 0; i < HIST16_BINS; i++) {
+    Uint16 v = lut16[i < levels ? i : maxval];
+    lut[i] = (Uint32)v | (Uint32)deep_to8(v, maxval) << 16;
+  }
+  if (out_hist) {
+    memset(out_hist, 0, sizeof(Uint32) * 256);
+    for (int i = 0; i < levels; i++) out_hist[deep_to8(i, maxval)] += hist[i];
+  }
+  if (out_hist16) {
+    memcpy(out_hist16, hist, sizeof(Uint32) * (size_t)levels);
+    memset(out_hist16 + levels, 0, sizeof(Uint32) * (size_t)(HIST16_BINS - levels));
+  }
+  free(hist);
+  free(lut16);
+  return true;
+}
+
+static const char* point_op_name(PointOpKind kind) {
+  switch (kind) {
+    case OP_EQUALIZE:  return "equalize";
+    case OP_GAMMA:     return "gamma";
+    case OP_STRETCH:   return "stretch";
+    case OP_THRESHOLD: return "threshold";
+    case OP_INVERT:    return "invert";
+  }
+  return "?";
+}
+
+//"equalize,gamma=0.5,stretch=1,threshold[=t],invert" ("gray" é aceito e ignorado:
+//a conversão para cinza sempre acontece na ingestão)
+static bool point_stack_parse(PointOpStack* stack, const char* spec) {
+  static const float defaults[] = { 0.0f, 0.5f, 1.0f, -1.0f, 0.0f };
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", spec);
+  stack->count = 0;
+  for (char* tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+    if (strcmp(tok, "gray") == 0) continue;
+    char* eq = strchr(tok, '=');
+    if (eq) *eq = '\0';
+
+    int kind = -1;
+    for (int k = OP_EQUALIZE; k <= OP_INVERT; k++)
+      if (strcmp(tok, point_op_name((PointOpKind)k)) == 0) kind = k;
+    if (kind < 0) { SDL_Log("Operação desconhecida em --ops: '%s'", tok); return false; }
+    if (stack->count == POINT_OPS_MAX) { SDL_Log("Operações demais em --ops"); return false; }
+
+    PointOp op = { (PointOpKind)kind, defaults[kind] };
+    if (eq) op.param = (float)atof(eq + 1);
+    if (op.kind == OP_GAMMA && op.param <= 0.0f) { SDL_Log("Gama inválido: %s", eq + 1); return false; }
+    stack->ops[stack->count++] = op;
+  }
+  return true;
+}
+
+static void point_stack_describe(const PointOpStack* stack, char* out, size_t outsz) {
+  int len = snprintf(out, outsz, "Operações:");
+  if (stack->count == 0) snprintf(out + len, outsz - (size_t)len, " nenhuma");
+  for (int i = 0; i < stack->count && len < (int)outsz; i++) {
+    const PointOp* op = &stack->ops[i];
+    if (op->kind == OP_GAMMA)
+      len += snprintf(out + len, outsz - (size_t)len, "%s gamma %.1f", i ? " >" : "", op->param);
+    else
+      len += snprintf(out + len, outsz - (size_t)len, "%s %s", i ? " >" : "", point_op_name(op->kind));
+  }
+}
+
+//CLAHE: histograma por bloco (em paralelo), corte no limite com redistribuição do
+//excesso, LUT por bloco e interpolação bilinear entre os 4 blocos mais próximos
+typedef struct {
+  const GrayPlane* src;
+  GrayPlane*       dst;
+  int        tiles_x, tiles_y;
+  float      clip;
+  int        bx[CLAHE_MAX_TILES + 1];      //bordas dos blocos em x
+  int        by[CLAHE_MAX_TILES + 1];
+  int        sx[CLAHE_MAX_TILES + 2];      //início dos segmentos de interpolação em x
+  int        sy[CLAHE_MAX_TILES + 2];
+  Uint32*    luts;                         //tiles_x*tiles_y LUTs (32 bits para o gather)
+  Uint16*    fx;                           //peso horizontal por coluna (0..256)
+  HistBins*  partial;                      //histograma da saída, por faixa
+} ClaheJob;
+
+static void clahe_tile_task(void* ctx, int tile, int ntiles) {
+  (void)ntiles;
+  ClaheJob* job = (ClaheJob*)ctx;
+  int ix = tile % job->tiles_x, iy = tile / job->tiles_x;
+  int x0 = job->bx[ix], x1 = job->bx[ix + 1];
+  int y0 = job->by[iy], y1 = job->by[iy + 1];
+
+  Uint32 hist[256] = {0};
+  for (int y = y0; y < y1; y++) g_kernels->row_hist(plane_row(job->src, y) + x0, x1 - x0, hist);
+  const Uint64 n = (Uint64)(x1 - x0) * (Uint64)(y1 - y0);
+
+  if (job->clip > 0.0f) {
+    Uint32 limit = (Uint32)((double)job->clip * (double)n / 256.0);
+    if (limit < 1) limit = 1;
+    Uint64 excess = 0;
+    for (int i = 0; i < 256; i++)
+      if (hist[i] > limit) { excess += hist[i] - limit; hist[i] = limit; }
+    //excesso espalhado por igual; o resto vai em passos regulares, somando exatamente n
+    Uint32 add = (Uint32)(excess / 256), rest = (Uint32)(excess % 256);
+    for (int i = 0; i < 256; i++)
+      hist[i] += add + (Uint32)(((Uint64)(i + 1) * rest) / 256 - ((Uint64)i * rest) / 256);
+  }
+
+  Uint32* lut = job->luts + (size_t)tile * 256;
+  Uint64 cum = 0;
+  for (int i = 0; i < 256; i++) {
+    cum += hist[i];
+    lut[i] = (Uint32)((cum * 255 + n / 2) / n);
+  }
+}
+
+//segmento s de uma dimensão: blocos vizinhos (a, b) e peso 0..256 de b na posição p;
+//antes do primeiro centro e depois do último só um bloco vale
+static Uint32 clahe_weight(const int* seg, int ntiles, int s, int p, int* a, int* b) {
+  *a = s > 0 ? s - 1 : 0;
+  *b = s < ntiles ? s : ntiles - 1;
+  if (s == 0 || s == ntiles) return 0;
+  int span = seg[s + 1] - seg[s];
+  return (Uint32)(((p - seg[s]) * 256 + span / 2) / span);
+}
+
+static void clahe_row_task(void* ctx, int band, int nbands) {
+  ClaheJob* job = (ClaheJob*)ctx;
+  Uint32* hist = job->partial[band].bins;
+  memset(hist, 0, sizeof(job->partial[band].bins));
+  int y0, y1;
+  band_rows(job->src->h, band, nbands, &y0, &y1);
+
+  int seg_y = 0;
+  while (job->sy[seg_y + 1] <= y0) seg_y++;
+  for (int y = y0; y < y1; y++) {
+    while (job->sy[seg_y + 1] <= y) seg_y++;
+    int ta, tb;
+    Uint32 fy = clahe_weight(job->sy, job->tiles_y, seg_y, y, &ta, &tb);
+    const Uint8* src = plane_row(job->src, y);
+    Uint8* dst = plane_row(job->dst, y);
+
+    for (int s = 0; s <= job->tiles_x; s++) {
+      int xs = job->sx[s], xe = job->sx[s + 1];
+      if (xe <= xs) continue;
+      int la = s > 0 ? s - 1 : 0, lb = s < job->tiles_x ? s : job->tiles_x - 1;
+      const Uint32* const luts[4] = {
+        job->luts + (size_t)(ta * job->tiles_x + la) * 256, job->luts + (size_t)(ta * job->tiles_x + lb) * 256,
+        job->luts + (size_t)(tb * job->tiles_x + la) * 256, job->luts + (size_t)(tb * job->tiles_x + lb) * 256,
+      };
+      g_kernels->row_bilerp_lut(src + xs, dst + xs, xe - xs, luts, job->fx + xs, fy);
+    }
+    g_kernels->row_hist(dst, job->src->w, hist);
+  }
+}
+
+//bordas dos blocos e início dos segmentos (centros dos blocos) em uma dimensão
+static void clahe_layout(int size, int ntiles, int* bounds, int* seg) {
+  for (int i = 0; i <= ntiles; i++) bounds[i] = (int)((Sint64)size * i / ntiles);
+  seg[0] = 0;
+  for (int i = 0; i < ntiles; i++) seg[i + 1] = (bounds[i] + bounds[i + 1]) / 2;
+  seg[ntiles + 1] = size;
+}
+
+static int clahe_clamp_tiles(int tiles, int size) {
+  int max_tiles = size / CLAHE_MIN_TILE;
+  if (tiles > max_tiles) tiles = max_tiles;
+  if (tiles > CLAHE_MAX_TILES) tiles = CLAHE_MAX_TILES;
+  return tiles < 1 ? 1 : tiles;
+}
+
+//src -> dst em planos distintos: os blocos leem a origem enquanto as linhas são escritas;
+//`out_hist` sai da própria passada de interpolação
+static bool plane_clahe(const GrayPlane* src, GrayPlane* dst, const ClaheParams* p, Uint32 out_hist[256]) {
+  ClaheJob* job = (ClaheJob*)calloc(1, sizeof(ClaheJob));
+  if (!job) return false;
+  job->src = src;
+  job->dst = dst;
+  job->tiles_x = clahe_clamp_tiles(p->tiles_x, src->w);
+  job->tiles_y = clahe_clamp_tiles(p->tiles_y, src->h);
+  job->clip = p->clip;
+  clahe_layout(src->w, job->tiles_x, job->bx, job->sx);
+  clahe_layout(src->h, job->tiles_y, job->by, job->sy);
+
+  int nbands = band_count(src->h, HIST_MIN_BAND_PIXELS / (src->w > 0 ? src->w : 1));
+  job->luts = (Uint32*)malloc(sizeof(Uint32) * 256 * (size_t)(job->tiles_x * job->tiles_y));
+  job->fx = (Uint16*)malloc(sizeof(Uint16) * (size_t)src->w);
+  job->partial = (HistBins*)SDL_aligned_alloc(64, sizeof(HistBins) * (size_t)nbands);
+  bool ok = job->luts && job->fx && job->partial;
+
+  if (ok) {
+    for (int s = 0; s <= job->tiles_x; s++)
+      for (int x = job->sx[s]; x < job->sx[s + 1]; x++) {
+        int a, b;
+        job->fx[x] = (Uint16)clahe_weight(job->sx, job->tiles_x, s, x, &a, &b);
+      }
+    parallel_for(job->tiles_x * job->tiles_y, clahe_tile_task, job);
+    parallel_for(nbands, clahe_row_task, job);
+
+    memset(out_hist, 0, sizeof(Uint32) * 256);
+    for (int b = 0; b < nbands; b++)
+      for (int i = 0; i < 256; i++) out_hist[i] += job->partial[b].bins[i];
+  } else {
+    SDL_Log("Sem memória para o CLAHE");
+  }
+  free(job->luts);
+  free(job->fx);
+  if (job->partial) SDL_aligned_free(job->partial);
+  free(job);
+  return ok;
+}
+
+//"CLIP" ou "CLIP:GXxGY" (ex.: "2.5:8x8"); grade padrão 8x8
+static bool clahe_parse(ClaheParams* p, const char* spec) {
+  p->tiles_x = p->tiles_y = 8;
+  p->clip = (float)atof(spec);
+  const char* grid = strchr(spec, ':');
+  if (grid && sscanf(grid + 1, "%dx%d", &p->tiles_x, &p->tiles_y) != 2) {
+    SDL_Log("Grade inválida em --clahe: '%s' (use CLIP:GXxGY)", grid + 1);
+    return false;
+  }
+  if (p->tiles_x < 1 || p->tiles_y < 1 || p->tiles_x > CLAHE_MAX_TILES || p->tiles_y > CLAHE_MAX_TILES) {
+    SDL_Log("Grade do CLAHE deve ficar entre 1x1 e %dx%d", CLAHE_MAX_TILES, CLAHE_MAX_TILES);
+    return false;
+  }
+  return true;
+}
+
+//filtros espaciais: a imagem é cortada em blocos de FILTER_TILE_W x FILTER_TILE_H; cada bloco
+//copia sua vizinhança (halo de `radius` px, bordas da imagem replicadas) para um buffer local
+//e roda as passadas ali, com tudo quente no cache. Gaussiana, caixa e unsharp são separáveis
+//(horizontal u8 -> Q8, vertical Q8 -> u8); Sobel/Scharr separam suavização e derivada;
+//a mediana 3x3 usa uma rede min/max. As faixas de blocos rodam em paralelo
+static const char* const filter_names[FILTER_COUNT] = {
+  "none", "gauss", "box", "unsharp", "sobel", "scharr", "median"
+};
+
+typedef struct {
+  const GrayPlane* src;
+  GrayPlane*       dst;
+  FilterKind kind;
+  int        radius;                          //halo em cada lado do bloco
+  int        ntaps;
+  Uint16     htaps[2 * FILTER_MAX_RADIUS + 1]; //Q8, somam 256
+  Uint16     vtaps[2 * FILTER_MAX_RADIUS + 1]; //Q16, somam 65536
+  int        amount;                          //unsharp, Q8
+  int        tiles_x, tiles_y;
+  size_t     scratch_size;                    //por tarefa: bloco com halo + linhas de 16 bits
+  Uint8*     scratch;
+  HistBins*  partial;                         //histograma da saída, por tarefa
+} FilterJob;
+
+//pesos em ponto fixo somando exatamente `one`; o arredondamento sobra no centro
+static void filter_quantize(const double* g, int ntaps, int one, Uint16* out) {
+  double sum = 0.0;
+  for (int k = 0; k < ntaps; k++) sum += g[k];
+  int acc = 0;
+  for (int k = 0; k < ntaps; k++) {
+    out[k] = (Uint16)lround(g[k] / sum * one);
+    acc += out[k];
+  }
+  out[ntaps / 2] = (Uint16)(out[ntaps / 2] + one - acc);
+}
+
+//raio e pesos do núcleo separável; Sobel/Scharr e mediana só precisam de 1 px de halo
+static void filter_setup(FilterJob* job, const FilterParams* p) {
+  job->kind = p->kind;
+  job->radius = 1;
+  if (p->kind == FILTER_GAUSSIAN || p->kind == FILTER_UNSHARP) {
+    job->radius = SDL_clamp((int)ceilf(3.0f * p->size), 1, FILTER_MAX_RADIUS);
+  } else if (p->kind == FILTER_BOX) {
+    job->radius = SDL_clamp((int)lroundf(p->size), 1, FILTER_MAX_RADIUS);
+  }
+  job->ntaps = 2 * job->radius + 1;
+  double g[2 * FILTER_MAX_RADIUS + 1];
+  for (int k = 0; k < job->ntaps; k++) {
+    double d = k - job->radius;
+    g[k] = p->kind == FILTER_BOX ? 1.0 : exp(-d * d / (2.0 * (double)p->size * (double)p->size));
+  }
+  filter_quantize(g, job->ntaps, 256, job->htaps);
+  filter_quantize(g, job->ntaps, 65536, job->vtaps);
+  job->amount = (int)lroundf(p->amount * 256.0f);
+}
+
+//copia [x0-r, x1+r) x [y0-r, y1+r) do plano para `pad`, replicando as bordas da imagem
+static void filter_load_tile(const GrayPlane* src, int x0, int y0, int x1, int y1, int r, Uint8* pad, int pw) {
+  int cx0 = SDL_max(x0 - r, 0), cx1 = SDL_min(x1 + r, src->w);
+  for (int i = 0; i < y1 - y0 + 2 * r; i++) {
+    const Uint8* row = plane_row(src, SDL_clamp(y0 - r + i, 0, src->h - 1));
+    Uint8* out = pad + (size_t)i * (size_t)pw;
+    int lead = cx0 - (x0 - r);
+    memset(out, row[cx0], (size_t)lead);
+    memcpy(out + lead, row + cx0, (size_t)(cx1 - cx0));
+    memset(out + lead + (cx1 - cx0), row[cx1 - 1], (size_t)((x1 + r) - cx1));
+  }
+}
+
+//núcleos [a b a] de suavização e [-1 0 1] de derivada; |gx| + |gy| normalizado para que
+//um degrau 0 -> 255 dê 255
+static void filter_edges(const Uint8* pad, int pw, int tw, int th, Sint16* sm, Sint16* df,
+                         int a, int b, int shift, GrayPlane* dst, int x0, int y0) {
+  for (int i = 0; i < th + 2; i++) {
+    const Uint8* p = pad + (size_t)i * (size_t)pw;
+    Sint16* s = sm + (size_t)i * (size_t)tw;
+    Sint16* d = df + (size_t)i * (size_t)tw;
+    for (int x = 0; x < tw; x++) {
+      s[x] = (Sint16)(a * p[x] + b * p[x + 1] + a * p[x + 2]);
+      d[x] = (Sint16)(p[x + 2] - p[x]);
+    }
+  }
+  for (int j = 0; j < th; j++) {
+    const Sint16* d0 = df + (size_t)j * (size_t)tw;
+    const Sint16* d1 = d0 + tw;
+    const Sint16* d2 = d1 + tw;
+    const Sint16* s0 = sm + (size_t)j * (size_t)tw;
+    const Sint16* s2 = s0 + 2 * (size_t)tw;
+    Uint8* out = plane_row(dst, y0 + j) + x0;
+    for (int x = 0; x < tw; x++) {
+      int gx = a * d0[x] + b * d1[x] + a * d2[x];
+      int gy = s2[x] - s0[x];
+      int m = ((gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy)) >> shift;
+      out[x] = (Uint8)(m > 255 ? 255 : m);
+    }
+  }
+}
+
+static void filter_tile(FilterJob* job, Uint8* scratch, int x0, int y0, int x1, int y1) {
+  const int r = job->radius, tw = x1 - x0, th = y1 - y0, pw = tw + 2 * r;
+  Uint8* pad = scratch;
+  Uint16* hbuf = (Uint16*)(scratch + (((size_t)(FILTER_TILE_H + 2 * r) * (size_t)pw + 63) & ~(size_t)63));
+  filter_load_tile(job->src, x0, y0, x1, y1, r, pad, pw);
+
+  if (job->kind == FILTER_MEDIAN) {
+    for (int j = 0; j < th; j++) {
+      const Uint8* p = pad + (size_t)j * (size_t)pw;
+      g_kernels->row_median3(p, p + pw, p + 2 * pw, plane_row(job->dst, y0 + j) + x0, tw);
+    }
+    return;
+  }
+  if (job->kind == FILTER_SOBEL || job->kind == FILTER_SCHARR) {
+    bool scharr = job->kind == FILTER_SCHARR;
+    Sint16* sm = (Sint16*)hbuf;
+    filter_edges(pad, pw, tw, th, sm, sm + (size_t)(th + 2) * (size_t)tw,
+                 scharr ? 3 : 1, scharr ? 10 : 2, scharr ? 4 : 2, job->dst, x0, y0);
+    return;
+  }
+
+  for (int i = 0; i < th + 2 * r; i++)
+    g_kernels->row_hconv(pad + (size_t)i * (size_t)pw, hbuf + (size_t)i * (size_t)tw, tw, job->htaps, job->ntaps);
+  const Uint16* rows[2 * FILTER_MAX_RADIUS + 1];
+  Uint8* blur = (Uint8*)(hbuf + (size_t)(FILTER_TILE_H + 2 * r) * (size_t)FILTER_TILE_W);
+  for (int j = 0; j < th; j++) {
+    for (int k = 0; k < job->ntaps; k++) rows[k] = hbuf + (size_t)(j + k) * (size_t)tw;
+    Uint8* out = plane_row(job->dst, y0 + j) + x0;
+    if (job->kind != FILTER_UNSHARP) {
+      g_kernels->row_vconv(rows, out, tw, job->vtaps, job->ntaps);
+      continue;
+    }
+    //unsharp: original + ganho * (original - borrada), com saturação
+    g_kernels->row_vconv(rows, blur, tw, job->vtaps, job->ntaps);
+    const Uint8* orig = pad + (size_t)(j + r) * (size_t)pw + r;
+    for (int x = 0; x < tw; x++) {
+      int v = orig[x] + (((orig[x] - blur[x]) * job->amount + 128) >> 8);
+      out[x] = (Uint8)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+  }
+}
+
+//uma tarefa = faixa de linhas de blocos, percorrida bloco a bloco com o mesmo scratch
+static void filter_band_task(void* ctx, int band, int nbands) {
+  FilterJob* job = (FilterJob*)ctx;
+  Uint8* scratch = job->scratch + (size_t)band * job->scratch_size;
+  Uint32* hist = job->partial[band].bins;
+  memset(hist, 0, sizeof(job->partial[band].bins));
+  int ty0, ty1;
+  band_rows(job->tiles_y, band, nbands, &ty0, &ty1);
+  for (int ty = ty0; ty < ty1; ty++) {
+    int y0 = ty * FILTER_TILE_H, y1 = SDL_min(y0 + FILTER_TILE_H, job->src->h);
+    for (int tx = 0; tx < job->tiles_x; tx++) {
+      int x0 = tx * FILTER_TILE_W, x1 = SDL_min(x0 + FILTER_TILE_W, job->src->w);
+      filter_tile(job, scratch, x0, y0, x1, y1);
+    }
+    for (int y = y0; y < y1; y++) g_kernels->row_hist(plane_row(job->dst, y), job->src->w, hist);
+  }
+}
+
+//src -> dst em planos distintos (o halo lê a origem em volta de cada bloco);
+//`out_hist` sai da própria passada
+static bool plane_filter(const GrayPlane* src, GrayPlane* dst, const FilterParams* p, Uint32 out_hist[256]) {
+  FilterJob* job = (FilterJob*)calloc(1, sizeof(FilterJob));
+  if (!job) return false;
+  job->src = src;
+  job->dst = dst;
+  filter_setup(job, p);
+  job->tiles_x = (src->w + FILTER_TILE_W - 1) / FILTER_TILE_W;
+  job->tiles_y = (src->h + FILTER_TILE_H - 1) / FILTER_TILE_H;
+  //bloco com halo (u8) + linhas da passada horizontal (u16; Sobel usa dois planos s16) + linha borrada
+  const int r = job->radius;
+  size_t pad_bytes = ((size_t)(FILTER_TILE_H + 2 * r) * (size_t)(FILTER_TILE_W + 2 * r) + 63) & ~(size_t)63;
+  size_t row_bytes = sizeof(Uint16) * (size_t)(FILTER_TILE_H + 2 * r) * FILTER_TILE_W * 2;
+  job->scratch_size = (pad_bytes + row_bytes + FILTER_TILE_W + 63) & ~(size_t)63;
+
+  int nbands = band_count(job->tiles_y, 1);
+  job->scratch = (Uint8*)SDL_aligned_alloc(64, job->scratch_size * (size_t)nbands);
+  job->partial = (HistBins*)SDL_aligned_alloc(64, sizeof(HistBins) * (size_t)nbands);
+  bool ok = job->scratch && job->partial && src->w > 0 && src->h > 0;
+  if (ok) {
+    parallel_for(nbands, filter_band_task, job);
+    memset(out_hist, 0, sizeof(Uint32) * 256);
+    for (int b = 0; b < nbands; b++)
+      for (int i = 0; i < 256; i++) out_hist[i] += job->partial[b].bins[i];
+  } else {
+    SDL_Log("Sem memória para o filtro");
+  }
+  if (job->scratch) SDL_aligned_free(job->scratch);
+  if (job->partial) SDL_aligned_free(job->partial);
+  free(job);
+  return ok;
+}
+
+//parâmetros padrão de cada filtro (usados também ao trocar de filtro na interface)
+static void filter_set_kind(FilterParams* p, FilterKind kind) {
+  p->kind = kind;
+  p->size = kind == FILTER_BOX ? 2.0f : 1.5f;
+  p->amount = 1.0f;
+}
+
+//"gauss[:SIGMA]", "box[:RAIO]", "unsharp[:SIGMA[:GANHO]]", "sobel", "scharr" ou "median"
+static bool filter_parse(FilterParams* p, const char* spec) {
+  const char* colon = strchr(spec, ':');
+  size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+  int kind = FILTER_COUNT;
+  for (int k = FILTER_GAUSSIAN; k < FILTER_COUNT; k++)
+    if (strlen(filter_names[k]) == len && strncmp(spec, filter_names[k], len) == 0) kind = k;
+  if (kind == FILTER_COUNT) {
+    SDL_Log("Filtro desconhecido: '%s' (use gauss, box, unsharp, sobel, scharr ou median)", spec);
+    return false;
+  }
+  filter_set_kind(p, (FilterKind)kind);
+  if (colon) {
+    bool sized = kind == FILTER_GAUSSIAN || kind == FILTER_BOX || kind == FILTER_UNSHARP;
+    int n = sscanf(colon + 1, "%f:%f", &p->size, &p->amount);
+    if (!sized || n < 1 || (n == 2 && kind != FILTER_UNSHARP)) {
+      SDL_Log("Parâmetros inválidos em --filter: '%s'", spec);
+      return false;
+    }
+  }
+  if (kind == FILTER_BOX && (p->size < 1.0f || p->size > FILTER_MAX_RADIUS)) {
+    SDL_Log("Raio da caixa deve ficar entre 1 e %d", FILTER_MAX_RADIUS);
+    return false;
+  }
+  if ((kind == FILTER_GAUSSIAN || kind == FILTER_UNSHARP) && (p->size < 0.5f || p->size > FILTER_MAX_RADIUS / 3.0f)) {
+    SDL_Log("Sigma deve ficar entre 0.5 e %.1f", FILTER_MAX_RADIUS / 3.0);
+    return false;
+  }
+  if (p->amount < 0.0f || p->amount > 8.0f) {
+    SDL_Log("Ganho do unsharp deve ficar entre 0 e 8");
+    return false;
+  }
+  return true;
+}
+
+static void filter_describe(const FilterParams* p, char* out, size_t outsz) {
+  switch (p->kind) {
+    case FILTER_GAUSSIAN: snprintf(out, outsz, "Gauss %.1f", p->size); break;
+    case FILTER_BOX:      snprintf(out, outsz, "Caixa r%d", (int)lroundf(p->size)); break;
+    case FILTER_UNSHARP:  snprintf(out, outsz, "Unsharp %.1f/%.1f", p->size, p->amount); break;
+    case FILTER_SOBEL:    snprintf(out, outsz, "Sobel"); break;
+    case FILTER_SCHARR:   snprintf(out, outsz, "Scharr"); break;
+    case FILTER_MEDIAN:   snprintf(out, outsz, "Mediana 3x3"); break;
+    default:              snprintf(out, outsz, "Sem filtro"); break;
+  }
+}
+
+//processamento fora da memória (out-of-core) para PGM/PPM binários: o arquivo é lido em
+//faixas duas vezes (1ª passada: histograma; 2ª: LUT e gravação), com a memória limitada
+//pelo orçamento de faixa. O SDL_image só decodifica a imagem inteira, então PNG/JPEG
+//continuam no caminho normal
+
+//lê um token do cabeçalho PNM pulando espaços e comentários; consome o separador final
+static bool pnm_token(SDL_IOStream* io, char* out, size_t outsz) {
+  size_t n = 0;
+  char c;
+  for (;;) {
+    if (SDL_ReadIO(io, &c, 1) != 1) return false;
+    if (c == '#') {
+      while (c != '\n') if (SDL_ReadIO(io, &c, 1) != 1) return false;
+      continue;
+    }
+    if (c != ' ' && c != '\t' && c != '\r' && c != '\n') break;
+  }
+  do {
+    if (n + 1 >= outsz) return false;
+    out[n++] = c;
+    if (SDL_ReadIO(io, &c, 1) != 1) break;
+  } while (c != ' ' && c != '\t' && c != '\r' && c != '\n');
+  out[n] = '\0';
+  return true;
+}
+
+static bool pnm_read_header(SDL_IOStream* io, PnmHeader* h) {
+  char magic[8], sw[16], sh[16], smax[16];
+  if (!pnm_token(io, magic, sizeof(magic)) || !pnm_token(io, sw, sizeof(sw)) ||
+      !pnm_token(io, sh, sizeof(sh)) || !pnm_token(io, smax, sizeof(smax))) {
+    SDL_Log("Cabeçalho PNM inválido");
+    return false;
+  }
+  if (strcmp(magic, "P5") == 0)      h->channels = 1;
+  else if (strcmp(magic, "P6") == 0) h->channels = 3;
+  else { SDL_Log("PNM '%s' não suportado (use P5 ou P6)", magic); return false; }
+  h->w = atoi(sw);
+  h->h = atoi(sh);
+  h->maxval = atoi(smax);
+  h->little_endian = false;
+  if (h->w <= 0 || h->h <= 0 || h->maxval < 1 || h->maxval > 65535) {
+    SDL_Log("PNM %sx%s com maxval %s inválido", sw, sh, smax);
+    return false;
+  }
+  h->data_offset = SDL_TellIO(io);
+  return true;
+}
+
+//maxval do cabeçalho (0 se não for um PNM válido)
+static int pnm_maxval(const char* path) {
+  SDL_IOStream* io = SDL_IOFromFile(path, "rb");
+  PnmHeader h;
+  bool ok = io && pnm_read_header(io, &h);
+  if (io) SDL_CloseIO(io);
+  return ok ? h.maxval : 0;
+}
+
+static bool is_pnm_name(const char* name) {
+  const char* dot = strrchr(name, '.');
+  return dot && (SDL_strcasecmp(dot, ".pgm") == 0 || SDL_strcasecmp(dot, ".ppm") == 0 ||
+                 SDL_strcasecmp(dot, ".pnm") == 0);
+}
+
+//lê `rows` linhas para a faixa e reduz para Y8 (mesma conversão da ingestão normal)
+static bool stream_read_strip(SDL_IOStream* io, const PnmHeader* h, int rows,
+                              Uint8* raw, Uint8* rgba, GrayPlane* strip) {
+  size_t bytes = (size_t)h->w * (size_t)h->channels * (size_t)rows;
+  if (SDL_ReadIO(io, raw, bytes) != bytes) { SDL_Log("Arquivo PNM truncado"); return false; }
+  strip->h = rows;
+  if (h->channels == 1) return true; //P5: a faixa lida já é o plano Y8
+
+  if (!SDL_ConvertPixels(h->w, rows, SDL_PIXELFORMAT_RGB24, raw, h->w * 3, SDL_PIXELFORMAT_RGBA32, rgba, h->w * 4)) {
+    log_sdl_error("SDL_ConvertPixels (faixa) falhou");
+    return false;
+  }
+  for (int r = 0; r < rows; r++)
+    g_kernels->row_to_gray(rgba + (size_t)r * h->w * 4, plane_row(strip, r), h->w);
+  return true;
+}
+
+//in.pgm/ppm -> (pilha de operações) -> out.pgm sem nunca ter a imagem inteira na memória.
+//`out_hist` recebe o histograma da saída
+static bool stream_process_pnm(const char* in_path, const char* out_path, const PointOpStack* ops,
+                               Sint64 budget, int* out_w, int* out_h, Uint32 out_hist[256]) {
+  SDL_IOStream* in = SDL_IOFromFile(in_path, "rb");
+  if (!in) { SDL_Log("Falha ao abrir %s: %s", in_path, SDL_GetError()); return false; }
+  PnmHeader h;
+  if (!pnm_read_header(in, &h)) { SDL_CloseIO(in); return false; }
+  if (h.maxval != 255) {
+    SDL_Log("%s: maxval %d não suportado em faixas (precisa de 8 bits, maxval 255)", in_path, h.maxval);
+    SDL_CloseIO(in);
+    return false;
+  }
+
+  //custo por linha: bytes lidos + RGBA intermediário (P6) + Y8 (P6; no P5 é o próprio lido)
+  Sint64 row_cost = (Sint64)h.w * h.channels + (h.channels == 3 ? (Sint64)h.w * 5 : 0);
+  Sint64 rows64 = budget / row_cost;
+  int strip_rows = rows64 < 1 ? 1 : rows64 > h.h ? h.h : (int)rows64;
+
+  Uint8* raw  = (Uint8*)SDL_aligned_alloc(64, (size_t)h.w * h.channels * strip_rows);
+  Uint8* rgba = h.channels == 3 ? (Uint8*)SDL_aligned_alloc(64, (size_t)h.w * 4 * strip_rows) : NULL;
+  GrayPlane strip = { NULL, h.w, strip_rows, h.w, false };
+  strip.pixels = h.channels == 3 ? (Uint8*)SDL_aligned_alloc(64, (size_t)h.w * strip_rows) : raw;
+  SDL_IOStream* out = NULL;
+  bool ok = raw && strip.pixels && (h.channels == 1 || rgba);
+  if (!ok) SDL_Log("Sem memória para faixas de %d linhas", strip_rows);
+
+  Uint64 t0 = SDL_GetTicksNS();
+  Uint32 hist[256] = {0};
+  for (int y0 = 0; ok && y0 < h.h; y0 += strip_rows) {
+    int rows = (h.h - y0 < strip_rows) ? h.h - y0 : strip_rows;
+    ok = stream_read_strip(in, &h, rows, raw, rgba, &strip);
+    if (ok) plane_histogram(&strip, hist);
+  }
+
+  Uint8 lut[256];
+  point_stack_build_lut(ops, hist, lut, out_hist);
+
+  if (ok) {
+    out = SDL_IOFromFile(out_path, "wb");
+    ok = out && SDL_IOprintf(out, "P5\n%d %d\n255\n", h.w, h.h) > 0;
+    if (!ok) SDL_Log("Falha ao criar %s: %s", out_path, SDL_GetError());
+  }
+  //se a imagem coube em uma faixa, ela ainda está na memória: pula a releitura
+  bool reread = strip_rows < h.h;
+  if (ok && reread) ok = SDL_SeekIO(in, h.data_offset, SDL_IO_SEEK_SET) == h.data_offset;
+  for (int y0 = 0; ok && y0 < h.h; y0 += strip_rows) {
+    int rows = (h.h - y0 < strip_rows) ? h.h - y0 : strip_rows;
+    if (reread) ok = stream_read_strip(in, &h, rows, raw, rgba, &strip);
+    if (!ok) break;
+    if (ops->count > 0) plane_apply_lut(&strip, &strip, lut);
+    ok = SDL_WriteIO(out, strip.pixels, (size_t)h.w * rows) == (size_t)h.w * rows;
+    if (!ok) SDL_Log("Falha ao gravar %s: %s", out_path, SDL_GetError());
+  }
+
+  if (ok) {
+    double ms = (double)(SDL_GetTicksNS() - t0) / 1e6;
+    SDL_Log("Faixas: %s %dx%d, %d linhas/faixa (%.1f MB), %s, %.0f ms (%.1f MP/s)", in_path, h.w, h.h,
+            strip_rows, (double)row_cost * strip_rows / (1024.0 * 1024.0), reread ? "2 leituras" : "1 leitura",
+            ms, ms > 0.0 ? (double)h.w * h.h / 1e3 / ms : 0.0);
+    *out_w = h.w;
+    *out_h = h.h;
+  }
+  if (out && !SDL_CloseIO(out)) ok = false;
+  SDL_CloseIO(in);
+  if (strip.pixels != raw) SDL_aligned_free(strip.pixels);
+  SDL_aligned_free(raw);
+  if (rgba) SDL_aligned_free(rgba);
+  return ok;
+}
+
+//--stream <in.pgm|ppm> <out.pgm> [--ops lista] [--strip-mb N]
+static int run_stream(int argc, char** argv) {
+  if (argc < 4) {
+    SDL_Log("Uso: %s --stream <entrada.pgm|ppm> <saida.pgm> [--ops equalize,...] [--strip-mb N]", argv[0]);
+    return 1;
+  }
+  PointOpStack ops = { { { OP_EQUALIZE, 0.0f } }, 1 };
+  Sint64 budget_mb = 64;
+  for (int i = 4; i < argc; i++) {
+    if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+      if (!point_stack_parse(&ops, argv[++i])) return 1;
+    } else if (strcmp(argv[i], "--strip-mb") == 0 && i + 1 < argc) {
+      budget_mb = atoi(argv[++i]);
+    } else {
+      SDL_Log("Argumento desconhecido: %s", argv[i]);
+      return 1;
+    }
+  }
+  if (budget_mb < 1) budget_mb = 1;
+
+  pool_init(0);
+  int w = 0, h = 0;
+  Uint32 hist[256];
+  if (!stream_process_pnm(argv[2], argv[3], &ops, budget_mb * 1024 * 1024, &w, &h, hist)) return 1;
+  float mean, sd;
+  hist_mean_stddev(hist, &mean, &sd);
+  SDL_Log("Saída: média %.1f, desvio padrão %.1f", mean, sd);
+  return 0;
+}
+
+//--sequence: processa uma série numerada (padrão printf, ex. cap/f_%05d.png) ou um fluxo
+//Y4M no stdin ("-") em 4 threads (decodifica -> cinza -> equaliza -> codifica) ligadas por
+//filas SPSC limitadas sem lock. os quadros voltam do último estágio ao primeiro por mais
+//uma fila, então a memória fica fixa em 3 * fila + 2 quadros
+#define SEQ_QUEUE_MAX 64
+
+typedef struct {
+  void*         items[SEQ_QUEUE_MAX];
+  int           cap;
+  SDL_AtomicInt head;          //próximo a ler (só o consumidor escreve)
+  SDL_AtomicInt tail;          //próximo a escrever (só o produtor escreve)
+} SpscQueue;
+
+typedef struct {
+  int          index;
+  bool         last;           //sentinela de fim: atravessa os estágios e encerra cada um
+  SDL_Surface* surf;           //decodificado, ainda não convertido (série)
+  ImageData    img;            //plano Y8 (+ alfa), reaproveitado entre quadros
+  Uint32       hist[256];
+} SeqFrame;
+
+enum { SEQ_DECODE, SEQ_GRAY, SEQ_EQUALIZE, SEQ_ENCODE, SEQ_STAGES };
+static const char* const seq_stage_names[SEQ_STAGES] = { "decodifica", "cinza", "equaliza", "codifica" };
+
+typedef struct {
+  const char*   in_pattern;    //NULL: Y4M no stdin
+  const char*   out_pattern;   //NULL: Y4M no stdout
+  int           start;
+  PointOpStack  ops;
+  float         smooth;        //0: LUT de cada quadro; perto de 1: histograma suavizado no tempo
+  double        smooth_hist[256];
+  bool          smooth_ready;
+  int           y4m_w, y4m_h;  //entrada: só o decodificador escreve, e só no cabeçalho
+  int           out_w, out_h;  //saída Y4M: só o codificador lê e escreve
+  size_t        y4m_chroma;    //bytes de croma por quadro (descartados)
+  char          y4m_rate[32];
+  Uint8*        y4m_skip;
+  bool          y4m_header_out;
+  SpscQueue     q[SEQ_STAGES]; //q[s] alimenta o estágio s; q[SEQ_DECODE] devolve quadros livres
+  SeqFrame*     frames;
+  int           nframes;
+  SDL_AtomicInt abort;
+  SDL_AtomicInt finished;      //estágios que já saíram
+  SDL_AtomicInt done[SEQ_STAGES];
+  Uint64        busy_ns[SEQ_STAGES];
+} SeqPipeline;
+
+typedef struct {
+  SeqPipeline* p;
+  int          stage;
+} SeqStageArg;
+
+static void spsc_backoff(int spins) {
+  if (spins < 256) SDL_CPUPauseInstruction();
+  else             SDL_DelayNS(20000);
+}
+
+static bool spsc_push(SpscQueue* q, void* item, SDL_AtomicInt* abort) {
+  for (int spins = 0;; spins++) {
+    int tail = SDL_GetAtomicInt(&q->tail);
+    if (tail - SDL_GetAtomicInt(&q->head) < q->cap) {
+      q->items[tail % q->cap] = item;
+      SDL_SetAtomicInt(&q->tail, tail + 1); //publica o item depois de escrito
+      return true;
+    }
+    if (SDL_GetAtomicInt(abort)) return false;
+    spsc_backoff(spins);
+  }
+}
+
+static void* spsc_pop(SpscQueue* q, SDL_AtomicInt* abort) {
+  for (int spins = 0;; spins++) {
+    int head = SDL_GetAtomicInt(&q->head);
+    if (head != SDL_GetAtomicInt(&q->tail)) {
+      void* item = q->items[head % q->cap];
+      SDL_SetAtomicInt(&q->head, head + 1);
+      return item;
+    }
+    if (SDL_GetAtomicInt(abort)) return NULL;
+    spsc_backoff(spins);
+  }
+}
+
+static int spsc_depth(SpscQueue* q) {
+  return SDL_GetAtomicInt(&q->tail) - SDL_GetAtomicInt(&q->head);
+}
+
+//aceita exatamente uma conversão %d (com largura/zeros opcionais); o resto é literal
+static bool seq_pattern_ok(const char* pattern) {
+  int convs = 0;
+  for (const char* c = pattern; *c; c++) {
+    if (*c != '%') continue;
+    if (c[1] == '%') { c++; continue; }
+    c++;
+    while (*c >= '0' && *c <= '9') c++;
+    if (*c != 'd') return false;
+    convs++;
+  }
+  return convs == 1;
+}
+
+static bool y4m_read_line(char* out, size_t outsz) {
+  size_t n = 0;
+  int ch;
+  while ((ch = fgetc(stdin)) != EOF && ch != '\n')
+    if (n + 1 < outsz) out[n++] = (char)ch;
+  out[n] = '\0';
+  return ch != EOF || n > 0;
+}
+
+static bool y4m_read_header(SeqPipeline* p) {
+  char line[512];
+  if (!y4m_read_line(line, sizeof(line)) || strncmp(line, "YUV4MPEG2", 9) != 0) {
+    SDL_Log("Entrada não é Y4M");
+    return false;
+  }
+  const char* color = "420";
+  snprintf(p->y4m_rate, sizeof(p->y4m_rate), "30:1");
+  char* save = NULL;
+  for (char* tok = SDL_strtok_r(line + 9, " ", &save); tok; tok = SDL_strtok_r(NULL, " ", &save)) {
+    if (tok[0] == 'W') p->y4m_w = atoi(tok + 1);
+    else if (tok[0] == 'H') p->y4m_h = atoi(tok + 1);
+    else if (tok[0] == 'F') snprintf(p->y4m_rate, sizeof(p->y4m_rate), "%s", tok + 1);
+    else if (tok[0] == 'C') color = tok + 1;
+  }
+  const size_t w = (size_t)p->y4m_w, h = (size_t)p->y4m_h;
+  //mais de 8 bits aparece como sufixo: C420p10, C444p12, Cmono16
+  const char* pd = strchr(color, 'p');
+  const bool deep = (pd && pd[1] >= '0' && pd[1] <= '9') || strncmp(color, "mono1", 5) == 0;
+  if (p->y4m_w <= 0 || p->y4m_h <= 0 || deep) {
+    SDL_Log("Y4M não suportado (W%d H%d C%s): só 8 bits", p->y4m_w, p->y4m_h, color);
+    return false;
+  }
+  //só o Y interessa: o croma de cada quadro é lido e descartado
+  if (strncmp(color, "mono", 4) == 0)          p->y4m_chroma = 0;
+  else if (strncmp(color, "444alpha", 8) == 0) p->y4m_chroma = 3 * w * h;
+  else if (strncmp(color, "444", 3) == 0)      p->y4m_chroma = 2 * w * h;
+  else if (strncmp(color, "422", 3) == 0)      p->y4m_chroma = 2 * ((w + 1) / 2) * h;
+  else if (strncmp(color, "411", 3) == 0)      p->y4m_chroma = 2 * ((w + 3) / 4) * h;
+  else                                         p->y4m_chroma = 2 * ((w + 1) / 2) * ((h + 1) / 2);
+  if (p->y4m_chroma > 0 && !(p->y4m_skip = (Uint8*)malloc(p->y4m_chroma))) return false;
+  SDL_Log("Y4M: %dx%d, C%s, F%s", p->y4m_w, p->y4m_h, color, p->y4m_rate);
+  return true;
+}
+
+static bool seq_decode(SeqPipeline* p, SeqFrame* f, int index) {
+  f->index = index;
+  f->last = false;
+  if (p->in_pattern) {
+    char path[1024];
+    snprintf(path, sizeof(path), p->in_pattern, index);
+    if (!SDL_GetPathInfo(path, NULL)) { f->last = true; return true; } //fim da série
+    f->surf = IMG_Load(path);
+    if (!f->surf) { SDL_Log("IMG_Load falhou em %s: %s", path, SDL_GetError()); return false; }
+    return true;
+  }
+
+  char line[256];
+  if (!y4m_read_line(line, sizeof(line))) { f->last = true; return true; }
+  if (strncmp(line, "FRAME", 5) != 0) { SDL_Log("Y4M: esperado FRAME no quadro %d", index); return false; }
+  GrayPlane* g = &f->img.gray;
+  if (!g->pixels) {
+    if (!plane_alloc(g, p->y4m_w, p->y4m_h)) return false;
+    f->img.w = p->y4m_w;
+    f->img.h = p->y4m_h;
+  }
+  for (int y = 0; y < g->h; y++)
+    if (fread(plane_row(g, y), 1, (size_t)g->w, stdin) != (size_t)g->w) { SDL_Log("Y4M truncado"); return false; }
+  if (p->y4m_chroma && fread(p->y4m_skip, 1, p->y4m_chroma, stdin) != p->y4m_chroma) {
+    SDL_Log("Y4M truncado");
+    return false;
+  }
+  return true;
+}
+
+static bool seq_gray(SeqPipeline* p, SeqFrame* f) {
+  if (!p->in_pattern) {
+    //Y4M já é luma: o estágio só acumula o histograma
+    memset(f->hist, 0, sizeof(f->hist));
+    plane_histogram(&f->img.gray, f->hist);
+    return true;
+  }
+  SDL_Surface* s = f->surf;
+  f->surf = NULL;
+  return ingest_surface_gray(s, &f->img, f->hist, false, false, true);
+}
+
+//a suavização é uma média exponencial do histograma normalizado: a LUT acompanha a
+//cena sem piscar quando a exposição oscila de um quadro para o outro
+static void seq_equalize(SeqPipeline* p, SeqFrame* f) {
+  const Uint64 n = (Uint64)f->img.w * (Uint64)f->img.h;
+  const Uint32* hist = f->hist;
+  Uint32 smoothed[256];
+  if (p->smooth > 0.0f && n > 0) {
+    for (int i = 0; i < 256; i++) {
+      double v = (double)f->hist[i] / (double)n;
+      p->smooth_hist[i] = p->smooth_ready ? p->smooth * p->smooth_hist[i] + (1.0 - p->smooth) * v : v;
+      smoothed[i] = (Uint32)lround(p->smooth_hist[i] * (double)n);
+    }
+    p->smooth_ready = true;
+    hist = smoothed;
+  }
+  Uint8 lut[256];
+  Uint32 out_hist[256];
+  point_stack_build_lut(&p->ops, hist, lut, out_hist);
+  if (p->ops.count > 0) plane_apply_lut(&f->img.gray, &f->img.gray, lut);
+}
+
+static bool write_pgm(const char* path, const GrayPlane* g) {
+  SDL_IOStream* io = SDL_IOFromFile(path, "wb");
+  bool ok = io && SDL_IOprintf(io, "P5\n%d %d\n255\n", g->w, g->h) > 0;
+  for (int y = 0; ok && y < g->h; y++) ok = SDL_WriteIO(io, plane_row(g, y), (size_t)g->w) == (size_t)g->w;
+  if (io && !SDL_CloseIO(io)) ok = false;
+  if (!ok) SDL_Log("Falha ao gravar %s: %s", path, SDL_GetError());
+  return ok;
+}
+
+static bool seq_encode(SeqPipeline* p, SeqFrame* f) {
+  if (p->out_pattern) {
+    char path[1024];
+    snprintf(path, sizeof(path), p->out_pattern, f->index);
+    return is_pnm_name(path) ? write_pgm(path, &f->img.gray) : save_image_png(&f->img, path);
+  }
+  const GrayPlane* g = &f->img.gray;
+  if (!p->y4m_header_out) {
+    p->out_w = g->w;
+    p->out_h = g->h;
+    if (fprintf(stdout, "YUV4MPEG2 W%d H%d F%s Ip A1:1 Cmono\n", g->w, g->h,
+                p->in_pattern ? "30:1" : p->y4m_rate) < 0) return false;
+    p->y4m_header_out = true;
+  }
+  if (g->w != p->out_w || g->h != p->out_h) {
+    SDL_Log("Quadro %d com tamanho diferente (%dx%d): Y4M exige tamanho fixo", f->index, g->w, g->h);
+    return false;
+  }
+  if (fputs("FRAME\n", stdout) < 0) return false;
+  for (int y = 0; y < g->h; y++)
+    if (fwrite(plane_row(g, y), 1, (size_t)g->w, stdout) != (size_t)g->w) return false;
+  return true;
+}
+
+static int SDLCALL seq_stage_thread(void* data) {
+  SeqPipeline* p = ((SeqStageArg*)data)->p;
+  const int s = ((SeqStageArg*)data)->stage;
+  SpscQueue* in = &p->q[s];
+  SpscQueue* out = &p->q[(s + 1) % SEQ_STAGES];
+  for (int index = p->start;; index++) {
+    SeqFrame* f = (SeqFrame*)spsc_pop(in, &p->abort);
+    if (!f) break;
+    Uint64 t0 = SDL_GetTicksNS();
+    bool ok = true;
+    if (s == SEQ_DECODE)                      ok = seq_decode(p, f, index);
+    else if (s == SEQ_GRAY && !f->last)       ok = seq_gray(p, f);
+    else if (s == SEQ_EQUALIZE && !f->last)   seq_equalize(p, f);
+    else if (s == SEQ_ENCODE && !f->last)     ok = seq_encode(p, f);
+    p->busy_ns[s] += SDL_GetTicksNS() - t0;
+    if (!ok) {
+      SDL_Log("Estágio '%s' falhou no quadro %d", seq_stage_names[s], f->index);
+      SDL_SetAtomicInt(&p->abort, 1);
+      break;
+    }
+    const bool last = f->last;
+    if (!last) SDL_AddAtomicInt(&p->done[s], 1);
+    if (last && s == SEQ_ENCODE) break; //o sentinela não volta para a fila de livres
+    if (!spsc_push(out, f, &p->abort) || last) break;
+  }
+  SDL_AddAtomicInt(&p->finished, 1);
+  return 0;
+}
+
+//--sequence <entrada|-> <saida|-> [--ops equalize,...] [--smooth A] [--queue N] [--start N]
+static int run_sequence(int argc, char** argv) {
+  if (argc < 4) {
+    SDL_Log("Uso: %s --sequence <padrao_entrada|-> <padrao_saida|-> [--ops equalize,...] [--smooth 0.9] [--queue N] [--start N]", argv[0]);
+    return 1;
+  }
+  SeqPipeline* p = (SeqPipeline*)calloc(1, sizeof(SeqPipeline));
+  if (!p) return 1;
+  p->in_pattern = strcmp(argv[2], "-") == 0 ? NULL : argv[2];
+  p->out_pattern = strcmp(argv[3], "-") == 0 ? NULL : argv[3];
+  p->ops = (PointOpStack){ { { OP_EQUALIZE, 0.0f } }, 1 };
+  p->start = -1;
+  int qcap = 4;
+  bool args_ok = (!p->in_pattern || seq_pattern_ok(p->in_pattern)) &&
+                 (!p->out_pattern || seq_pattern_ok(p->out_pattern));
+  if (!args_ok) SDL_Log("Padrões de arquivo precisam de exatamente um %%d (ex. quadro_%%05d.png)");
+  for (int i = 4; i < argc && args_ok; i++) {
+    if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc)         args_ok = point_stack_parse(&p->ops, argv[++i]);
+    else if (strcmp(argv[i], "--smooth") == 0 && i + 1 < argc) p->smooth = (float)atof(argv[++i]);
+    else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc)  qcap = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)  p->start = atoi(argv[++i]);
+    else { SDL_Log("Argumento desconhecido: %s", argv[i]); args_ok = false; }
+  }
+  if (p->smooth < 0.0f) p->smooth = 0.0f;
+  if (p->smooth > 0.99f) p->smooth = 0.99f;
+  if (qcap < 1) qcap = 1;
+  if (qcap > 16) qcap = 16;
+  if (args_ok && !p->in_pattern) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    args_ok = y4m_read_header(p);
+  }
+  if (args_ok && !p->out_pattern) {
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  }
+  //sem --start a série começa em 0 ou, se não houver quadro 0, em 1
+  if (p->start < 0) {
+    char path[1024];
+    p->start = 0;
+    if (p->in_pattern) {
+      snprintf(path, sizeof(path), p->in_pattern, 0);
+      if (!SDL_GetPathInfo(path, NULL)) p->start = 1;
+    }
+  }
+  if (!args_ok) { free(p->y4m_skip); free(p); return 1; }
+
+  pool_init(0);
+  p->nframes = 3 * qcap + 2;
+  p->frames = (SeqFrame*)calloc((size_t)p->nframes, sizeof(SeqFrame));
+  if (!p->frames) { free(p->y4m_skip); free(p); return 1; }
+  for (int s = 0; s < SEQ_STAGES; s++) p->q[s].cap = (s == SEQ_DECODE) ? p->nframes : qcap;
+  for (int i = 0; i < p->nframes; i++) spsc_push(&p->q[SEQ_DECODE], &p->frames[i], &p->abort);
+
+  SeqStageArg args[SEQ_STAGES];
+  SDL_Thread* threads[SEQ_STAGES] = {0};
+  const Uint64 t0 = SDL_GetTicksNS();
+  for (int s = 0; s < SEQ_STAGES; s++) {
+    args[s] = (SeqStageArg){ p, s };
+    threads[s] = SDL_CreateThread(seq_stage_thread, seq_stage_names[s], &args[s]);
+    if (!threads[s]) {
+      log_sdl_error("SDL_CreateThread (sequência) falhou");
+      SDL_SetAtomicInt(&p->abort, 1);
+      SDL_AddAtomicInt(&p->finished, SEQ_STAGES - s);
+      break;
+    }
+  }
+
+  //acompanha o pipeline: FPS sustentado e ocupação média de cada fila (cinza, equaliza, codifica)
+  double depth_sum[SEQ_STAGES] = {0};
+  int samples = 0, last_frames = 0;
+  Uint64 last_report = t0;
+  while (SDL_GetAtomicInt(&p->finished) < SEQ_STAGES) {
+    SDL_Delay(20);
+    for (int s = SEQ_GRAY; s < SEQ_STAGES; s++) depth_sum[s] += spsc_depth(&p->q[s]);
+    samples++;
+    Uint64 now = SDL_GetTicksNS();
+    if (now - last_report >= 1000000000u) {
+      int frames = SDL_GetAtomicInt(&p->done[SEQ_ENCODE]);
+      SDL_Log("%d quadros, %.1f FPS | filas: cinza %d/%d, equaliza %d/%d, codifica %d/%d", frames,
+              (frames - last_frames) * 1e9 / (double)(now - last_report),
+              spsc_depth(&p->q[SEQ_GRAY]), qcap, spsc_depth(&p->q[SEQ_EQUALIZE]), qcap,
+              spsc_depth(&p->q[SEQ_ENCODE]), qcap);
+      last_frames = frames;
+      last_report = now;
+    }
+  }
+  for (int s = 0; s < SEQ_STAGES; s++)
+    if (threads[s]) SDL_WaitThread(threads[s], NULL);
+  if (!p->out_pattern) fflush(stdout);
+
+  const double secs = (double)(SDL_GetTicksNS() - t0) / 1e9;
+  const int frames = SDL_GetAtomicInt(&p->done[SEQ_ENCODE]);
+  SDL_Log("Sequência: %d quadros em %.2f s (%.1f FPS), fila %d, suavização %.2f", frames, secs,
+          secs > 0.0 ? frames / secs : 0.0, qcap, p->smooth);
+  for (int s = 0; s < SEQ_STAGES; s++) {
+    int n = SDL_GetAtomicInt(&p->done[s]);
+    SDL_Log("  %-10s %7.2f ms/quadro, fila de entrada média %.2f", seq_stage_names[s],
+            n ? (double)p->busy_ns[s] / 1e6 / n : 0.0,
+            (s != SEQ_DECODE && samples) ? depth_sum[s] / samples : 0.0);
+  }
+
+  const bool ok = !SDL_GetAtomicInt(&p->abort);
+  for (int i = 0; i < p->nframes; i++) {
+    if (p->frames[i].surf) SDL_DestroySurface(p->frames[i].surf);
+    free_image(&p->frames[i].img);
+  }
+  free(p->frames);
+  free(p->y4m_skip);
+  free(p);
+  return ok ? 0 : 1;
+}
+
+//modo batch: processa um diretório inteiro sem abrir janelas
+typedef struct {
+  bool  ok;
+  int   w, h;
+  int   maxval;            //255 ou, em 16 bits, o da entrada (média e desvio nessa escala)
+  float mean, stddev;
+} BatchResult;
+
+typedef struct {
+  const char*  in_dir;
+  const char*  out_dir;
+  char**       files;      //nomes dos arquivos dentro de in_dir (ordenados)
+  char**       out_names;  //nome de saída de cada arquivo dentro de out_dir (únicos)
+  int          count;
+  PointOpStack ops;
+  FilterParams filter;     //antes do CLAHE e da pilha
+  bool         clahe_on;
+  ClaheParams  clahe;
+  bool         color;      //equaliza só a luminância e grava em cor
+  Sint64       strip_budget; //> 0: PGM/PPM vão pelo caminho em faixas (saída .pgm)
+  SDL_AtomicInt next;      //próximo índice a ser pego por um worker
+  SDL_AtomicInt done;
+  BatchResult* results;
+} BatchJob;
+
+static bool has_image_extension(const char* name) {
+  static const char* exts[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif",
+                                ".webp", ".tif", ".tiff", ".pnm", ".pgm", ".ppm", ".qoi" };
+  const char* dot = strrchr(name, '.');
+  if (!dot) return false;
+  for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++)
+    if (SDL_strcasecmp(dot, exts[i]) == 0) return true;
+  return false;
+}
+
+static SDL_EnumerationResult SDLCALL collect_image_file(void* userdata, const char* dirname, const char* fname) {
+  (void)dirname;
+  BatchJob* job = (BatchJob*)userdata;
+  if (!has_image_extension(fname)) return SDL_ENUM_CONTINUE;
+
+  char** grown = (char**)realloc(job->files, sizeof(char*) * (size_t)(job->count + 1));
+  if (!grown) return SDL_ENUM_FAILURE;
+  job->files = grown;
+  job->files[job->count] = SDL_strdup(fname);
+  if (!job->files[job->count]) return SDL_ENUM_FAILURE;
+  job->count++;
+  return SDL_ENUM_CONTINUE;
+}
+
+static int compare_names(const void* a, const void* b) {
+  return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int compare_names_nocase(const void* a, const void* b) {
+  return SDL_strcasecmp(**(const char* const* const*)a, **(const char* const* const*)b);
+}
+
+//"nome_sem_extensao.ext" ou, com keep_ext, "nome.ext_original.ext"; PGM/PPM no caminho
+//em faixas saem em .pgm, o resto em .png
+static char* batch_output_name(const BatchJob* job, const char* fname, bool keep_ext) {
+  const char* ext = (job->strip_budget > 0 && is_pnm_name(fname)) ? "pgm" : "png";
+  const char* dot = strrchr(fname, '.');
+  int base_len = (dot && !keep_ext) ? (int)(dot - fname) : (int)strlen(fname);
+  char* name = NULL;
+  return SDL_asprintf(&name, "%.*s.%s", base_len, fname, ext) < 0 ? NULL : name;
+}
+
+static bool same_directory(const char* a, const char* b) {
+  char ra[4096], rb[4096];
+#ifdef _WIN32
+  bool resolved = _fullpath(ra, a, sizeof(ra)) && _fullpath(rb, b, sizeof(rb));
+  return resolved ? SDL_strcasecmp(ra, rb) == 0 : SDL_strcasecmp(a, b) == 0;
+#else
+  bool resolved = realpath(a, ra) && realpath(b, rb);
+  return resolved ? strcmp(ra, rb) == 0 : strcmp(a, b) == 0;
+#endif
+}
+
+//escolhe o nome de saída de cada arquivo. "scan.jpg" e "scan.png" (ou "a.tif" e "a.tiff")
+//dariam o mesmo "scan.png", com dois workers gravando o mesmo arquivo e só um resultado
+//sobrando: esses grupos mantêm a extensão original no nome. a comparação ignora maiúsculas
+//por causa dos sistemas de arquivos que também ignoram. gravar no próprio diretório de
+//entrada trocaria os .png originais pelos processados e é recusado
+static bool batch_plan_outputs(BatchJob* job) {
+  if (same_directory(job->in_dir, job->out_dir)) {
+    SDL_Log("O diretório de saída é o de entrada (%s): as saídas sobrescreveriam as originais", job->out_dir);
+    return false;
+  }
+  job->out_names = (char**)calloc((size_t)job->count, sizeof(char*));
+  char*** order = (char***)malloc(sizeof(char**) * (size_t)job->count);
+  bool ok = job->out_names && order;
+  for (int i = 0; ok && i < job->count; i++) {
+    ok = (job->out_names[i] = batch_output_name(job, job->files[i], false)) != NULL;
+    order[i] = &job->out_names[i];
+  }
+  for (int pass = 0; ok && pass < 2; pass++) {
+    qsort(order, (size_t)job->count, sizeof(char**), compare_names_nocase);
+    int renamed = 0;
+    for (int i = 0; ok && i < job->count;) {
+      int j = i + 1;
+      while (j < job->count && SDL_strcasecmp(*order[i], *order[j]) == 0) j++;
+      if (j - i > 1 && pass == 1) {
+        //só sobra colisão com nomes como "a.png" e "a.png.png" juntos, ou que diferem só
+        //em maiúsculas
+        SDL_Log("Saída duplicada: '%s' e '%s' gravariam '%s'", job->files[order[i] - job->out_names],
+                job->files[order[i + 1] - job->out_names], *order[i]);
+        ok = false;
+      }
+      for (int k = i; j - i > 1 && pass == 0 && ok && k < j; k++) {
+        const int idx = (int)(order[k] - job->out_names);
+        SDL_free(job->out_names[idx]);
+        ok = (job->out_names[idx] = batch_output_name(job, job->files[idx], true)) != NULL;
+        renamed++;
+      }
+      i = j;
+    }
+    if (renamed > 0) SDL_Log("%d arquivos com o mesmo nome de saída mantêm a extensão original (ex.: scan.jpg.png)", renamed);
+  }
+  if (!job->out_names || !order) SDL_Log("Sem memória para os nomes de saída");
+  free(order);
+  return ok;
+}
+
+//monta "out_dir/nome_de_saida"
+static void batch_output_path(const BatchJob* job, int idx, char* out, size_t outsz) {
+  snprintf(out, outsz, "%s/%s", job->out_dir, job->out_names[idx]);
+}
+
+//16 bits sem filtro nem CLAHE: pilha em 16 bits no próprio plano Y16 e PNG de 16 bits
+//(sem compressão: o IMG_SavePNG só grava 8 bits)
+static bool batch_process_deep(const BatchJob* job, ImageData* img, const char* out_path, BatchResult* res) {
+  Uint32* lut = (Uint32*)malloc(sizeof(Uint32) * HIST16_BINS * 2);
+  Uint32 hist[256];
+  if (!lut || !point_stack_build_lut16(&job->ops, img->hist16, img->maxval, lut, lut + HIST16_BINS, hist)) {
+    free(lut);
+    return false;
+  }
+  plane_apply_lut16(&img->deep, &img->deep, &img->gray, lut);
+
+  SaveTask t = {0};
+  t.deep = img->deep;
+  t.maxval = img->maxval;
+  t.w = img->w;
+  t.h = img->h;
+  t.format = SAVE_PNG_STORE;
+  SDL_IOStream* io = SDL_IOFromFile(out_path, "wb");
+  bool ok = io && save_png_store(&t, io);
+  if (io && !SDL_CloseIO(io)) ok = false;
+  if (!ok) SDL_Log("Falha ao gravar %s: %s", out_path, SDL_GetError());
+  if (ok) {
+    hist_mean_stddev_n(lut + HIST16_BINS, img->maxval + 1, &res->mean, &res->stddev);
+    res->w = img->w;
+    res->h = img->h;
+    res->maxval = img->maxval;
+  }
+  free(lut);
+  return ok;
+}
+
+//carrega -> cinza -> (CLAHE) -> (pilha de operações em uma LUT) -> salva -> estatísticas de um arquivo
+static bool batch_process_file(BatchJob* job, int idx) {
+  const char* fname = job->files[idx];
+  BatchResult* res = &job->results[idx];
+  char in_path[1024], out_path[1024];
+  snprintf(in_path, sizeof(in_path), "%s/%s", job->in_dir, fname);
+
+  Uint32 hist[256];
+  res->maxval = 255;
+  if (job->strip_budget > 0 && is_pnm_name(fname)) {
+    batch_output_path(job, idx, out_path, sizeof(out_path));
+    if (!stream_process_pnm(in_path, out_path, &job->ops, job->strip_budget, &res->w, &res->h, hist)) return false;
+    hist_mean_stddev(hist, &res->mean, &res->stddev);
+    return true;
+  }
+  batch_output_path(job, idx, out_path, sizeof(out_path));
+
+  ImageData img = {0};
+  if (!img_load_gray(in_path, &img, hist, false, job->color)) return false;
+  if (img.deep.pixels && job->filter.kind == FILTER_NONE && !job->clahe_on) {
+    bool ok = batch_process_deep(job, &img, out_path, res);
+    free_image(&img);
+    return ok;
+  }
+
+  if (job->filter.kind != FILTER_NONE) {
+    GrayPlane out = {0};
+    if (!plane_alloc(&out, img.w, img.h) || !plane_filter(&img.gray, &out, &job->filter, hist)) {
+      plane_free(&out);
+      free_image(&img);
+      return false;
+    }
+    plane_free(&img.gray);
+    img.gray = out;
+  }
+  if (job->clahe_on) {
+    GrayPlane out = {0};
+    if (!plane_alloc(&out, img.w, img.h) || !plane_clahe(&img.gray, &out, &job->clahe, hist)) {
+      plane_free(&out);
+      free_image(&img);
+      return false;
+    }
+    plane_free(&img.gray);
+    img.gray = out;
+  }
+  if (job->ops.count > 0) {
+    Uint8 lut[256];
+    point_stack_build_lut(&job->ops, hist, lut, hist);
+    plane_apply_lut(&img.gray, &img.gray, lut);
+  }
+
+  bool ok = save_image_png(&img, out_path);
+
+  if (ok) {
+    hist_mean_stddev(hist, &res->mean, &res->stddev);
+    res->w = img.w;
+    res->h = img.h;
+  }
+
+  free_image(&img);
+  return ok;
+}
+
+static int SDLCALL batch_worker(void* data) {
+  BatchJob* job = (BatchJob*)data;
+  for (;;) {
+    int idx = SDL_AddAtomicInt(&job->next, 1);
+    if (idx >= job->count) break;
+
+    job->results[idx].ok = batch_process_file(job, idx);
+
+    int done = SDL_AddAtomicInt(&job->done, 1) + 1;
+    if (done % 100 == 0 || done == job->count)
+      SDL_Log("Batch: %d/%d arquivos", done, job->count);
+  }
+  return 0;
+}
+
+//campo entre aspas (RFC 4180): vírgulas e quebras no nome ficam dentro do campo e as
+//aspas internas são dobradas
+static void csv_write_quoted(FILE* f, const char* text) {
+  fputc('"', f);
+  for (const char* c = text; *c; c++) {
+    if (*c == '"') fputc('"', f);
+    fputc(*c, f);
+  }
+  fputc('"', f);
+}
+
+static bool write_batch_csv(const BatchJob* job, const char* csv_path) {
+  FILE* f = fopen(csv_path, "w");
+  if (!f) {
+    SDL_Log("Falha ao criar CSV '%s'", csv_path);
+    return false;
+  }
+  fprintf(f, "arquivo,largura,altura,media,desvio_padrao,maxval,status\n");
+  for (int i = 0; i < job->count; i++) {
+    const BatchResult* r = &job->results[i];
+    csv_write_quoted(f, job->files[i]);
+    if (r->ok)
+      fprintf(f, ",%d,%d,%.3f,%.3f,%d,ok\n", r->w, r->h, r->mean, r->stddev, r->maxval);
+    else
+      fprintf(f, ",,,,,,erro\n");
+  }
+  fclose(f);
+  return true;
+}
+
+//--batch <in_dir> <out_dir> [--ops equalize,gamma=0.5,...] [--filter ESPEC] [--clahe CLIP[:GXxGY]] [--strip-mb N] [--jobs N] [--csv arquivo]
+static int run_batch(int argc, char** argv) {
+  if (argc < 4) {
+    SDL_Log("Uso: %s --batch <dir_entrada> <dir_saida> [--ops equalize,gamma=0.5,...] [--filter ESPEC] [--clahe CLIP[:GXxGY]] [--color] [--strip-mb N] [--jobs N] [--csv arquivo]", argv[0]);
+    return 1;
+  }
+
+  BatchJob job = {0};
+  job.in_dir  = argv[2];
+  job.out_dir = argv[3];
+  bool ops_given = false;
+  int jobs = SDL_GetNumLogicalCPUCores();
+  char csv_path[1024];
+  snprintf(csv_path, sizeof(csv_path), "%s/stats.csv", job.out_dir);
+
+  for (int i = 4; i < argc; i++) {
+    if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+      if (!point_stack_parse(&job.ops, argv[++i])) return 1;
+      ops_given = true;
+    } else if (strcmp(argv[i], "--clahe") == 0 && i + 1 < argc) {
+      if (!clahe_parse(&job.clahe, argv[++i])) return 1;
+      job.clahe_on = true;
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      if (!filter_parse(&job.filter, argv[++i])) return 1;
+    } else if (strcmp(argv[i], "--color") == 0) {
+      job.color = true;
+    } else if (strcmp(argv[i], "--strip-mb") == 0 && i + 1 < argc) {
+      job.strip_budget = (Sint64)atoi(argv[++i]) * 1024 * 1024;
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+      snprintf(csv_path, sizeof(csv_path), "%s", argv[++i]);
+    } else {
+      SDL_Log("Argumento desconhecido: %s", argv[i]);
+      return 1;
+    }
+  }
+  if ((job.clahe_on || job.color || job.filter.kind != FILTER_NONE) && job.strip_budget > 0) {
+    SDL_Log("--clahe, --filter e --color precisam da imagem inteira e não combinam com --strip-mb");
+    return 1;
+  }
+  //sem --ops o padrão é equalizar, a menos que o CLAHE ou um filtro já sejam o processamento
+  if (!ops_given && !job.clahe_on && job.filter.kind == FILTER_NONE) {
+    job.ops.ops[0] = (PointOp){ OP_EQUALIZE, 0.0f };
+    job.ops.count = 1;
+  }
+  if (jobs < 1) jobs = 1;
+  if (jobs > BATCH_MAX_JOBS) jobs = BATCH_MAX_JOBS;
+
+  if (!SDL_CreateDirectory(job.out_dir)) {
+    log_sdl_error("Falha ao criar diretório de saída");
+    return 1;
+  }
+  if (!SDL_EnumerateDirectory(job.in_dir, collect_image_file, &job)) {
+    log_sdl_error("Falha ao listar diretório de entrada");
+    return 1;
+  }
+  if (job.count == 0) {
+    SDL_Log("Nenhuma imagem encontrada em %s", job.in_dir);
+    free(job.files);
+    return 1;
+  }
+  qsort(job.files, (size_t)job.count, sizeof(char*), compare_names);
+
+  job.results = (BatchResult*)calloc((size_t)job.count, sizeof(BatchResult));
+  if (!job.results) {
+    SDL_Log("Sem memória para %d resultados", job.count);
+    return 1;
+  }
+  if (!batch_plan_outputs(&job)) return 1;
+  if (jobs > job.count) jobs = job.count;
+  char ops_desc[128];
+  int len = 0;
+  if (job.filter.kind != FILTER_NONE) {
+    filter_describe(&job.filter, ops_desc, sizeof(ops_desc) - 3);
+    len = (int)strlen(ops_desc);
+    len += snprintf(ops_desc + len, sizeof(ops_desc) - (size_t)len, " | ");
+  }
+  point_stack_describe(&job.ops, ops_desc + len, sizeof(ops_desc) - (size_t)len);
+  if (job.clahe_on)
+    SDL_Log("Batch: %d arquivos, %d threads, CLAHE %dx%d/%.1f, %s", job.count, jobs,
+            job.clahe.tiles_x, job.clahe.tiles_y, job.clahe.clip, ops_desc);
+  else
+    SDL_Log("Batch: %d arquivos, %d threads, %s", job.count, jobs, ops_desc);
+
+  crc_init(); //entradas de 16 bits gravam PNG pelo gravador próprio
+  Uint64 t0 = SDL_GetTicks();
+  SDL_Thread* threads[BATCH_MAX_JOBS];
+  int started = 0;
+  for (int i = 0; i < jobs; i++) {
+    threads[started] = SDL_CreateThread(batch_worker, "batch_worker", &job);
+    if (!threads[started]) { log_sdl_error("SDL_CreateThread falhou"); break; }
+    started++;
+  }
+  if (started == 0) batch_worker(&job); //sem threads: processa na thread principal
+  for (int i = 0; i < started; i++) SDL_WaitThread(threads[i], NULL);
+  Uint64 elapsed = SDL_GetTicks() - t0;
+
+  int failed = 0;
+  for (int i = 0; i < job.count; i++) if (!job.results[i].ok) failed++;
+  bool csv_ok = write_batch_csv(&job, csv_path);
+  SDL_Log("Batch concluído: %d ok, %d com erro, %.2f s | CSV: %s",
+          job.count - failed, failed, (double)elapsed / 1000.0, csv_path);
+
+  for (int i = 0; i < job.count; i++) {
+    SDL_free(job.files[i]);
+    SDL_free(job.out_names[i]);
+  }
+  free(job.files);
+  free(job.out_names);
+  free(job.results);
+  return (failed == 0 && csv_ok) ? 0 : 1;
+}
+
+//modo daemon: um processo sem janelas e já aquecido atende pedidos de histograma/equalização
+//por um socket Unix, evitando a partida do processo a cada imagem. cada conexão é servida
+//por um worker (um por núcleo), com buffers que crescem e são reaproveitados entre pedidos.
+//protocolo binário na ordem de bytes da máquina (cliente e servidor são a mesma máquina):
+//DaemonRequest + carga -> DaemonResponse + carga. a carga do pedido é o arquivo codificado
+//(w == 0), Y8 cru (w x h) ou, com shm[] preenchido, o nome de um objeto de memória
+//compartilhada POSIX com esses bytes
+#define DAEMON_MAGIC       0x31445643u //"CVD1"
+#define DAEMON_WANT_IMAGE  (1u << 0)   //devolve a imagem processada (Y8, w x h)
+#define DAEMON_WANT_STATS  (1u << 1)   //devolve o texto com os percentis de latência
+#define DAEMON_QUEUE_MAX   256         //conexões aceitas esperando worker
+#define DAEMON_LAT_BUCKETS 256         //buckets de 1/8 de oitava a partir de 1 us
+
+enum { DAEMON_OK, DAEMON_ERR_PROTO, DAEMON_ERR_TOO_BIG, DAEMON_ERR_SIZE, DAEMON_ERR_DECODE,
+       DAEMON_ERR_SHM, DAEMON_ERR_MEMORY };
+static const char* const daemon_status_names[] = { "ok", "protocolo", "grande demais", "tamanho",
+                                                   "decodificação", "memória compartilhada", "memória" };
+
+typedef struct {
+  Uint32 magic;
+  Uint32 flags;
+  Uint32 w, h;                 //0 x 0: a carga é um arquivo codificado (PNG, JPG, PGM...)
+  Uint64 size;                 //bytes da carga
+  char   shm[64];              //"" : a carga segue no socket; senão o nome do objeto (shm_open)
+} DaemonRequest;
+
+typedef struct {
+  Uint32 magic;
+  Uint32 status;
+  Uint32 w, h;
+  float  mean, stddev;         //da entrada
+  Uint32 hist[256];
+  Uint64 size;                 //bytes que seguem: imagem processada ou texto das estatísticas
+} DaemonResponse;
+
+#ifdef _WIN32
+static int run_serve(int argc, char** argv) {
+  (void)argc;
+  SDL_Log("%s --serve: sockets Unix e memória compartilhada POSIX não estão disponíveis no Windows; use --batch", argv[0]);
+  return 1;
+}
+
+static int run_client(int argc, char** argv) {
+  (void)argc;
+  SDL_Log("%s --client: sockets Unix e memória compartilhada POSIX não estão disponíveis no Windows", argv[0]);
+  return 1;
+}
+#else
+typedef struct {
+  Uint8* p;
+  size_t cap;
+} PoolBuf;
+
+typedef struct {
+  int          index;
+  struct Daemon* d;
+  SDL_Thread*  thread;
+  int          conn_fd;        //conexão em atendimento (-1: nenhuma), protegido por d->lock
+  PoolBuf      in, gray, out;
+  char         text[512];
+  //último objeto de memória compartilhada mapeado: pedidos seguidos com o mesmo buffer
+  //não pagam mmap nem as faltas de página de novo
+  char         shm_name[64];
+  int          shm_fd;
+  void*        shm_map;
+  size_t       shm_size;
+  dev_t        shm_dev;
+  ino_t        shm_ino;
+  SDL_ThreadID tid;
+  sigjmp_buf   bus_jmp;        //volta de um SIGBUS durante a leitura de shm_map
+  volatile sig_atomic_t bus_armed;
+} DaemonWorker;
+
+typedef struct Daemon {
+  PointOpStack  ops;
+  size_t        max_bytes;     //maior carga aceita
+  Uint64        max_pixels;    //maior imagem decodificada aceita
+  int           idle_s;        //conexão parada por mais que isso é fechada (0: nunca)
+  SDL_Mutex*    lock;
+  SDL_Condition* ready;
+  int           queue[DAEMON_QUEUE_MAX];
+  int           qhead, qcount;
+  bool          stop;
+  DaemonWorker* workers;
+  int           nworkers;
+  SDL_AtomicInt requests, errors;
+  SDL_AtomicInt lat[DAEMON_LAT_BUCKETS];
+  SDL_AtomicInt lat_max_us;
+} Daemon;
+
+static volatile sig_atomic_t g_daemon_signal = 0;
+static Daemon* g_daemon = NULL;
+
+static void daemon_on_signal(int sig) {
+  g_daemon_signal = sig;
+}
+
+//o objeto de memória compartilhada é do cliente: se ele encolher (ftruncate, ou outro
+//objeto com o mesmo nome) enquanto um worker lê o mapeamento, a leitura gera SIGBUS.
+//dentro de uma leitura protegida o worker volta ao sigsetjmp e o pedido vira erro; fora
+//dela o sinal segue o padrão e derruba o processo como antes
+static void daemon_on_sigbus(int sig) {
+  Daemon* d = g_daemon;
+  const SDL_ThreadID self = SDL_GetCurrentThreadID();
+  for (int i = 0; d && i < d->nworkers; i++) {
+    DaemonWorker* w = &d->workers[i];
+    if (w->bus_armed && w->tid == self) siglongjmp(w->bus_jmp, 1);
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+//buffer do pool: cresce até caber e nunca encolhe (o pico fica reservado para os próximos pedidos)
+static bool pool_buf_reserve(PoolBuf* b, size_t need) {
+  if (need <= b->cap) return true;
+  size_t cap = (need + (1u << 20) - 1) & ~(size_t)((1u << 20) - 1);
+  Uint8* p = (Uint8*)SDL_aligned_alloc(64, cap);
+  if (!p) { SDL_Log("Sem memória para buffer de %zu bytes", cap); return false; }
+  if (b->p) SDL_aligned_free(b->p);
+  b->p = p;
+  b->cap = cap;
+  return true;
+}
+
+static void pool_buf_free(PoolBuf* b) {
+  if (b->p) SDL_aligned_free(b->p);
+  b->p = NULL;
+  b->cap = 0;
+}
+
+static bool sock_read_all(int fd, void* buf, size_t n) {
+  Uint8* p = (Uint8*)buf;
+  while (n > 0) {
+    ssize_t r = recv(fd, p, n, 0);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    p += r;
+    n -= (size_t)r;
+  }
+  return true;
+}
+
+static bool sock_write_all(int fd, const void* buf, size_t n) {
+  const Uint8* p = (const Uint8*)buf;
+  while (n > 0) {
+    ssize_t r = send(fd, p, n, 0);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    p += r;
+    n -= (size_t)r;
+  }
+  return true;
+}
+
+static bool unix_address(struct sockaddr_un* addr, const char* path) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    SDL_Log("Caminho de socket longo demais: %s", path);
+    return false;
+  }
+  memcpy(addr->sun_path, path, strlen(path) + 1);
+  return true;
+}
+
+//latência em buckets logarítmicos (1/8 de oitava, ~9% de resolução) com contadores
+//atômicos: os workers registram sem lock e o percentil sai da soma acumulada
+static void daemon_record(Daemon* d, Uint64 ns, bool ok) {
+  const double us = (double)ns / 1000.0;
+  int b = us <= 1.0 ? 0 : (int)(8.0 * log2(us));
+  if (b >= DAEMON_LAT_BUCKETS) b = DAEMON_LAT_BUCKETS - 1;
+  SDL_AddAtomicInt(&d->lat[b], 1);
+  SDL_AddAtomicInt(&d->requests, 1);
+  if (!ok) SDL_AddAtomicInt(&d->errors, 1);
+  const int v = us > 2e9 ? 2000000000 : (int)us;
+  for (int cur = SDL_GetAtomicInt(&d->lat_max_us); v > cur; cur = SDL_GetAtomicInt(&d->lat_max_us))
+    if (SDL_CompareAndSwapAtomicInt(&d->lat_max_us, cur, v)) break;
+}
+
+static double daemon_percentile_us(const Uint32 counts[DAEMON_LAT_BUCKETS], Uint64 total, double p, int max_us) {
+  const Uint64 rank = (Uint64)ceil(p * (double)total);
+  Uint64 cum = 0;
+  for (int b = 0; b < DAEMON_LAT_BUCKETS; b++) {
+    cum += counts[b];
+    if (cum >= rank && cum > 0) return SDL_min(pow(2.0, (b + 0.5) / 8.0), (double)max_us); //meio geométrico do bucket
+  }
+  return 0.0;
+}
+
+static int daemon_stats_text(Daemon* d, char* out, size_t outsz) {
+  Uint32 counts[DAEMON_LAT_BUCKETS];
+  Uint64 total = 0;
+  for (int b = 0; b < DAEMON_LAT_BUCKETS; b++) total += counts[b] = (Uint32)SDL_GetAtomicInt(&d->lat[b]);
+  const int max_us = SDL_GetAtomicInt(&d->lat_max_us);
+  int n = snprintf(out, outsz, "%d pedidos, %d com erro, %d workers | latência no servidor (us): "
+                   "p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, máx %d",
+                   SDL_GetAtomicInt(&d->requests), SDL_GetAtomicInt(&d->errors), d->nworkers,
+                   daemon_percentile_us(counts, total, 0.50, max_us), daemon_percentile_us(counts, total, 0.90, max_us),
+                   daemon_percentile_us(counts, total, 0.99, max_us), daemon_percentile_us(counts, total, 0.999, max_us),
+                   max_us);
+  return n < 0 ? 0 : n >= (int)outsz ? (int)outsz - 1 : n;
+}
+
+static void daemon_unmap_shm(DaemonWorker* w) {
+  if (w->shm_map) munmap(w->shm_map, w->shm_size);
+  if (w->shm_fd >= 0) close(w->shm_fd);
+  w->shm_map = NULL;
+  w->shm_fd = -1;
+  w->shm_size = 0;
+  w->shm_name[0] = '\0';
+}
+
+//mapeia (só leitura) o objeto do pedido; o mapeamento anterior é reaproveitado se o nome
+//ainda aponta para o mesmo objeto e ele não mudou de tamanho (o fstat de cada pedido só
+//reduz a janela: o cliente ainda pode encolher o objeto durante a leitura, ver
+//daemon_handle_shm)
+static const Uint8* daemon_map_shm(DaemonWorker* w, const char* name, size_t size) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || (Uint64)st.st_size < size) {
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  if (w->shm_map && strcmp(w->shm_name, name) == 0 && w->shm_dev == st.st_dev && w->shm_ino == st.st_ino &&
+      w->shm_size == (size_t)st.st_size) {
+    close(fd);
+    return (const Uint8*)w->shm_map;
+  }
+  daemon_unmap_shm(w);
+  void* map = st.st_size > 0 ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  if (map == MAP_FAILED) { close(fd); return NULL; }
+  snprintf(w->shm_name, sizeof(w->shm_name), "%s", name);
+  w->shm_fd = fd;
+  w->shm_map = map;
+  w->shm_size = (size_t)st.st_size;
+  w->shm_dev = st.st_dev;
+  w->shm_ino = st.st_ino;
+  return (const Uint8*)map;
+}
+
+//decodifica a carga para Y8 no buffer do worker (pitch = largura); o alfa é descartado.
+//um arquivo pequeno pode descomprimir para uma imagem enorme: acima de max_pixels o pedido
+//é recusado antes da conversão e antes de o buffer do worker (que nunca encolhe) crescer
+static int daemon_decode(DaemonWorker* w, const Uint8* data, size_t size, GrayPlane* g) {
+  SDL_IOStream* io = SDL_IOFromConstMem(data, size);
+  SDL_Surface* s = io ? IMG_Load_IO(io, true) : NULL;
+  if (s && (Uint64)s->w * (Uint64)s->h > w->d->max_pixels) {
+    SDL_DestroySurface(s);
+    return DAEMON_ERR_SIZE;
+  }
+  if (s && s->format != SDL_PIXELFORMAT_RGBA32) {
+    SDL_Surface* conv = SDL_ConvertSurface(s, SDL_PIXELFORMAT_RGBA32);
+    SDL_DestroySurface(s);
+    s = conv;
+  }
+  if (!s) return DAEMON_ERR_DECODE;
+  int status = DAEMON_OK;
+  if (!pool_buf_reserve(&w->gray, (size_t)s->w * (size_t)s->h) || !SDL_LockSurface(s)) {
+    status = DAEMON_ERR_MEMORY;
+  } else {
+    *g = (GrayPlane){ w->gray.p, s->w, s->h, s->w, true };
+    for (int y = 0; y < s->h; y++)
+      g_kernels->row_to_gray((const Uint8*)s->pixels + (size_t)y * s->pitch, plane_row(g, y), s->w);
+    SDL_UnlockSurface(s);
+  }
+  SDL_DestroySurface(s);
+  return status;
+}
+
+//um pedido já com a carga em mãos. cada worker é uma thread por núcleo, então o pedido
+//roda em série (nada de parallel_for dentro dele)
+static int daemon_handle(Daemon* d, DaemonWorker* w, const DaemonRequest* req, const Uint8* data,
+                         DaemonResponse* res, const Uint8** out) {
+  if (req->flags & DAEMON_WANT_STATS) {
+    res->size = (Uint64)daemon_stats_text(d, w->text, sizeof(w->text));
+    *out = (const Uint8*)w->text;
+    return DAEMON_OK;
+  }
+  GrayPlane g;
+  if (req->w > 0 || req->h > 0) {
+    if (req->w == 0 || req->h == 0 || req->w > 1u << 20 || req->h > 1u << 20 ||
+        (Uint64)req->w * req->h != req->size)
+      return DAEMON_ERR_SIZE;
+    g = (GrayPlane){ (Uint8*)data, (int)req->w, (int)req->h, (int)req->w, true };
+  } else {
+    int status = daemon_decode(w, data, (size_t)req->size, &g);
+    if (status != DAEMON_OK) return status;
+  }
+
+  for (int y = 0; y < g.h; y++) g_kernels->row_hist(plane_row(&g, y), g.w, res->hist);
+  hist_mean_stddev(res->hist, &res->mean, &res->stddev);
+  res->w = (Uint32)g.w;
+  res->h = (Uint32)g.h;
+  if (req->flags & DAEMON_WANT_IMAGE) {
+    const size_t bytes = (size_t)g.w * (size_t)g.h;
+    if (!pool_buf_reserve(&w->out, bytes)) return DAEMON_ERR_MEMORY;
+    Uint8 lut[256];
+    Uint32 out_hist[256];
+    point_stack_build_lut(&d->ops, res->hist, lut, out_hist);
+    for (int y = 0; y < g.h; y++)
+      g_kernels->row_apply_lut(plane_row(&g, y), w->out.p + (size_t)y * g.w, g.w, lut);
+    res->size = bytes;
+    *out = w->out.p;
+  }
+  return DAEMON_OK;
+}
+
+//daemon_handle com a carga no mapeamento do cliente, sob a guarda de SIGBUS. o Y8 cru é lido
+//direto (só kernels de linha, sem lock nem alocação no meio, então abandonar a leitura é
+//seguro); um arquivo codificado é copiado antes para w->in, porque o decodificador não pode
+//ser interrompido no meio
+static int daemon_handle_shm(Daemon* d, DaemonWorker* w, const DaemonRequest* req, const Uint8* data,
+                             DaemonResponse* res, const Uint8** out) {
+  if (sigsetjmp(w->bus_jmp, 1)) {
+    w->bus_armed = 0;
+    daemon_unmap_shm(w);
+    SDL_Log("Memória compartilhada %s encolheu durante a leitura", req->shm);
+    return DAEMON_ERR_SHM;
+  }
+  const bool encoded = req->w == 0 && req->h == 0 && !(req->flags & DAEMON_WANT_STATS);
+  if (encoded && !pool_buf_reserve(&w->in, (size_t)req->size)) return DAEMON_ERR_MEMORY;
+  w->bus_armed = 1;
+  SDL_CompilerBarrier();
+  if (encoded) {
+    memcpy(w->in.p, data, (size_t)req->size);
+    SDL_CompilerBarrier();
+    w->bus_armed = 0;
+  }
+  int status = daemon_handle(d, w, req, encoded ? w->in.p : data, res, out);
+  SDL_CompilerBarrier();
+  w->bus_armed = 0;
+  return status;
+}
+
+//atende os pedidos de uma conexão até o cliente fechar ou ficar parado além de idle_s
+//(o recv expira e a conexão cai). a latência medida vai do cabeçalho recebido até a
+//resposta enviada
+static void daemon_serve_conn(Daemon* d, DaemonWorker* w, int fd) {
+  DaemonRequest req;
+  DaemonResponse res;
+  while (sock_read_all(fd, &req, sizeof(req))) {
+    const Uint64 t0 = SDL_GetTicksNS();
+    memset(&res, 0, sizeof(res));
+    res.magic = DAEMON_MAGIC;
+    const Uint8* out = NULL;
+    const Uint8* data = NULL;
+    bool desync = false;       //carga não consumida: a conexão não tem como continuar
+    req.shm[sizeof(req.shm) - 1] = '\0';
+    if (req.magic != DAEMON_MAGIC) {
+      res.status = DAEMON_ERR_PROTO;
+      desync = true;
+    } else if (req.size > d->max_bytes) {
+      res.status = DAEMON_ERR_TOO_BIG;
+      desync = req.shm[0] == '\0';
+    } else if (req.shm[0] != '\0') {
+      data = daemon_map_shm(w, req.shm, (size_t)req.size);
+      if (!data) res.status = DAEMON_ERR_SHM;
+    } else if (!pool_buf_reserve(&w->in, (size_t)req.size)) {
+      res.status = DAEMON_ERR_MEMORY;
+      desync = true;
+    } else if (!sock_read_all(fd, w->in.p, (size_t)req.size)) {
+      break;
+    } else {
+      data = w->in.p;
+    }
+    if (res.status == DAEMON_OK)
+      res.status = (Uint32)(req.shm[0] != '\0' ? daemon_handle_shm(d, w, &req, data, &res, &out)
+                                                 : daemon_handle(d, w, &req, data, &res, &out));
+    if (res.status != DAEMON_OK) res.size = 0;
+    bool ok = sock_write_all(fd, &res, sizeof(res)) && (res.size == 0 || sock_write_all(fd, out, (size_t)res.size));
+    daemon_record(d, SDL_GetTicksNS() - t0, res.status == DAEMON_OK);
+    if (!ok || desync) break;
+  }
+}
+
+static int SDLCALL daemon_worker(void* data) {
+  DaemonWorker* w = (DaemonWorker*)data;
+  Daemon* d = w->d;
+  w->tid = SDL_GetCurrentThreadID();
+  for (;;) {
+    SDL_LockMutex(d->lock);
+    while (!d->stop && d->qcount == 0) SDL_WaitCondition(d->ready, d->lock);
+    if (d->stop) { SDL_UnlockMutex(d->lock); break; }
+    int fd = d->queue[d->qhead];
+    d->qhead = (d->qhead + 1) % DAEMON_QUEUE_MAX;
+    d->qcount--;
+    w->conn_fd = fd;
+    SDL_UnlockMutex(d->lock);
+
+    daemon_serve_conn(d, w, fd);
+
+    SDL_LockMutex(d->lock);
+    w->conn_fd = -1;
+    close(fd);
+    SDL_UnlockMutex(d->lock);
+  }
+  return 0;
+}
+
+//abre o socket; um arquivo de socket que sobrou de um daemon morto (ninguém aceita
+//conexão nele) é removido, um daemon vivo no mesmo caminho é erro
+static int daemon_listen(const char* path) {
+  struct sockaddr_un addr;
+  if (!unix_address(&addr, path)) return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) { SDL_Log("socket() falhou: %s", strerror(errno)); return -1; }
+  bool bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+  if (!bound && errno == EADDRINUSE) {
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool alive = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    if (probe >= 0) close(probe);
+    if (alive) {
+      SDL_Log("Já existe um daemon atendendo em %s", path);
+      close(fd);
+      return -1;
+    }
+    unlink(path);
+    bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+  }
+  if (!bound || listen(fd, 128) != 0) {
+    SDL_Log("Falha ao abrir o socket %s: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+//--serve <socket> [--ops equalize,...] [--workers N] [--max-mb N] [--max-mp N] [--warm-mp N] [--idle-s N]
+static int run_serve(int argc, char** argv) {
+  if (argc < 3) {
+    SDL_Log("Uso: %s --serve <socket> [--ops equalize,...] [--workers N] [--max-mb N] [--max-mp N] [--warm-mp N] [--idle-s N]", argv[0]);
+    return 1;
+  }
+  Daemon* d = (Daemon*)calloc(1, sizeof(Daemon));
+  if (!d) return 1;
+  const char* path = argv[2];
+  d->ops = (PointOpStack){ { { OP_EQUALIZE, 0.0f } }, 1 };
+  d->max_bytes = (size_t)256 << 20;
+  double max_mp = -1.0;        //sem --max-mp: o mesmo teto de uma carga Y8 crua
+  d->idle_s = 30;
+  int nworkers = SDL_GetNumLogicalCPUCores();
+  double warm_mp = 1.0;
+  bool args_ok = true;
+  for (int i = 3; i < argc && args_ok; i++) {
+    if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc)            args_ok = point_stack_parse(&d->ops, argv[++i]);
+    else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)   nworkers = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--max-mb") == 0 && i + 1 < argc)    d->max_bytes = (size_t)atoi(argv[++i]) << 20;
+    else if (strcmp(argv[i], "--max-mp") == 0 && i + 1 < argc)    max_mp = atof(argv[++i]);
+    else if (strcmp(argv[i], "--warm-mp") == 0 && i + 1 < argc)   warm_mp = atof(argv[++i]);
+    else if (strcmp(argv[i], "--idle-s") == 0 && i + 1 < argc)    d->idle_s = atoi(argv[++i]);
+    else { SDL_Log("Argumento desconhecido: %s", argv[i]); args_ok = false; }
+  }
+  if (nworkers < 1) nworkers = 1;
+  if (nworkers > BATCH_MAX_JOBS) nworkers = BATCH_MAX_JOBS;
+  if (warm_mp < 0.0) warm_mp = 0.0;
+  if (d->idle_s < 0) d->idle_s = 0;
+  d->max_pixels = max_mp < 0.0 ? (Uint64)d->max_bytes : (Uint64)(max_mp * 1e6);
+  int lfd = args_ok ? daemon_listen(path) : -1;
+  d->lock = SDL_CreateMutex();
+  d->ready = SDL_CreateCondition();
+  d->workers = (DaemonWorker*)calloc((size_t)nworkers, sizeof(DaemonWorker));
+  if (lfd < 0 || !d->lock || !d->ready || !d->workers) {
+    if (lfd >= 0) { close(lfd); unlink(path); }
+    SDL_DestroyCondition(d->ready);
+    SDL_DestroyMutex(d->lock);
+    free(d->workers);
+    free(d);
+    return 1;
+  }
+
+  //workers aquecidos: a thread já existe e os buffers do tamanho típico já foram tocados,
+  //então o primeiro pedido não paga criação de thread nem faltas de página
+  const size_t warm = (size_t)(warm_mp * 1e6);
+  for (int i = 0; i < nworkers; i++) {
+    d->workers[i].index = i;
+    d->workers[i].d = d;
+    d->workers[i].conn_fd = -1;
+    d->workers[i].shm_fd = -1;
+  }
+  for (int i = 0; i < nworkers; i++) {
+    DaemonWorker* w = &d->workers[i];
+    if (warm > 0 && pool_buf_reserve(&w->in, warm) && pool_buf_reserve(&w->gray, warm) &&
+        pool_buf_reserve(&w->out, warm)) {
+      memset(w->in.p, 0, w->in.cap);
+      memset(w->gray.p, 0, w->gray.cap);
+      memset(w->out.p, 0, w->out.cap);
+    }
+    w->thread = SDL_CreateThread(daemon_worker, "daemon_worker", w);
+    if (!w->thread) { log_sdl_error("SDL_CreateThread (daemon) falhou"); break; }
+    d->nworkers++;
+  }
+
+  signal(SIGPIPE, SIG_IGN); //cliente que fecha no meio da resposta vira erro de send, não sinal
+  signal(SIGINT, daemon_on_signal);
+  signal(SIGTERM, daemon_on_signal);
+  struct sigaction bus = {0};
+  bus.sa_handler = daemon_on_sigbus;
+  sigemptyset(&bus.sa_mask);
+  g_daemon = d;
+  sigaction(SIGBUS, &bus, NULL);
+  char ops_desc[128];
+  point_stack_describe(&d->ops, ops_desc, sizeof(ops_desc));
+  SDL_Log("Daemon em %s: %d workers, %s, carga máxima %zu MB, imagem máxima %.1f MP", path, d->nworkers, ops_desc,
+          d->max_bytes >> 20, (double)d->max_pixels / 1e6);
+
+  //a thread principal só aceita conexões e, a cada 10 s com movimento, registra os percentis
+  Uint64 last_report = SDL_GetTicksNS();
+  int last_requests = 0;
+  char text[512];
+  while (d->nworkers > 0 && !g_daemon_signal) {
+    struct pollfd pfd = { lfd, POLLIN, 0 };
+    int r = poll(&pfd, 1, 200);
+    if (r > 0 && (pfd.revents & POLLIN)) {
+      int cfd = accept(lfd, NULL, NULL);
+      if (cfd >= 0) {
+        //cada conexão prende um worker: sem o prazo, N clientes parados travariam o daemon
+        //(vale também para o send, com um cliente que não lê a resposta)
+        if (d->idle_s > 0) {
+          struct timeval tv = { d->idle_s, 0 };
+          setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+          setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
+        SDL_LockMutex(d->lock);
+        if (d->qcount < DAEMON_QUEUE_MAX) {
+          d->queue[(d->qhead + d->qcount) % DAEMON_QUEUE_MAX] = cfd;
+          d->qcount++;
+          SDL_SignalCondition(d->ready);
+          cfd = -1;
+        }
+        SDL_UnlockMutex(d->lock);
+        if (cfd >= 0) { SDL_Log("Fila de conexões cheia: conexão recusada"); close(cfd); }
+      }
+    }
+    Uint64 now = SDL_GetTicksNS();
+    if (now - last_report >= 10000000000u && SDL_GetAtomicInt(&d->requests) != last_requests) {
+      daemon_stats_text(d, text, sizeof(text));
+      SDL_Log("Daemon: %s", text);
+      last_requests = SDL_GetAtomicInt(&d->requests);
+      last_report = now;
+    }
+  }
+
+  //encerramento: para de aceitar, derruba as conexões em atendimento e espera os workers
+  SDL_Log("Daemon encerrando (sinal %d)", (int)g_daemon_signal);
+  close(lfd);
+  unlink(path);
+  SDL_LockMutex(d->lock);
+  d->stop = true;
+  for (int i = 0; i < d->nworkers; i++)
+    if (d->workers[i].conn_fd >= 0) shutdown(d->workers[i].conn_fd, SHUT_RDWR);
+  SDL_BroadcastCondition(d->ready);
+  SDL_UnlockMutex(d->lock);
+  for (int i = 0; i < d->nworkers; i++) SDL_WaitThread(d->workers[i].thread, NULL);
+  for (; d->qcount > 0; d->qcount--, d->qhead = (d->qhead + 1) % DAEMON_QUEUE_MAX) close(d->queue[d->qhead]);
+
+  daemon_stats_text(d, text, sizeof(text));
+  SDL_Log("Daemon: %s", text);
+  const int rc = d->nworkers > 0 ? 0 : 1; //sem nenhum worker o daemon nem chegou a atender
+  for (int i = 0; i < nworkers; i++) {
+    DaemonWorker* w = &d->workers[i];
+    pool_buf_free(&w->in);
+    pool_buf_free(&w->gray);
+    pool_buf_free(&w->out);
+    daemon_unmap_shm(w);
+  }
+  SDL_DestroyCondition(d->ready);
+  SDL_DestroyMutex(d->lock);
+  free(d->workers);
+  free(d);
+  return rc;
+}
+
+//gerador de carga: C conexões em paralelo, cada uma mandando pedidos em sequência
+typedef struct {
+  const char*          path;
+  DaemonRequest        req;
+  const Uint8*         payload;    //NULL com shm
+  int                  count;      //pedidos desta conexão
+  Uint64*              lat_ns;
+  int                  done;
+  DaemonResponse       first;
+  bool                 ok;
+} ClientConn;
+
+static int client_connect(const char* path) {
+  struct sockaddr_un addr;
+  if (!unix_address(&addr, path)) return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    SDL_Log("Falha ao conectar em %s: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int SDLCALL client_conn_thread(void* data) {
+  ClientConn* c = (ClientConn*)data;
+  int fd = client_connect(c->path);
+  if (fd < 0) return 0;
+  PoolBuf reply = {0};
+  DaemonResponse res;
+  c->ok = true;
+  for (int i = 0; i < c->count && c->ok; i++) {
+    const Uint64 t0 = SDL_GetTicksNS();
+    c->ok = sock_write_all(fd, &c->req, sizeof(c->req)) &&
+            (!c->payload || sock_write_all(fd, c->payload, (size_t)c->req.size)) &&
+            sock_read_all(fd, &res, sizeof(res)) && res.magic == DAEMON_MAGIC &&
+            pool_buf_reserve(&reply, (size_t)res.size) && sock_read_all(fd, reply.p, (size_t)res.size);
+    if (c->ok && res.status != DAEMON_OK) {
+      SDL_Log("Daemon respondeu erro: %s", res.status < sizeof(daemon_status_names) / sizeof(daemon_status_names[0]) ?
+              daemon_status_names[res.status] : "?");
+      c->ok = false;
+    }
+    if (!c->ok) break;
+    c->lat_ns[c->done++] = SDL_GetTicksNS() - t0;
+    if (i == 0) c->first = res;
+  }
+  pool_buf_free(&reply);
+  close(fd);
+  return 0;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  const Uint64 x = *(const Uint64*)a, y = *(const Uint64*)b;
+  return x < y ? -1 : x > y;
+}
+
+static double client_percentile_us(const Uint64* sorted, int n, double p) {
+  int i = (int)ceil(p * n) - 1;
+  if (i < 0) i = 0;
+  return (double)sorted[i] / 1000.0;
+}
+
+//--client <socket> <imagem> [--requests N] [--concurrency C] [--image] [--raw] [--shm]
+static int run_client(int argc, char** argv) {
+  if (argc < 4) {
+    SDL_Log("Uso: %s --client <socket> <imagem> [--requests N] [--concurrency C] [--image] [--raw] [--shm]", argv[0]);
+    return 1;
+  }
+  const char* path = argv[2];
+  const char* image = argv[3];
+  int requests = 1000, conc = 4;
+  bool want_image = false, raw = false, use_shm = false;
+  for (int i = 4; i < argc; i++) {
+    if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc)          requests = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc)  conc = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--image") == 0)                        want_image = true;
+    else if (strcmp(argv[i], "--raw") == 0)                          raw = true;
+    else if (strcmp(argv[i], "--shm") == 0)                          use_shm = true;
+    else { SDL_Log("Argumento desconhecido: %s", argv[i]); return 1; }
+  }
+  if (requests < 1) requests = 1;
+  if (conc < 1) conc = 1;
+  if (conc > BATCH_MAX_JOBS) conc = BATCH_MAX_JOBS;
+  if (conc > requests) conc = requests;
+
+  //a carga é o arquivo como está (o daemon decodifica) ou, com --raw, o Y8 já decodificado aqui
+  DaemonRequest req = {0};
+  req.magic = DAEMON_MAGIC;
+  req.flags = want_image ? DAEMON_WANT_IMAGE : 0;
+  Uint8* payload = NULL;
+  if (raw) {
+    ImageData img = {0};
+    Uint32 hist[256];
+    if (!img_load_gray(image, &img, hist, false, false)) return 1;
+    payload = (Uint8*)malloc((size_t)img.w * (size_t)img.h);
+    for (int y = 0; payload && y < img.h; y++) memcpy(payload + (size_t)y * img.w, plane_row(&img.gray, y), (size_t)img.w);
+    req.w = (Uint32)img.w;
+    req.h = (Uint32)img.h;
+    req.size = (Uint64)img.w * (Uint64)img.h;
+    free_image(&img);
+  } else {
+    size_t n = 0;
+    payload = (Uint8*)SDL_LoadFile(image, &n);
+    req.size = n;
+    if (!payload) log_sdl_error("Falha ao ler a imagem");
+  }
+  if (!payload) return 1;
+
+  //com --shm a carga vai uma vez para um objeto de memória compartilhada e os pedidos
+  //levam só o nome
+  void* shm_map = NULL;
+  if (use_shm) {
+    snprintf(req.shm, sizeof(req.shm), "/cv_client_%d", (int)getpid());
+    int fd = shm_open(req.shm, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd >= 0 && ftruncate(fd, (off_t)req.size) == 0)
+      shm_map = mmap(NULL, (size_t)req.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0) close(fd);
+    if (!shm_map || shm_map == MAP_FAILED) {
+      SDL_Log("Falha ao criar memória compartilhada %s: %s", req.shm, strerror(errno));
+      if (fd >= 0) shm_unlink(req.shm);
+      free(payload);
+      return 1;
+    }
+    memcpy(shm_map, payload, (size_t)req.size);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  ClientConn* conns = (ClientConn*)calloc((size_t)conc, sizeof(ClientConn));
+  Uint64* lat = (Uint64*)malloc(sizeof(Uint64) * (size_t)requests);
+  SDL_Thread* threads[BATCH_MAX_JOBS] = {0};
+  bool ok = conns && lat;
+  const Uint64 t0 = SDL_GetTicksNS();
+  for (int i = 0, first = 0; ok && i < conc; i++) {
+    ClientConn* c = &conns[i];
+    c->path = path;
+    c->req = req;
+    c->payload = use_shm ? NULL : payload;
+    c->count = requests / conc + (i < requests % conc);
+    c->lat_ns = lat + first;
+    first += c->count;
+    threads[i] = SDL_CreateThread(client_conn_thread, "client_conn", c);
+    if (!threads[i]) { log_sdl_error("SDL_CreateThread (cliente) falhou"); ok = false; }
+  }
+  for (int i = 0; i < conc; i++) if (threads[i]) SDL_WaitThread(threads[i], NULL);
+  const double secs = (double)(SDL_GetTicksNS() - t0) / 1e9;
+
+  //junta as latências de todas as conexões (cada uma preencheu o começo da sua fatia),
+  //inclusive as que vieram antes de uma falha: os percentis cobrem todo pedido respondido
+  int n = 0;
+  for (int i = 0; conns && lat && i < conc; i++) {
+    memmove(lat + n, conns[i].lat_ns, sizeof(Uint64) * (size_t)conns[i].done);
+    n += conns[i].done;
+  }
+  for (int i = 0; ok && i < conc; i++)
+    if (!conns[i].ok) ok = false;
+  if (n > 0) {
+    qsort(lat, (size_t)n, sizeof(Uint64), compare_u64);
+    int c0 = 0;
+    while (conns[c0].done == 0) c0++; //a primeira conexão pode ter falhado antes de responder
+    const DaemonResponse* r = &conns[c0].first;
+    SDL_Log("Resposta: %ux%u, média %.2f, desvio %.2f%s", r->w, r->h, r->mean, r->stddev,
+            want_image ? " (+ imagem processada)" : "");
+    SDL_Log("Cliente: %d/%d pedidos em %.2f s (%.0f pedidos/s), %d conexões, carga %s %llu bytes%s", n, requests,
+            secs, secs > 0.0 ? n / secs : 0.0, conc, raw ? "Y8" : "codificada", (unsigned long long)req.size,
+            use_shm ? " (memória compartilhada)" : "");
+    SDL_Log("Latência ponta a ponta (us): p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, máx %.0f",
+            client_percentile_us(lat, n, 0.50), client_percentile_us(lat, n, 0.90),
+            client_percentile_us(lat, n, 0.99), client_percentile_us(lat, n, 0.999), (double)lat[n - 1] / 1000.0);
+  }
+
+  //percentis do lado do servidor (sem o tempo de socket do cliente)
+  int fd = client_connect(path);
+  DaemonRequest sreq = { DAEMON_MAGIC, DAEMON_WANT_STATS, 0, 0, 0, "" };
+  DaemonResponse res;
+  char text[512];
+  if (fd >= 0 && sock_write_all(fd, &sreq, sizeof(sreq)) && sock_read_all(fd, &res, sizeof(res)) &&
+      res.size < sizeof(text) && sock_read_all(fd, text, (size_t)res.size)) {
+    text[res.size] = '\0';
+    SDL_Log("Servidor: %s", text);
+  }
+  if (fd >= 0) close(fd);
+
+  if (shm_map) {
+    munmap(shm_map, (size_t)req.size);
+    shm_unlink(req.shm);
+  }
+  free(conns);
+  free(lat);
+  if (raw) free(payload);
+  else     SDL_free(payload);
+  return ok && n == requests ? 0 : 1;
+}
+#endif
+
+//--selftest: confere que cada caminho SIMD gera saída idêntica à do escalar (referência)
+static Uint32 selftest_rand(Uint32* state) {
+  Uint32 x = *state;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  return *state = x;
+}
+
+static int compare_kernels(const PixelKernels* k, Uint32* seed) {
+  int failures = 0;
+  const int max_w = 1031; //não múltiplo de 16/32: exercita as caudas escalares
+  Uint8* rgba  = (Uint8*)malloc((size_t)max_w * 4);
+  Uint8* ref   = (Uint8*)malloc((size_t)max_w * 4);
+  Uint8* got   = (Uint8*)malloc((size_t)max_w * 4);
+  Uint8* color = (Uint8*)malloc((size_t)max_w * 4);
+  Uint8* alpha = (Uint8*)malloc((size_t)max_w);
+  Uint16* fx  = (Uint16*)malloc(sizeof(Uint16) * (size_t)max_w);
+  //filtros: linhas com halo e a janela vertical inteira em Q8
+  const int max_taps = 2 * FILTER_MAX_RADIUS + 1;
+  Uint8* pad    = (Uint8*)malloc((size_t)(max_w + max_taps) * 3);
+  Uint16* qrows = (Uint16*)malloc(sizeof(Uint16) * (size_t)max_w * (size_t)(max_taps + 2));
+  Uint32* lut16 = (Uint32*)malloc(sizeof(Uint32) * HIST16_BINS);
+  Uint8 lut[256];
+  Uint32 luts4[4][256];
+  const Uint32* const luts[4] = { luts4[0], luts4[1], luts4[2], luts4[3] };
+  if (!rgba || !ref || !got || !color || !alpha || !fx || !pad || !qrows || !lut16) {
+    free(rgba); free(ref); free(got); free(color); free(alpha); free(fx); free(pad); free(qrows); free(lut16);
+    return 1;
+  }
+  for (int i = 0; i < 256; i++) lut[i] = (Uint8)selftest_rand(seed);
+  for (int i = 0; i < HIST16_BINS; i++) lut16[i] = selftest_rand(seed) & 0xFFFFFF;
+  for (int t = 0; t < 4; t++)
+    for (int i = 0; i < 256; i++) luts4[t][i] = (Uint8)selftest_rand(seed);
+
+  for (int w = 1; w <= max_w; w += (w < 70 ? 1 : 97)) {
+    for (int i = 0; i < w * 4; i++) rgba[i] = (Uint8)selftest_rand(seed);
+    for (int i = 0; i < w; i++) alpha[i] = (Uint8)selftest_rand(seed);
+
+    row_to_gray_scalar(rgba, ref, w);
+    k->row_to_gray(rgba, got, w);
+    if (memcmp(ref, got, (size_t)w) != 0) failures++;
+
+    Uint32 h_ref[256] = {0}, h_got[256] = {0};
+    row_hist_scalar(ref, w, h_ref);
+    k->row_hist(ref, w, h_got);
+    if (memcmp(h_ref, h_got, sizeof(h_ref)) != 0) failures++;
+
+    row_apply_lut_scalar(ref, got, w, lut);
+    k->row_apply_lut(ref, ref, w, lut); //in-place, como na equalização
+    if (memcmp(ref, got, (size_t)w) != 0) failures++;
+
+    memcpy(got, ref, (size_t)w);
+    for (int with_alpha = 0; with_alpha < 2; with_alpha++) {
+      const Uint8* a = with_alpha ? alpha : NULL;
+      row_expand_scalar(got, a, rgba, w);
+      k->row_expand(got, a, ref, w);
+      if (memcmp(rgba, ref, (size_t)w * 4) != 0) failures++;
+    }
+
+    //recolor: got = Y original, alpha = Y' (valores aleatórios cobrem os dois sentidos)
+    for (int i = 0; i < w * 4; i++) rgba[i] = (Uint8)selftest_rand(seed);
+    for (int i = 0; i < w; i++) alpha[i] = (Uint8)selftest_rand(seed);
+    row_recolor_scalar(rgba, got, alpha, color, w);
+    k->row_recolor(rgba, got, alpha, ref, w);
+    if (memcmp(color, ref, (size_t)w * 4) != 0) failures++;
+
+    for (int i = 0; i < w; i++) fx[i] = (Uint16)(selftest_rand(seed) % 257);
+    Uint32 fy = selftest_rand(seed) % 257;
+    row_bilerp_lut_scalar(got, ref, w, luts, fx, fy);
+    k->row_bilerp_lut(got, alpha, w, luts, fx, fy);
+    if (memcmp(ref, alpha, (size_t)w) != 0) failures++;
+
+    //convolução com raio e pesos aleatórios (normalizados como no filtro)
+    int ntaps = 2 * (1 + (int)(selftest_rand(seed) % FILTER_MAX_RADIUS)) + 1;
+    double g[2 * FILTER_MAX_RADIUS + 1];
+    Uint16 htaps[2 * FILTER_MAX_RADIUS + 1], vtaps[2 * FILTER_MAX_RADIUS + 1];
+    for (int t = 0; t < ntaps; t++) g[t] = 1.0 + selftest_rand(seed) % 1000;
+    filter_quantize(g, ntaps, 256, htaps);
+    filter_quantize(g, ntaps, 65536, vtaps);
+    for (int i = 0; i < w + ntaps; i++) pad[i] = (Uint8)selftest_rand(seed);
+    Uint16* q_ref = qrows + (size_t)max_taps * (size_t)max_w;
+    Uint16* q_got = q_ref + max_w;
+    row_hconv_scalar(pad, q_ref, w, htaps, ntaps);
+    k->row_hconv(pad, q_got, w, htaps, ntaps);
+    if (memcmp(q_ref, q_got, sizeof(Uint16) * (size_t)w) != 0) failures++;
+
+    const Uint16* rows[2 * FILTER_MAX_RADIUS + 1];
+    for (int t = 0; t < ntaps; t++) {
+      Uint16* r = qrows + (size_t)t * (size_t)max_w;
+      for (int i = 0; i < w; i++) r[i] = (Uint16)(selftest_rand(seed) % (255 * 256 + 1));
+      rows[t] = r;
+    }
+    row_vconv_scalar(rows, ref, w, vtaps, ntaps);
+    k->row_vconv(rows, got, w, vtaps, ntaps);
+    if (memcmp(ref, got, (size_t)w) != 0) failures++;
+
+    for (int i = 0; i < (w + 2) * 3; i++) pad[i] = (Uint8)selftest_rand(seed);
+    row_median3_scalar(pad, pad + w + 2, pad + 2 * (w + 2), ref, w);
+    k->row_median3(pad, pad + w + 2, pad + 2 * (w + 2), got, w);
+    if (memcmp(ref, got, (size_t)w) != 0) failures++;
+
+    //LUT de 16 bits: as duas saídas e só a exibição
+    Uint16* s16 = qrows;
+    for (int i = 0; i < w; i++) s16[i] = (Uint16)selftest_rand(seed);
+    for (int with16 = 0; with16 < 2; with16++) {
+      row_apply_lut16_scalar(s16, with16 ? q_ref : NULL, ref, w, lut16);
+      k->row_apply_lut16(s16, with16 ? q_got : NULL, got, w, lut16);
+      if (memcmp(ref, got, (size_t)w) != 0) failures++;
+      if (with16 && memcmp(q_ref, q_got, sizeof(Uint16) * (size_t)w) != 0) failures++;
+    }
+  }
+  free(rgba);
+  free(ref);
+  free(got);
+  free(color);
+  free(alpha);
+  free(fx);
+  free(pad);
+  free(qrows);
+  free(lut16);
+  return failures;
+}
+
+static int run_selftest(void) {
+  const PixelKernels* paths[3];
+  int npaths = 0;
+#ifdef CV_X86_SIMD
+  if (SDL_HasSSE2()) paths[npaths++] = &kernels_sse2;
+  if (SDL_HasAVX2()) paths[npaths++] = &kernels_avx2;
+#endif
+  if (npaths == 0) {
+    SDL_Log("Selftest: nenhum caminho SIMD disponível, apenas o escalar");
+    return 0;
+  }
+
+  int total = 0;
+  for (int i = 0; i < npaths; i++) {
+    Uint32 seed = 0x12345678u;
+    int f = compare_kernels(paths[i], &seed);
+    SDL_Log("Selftest %-6s vs scalar: %s (%d divergências)", paths[i]->name, f ? "FALHOU" : "ok", f);
+    total += f;
+  }
+  return total ? 1 : 0;
+}
+
+//--hist-scaling <imagem>: mede o histograma paralelo com 1, 2, 4, ... 32 threads
+static int run_hist_scaling(const char* path) {
+  pool_init(0);
+  ImageData img = {0};
+  Uint32 hist[256];
+  if (!img_load_gray(path, &img, hist, false, false)) return 1;
+
+  const double mp = (double)img.w * (double)img.h / 1e6;
+  const int reps = 10;
+  Uint32 ref[256];
+  memcpy(ref, hist, sizeof(ref));
+  double base_ms = 0.0;
+  SDL_Log("threads | ms/hist | MP/s | speedup  (%.1f MP, kernels %s)", mp, g_kernels->name);
+  for (int t = 1; t <= 32; t *= 2) {
+    if (t > g_pool.nthreads + 1) break;
+    pool_set_max_threads(t);
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    for (int r = 0; r < reps; r++) compute_histogram_gray(&img.gray, hist, NULL, NULL);
+    double ms = (double)(SDL_GetPerformanceCounter() - t0) * 1000.0 /
+                (double)SDL_GetPerformanceFrequency() / reps;
+    if (t == 1) base_ms = ms;
+    if (memcmp(ref, hist, sizeof(ref)) != 0) SDL_Log("ERRO: histograma com %d threads difere da ingestão", t);
+    SDL_Log("%7d | %7.3f | %6.0f | %5.2fx", t, ms, mp / (ms / 1000.0), base_ms / ms);
+  }
+  pool_set_max_threads(g_pool.nthreads + 1);
+
+  free_image(&img);
+  return 0;
+}
+
+//--bench: mede os kernels em imagens sintéticas (0.3 a 100 MP, conteúdo liso, ruído e
+//gradiente), imprime MP/s e ns/px, a curva de escalabilidade por threads e compara com
+//um baseline JSON: qualquer kernel mais lento que a tolerância faz a execução falhar.
+//não abre janelas; o upload de textura usa o driver de vídeo dummy (ou o de SDL_VIDEO_DRIVER)
+#define BENCH_MAX_SIZES 16
+#define BENCH_SCALING_MP 16.0
+
+typedef enum { SYNTH_FLAT, SYNTH_NOISE, SYNTH_GRADIENT, SYNTH_COUNT } SynthContent;
+static const char* const synth_names[SYNTH_COUNT] = { "flat", "noise", "gradient" };
+
+typedef struct {
+  char   name[24];
+  float  mp;
+  char   content[12];
+  int    threads;
+  double mps;                  //megapixels por segundo (melhor repetição)
+  double ns_px;
+} BenchEntry;
+
+typedef struct {
+  BenchEntry* entries;
+  int         count, cap;
+} BenchReport;
+
+typedef struct {
+  SDL_Surface*  rgba;          //imagem sintética em RGBA32
+  ImageData     img;           //já ingerida (com backup): entrada dos kernels de plano
+  Uint32        hist[256];
+  GrayPlane     scratch;       //destino do cinza/CLAHE
+  GrayPlane16   deep, deep_out; //mesma imagem em 16 bits (ruído: byte baixo aleatório)
+  Uint32*       hist16;        //histograma de referência do deep; a 2ª metade é rascunho
+  Uint8*        pgm16;         //o deep como arquivo PGM de 16 bits na memória
+  size_t        pgm16_size;
+  ClaheParams   clahe;
+  char          tmp_path[64];
+  bool          ok;            //algum kernel falhou: o resultado não vale
+} BenchCtx;
+
+typedef void (*BenchFn)(BenchCtx* ctx);
+
+static SDL_Surface* synth_surface(int w, int h, SynthContent content) {
+  SDL_Surface* s = SDL_CreateSurface(w, h, SDL_PIXELFORMAT_RGBA32);
+  if (!s) { log_sdl_error("SDL_CreateSurface (bench) falhou"); return NULL; }
+  Uint32 seed = 0x9E3779B9u;
+  for (int y = 0; y < h; y++) {
+    Uint8* p = (Uint8*)s->pixels + (size_t)y * s->pitch;
+    for (int x = 0; x < w; x++, p += 4) {
+      if (content == SYNTH_FLAT) {
+        p[0] = 180; p[1] = 120; p[2] = 60;
+      } else if (content == SYNTH_NOISE) {
+        Uint32 r = selftest_rand(&seed);
+        p[0] = (Uint8)r; p[1] = (Uint8)(r >> 8); p[2] = (Uint8)(r >> 16);
+      } else {
+        p[0] = (Uint8)((Sint64)x * 255 / w);
+        p[1] = (Uint8)((Sint64)y * 255 / h);
+        p[2] = (Uint8)(((Sint64)x + y) * 255 / (w + h));
+      }
+      p[3] = 255;
+    }
+  }
+  return s;
+}
+
+static void bench_gray(BenchCtx* c) {
+  for (int y = 0; y < c->rgba->h; y++)
+    g_kernels->row_to_gray((const Uint8*)c->rgba->pixels + (size_t)y * c->rgba->pitch,
+                           plane_row(&c->scratch, y), c->rgba->w);
+}
+
+//ingestão completa (cinza + checagem de alfa + histograma + backup) sem copiar a surface
+static void bench_ingest(BenchCtx* c) {
+  SDL_Surface* s = SDL_CreateSurfaceFrom(c->rgba->w, c->rgba->h, SDL_PIXELFORMAT_RGBA32,
+                                         c->rgba->pixels, c->rgba->pitch);
+  ImageData tmp = {0};
+  Uint32 hist[256];
+  if (!s || !ingest_surface_gray(s, &tmp, hist, true, false, false)) { c->ok = false; return; }
+  free_image(&tmp);
+}
+
+static void bench_histogram(BenchCtx* c) {
+  Uint32 hist[256] = {0};
+  plane_histogram(&c->img.original_gray, hist);
+  if (memcmp(hist, c->hist, sizeof(hist)) != 0) c->ok = false;
+}
+
+static void bench_equalize(BenchCtx* c) {
+  const PointOpStack eq = { { { OP_EQUALIZE, 0.0f } }, 1 };
+  Uint8 lut[256];
+  Uint32 out_hist[256];
+  point_stack_build_lut(&eq, c->hist, lut, out_hist);
+  plane_apply_lut(&c->img.original_gray, &c->img.gray, lut);
+}
+
+//mesma ingestão em 16 bits: PGM na memória -> Y16 + exibição + backup + histograma de 65536 bins
+static void bench_ingest16(BenchCtx* c) {
+  SDL_IOStream* io = SDL_IOFromConstMem(c->pgm16, c->pgm16_size);
+  PnmHeader h;
+  ImageData tmp = {0};
+  Uint32 hist[256];
+  bool ok = io && pnm_read_header(io, &h) && ingest_deep(io, &h, &tmp, hist, true);
+  if (io) SDL_CloseIO(io);
+  if (!ok) { c->ok = false; return; }
+  free_image(&tmp);
+}
+
+static void bench_histogram16(BenchCtx* c) {
+  Uint32* hist = c->hist16 + HIST16_BINS;
+  memset(hist, 0, sizeof(Uint32) * HIST16_BINS);
+  if (!plane_histogram16(&c->deep, hist) || memcmp(hist, c->hist16, sizeof(Uint32) * HIST16_BINS) != 0)
+    c->ok = false;
+}
+
+static void bench_equalize16(BenchCtx* c) {
+  const PointOpStack eq = { { { OP_EQUALIZE, 0.0f } }, 1 };
+  Uint32* lut = c->hist16 + HIST16_BINS;
+  Uint32 out_hist[256];
+  if (!point_stack_build_lut16(&eq, c->hist16, 65535, lut, NULL, out_hist)) { c->ok = false; return; }
+  plane_apply_lut16(&c->deep, &c->deep_out, &c->scratch, lut);
+}
+
+static void bench_clahe(BenchCtx* c) {
+  Uint32 hist[256];
+  if (!plane_clahe(&c->img.original_gray, &c->scratch, &c->clahe, hist)) c->ok = false;
+}
+
+static void bench_gauss(BenchCtx* c) {
+  const FilterParams f = { FILTER_GAUSSIAN, 2.0f, 1.0f };
+  Uint32 hist[256];
+  if (!plane_filter(&c->img.original_gray, &c->scratch, &f, hist)) c->ok = false;
+}
+
+static void bench_median(BenchCtx* c) {
+  const FilterParams f = { FILTER_MEDIAN, 1.0f, 1.0f };
+  Uint32 hist[256];
+  if (!plane_filter(&c->img.original_gray, &c->scratch, &f, hist)) c->ok = false;
+}
+
+static void bench_upload(BenchCtx* c) {
+  mark_texture_rows(&c->img, 0, c->img.h);
+  if (!sync_texture_rows(&c->img)) c->ok = false;
+}
+
+static void bench_save(BenchCtx* c) {
+  if (!save_image_png(&c->img, c->tmp_path)) c->ok = false;
+}
+
+static void bench_load(BenchCtx* c) {
+  SDL_Surface* s = IMG_Load(c->tmp_path);
+  ImageData tmp = {0};
+  Uint32 hist[256];
+  if (!s || !ingest_surface_gray(s, &tmp, hist, false, false, false)) { c->ok = false; return; }
+  free_image(&tmp);
+}
+
+//melhor tempo (ns) entre as repetições: ao menos 3 e até somar `min_ms`
+static double bench_best_ns(BenchFn fn, BenchCtx* c, double min_ms) {
+  const double freq = (double)SDL_GetPerformanceFrequency();
+  double best = 0.0, total = 0.0;
+  for (int r = 0; c->ok && (r < 3 || total < min_ms) && r < 1000; r++) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    fn(c);
+    double ms = (double)(SDL_GetPerformanceCounter() - t0) * 1000.0 / freq;
+    total += ms;
+    if (r == 0 || ms < best) best = ms;
+  }
+  return best * 1e6;
+}
+
+static bool bench_record(BenchReport* rep, const char* name, float mp, const char* content,
+                         int threads, double ns, Uint64 pixels) {
+  if (rep->count == rep->cap) {
+    int cap = rep->cap ? rep->cap * 2 : 64;
+    BenchEntry* e = (BenchEntry*)realloc(rep->entries, sizeof(BenchEntry) * (size_t)cap);
+    if (!e) return false;
+    rep->entries = e;
+    rep->cap = cap;
+  }
+  BenchEntry* e = &rep->entries[rep->count++];
+  snprintf(e->name, sizeof(e->name), "%s", name);
+  snprintf(e->content, sizeof(e->content), "%s", content);
+  e->mp = mp;
+  e->threads = threads;
+  e->ns_px = ns / (double)pixels;
+  e->mps = (double)pixels / 1e6 / (ns / 1e9);
+  return true;
+}
+
+static bool bench_run(BenchReport* rep, BenchCtx* c, const char* name, BenchFn fn,
+                      float mp, const char* content, double min_ms) {
+  c->ok = true;
+  double ns = bench_best_ns(fn, c, min_ms);
+  if (!c->ok) { SDL_Log("Bench %s (%.2f MP, %s) falhou", name, mp, content); return false; }
+  Uint64 pixels = (Uint64)c->img.w * (Uint64)c->img.h;
+  if (!bench_record(rep, name, mp, content, pool_thread_count(), ns, pixels)) return false;
+  const BenchEntry* e = &rep->entries[rep->count - 1];
+  SDL_Log("%-12s %7.2f %-9s %3d %10.1f %8.3f", e->name, e->mp, e->content, e->threads, e->mps, e->ns_px);
+  return true;
+}
+
+//prepara a imagem sintética, a ingestão de referência e (se houver renderer) a textura
+static bool bench_prepare(BenchCtx* c, float mp, SynthContent content, SDL_Renderer* rr) {
+  int w = (int)lround(sqrt((double)mp * 1e6 * 4.0 / 3.0));
+  int h = (int)lround((double)mp * 1e6 / w);
+  if (w < 1) w = 1;
+  if (h < 1) h = 1;
+  c->rgba = synth_surface(w, h, content);
+  if (!c->rgba) return false;
+  SDL_Surface* view = SDL_CreateSurfaceFrom(w, h, SDL_PIXELFORMAT_RGBA32, c->rgba->pixels, c->rgba->pitch);
+  if (!view || !ingest_surface_gray(view, &c->img, c->hist, true, false, false) || !plane_alloc(&c->scratch, w, h)) {
+    SDL_Log("Sem memória para a imagem de %.2f MP", mp);
+    return false;
+  }
+  if (rr && !upload_texture_gray(&c->img, rr)) SDL_Log("Upload indisponível para %dx%d", w, h);
+
+  char header[64];
+  int hlen = snprintf(header, sizeof(header), "P5\n%d %d\n65535\n", w, h);
+  c->pgm16_size = (size_t)hlen + (size_t)w * (size_t)h * 2;
+  c->pgm16 = (Uint8*)malloc(c->pgm16_size);
+  c->hist16 = (Uint32*)calloc(HIST16_BINS * 2, sizeof(Uint32));
+  if (!c->pgm16 || !c->hist16 || !plane16_alloc(&c->deep, w, h) || !plane16_alloc(&c->deep_out, w, h)) {
+    SDL_Log("Sem memória para a imagem de 16 bits de %.2f MP", mp);
+    return false;
+  }
+  memcpy(c->pgm16, header, (size_t)hlen);
+  Uint32 seed = 0x85EBCA6Bu;
+  for (int y = 0; y < h; y++) {
+    const Uint8* g = plane_row(&c->img.original_gray, y);
+    Uint16* d = plane16_row(&c->deep, y);
+    Uint8* f = c->pgm16 + hlen + (size_t)y * w * 2;
+    for (int x = 0; x < w; x++) {
+      d[x] = (Uint16)(g[x] * 257 ^ (content == SYNTH_NOISE ? selftest_rand(&seed) & 0xFF : 0));
+      c->hist16[d[x]]++;
+    }
+    row_store_be16(d, f, w);
+  }
+  return true;
+}
+
+static void bench_release(BenchCtx* c) {
+  free_image(&c->img);
+  plane_free(&c->scratch);
+  plane16_free(&c->deep);
+  plane16_free(&c->deep_out);
+  free(c->hist16);
+  free(c->pgm16);
+  c->hist16 = NULL;
+  c->pgm16 = NULL;
+  if (c->rgba) SDL_DestroySurface(c->rgba);
+  c->rgba = NULL;
+}
+
+static bool write_bench_json(const BenchReport* rep, const char* path) {
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    SDL_Log("Falha ao criar JSON '%s'", path);
+    return false;
+  }
+  fprintf(f, "{\n  \"kernels\": \"%s\",\n  \"threads\": %d,\n  \"results\": [\n", g_kernels->name, g_pool.nthreads + 1);
+  for (int i = 0; i < rep->count; i++) {
+    const BenchEntry* e = &rep->entries[i];
+    fprintf(f, "    {\"name\": \"%s\", \"mp\": %.2f, \"content\": \"%s\", \"threads\": %d, \"mps\": %.1f, \"ns_px\": %.4f}%s\n",
+            e->name, e->mp, e->content, e->threads, e->mps, e->ns_px, i + 1 < rep->count ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+  return true;
+}
+
+//lê um JSON gerado por write_bench_json (um resultado por linha)
+static bool read_bench_json(BenchReport* rep, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    SDL_Log("Falha ao abrir baseline '%s'", path);
+    return false;
+  }
+  char line[512];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f)) {
+    BenchEntry e = {0};
+    if (sscanf(line, " {\"name\": \"%23[^\"]\", \"mp\": %f, \"content\": \"%11[^\"]\", \"threads\": %d, \"mps\": %lf",
+               e.name, &e.mp, e.content, &e.threads, &e.mps) != 5)
+      continue;
+    ok = bench_record(rep, e.name, e.mp, e.content, e.threads, 1e9 / e.mps, 1000000);
+  }
+  fclose(f);
+  if (ok && rep->count == 0) SDL_Log("Baseline '%s' sem resultados", path);
+  return ok && rep->count > 0;
+}
+
+static const BenchEntry* bench_find(const BenchReport* rep, const BenchEntry* key, int threads) {
+  for (int i = 0; i < rep->count; i++) {
+    const BenchEntry* e = &rep->entries[i];
+    if (strcmp(e->name, key->name) == 0 && strcmp(e->content, key->content) == 0 && e->threads == threads &&
+        fabsf(e->mp - key->mp) <= 0.005f)
+      return e;
+  }
+  return NULL;
+}
+
+static int bench_max_threads(const BenchReport* rep) {
+  int t = 0;
+  for (int i = 0; i < rep->count; i++) t = SDL_max(t, rep->entries[i].threads);
+  return t;
+}
+
+//compara com o baseline e devolve o número de falhas: kernel mais lento que (1 - tolerância),
+//entrada do baseline sem medida correspondente nesta execução, ou nada comparado. as linhas
+//com o pool inteiro casam entre máquinas com outro número de núcleos (pool inteiro contra
+//pool inteiro); as da curva de escalabilidade com mais threads que esta máquina não têm
+//como ser medidas aqui e ficam de fora
+static int compare_bench(const BenchReport* cur, const BenchReport* base, double tolerance) {
+  const int cur_max = bench_max_threads(cur), base_max = bench_max_threads(base);
+  int regressions = 0, matched = 0, missing = 0, skipped = 0;
+  if (cur_max != base_max)
+    SDL_Log("Baseline com %d threads e esta máquina com %d: o pool inteiro é comparado com o pool inteiro",
+            base_max, cur_max);
+  for (int j = 0; j < base->count; j++) {
+    const BenchEntry* b = &base->entries[j];
+    const BenchEntry* e = bench_find(cur, b, b->threads);
+    if (!e && b->threads == base_max) e = bench_find(cur, b, cur_max);
+    if (!e && b->threads > cur_max) { skipped++; continue; }
+    if (!e) {
+      SDL_Log("AUSENTE: %s %.2f MP %s %d threads está no baseline e não foi medido", b->name, b->mp, b->content,
+              b->threads);
+      missing++;
+      continue;
+    }
+    matched++;
+    double ratio = e->mps / b->mps;
+    if (ratio < 1.0 - tolerance) {
+      SDL_Log("REGRESSÃO: %s %.2f MP %s %d threads: %.1f MP/s (baseline %.1f, %.0f%%)",
+              e->name, e->mp, e->content, e->threads, e->mps, b->mps, ratio * 100.0);
+      regressions++;
+    }
+  }
+  SDL_Log("Baseline: %d resultados comparados, %d regressões, %d ausentes, %d fora do alcance (tolerância %.0f%%)",
+          matched, regressions, missing, skipped, tolerance * 100.0);
+  if (matched == 0) SDL_Log("Nenhum resultado casou com o baseline: nada foi verificado");
+  return regressions + missing + (matched == 0);
+}
+
+static int parse_sizes(const char* spec, float* sizes) {
+  int n = 0;
+  const char* p = spec;
+  while (*p && n < BENCH_MAX_SIZES) {
+    char* end = NULL;
+    double v = strtod(p, &end);
+    if (end == p || v <= 0.0 || v > 4000.0) return 0;
+    sizes[n++] = (float)v;
+    p = (*end == ',') ? end + 1 : end;
+    if (*end && *end != ',') return 0;
+  }
+  return n;
+}
+
+//--bench [--sizes 0.3,1,4,16,100] [--contents flat,noise,gradient] [--io-max-mp N]
+//        [--min-ms N] [--json saida.json] [--baseline base.json] [--tolerance 0.2]
+static int run_bench(int argc, char** argv) {
+  float sizes[BENCH_MAX_SIZES] = { 0.3f, 1.0f, 4.0f, 16.0f, 100.0f };
+  int nsizes = 5;
+  bool contents[SYNTH_COUNT] = { true, true, true };
+  double io_max_mp = 4.0, min_ms = 300.0, tolerance = 0.2;
+  const char* json_path = NULL;
+  const char* baseline_path = NULL;
+  bool args_ok = true;
+  for (int i = 2; i < argc && args_ok; i++) {
+    if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+      args_ok = (nsizes = parse_sizes(argv[++i], sizes)) > 0;
+    } else if (strcmp(argv[i], "--contents") == 0 && i + 1 < argc) {
+      const char* spec = argv[++i];
+      for (int k = 0; k < SYNTH_COUNT; k++) contents[k] = strstr(spec, synth_names[k]) != NULL;
+      args_ok = contents[0] || contents[1] || contents[2];
+    } else if (strcmp(argv[i], "--io-max-mp") == 0 && i + 1 < argc) {
+      io_max_mp = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+      min_ms = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+      args_ok = tolerance > 0.0 && tolerance < 1.0;
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else {
+      args_ok = false;
+    }
+  }
+  if (!args_ok) {
+    SDL_Log("Uso: %s --bench [--sizes 0.3,1,4,16,100] [--contents flat,noise,gradient] [--io-max-mp N] "
+            "[--min-ms N] [--json saida.json] [--baseline base.json] [--tolerance 0.2]", argv[0]);
+    return 1;
+  }
+
+  BenchReport base = {0};
+  if (baseline_path && !read_bench_json(&base, baseline_path)) return 1;
+
+  pool_init(0);
+  //sem janela visível: o padrão é o driver dummy (SDL_VIDEO_DRIVER no ambiente tem prioridade)
+  SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "dummy");
+  SDL_Window* win = NULL;
+  SDL_Renderer* rr = NULL;
+  if (SDL_Init(SDL_INIT_VIDEO) && (win = SDL_CreateWindow("bench", 64, 64, SDL_WINDOW_HIDDEN)))
+    rr = SDL_CreateRenderer(win, NULL);
+  if (!rr) log_sdl_error("Sem renderer, upload de textura não será medido");
+
+  BenchReport rep = {0};
+  BenchCtx c = {0};
+  c.clahe = (ClaheParams){ 8, 8, 2.0f };
+  snprintf(c.tmp_path, sizeof(c.tmp_path), "bench_tmp_%u.png", (unsigned)SDL_GetTicks());
+  bool ok = true;
+  float scaling_mp = 0.0f;
+
+  SDL_Log("kernels %s, %d threads", g_kernels->name, g_pool.nthreads + 1);
+  SDL_Log("%-12s %7s %-9s %3s %10s %8s", "kernel", "MP", "conteúdo", "thr", "MP/s", "ns/px");
+  for (int s = 0; s < nsizes && ok; s++) {
+    if (sizes[s] <= BENCH_SCALING_MP && sizes[s] > scaling_mp) scaling_mp = sizes[s];
+    for (int k = 0; k < SYNTH_COUNT && ok; k++) {
+      if (!contents[k]) continue;
+      const char* cn = synth_names[k];
+      ok = bench_prepare(&c, sizes[s], (SynthContent)k, rr) &&
+           bench_run(&rep, &c, "gray", bench_gray, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "ingest", bench_ingest, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "histogram", bench_histogram, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "equalize", bench_equalize, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "ingest16", bench_ingest16, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "histogram16", bench_histogram16, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "equalize16", bench_equalize16, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "clahe", bench_clahe, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "gauss", bench_gauss, sizes[s], cn, min_ms) &&
+           bench_run(&rep, &c, "median", bench_median, sizes[s], cn, min_ms) &&
+           (!c.img.texture || bench_run(&rep, &c, "upload", bench_upload, sizes[s], cn, min_ms));
+      if (ok && sizes[s] <= io_max_mp)
+        ok = bench_run(&rep, &c, "save_png", bench_save, sizes[s], cn, min_ms) &&
+             bench_run(&rep, &c, "load_png", bench_load, sizes[s], cn, min_ms);
+      bench_release(&c);
+    }
+  }
+  SDL_RemovePath(c.tmp_path);
+
+  //curva de escalabilidade: maior tamanho até BENCH_SCALING_MP, ruído, 1, 2, 4, ... threads
+  if (ok && scaling_mp == 0.0f) scaling_mp = sizes[0];
+  if (ok && bench_prepare(&c, scaling_mp, SYNTH_NOISE, rr)) {
+    static const char* const names[] = { "histogram", "equalize", "clahe", "gauss", "upload" };
+    static const BenchFn fns[] = { bench_histogram, bench_equalize, bench_clahe, bench_gauss, bench_upload };
+    const int max_t = g_pool.nthreads + 1;
+    SDL_Log("escalabilidade (%.2f MP, noise): kernel | threads | MP/s | speedup", scaling_mp);
+    for (int f = 0; f < (int)(sizeof(fns) / sizeof(fns[0])) && ok; f++) {
+      if (fns[f] == bench_upload && !c.img.texture) continue;
+      double base_mps = 0.0;
+      for (int t = 1; ok; t = (t * 2 > max_t && t < max_t) ? max_t : t * 2) {
+        pool_set_max_threads(t);
+        c.ok = true;
+        double ns = bench_best_ns(fns[f], &c, min_ms);
+        ok = c.ok && bench_record(&rep, names[f], scaling_mp, "noise", t, ns, (Uint64)c.img.w * (Uint64)c.img.h);
+        if (!ok) break;
+        const BenchEntry* e = &rep.entries[rep.count - 1];
+        if (t == 1) base_mps = e->mps;
+        SDL_Log("%-12s %3d %10.1f %6.2fx", e->name, t, e->mps, e->mps / base_mps);
+        if (t >= max_t) break;
+      }
+    }
+    pool_set_max_threads(g_pool.nthreads + 1);
+    bench_release(&c);
+  } else {
+    ok = false;
+  }
+  if (rr) SDL_DestroyRenderer(rr);
+  if (win) SDL_DestroyWindow(win);
+
+  if (ok && json_path) ok = write_bench_json(&rep, json_path);
+  int regressions = (ok && baseline_path) ? compare_bench(&rep, &base, tolerance) : 0;
+  free(rep.entries);
+  free(base.entries);
+  return (ok && regressions == 0) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  atexit(app_shutdown);
+  init_pixel_kernels();
+  trace_init(SDL_getenv("CV_TRACE"));
+
+  if (argc >= 2 && strcmp(argv[1], "--selftest") == 0)
+    return run_selftest();
+  if (argc == 3 && strcmp(argv[1], "--hist-scaling") == 0)
+    return run_hist_scaling(argv[2]);
+
+  if (argc >= 2 && strcmp(argv[1], "--batch") == 0)
+    return run_batch(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "--stream") == 0)
+    return run_stream(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "--sequence") == 0)
+    return run_sequence(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+    return run_bench(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "--serve") == 0)
+    return run_serve(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "--client") == 0)
+    return run_client(argc, argv);
+
+  //uma ou mais imagens (ou diretórios) e as opções, em qualquer ordem
+  UIContext ui = {0};
+  Session* session = &ui.session;
+  ClaheParams clahe = { 8, 8, 2.0f };
+  bool clahe_on = false, color = false, args_ok = argc >= 2;
+  SaveFormat save_format = SAVE_PNG;
+  int raw_w = 0, raw_h = 0;
+  bool raw16 = false;
+  for (int i = 1; i < argc && args_ok; i++) {
+    if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc)
+      args_ok = point_stack_parse(&ui.ops, argv[++i]);
+    else if (strcmp(argv[i], "--clahe") == 0 && i + 1 < argc)
+      args_ok = clahe_on = clahe_parse(&clahe, argv[++i]);
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      args_ok = filter_parse(&ui.filter, argv[++i]);
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      trace_init(argv[++i]);
+    else if (strcmp(argv[i], "--save-format") == 0 && i + 1 < argc)
+      args_ok = save_format_parse(&save_format, argv[++i]);
+    else if ((strcmp(argv[i], "--raw") == 0 || strcmp(argv[i], "--raw16") == 0) && i + 1 < argc) {
+      raw16 = strcmp(argv[i], "--raw16") == 0;
+      args_ok = sscanf(argv[++i], "%dx%d", &raw_w, &raw_h) == 2 && raw_w > 0 && raw_h > 0;
+    }
+    else if (strcmp(argv[i], "--color") == 0)
+      color = true;
+    else if (strncmp(argv[i], "--", 2) != 0)
+      args_ok = session_add_arg(session, argv[i]);
+    else
+      args_ok = false;
+  }
+  if (!args_ok || session->count == 0) {
+    SDL_Log("Uso: %s <imagem|diretório>... [--ops equalize,gamma=0.5,...] [--filter gauss:1.5|box:2|unsharp:1.5:1|sobel|scharr|median] [--clahe CLIP[:GXxGY]] [--color] [--save-format png|png0|pgm|qoi] [--raw LxA|--raw16 LxA] [--trace trace.json]", argv[0]);
+    SDL_Log("     %s --batch <dir_entrada> <dir_saida> [--ops equalize,gamma=0.5,...] [--filter ESPEC] [--clahe CLIP[:GXxGY]] [--color] [--strip-mb N] [--jobs N] [--csv arquivo]", argv[0]);
+    SDL_Log("     %s --stream <entrada.pgm|ppm> <saida.pgm> [--ops equalize,...] [--strip-mb N]", argv[0]);
+    SDL_Log("     %s --sequence <padrao_entrada|-> <padrao_saida|-> [--ops equalize,...] [--smooth 0.9] [--queue N] [--start N]", argv[0]);
+    SDL_Log("     %s --serve <socket> [--ops equalize,...] [--workers N] [--max-mb N] [--max-mp N] [--warm-mp N] [--idle-s N]", argv[0]);
+    SDL_Log("     %s --client <socket> <imagem> [--requests N] [--concurrency C] [--image] [--raw] [--shm]", argv[0]);
+    SDL_Log("     %s --selftest", argv[0]);
+    SDL_Log("     %s --hist-scaling <caminho_imagem>", argv[0]);
+    SDL_Log("     %s --bench [--sizes 0.3,1,4,16,100] [--json saida.json] [--baseline base.json] [--tolerance 0.2]", argv[0]);
+    return 1;
+  }
+
+  if (!SDL_Init(SDL_INIT_VIDEO)) {
+    log_sdl_error("SDL_Init: Erro ao inicializar"); return 1;
+  }
+  if (!TTF_Init()) {
+    SDL_Log("TTF_Init falhou: %s", SDL_GetError());
+    return 1;
+  }
+
+
+  pool_init(0);
+
+  // carrega, converte para cinza, calcula o histograma e cria o backup em uma passada;
+  //Y8/Y16 cru não tem cabeçalho: as dimensões vêm de --raw/--raw16
+  if (!session_init(session, raw_w, raw_h, raw16, color)) { cleanup_all(&ui); return 1; }
+  int first = 0;
+  while (first < session->count && !session_acquire(session, first)) first++;
+  if (first == session->count) { cleanup_all(&ui); return 1; }
+  const ImageData* img = &session->entries[first].img;
 
-  UIContext ui = {0};
   ui.is_equalized = false;
   ui.yzoom = 1.5f;
-  if (!create_main_window(&ui, img.w, img.h)) { cleanup_all(&ui, &img); return 1; }
-  if (!create_side_window(&ui))               { cleanup_all(&ui, &img); return 1; }
+  ui.view.fit = true;
+  if (!create_main_window(&ui, img->w, img->h)) { cleanup_all(&ui); return 1; }
+  if (!create_side_window(&ui))                 { cleanup_all(&ui); return 1; }
 
   ui.font = TTF_OpenFont(FONT_PATH, 16);  // tamanho 16 px
   if (!ui.font) {
     SDL_Log("Falha ao abrir fonte '%s': %s", FONT_PATH, SDL_GetError());
-    cleanup_all(&ui, &img);
+    cleanup_all(&ui);
     return 1;
   }
 
-  img.texture = SDL_CreateTextureFromSurface(ui.mainApp.renderer, img.surface_rgba);
-  if (!img.texture) { log_sdl_error("CreateTextureFromSurface"); cleanup_all(&ui, &img); return 1; }
+  //maior que a textura máxima do renderer (ou CV_TILED=1): exibe pela pirâmide em blocos
+  ui.max_tex = SDL_GetNumberProperty(SDL_GetRendererProperties(ui.mainApp.renderer),
+                                     SDL_PROP_RENDERER_MAX_TEXTURE_SIZE_NUMBER, 0);
+  ui.clahe = clahe;
+  ui.clahe_on = clahe_on;
+  ui.save_format = save_format;
+  session->current = first;
+  if (!session_show(&ui, first)) { cleanup_all(&ui); return 1; }
+  session_start_prefetch(session);
 
-  render_loop(&ui, &img);
+  render_loop(&ui);
 
-  cleanup_all(&ui, &img);
+  cleanup_all(&ui);
   return 0;
 }